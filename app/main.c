@@ -1,30 +1,107 @@
 #include <shell.h>
 extern char **environ; //環境変数呼び出し
-int main() {
+int main(int argc, char *argv[]) {
+	shell_pid = getpid();
+#ifdef MYSHELL_STATS
+	atexit(stats_exit_report);
+#endif
+	// サーバーモード (myshell --serve SOCKET [INIT_SCRIPT]) とそのクライアント
+	if (argc > 2 && strcmp(argv[1], "--serve") == 0) {
+		vars_init(1, argv);
+		return serve_main(argv[2], argc > 3 ? argv[3] : NULL);
+	}
+	if (argc > 2 && strcmp(argv[1], "--client") == 0) {
+		return client_main(argv[2], argc - 3, argv + 3);
+	}
+	stage_sched_init(); // 補助プロセスの子とも共有するので先に作る
+	fork_server_init(); // ヒープが小さいうちに補助プロセスを作る
+	session_record_init();
+	// スクリプトが指定されたら実行して終了する (残りの引数は $1 以降)
+	if (argc > 1) {
+		vars_init(argc - 1, argv + 1);
+		session_record_script(argv[1]);
+		return last_exit_status = run_script(argv[1]);
+	}
+	vars_init(1, argv);
     // --- 1. 初期化 ---
-    // 設定ファイルの読み込みなど（高度な機能）
+    // 設定ファイルの読み込み (変わっていなければスナップショットから戻す)
+	rc_load();
 	shell_animation();
+	init_completion();
+	history_store_init();
+	shared_history_init();
+	prefetch_init();
+	prompt_init();
+	highlight_init();
     //--- signal handler ---
     signal(SIGINT, signal_handler);
     // --- 2. メインループ ---
+    // if や引用符が閉じていなければ $PS2 で続きの行を読み、まとめてコンパイルする
+    char *buffer = NULL;
+    size_t buffer_len = 0;
     while (1) {
-    	char *line = readline("myshell> ");
+		if (buffer == NULL) {
+			shared_history_poll(); // 他のセッションの履歴を取り込む
+		}
+		out_flush(); // 端末から読む前に、溜めた出力を書き出す
+    	char *line = readline(buffer == NULL ? prompt_primary() : prompt_continuation());
         if (!line) {
             if (errno) {
                 perror("readline");
                 return EXIT_FAILURE;
             }
+			if (buffer != NULL) {
+				fprintf(stderr, "myshell: syntax error: unexpected end of file\n");
+				free(buffer);
+				buffer = NULL;
+				buffer_len = 0;
+				last_exit_status = 2;
+				continue;
+			}
             printf("\nexit\n");
 			exit(EXIT_SUCCESS);
             break; 
         }
-		if(line[0] != '\0'){
-			add_history(line);
+		size_t len = strlen(line);
+		char *tmp = (char *)realloc(buffer, buffer_len + len + 2);
+		if (tmp == NULL) {
+			perror("realloc");
+			free(line);
+			continue;
 		}
-		Command* parsed = parser(line);
-        print_command_list(parsed);
-        free_command_list(parsed);
+		buffer = tmp;
+		memcpy(buffer + buffer_len, line, len);
+		buffer_len += len;
+		buffer[buffer_len++] = '\n';
+		buffer[buffer_len] = '\0';
 		free(line);
+
+		Program *prog = NULL;
+		SyntaxStatus result = syntax_compile(buffer, buffer_len, NULL, 0, &prog);
+		if (result == SYNTAX_INCOMPLETE) {
+			continue;
+		}
+		buffer[buffer_len - 1] = '\0'; // 履歴には最後の改行を含めない
+		if (buffer[0] != '\0') {
+			add_history(buffer);
+			history_store_append(buffer);
+			shared_history_publish(buffer);
+		}
+		char *input = buffer;
+		buffer = NULL;
+		buffer_len = 0;
+		if (result == SYNTAX_ERROR) {
+			last_exit_status = 2;
+			session_record(input, last_exit_status, session_record_start());
+			free(input);
+			continue;
+		}
+		long long started = session_record_start();
+		prefetch_account(prog);
+		execute_program(prog, prog->root);
+		program_free(prog);
+		session_record(input, last_exit_status, started);
+		free(input);
     }
 
     // --- 3. 終了処理 ---
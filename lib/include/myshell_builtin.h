@@ -0,0 +1,49 @@
+#ifndef MYSHELL_BUILTIN_H
+#define MYSHELL_BUILTIN_H
+
+/*
+ * 共有ライブラリから読み込む組み込みコマンド (enable -f) のための ABI
+ *
+ * シェルの内部の構造体や関数には依存しない。ライブラリはこのヘッダーだけを include して、
+ *
+ *     #include <myshell_builtin.h>
+ *
+ *     MYSHELL_BUILTIN_ABI;
+ *
+ *     MYSHELL_BUILTIN(hello) {
+ *         const char *name = argc > 1 ? argv[1] : api->get_var("USER");
+ *         dprintf(api->out_fd, "hello, %s\n", name ? name : "world");
+ *         return 0;
+ *     }
+ *
+ * のように書き、gcc -shared -fPIC でビルドする。`enable -f ./hello.so hello` で
+ * myshell_builtin_hello がシェルのプロセスの中で呼ばれるようになる。
+ * 構造体にはメンバーを末尾に足すだけで、並びや意味は変えない。
+ * 互換性のない変更をしたときは MYSHELL_BUILTIN_ABI_VERSION を上げる。
+ */
+
+#define MYSHELL_BUILTIN_ABI_VERSION 1
+
+typedef struct MyshellBuiltinApi {
+    int abi_version;        // シェルの MYSHELL_BUILTIN_ABI_VERSION
+    int in_fd;              // 標準入力 (リダイレクトやパイプを反映したもの)
+    int out_fd;             // 標準出力
+    int err_fd;             // 標準エラー出力
+    // シェル変数を読む。なければNULL (次に変数を変えるまで有効)
+    const char *(*get_var)(const char *name);
+    // シェル変数を設定する。成功時0
+    int (*set_var)(const char *name, const char *value);
+    // シェル変数を削除する。成功時0
+    int (*unset_var)(const char *name);
+} MyshellBuiltinApi;
+
+typedef int (*MyshellBuiltinFunc)(int argc, char **argv, const MyshellBuiltinApi *api);
+
+// ライブラリがどの ABI でビルドされたか (シェルは読み込むときに確かめる)
+#define MYSHELL_BUILTIN_ABI const int myshell_builtin_abi = MYSHELL_BUILTIN_ABI_VERSION
+
+// コマンド NAME の本体を定義する
+#define MYSHELL_BUILTIN(name) \
+    int myshell_builtin_##name(int argc, char **argv, const MyshellBuiltinApi *api)
+
+#endif
@@ -18,6 +18,7 @@
 #include <grp.h>        /* グループファイルエントリ */
 #include <dirent.h>     /* ディレクトリエントリ */
 #include <time.h>       /* 時間関数 */
+#include <stdint.h>     /* 固定幅の整数型 */
 
 /* GNU Readline ライブラリ */
 #include <readline/readline.h>
@@ -48,13 +49,146 @@ typedef struct Command {
     char *redirect_out;   // 出力リダイレクトのファイル名
 	TokenType append_mode; // >>かどうか判別
 	char *heredoc_delimiter;
+	char *heredoc_body;   // コンパイル時に読んだヒアドキュメントの本文
+	char **assigns;       // コマンドの前の NAME=value (そのコマンドの間だけ設定する)
+	char **array_assigns; // NAME=(...) の配列の代入 (展開前の単語。コマンドがないときだけ代入する)
+	const struct Program *program; // 複合コマンドの段 (NULLなら argv を実行する)
+	uint32_t node;
+	int subst_status;     // 展開中に最後に実行したコマンド置換の終了ステータス (-1: なし)
     struct Command *next; // パイプで繋がる次のコマンド
 } Command;
 
+/* 配列変数 (array.c) */
+typedef struct ShArray ShArray;
+
+/* パス名展開のパターン (glob.c) */
+typedef struct GlobMatcher GlobMatcher;
+
+/* 組み込みコマンド (builtin/) */
+typedef int (*BuiltinFunc)(char **argv);
+typedef struct Builtin {
+    const char *name;
+    BuiltinFunc func;   // NULLなら enable -f で読み込んだコマンド (builtin_call で呼ぶ)
+} Builtin;
+
+/* スクリプトの中間表現 (bytecode.c) */
+typedef enum {
+    N_NONE,         // 使わない (インデックス0は「なし」を表す)
+    N_LIST,         // kids[0] から next で連なる文を順に実行する
+    N_PIPELINE,     // kids[0] から next で連なる段 (N_COMMAND または複合コマンド) をパイプでつなぐ
+    N_COMMAND,      // 単純コマンド (words と str[] のリダイレクト)
+    N_AND,          // kids[0] && kids[1]
+    N_OR,           // kids[0] || kids[1]
+    N_IF,           // if kids[0]; then kids[1]; else kids[2] (elif は kids[2] の N_IF)
+    N_WHILE,        // while (until) kids[0]; do kids[1]; done
+    N_FOR,          // for words[0] in words[1..]; do kids[0]; done
+    N_CASE,         // case words[0] in kids[0] から next で連なる N_CASE_ITEM esac
+    N_CASE_ITEM,    // words のパターンのどれかに一致したら kids[0] を実行する
+    N_GROUP,        // { kids[0]; }
+    N_SUBSHELL,     // ( kids[0] )
+    N_FUNCDEF,      // words[0]() kids[0]
+    N_ARITH         // (( words[0] ))
+} NodeType;
+
+#define NO_STRING 0xffffffffu       /* Node.str[] に文字列がない */
+#define NODE_APPEND 0x0001          /* 出力リダイレクトが >> */
+#define NODE_NEGATE 0x0002          /* N_PIPELINE: 先頭に ! がある */
+#define NODE_UNTIL 0x0004           /* N_WHILE: until */
+#define NODE_FOR_ARGS 0x0008        /* N_FOR: in がない ("$@" を回す) */
+#define NODE_HEREDOC_QUOTED 0x0010  /* ヒアドキュメントの区切りが引用されている (本文を展開しない) */
+
+enum { STR_REDIRECT_IN, STR_REDIRECT_OUT, STR_HEREDOC_DELIMITER, STR_HEREDOC_BODY, NODE_STRS };
+
+typedef struct Node {
+    uint16_t type;              // NodeType
+    uint16_t flags;
+    uint32_t next;              // 同じ並びの次のノード (0なら終わり)
+    uint32_t kids[3];
+    uint32_t word;              // Program.words の先頭
+    uint32_t nwords;
+    uint32_t str[NODE_STRS];    // 文字列表のオフセット (リダイレクト)
+} Node;
+
+// コンパイル済みのスクリプト。1つのバッファ (またはmmapしたキャッシュ) を指す
+typedef struct Program {
+    const Node *nodes;
+    const uint32_t *words;      // 文字列表のオフセット
+    const char *strings;
+    uint32_t node_count;
+    uint32_t word_count;
+    uint32_t string_size;
+    uint32_t root;
+    void *base;
+    size_t size;
+    int mapped;
+    int refs;                   // 関数の定義などから参照されている数
+} Program;
+
+// syntax_compile の結果
+typedef enum {
+    SYNTAX_OK,
+    SYNTAX_INCOMPLETE,          // 続きの行が必要 (if の途中、閉じていない引用符など)
+    SYNTAX_ERROR
+} SyntaxStatus;
+
+typedef struct ProgramBuilder ProgramBuilder;
+
+/* メモリ使用量の計測の分類 (shellStats.c)。各ファイルは shell.h の前に STATS_SUBSYSTEM を定義する */
+typedef enum {
+    STATS_OTHER,
+    STATS_LEX,          // 字句解析 (split_by_whitespace, create_token_node, syntax.c の字句)
+    STATS_PARSE,        // 構文解析 (create_command_node, argv, 構文木)
+    STATS_HISTORY,
+    STATS_VARS,
+    STATS_EXPAND,       // 単語の展開とパス名展開
+    STATS_EXEC,
+    STATS_COMPLETION,   // 補完と先読み
+    STATS_SUBSYSTEMS
+} StatsSubsystem;
+
+/* パイプラインの段ごとの CPU・優先度の設定 (stageSched.c)。フォークサーバーにもそのまま送る */
+#define STAGE_CPU_WORDS 16      /* CPU の集合のビット列の長さ (1024 CPU まで) */
+#define STAGE_SET_CPUS 0x1
+#define STAGE_SET_NICE 0x2
+#define STAGE_SET_IOPRIO 0x4
+#define STAGE_SET_PGROUP 0x8    /* pgid のプロセスグループに入る (期限のあるパイプライン) */
+typedef struct StageSched {
+    uint32_t flags;             // STAGE_SET_*
+    int32_t nice;
+    int32_t ioprio;             // ioprio_set の値 (クラス << 13 | レベル)
+    int32_t pgid;               // 0なら自分を新しいプロセスグループのリーダーにする
+    uint32_t stage;             // パイプラインの何段目か (適用に失敗した設定を記録する場所)
+    uint64_t cpus[STAGE_CPU_WORDS];
+} StageSched;
+
+/* まとめて発行する入出力の操作 (ioBatch.c) */
+typedef enum { IO_OPEN, IO_WRITE } IoOpKind;
+typedef struct IoOp {
+    IoOpKind kind;
+    const char *path;           // IO_OPEN
+    int flags;
+    mode_t mode;
+    int fd;                     // IO_WRITE
+    const void *buf;
+    size_t len;
+    off_t offset;
+    int link;                   // 1ならこの操作が失敗したとき次の操作を実行しない
+    int result;                 // fd または書いたバイト数。失敗時は -errno
+} IoOp;
+
+/* コマンドの実行期限 (deadline.c) */
+typedef struct Deadline {
+    long long timeout_ns;
+    long long kill_after_ns;    // 最初のシグナルから SIGKILL までの猶予 (0なら送らない)
+    int signal;                 // 期限になったら送るシグナル
+    int report;                 // 打ち切ったことを標準エラー出力に書くか
+} Deadline;
+
 /* マクロ定義 */
 #define MAX_LINE 80     /* コマンドラインの最大長 */
 #define MAX_ARGS 64     /* 引数の最大数 */
 #define MAX_PATH 1024   /* パスの最大長 */
+#define MYSHELL_VERSION "0.3.0" /* バイトコードのキャッシュのキーに含める */
 
 /* 関数宣言 */
 char** split_by_whitespace(const char* str, size_t* num_tokens);
@@ -76,5 +210,210 @@ Token* tokenize_strings(char** str_array, size_t count);
 Command* parser(char* line);
 void print_command_list(Command* head);
 void signal_handler(int signum);
+void init_completion(void);
+int path_cache_lookup(const char *name, char *out, size_t out_size);
+void path_cache_warm(void);
+GlobMatcher* glob_matcher_compile(const char *pattern, size_t len);
+void glob_matcher_free(GlobMatcher *m);
+int glob_matcher_match(const GlobMatcher *m, const char *s, size_t n);
+ssize_t glob_matcher_anchored(const GlobMatcher *m, const char *s, size_t n, int at_end, int longest);
+ssize_t glob_matcher_search(const GlobMatcher *m, const char *s, size_t n, size_t *start);
+int glob_has_meta(const char *s);
+char** glob_expand(const char *pattern, size_t *count);
+void history_store_init(void);
+void history_store_append(const char *line);
+void history_store_import(const char *line);
+long history_store_search(const char *query, long before);
+char* history_store_get(long id);
+void history_store_close(void);
+void shared_history_init(void);
+void shared_history_publish(const char *line);
+int shared_history_poll(void);
+void prefetch_init(void);
+void prefetch_account(const Program *prog);
+void prefetch_print_stats(FILE *out);
+void prompt_init(void);
+const char* prompt_primary(void);
+const char* prompt_continuation(void);
+void highlight_init(void);
+extern int last_exit_status;
+int status_to_exit_code(int status);
+void exec_argv(char **argv);
+pid_t spawn_argv(char **argv, int in_fd, int out_fd, int err_fd);
+void io_batch(IoOp *ops, size_t n);
+void out_write(const void *data, size_t len);
+void out_putc(int c);
+void out_puts(const char *s);
+void out_printf(const char *fmt, ...);
+int out_flush(void);
+int out_append_begin(const char *path);
+int out_append_end(void);
+int out_command_done(void);
+int execute_command_list(Command *head);
+int execute_command_deadline(Command *head, const Deadline *dl);
+int parse_duration(const char *s, long long *ns);
+void deadline_init(Deadline *dl, long long timeout_ns);
+int deadline_from_env(Deadline *dl);
+int deadline_wait(const pid_t *pids, int *statuses, size_t count, pid_t pgid, const Deadline *dl);
+int redirect_push(Command *cmd, int saved[2]);
+int fork_server_start(void);
+void fork_server_init(void);
+int fork_server_enabled(void);
+void fork_server_stop(void);
+pid_t fork_server_spawn(char *const argv[], char *const envp[], int in_fd, int out_fd, int err_fd,
+                        const StageSched *sched);
+void stage_sched_init(void);
+int stage_sched_configure(const char *cpus, const char *nice, const char *ioprio);
+void stage_sched_begin(size_t stages);
+const StageSched* stage_sched_plan(size_t stage, StageSched *buf);
+void stage_sched_apply(const StageSched *s);
+void stage_sched_record(size_t stage, pid_t pid, const Command *cmd, const StageSched *s);
+void stage_sched_print(FILE *out);
+void* stats_malloc(StatsSubsystem sub, size_t size);
+void* stats_calloc(StatsSubsystem sub, size_t count, size_t size);
+void* stats_realloc(StatsSubsystem sub, void *ptr, size_t size);
+char* stats_strdup(StatsSubsystem sub, const char *s);
+char* stats_strndup(StatsSubsystem sub, const char *s, size_t n);
+void stats_free(void *ptr);
+void stats_report(FILE *out);
+void stats_exit_report(void);
+int builtin_shellstats(char **argv);
+void session_record_init(void);
+long long session_record_start(void);
+void session_record(const char *text, int status, long long started);
+void session_record_script(const char *path);
+int serve_main(const char *socket_path, const char *init_script);
+int client_main(const char *socket_path, int argc, char **argv);
+int redirect_pop(int saved[2]);
+const Builtin* find_builtin(const char *name);
+void builtin_foreach(void (*fn)(const char *name));
+int builtin_call(const Builtin *builtin, char **argv);
+int builtin_uses_out_buffer(const Builtin *builtin);
+const Builtin* find_loaded_builtin(const char *name);
+void loaded_builtin_foreach(void (*fn)(const char *name));
+int loaded_builtin_call(const Builtin *builtin, char **argv);
+int builtin_cd(char **argv);
+int builtin_exit(char **argv);
+int builtin_memo(char **argv);
+ProgramBuilder* program_builder_new(void);
+void program_builder_free(ProgramBuilder *b);
+uint32_t program_add_node(ProgramBuilder *b, NodeType type);
+Node* program_node(ProgramBuilder *b, uint32_t index);
+uint32_t program_add_string(ProgramBuilder *b, const char *s);
+uint32_t program_add_words(ProgramBuilder *b, char *const *argv, uint32_t *count);
+Program* program_builder_finish(ProgramBuilder *b, uint32_t root, uint64_t source_hash, uint64_t source_size);
+int program_save(const Program *prog, const char *path);
+Program* program_load(const char *path, uint64_t source_hash, uint64_t source_size);
+Program* program_from_image(void *base, size_t size);
+Program* program_retain(Program *prog);
+void program_free(Program *prog);
+SyntaxStatus syntax_compile(const char *text, size_t len, const char *name, uint64_t source_hash, Program **out);
+const char* scan_command_subst(const char *p, const char *end);
+const char* syntax_scan_word(const char *p, const char *end, int *quoted);
+int syntax_is_process_subst(const char *p, const char *end);
+int syntax_starts_command(const char *w, size_t len);
+int execute_program(const Program *prog, uint32_t node);
+int call_function(const char *name, char **argv, int *status);
+int has_function(const char *name);
+int define_function(const Program *prog, uint32_t node);
+int unset_function(const char *name);
+int function_set(const char *name, const Program *prog, uint32_t body);
+int function_definition(const char *name, const Program **prog, uint32_t *body);
+char* command_substitute(const char *text, size_t len);
+GlobMatcher* pattern_matcher(const char *pattern);
+char* process_substitute(const char *text, size_t len, int output);
+size_t process_subst_mark(void);
+void process_subst_finish(size_t mark);
+int process_subst_active(void);
+void process_subst_inherit(void);
+void interp_break(int levels, int is_continue);
+void interp_return(int status);
+int interp_in_function(void);
+int interp_loop_depth(void);
+int run_script(const char *path);
+int cache_path(const char *subdir, const char *file, char *out, size_t size);
+void rc_load(void);
+void rc_snapshot_note_read(const char *name);
+void rc_snapshot_note_write(const char *name);
+void rc_snapshot_note_function(const char *name);
+void rc_snapshot_note_file(const char *path);
+void rc_snapshot_note_probe(const char *path);
+extern int rc_snapshot_tracing;
+extern pid_t shell_pid;
+char** expand_word_fields(const char *raw, size_t *count);
+char* expand_word_string(const char *raw);
+char* expand_word_pattern(const char *raw);
+char* expand_heredoc(const char *body);
+int arith_eval(const char *text, size_t len, int64_t *result);
+int is_assignment_word(const char *word);
+int is_compound_assignment(const char *word);
+void vars_init(int argc, char **argv);
+void vars_set_args(int argc, char **argv);
+const char* var_get(const char *name);
+int var_set(const char *name, const char *value);
+int var_set_local(const char *name, const char *value);
+int var_export(const char *name, const char *value);
+int var_unset(const char *name);
+int var_is_name(const char *s, size_t len);
+int vars_push_function(int argc, char **argv);
+int vars_push_temp(void);
+int var_set_temp(const char *name, const char *value);
+void vars_pop_scope(void);
+int var_positional_count(void);
+const char* var_positional(int n);
+int var_shift(int n);
+int var_global_state(const char *name, const char **value, const ShArray **array);
+ShArray* var_get_array(const char *name);
+ShArray* var_make_array(const char *name, int kind, int local);
+int var_subscript(const ShArray *a, const char *sub, size_t len, char **key, int64_t *index);
+const char* var_get_element(const char *name, const char *sub, size_t len, int *error);
+int var_assign(const char *lhs, size_t len, const char *value);
+int var_unset_element(const char *name, const char *sub, size_t len);
+int var_assign_compound(const char *word, int kind, int local);
+int var_declare(const char *arg, int kind, int local);
+ShArray* array_new(int assoc);
+void array_free(ShArray *a);
+void array_clear(ShArray *a);
+int array_is_assoc(const ShArray *a);
+size_t array_count(const ShArray *a);
+int64_t array_end(const ShArray *a);
+const char* array_get_index(const ShArray *a, int64_t index);
+int array_set_index(ShArray *a, int64_t index, const char *value);
+const char* array_get_key(const ShArray *a, const char *key);
+int array_set_key(ShArray *a, const char *key, const char *value);
+int array_iter(const ShArray *a, size_t *pos, const char **key, int64_t *index, const char **value);
+int builtin_true(char **argv);
+int builtin_false(char **argv);
+int builtin_echo(char **argv);
+int builtin_test(char **argv);
+int builtin_local(char **argv);
+int builtin_declare(char **argv);
+int builtin_let(char **argv);
+int builtin_export(char **argv);
+int builtin_unset(char **argv);
+int builtin_return(char **argv);
+int builtin_break(char **argv);
+int builtin_continue(char **argv);
+int builtin_shift(char **argv);
+int builtin_pipesched(char **argv);
+int builtin_timeout(char **argv);
+int builtin_enable(char **argv);
+int builtin_source(char **argv);
+
+/*
+ * make stats (-DMYSHELL_STATS) でビルドしたときだけ、確保と解放を数える関数に置き換える。
+ * 通常のビルドでは何も置き換えないので、計測のコストはかからない。
+ */
+#ifdef MYSHELL_STATS
+#ifndef STATS_SUBSYSTEM
+#define STATS_SUBSYSTEM STATS_OTHER
+#endif
+#define malloc(size) stats_malloc(STATS_SUBSYSTEM, (size))
+#define calloc(count, size) stats_calloc(STATS_SUBSYSTEM, (count), (size))
+#define realloc(ptr, size) stats_realloc(STATS_SUBSYSTEM, (ptr), (size))
+#define strdup(s) stats_strdup(STATS_SUBSYSTEM, (s))
+#define strndup(s, n) stats_strndup(STATS_SUBSYSTEM, (s), (n))
+#define free(ptr) stats_free(ptr)
+#endif
 
 #endif /* SHELL_H */
@@ -0,0 +1,760 @@
+#define STATS_SUBSYSTEM STATS_EXPAND
+#include <shell.h>
+
+/*
+ * 算術式 ($(( )), (( )), let)
+ *
+ * 式は一度だけスタックマシンの命令列にコンパイルし、式の文字列をキーにして覚えておく。
+ * ループの本体の $((i + 1)) や ((i++)) は2回目から字句解析も構文解析もしない。
+ * 変数 (i や配列の要素 a[i]) は命令列の中では名前のまま持ち、評価のたびに読み書きする。
+ * $ (x="1+2" の $x は値を式の一部として読む)・引用符などを含む式だけは、先に文字列として
+ * 展開してからコンパイルする (展開の結果は毎回変わりうるので覚えない)。
+ *
+ * 値は64ビットの符号付き整数で、あふれたら折り返す (bash と同じ)。
+ * 演算子の優先順位も bash と同じ: 後置 ++ -- > 前置 ++ -- + - ! ~ > ** > * / % > + - >
+ * << >> > < <= > >= > == != > & > ^ > | > && > || > ?: > = op= > ,
+ */
+
+#define ARITH_CACHE_SIZE 256        /* コンパイル済みの式を覚えておく数 (2の累乗) */
+#define ARITH_MAX_STACK 64          /* 評価のスタックの深さの上限 */
+#define ARITH_MAX_RECURSION 32      /* 変数の値を式として評価するときの深さの上限 */
+
+typedef enum {
+    OP_PUSH,        // value を積む
+    OP_LOAD,        // 変数 names[arg] の値を積む
+    OP_STORE,       // 一番上の値を変数 names[arg] に代入する (値は残す)
+    OP_INCR,        // 変数 names[arg] に value を足す。post なら足す前の値を積む
+    OP_NEG, OP_NOT, OP_BITNOT, OP_BOOL,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+    OP_SHL, OP_SHR, OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_BITAND, OP_BITXOR, OP_BITOR,
+    OP_JZ,          // 取り出して0なら arg へ
+    OP_JNZ,         // 取り出して0でなければ arg へ
+    OP_JMP,
+    OP_POP
+} ArithOp;
+
+typedef struct ArithInsn {
+    uint8_t op;
+    uint8_t post;               // OP_INCR: 後置
+    uint32_t arg;
+    int64_t value;
+} ArithInsn;
+
+typedef struct ArithProgram {
+    char *source;               // 式の文字列 (キャッシュのキーとエラーメッセージ用)
+    ArithInsn *code;
+    size_t count, cap;
+    char **names;
+    size_t nnames;
+} ArithProgram;
+
+typedef enum { AT_NUM, AT_NAME, AT_OP, AT_END } ArithTokKind;
+
+typedef struct ArithCompiler {
+    const char *p, *end;
+    ArithProgram *prog;
+    ArithTokKind kind;
+    char op[4];                 // AT_OP: 演算子
+    int64_t value;              // AT_NUM
+    const char *name;           // AT_NAME
+    size_t name_len;
+    int depth, max_depth;       // 評価したときのスタックの深さ
+    const char *error;
+} ArithCompiler;
+
+static ArithProgram *cache[ARITH_CACHE_SIZE];
+
+static int arith_eval_depth(const char *text, size_t len, int64_t *result, int depth);
+
+/* ---------- 字句 ---------- */
+
+static int digit_value(char c) {
+    if (isdigit((unsigned char)c)) {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A' + 36;
+    }
+    if (c == '@') {
+        return 62;
+    }
+    if (c == '_') {
+        return 63;
+    }
+    return -1;
+}
+
+/**
+ * @brief 整数の定数 (10進、0x.. の16進、0.. の8進、BASE#N) を読む
+ * @return 読んだ後の位置。数でなければNULL
+ */
+static const char* parse_number(const char *p, const char *end, int64_t *out) {
+    uint64_t base = 10, value = 0;
+    const char *start = p;
+    if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+        start = p;
+    } else if (p < end && p[0] == '0') {
+        base = 8;
+    } else {
+        const char *q = p;
+        while (q < end && isdigit((unsigned char)*q)) {
+            q++;
+        }
+        if (q > p && q < end && *q == '#') {
+            base = strtoull(p, NULL, 10);
+            if (base < 2 || base > 64) {
+                return NULL;
+            }
+            p = q + 1;
+            start = p;
+        }
+    }
+    while (p < end) {
+        int d = digit_value(*p);
+        if (d < 0) {
+            break;
+        }
+        if (base <= 36 && d >= 36) {
+            d -= 26; // 36進までは大文字と小文字を区別しない
+        }
+        if ((uint64_t)d >= base) {
+            return NULL;
+        }
+        value = value * base + (uint64_t)d;
+        p++;
+    }
+    if (p == start) {
+        return NULL;
+    }
+    *out = (int64_t)value;
+    return p;
+}
+
+static int is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// 次の字句を読む
+static void next_token(ArithCompiler *c) {
+    static const char *const ops[] = {
+        "<<=", ">>=", "**", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+        "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=",
+    };
+    while (c->p < c->end && isspace((unsigned char)*c->p)) {
+        c->p++;
+    }
+    if (c->p >= c->end) {
+        c->kind = AT_END;
+        return;
+    }
+    const char *p = c->p;
+    if (isdigit((unsigned char)*p)) {
+        const char *q = parse_number(p, c->end, &c->value);
+        if (q == NULL || (q < c->end && is_name_char(*q))) {
+            c->error = "value too great for base";
+            c->kind = AT_END;
+            return;
+        }
+        c->kind = AT_NUM;
+        c->p = q;
+        return;
+    }
+    if (is_name_start(*p)) {
+        const char *q = p;
+        while (q < c->end && is_name_char(*q)) {
+            q++;
+        }
+        if (q < c->end && *q == '[') {
+            // 配列の要素 a[i] は添字ごと名前にする (評価のたびに添字を評価する)
+            int nest = 0;
+            const char *close = q + 1;
+            for (; close < c->end && (*close != ']' || nest > 0); close++) {
+                nest += *close == '[' ? 1 : *close == ']' ? -1 : 0;
+            }
+            if (close >= c->end) {
+                c->error = "bad array subscript";
+                c->kind = AT_END;
+                return;
+            }
+            q = close + 1;
+        }
+        c->kind = AT_NAME;
+        c->name = p;
+        c->name_len = (size_t)(q - p);
+        c->p = q;
+        return;
+    }
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        size_t n = strlen(ops[i]);
+        if ((size_t)(c->end - p) >= n && memcmp(p, ops[i], n) == 0) {
+            memcpy(c->op, ops[i], n + 1);
+            c->kind = AT_OP;
+            c->p += n;
+            return;
+        }
+    }
+    if (strchr("+-*/%<>&^|!~?:=,()", *p) == NULL) {
+        c->error = "syntax error: invalid arithmetic operator";
+        c->kind = AT_END;
+        return;
+    }
+    c->op[0] = *p;
+    c->op[1] = '\0';
+    c->kind = AT_OP;
+    c->p++;
+}
+
+static int is_op(const ArithCompiler *c, const char *op) {
+    return c->kind == AT_OP && strcmp(c->op, op) == 0;
+}
+
+/* ---------- コンパイル ---------- */
+
+static size_t emit(ArithCompiler *c, ArithOp op, uint32_t arg, int64_t value, int stack_change) {
+    ArithProgram *prog = c->prog;
+    if (prog->count == prog->cap) {
+        size_t new_cap = prog->cap ? prog->cap * 2 : 16;
+        ArithInsn *tmp = (ArithInsn *)realloc(prog->code, new_cap * sizeof(ArithInsn));
+        if (tmp == NULL) {
+            c->error = "out of memory";
+            return prog->count;
+        }
+        prog->code = tmp;
+        prog->cap = new_cap;
+    }
+    ArithInsn *insn = &prog->code[prog->count];
+    insn->op = (uint8_t)op;
+    insn->post = 0;
+    insn->arg = arg;
+    insn->value = value;
+    c->depth += stack_change;
+    if (c->depth > c->max_depth) {
+        c->max_depth = c->depth;
+    }
+    return prog->count++;
+}
+
+// 変数名を names に登録して番号を返す
+static uint32_t name_index(ArithCompiler *c, const char *name, size_t len) {
+    ArithProgram *prog = c->prog;
+    for (size_t i = 0; i < prog->nnames; i++) {
+        if (strncmp(prog->names[i], name, len) == 0 && prog->names[i][len] == '\0') {
+            return (uint32_t)i;
+        }
+    }
+    char **tmp = (char **)realloc(prog->names, (prog->nnames + 1) * sizeof(char *));
+    char *copy = strndup(name, len);
+    if (tmp == NULL || copy == NULL) {
+        if (tmp != NULL) {
+            prog->names = tmp;
+        }
+        free(copy);
+        c->error = "out of memory";
+        return 0;
+    }
+    prog->names = tmp;
+    prog->names[prog->nnames] = copy;
+    return (uint32_t)prog->nnames++;
+}
+
+static void patch(ArithCompiler *c, size_t at) {
+    if (at < c->prog->count) {
+        c->prog->code[at].arg = (uint32_t)c->prog->count;
+    }
+}
+
+static void compile_comma(ArithCompiler *c);
+static void compile_assign(ArithCompiler *c);
+static void compile_unary(ArithCompiler *c);
+static void compile_power(ArithCompiler *c);
+
+static void compile_primary(ArithCompiler *c) {
+    if (c->error != NULL) {
+        return;
+    }
+    if (c->kind == AT_NUM) {
+        emit(c, OP_PUSH, 0, c->value, 1);
+        next_token(c);
+    } else if (c->kind == AT_NAME) {
+        uint32_t index = name_index(c, c->name, c->name_len);
+        next_token(c);
+        if (is_op(c, "++") || is_op(c, "--")) {
+            size_t at = emit(c, OP_INCR, index, c->op[0] == '+' ? 1 : -1, 1);
+            if (at < c->prog->count) {
+                c->prog->code[at].post = 1;
+            }
+            next_token(c);
+        } else {
+            emit(c, OP_LOAD, index, 0, 1);
+        }
+    } else if (is_op(c, "(")) {
+        next_token(c);
+        compile_comma(c);
+        if (!is_op(c, ")")) {
+            c->error = c->error ? c->error : "missing `)'";
+            return;
+        }
+        next_token(c);
+    } else {
+        c->error = c->error ? c->error : "syntax error: operand expected";
+    }
+}
+
+static void compile_unary(ArithCompiler *c) {
+    if (c->error != NULL) {
+        return;
+    }
+    if (is_op(c, "++") || is_op(c, "--")) {
+        int64_t delta = c->op[0] == '+' ? 1 : -1;
+        next_token(c);
+        if (c->kind != AT_NAME) {
+            c->error = c->error ? c->error : "syntax error: operand expected";
+            return;
+        }
+        emit(c, OP_INCR, name_index(c, c->name, c->name_len), delta, 1);
+        next_token(c);
+        return;
+    }
+    if (is_op(c, "+") || is_op(c, "-") || is_op(c, "!") || is_op(c, "~")) {
+        char op = c->op[0];
+        next_token(c);
+        compile_unary(c);
+        if (op != '+') {
+            emit(c, op == '-' ? OP_NEG : op == '!' ? OP_NOT : OP_BITNOT, 0, 0, 0);
+        }
+        return;
+    }
+    compile_primary(c);
+}
+
+// ** は右結合で、単項演算子より弱い (-2**2 は 4)
+static void compile_power(ArithCompiler *c) {
+    compile_unary(c);
+    if (c->error == NULL && is_op(c, "**")) {
+        next_token(c);
+        compile_power(c);
+        emit(c, OP_POW, 0, 0, -1);
+    }
+}
+
+// 二項演算子の優先順位 (大きいほど強い)。&& と || は別に扱う
+static int binary_level(const ArithCompiler *c, ArithOp *op) {
+    static const struct {
+        const char *text;
+        ArithOp op;
+        int level;
+    } table[] = {
+        {"|", OP_BITOR, 3}, {"^", OP_BITXOR, 4}, {"&", OP_BITAND, 5},
+        {"==", OP_EQ, 6}, {"!=", OP_NE, 6},
+        {"<", OP_LT, 7}, {"<=", OP_LE, 7}, {">", OP_GT, 7}, {">=", OP_GE, 7},
+        {"<<", OP_SHL, 8}, {">>", OP_SHR, 8},
+        {"+", OP_ADD, 9}, {"-", OP_SUB, 9},
+        {"*", OP_MUL, 10}, {"/", OP_DIV, 10}, {"%", OP_MOD, 10},
+    };
+    if (c->kind != AT_OP) {
+        return -1;
+    }
+    if (strcmp(c->op, "||") == 0) {
+        return 1;
+    }
+    if (strcmp(c->op, "&&") == 0) {
+        return 2;
+    }
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        if (strcmp(c->op, table[i].text) == 0) {
+            *op = table[i].op;
+            return table[i].level;
+        }
+    }
+    return -1;
+}
+
+// 優先順位が min_level 以上の二項演算子の並びを読む (左結合)
+static void compile_binary(ArithCompiler *c, int min_level) {
+    compile_power(c);
+    ArithOp op = OP_ADD;
+    int level;
+    while (c->error == NULL && (level = binary_level(c, &op)) >= min_level) {
+        next_token(c);
+        if (level <= 2) {
+            // && と || は右辺を評価しないことがある: lhs JZ/JNZ rhs BOOL JMP end; 定数
+            size_t jump = emit(c, level == 2 ? OP_JZ : OP_JNZ, 0, 0, -1);
+            compile_binary(c, level + 1);
+            emit(c, OP_BOOL, 0, 0, 0);
+            size_t skip = emit(c, OP_JMP, 0, 0, 0);
+            patch(c, jump);
+            emit(c, OP_PUSH, 0, level == 2 ? 0 : 1, 0);
+            patch(c, skip);
+        } else {
+            compile_binary(c, level + 1);
+            emit(c, op, 0, 0, -1);
+        }
+    }
+}
+
+static void compile_ternary(ArithCompiler *c) {
+    compile_binary(c, 1);
+    if (c->error != NULL || !is_op(c, "?")) {
+        return;
+    }
+    next_token(c);
+    size_t jump = emit(c, OP_JZ, 0, 0, -1);
+    compile_comma(c);
+    size_t skip = emit(c, OP_JMP, 0, 0, -1); // 偽の側では真の側の値は積まれない
+    if (!is_op(c, ":")) {
+        c->error = c->error ? c->error : "`:' expected for conditional expression";
+        return;
+    }
+    next_token(c);
+    patch(c, jump);
+    compile_ternary(c);
+    patch(c, skip);
+}
+
+// 代入演算子なら対応する二項演算を返す ("=" は OP_POP で表す)。代入でなければ-1
+static int assign_op(const ArithCompiler *c) {
+    static const struct {
+        const char *text;
+        ArithOp op;
+    } table[] = {
+        {"=", OP_POP}, {"+=", OP_ADD}, {"-=", OP_SUB}, {"*=", OP_MUL}, {"/=", OP_DIV},
+        {"%=", OP_MOD}, {"<<=", OP_SHL}, {">>=", OP_SHR}, {"&=", OP_BITAND},
+        {"^=", OP_BITXOR}, {"|=", OP_BITOR},
+    };
+    for (size_t i = 0; c->kind == AT_OP && i < sizeof(table) / sizeof(table[0]); i++) {
+        if (strcmp(c->op, table[i].text) == 0) {
+            return (int)table[i].op;
+        }
+    }
+    return -1;
+}
+
+static void compile_assign(ArithCompiler *c) {
+    size_t start = c->prog->count;
+    compile_ternary(c);
+    int op = c->error == NULL ? assign_op(c) : -1;
+    if (op < 0) {
+        return;
+    }
+    // 左辺は変数1つだけ (その OP_LOAD を取り消して代入にする)
+    if (c->prog->count != start + 1 || c->prog->code[start].op != OP_LOAD) {
+        c->error = "attempted assignment to non-variable";
+        return;
+    }
+    uint32_t index = c->prog->code[start].arg;
+    c->prog->count = start;
+    c->depth--;
+    next_token(c);
+    if (op != OP_POP) {
+        emit(c, OP_LOAD, index, 0, 1);
+    }
+    compile_assign(c);
+    if (op != OP_POP) {
+        emit(c, (ArithOp)op, 0, 0, -1);
+    }
+    emit(c, OP_STORE, index, 0, 0);
+}
+
+static void compile_comma(ArithCompiler *c) {
+    compile_assign(c);
+    while (c->error == NULL && is_op(c, ",")) {
+        next_token(c);
+        emit(c, OP_POP, 0, 0, -1);
+        compile_assign(c);
+    }
+}
+
+static void arith_program_free(ArithProgram *prog) {
+    if (prog == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < prog->nnames; i++) {
+        free(prog->names[i]);
+    }
+    free(prog->names);
+    free(prog->code);
+    free(prog->source);
+    free(prog);
+}
+
+/**
+ * @brief 式をコンパイルする
+ * @return コンパイルした式。エラーならメッセージを出してNULL
+ */
+static ArithProgram* arith_compile(const char *text, size_t len) {
+    ArithProgram *prog = (ArithProgram *)calloc(1, sizeof(ArithProgram));
+    if (prog == NULL || (prog->source = strndup(text, len)) == NULL) {
+        perror("arithmetic");
+        free(prog);
+        return NULL;
+    }
+    ArithCompiler c = {0};
+    c.p = text;
+    c.end = text + len;
+    c.prog = prog;
+    next_token(&c);
+    if (c.kind == AT_END && c.error == NULL) {
+        emit(&c, OP_PUSH, 0, 0, 1); // 空の式は0
+    } else {
+        compile_comma(&c);
+    }
+    if (c.error == NULL && c.kind != AT_END) {
+        c.error = "syntax error in expression";
+    }
+    if (c.error == NULL && c.max_depth > ARITH_MAX_STACK) {
+        c.error = "expression too complex";
+    }
+    if (c.error != NULL) {
+        fprintf(stderr, "myshell: %s: %s\n", prog->source, c.error);
+        arith_program_free(prog);
+        return NULL;
+    }
+    return prog;
+}
+
+/* ---------- 評価 ---------- */
+
+// 変数の値を数にする (数でなければ式として評価する)
+static int load_variable(const char *name, int64_t *out, int depth) {
+    const char *bracket = strchr(name, '[');
+    const char *value;
+    if (bracket != NULL) {
+        char base[128];
+        int error;
+        snprintf(base, sizeof(base), "%.*s", (int)(bracket - name), name);
+        value = var_get_element(base, bracket + 1, strlen(bracket) - 2, &error);
+        if (error) {
+            return -1;
+        }
+    } else {
+        value = var_get(name);
+    }
+    if (value == NULL || value[0] == '\0') {
+        *out = 0;
+        return 0;
+    }
+    const char *end = value + strlen(value);
+    const char *p = value;
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    int negative = *p == '-';
+    p += *p == '-' || *p == '+';
+    const char *q = parse_number(p, end, out);
+    if (q != NULL && q == end) {
+        *out = negative ? (int64_t)(0 - (uint64_t)*out) : *out;
+        return 0;
+    }
+    return arith_eval_depth(value, strlen(value), out, depth + 1);
+}
+
+static int store_variable(const char *name, int64_t value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", (long long)value);
+    return var_assign(name, strlen(name), buf);
+}
+
+static int64_t power(int64_t base, int64_t exp) {
+    uint64_t result = 1, b = (uint64_t)base;
+    for (; exp > 0; exp >>= 1) {
+        if (exp & 1) {
+            result *= b;
+        }
+        b *= b;
+    }
+    return (int64_t)result;
+}
+
+static int arith_run(const ArithProgram *prog, int64_t *result, int depth) {
+    int64_t stack[ARITH_MAX_STACK + 1];
+    int sp = 0;
+    for (size_t pc = 0; pc < prog->count;) {
+        const ArithInsn *in = &prog->code[pc++];
+        int64_t a, b;
+        switch ((ArithOp)in->op) {
+            case OP_PUSH:
+                stack[sp++] = in->value;
+                break;
+            case OP_LOAD:
+                if (load_variable(prog->names[in->arg], &stack[sp++], depth) != 0) {
+                    return -1;
+                }
+                break;
+            case OP_STORE:
+                store_variable(prog->names[in->arg], stack[sp - 1]);
+                break;
+            case OP_INCR:
+                if (load_variable(prog->names[in->arg], &a, depth) != 0) {
+                    return -1;
+                }
+                b = (int64_t)((uint64_t)a + (uint64_t)in->value);
+                store_variable(prog->names[in->arg], b);
+                stack[sp++] = in->post ? a : b;
+                break;
+            case OP_NEG:
+                stack[sp - 1] = (int64_t)(0 - (uint64_t)stack[sp - 1]);
+                break;
+            case OP_NOT:
+                stack[sp - 1] = !stack[sp - 1];
+                break;
+            case OP_BITNOT:
+                stack[sp - 1] = ~stack[sp - 1];
+                break;
+            case OP_BOOL:
+                stack[sp - 1] = stack[sp - 1] != 0;
+                break;
+            case OP_JZ:
+                if (stack[--sp] == 0) {
+                    pc = in->arg;
+                }
+                break;
+            case OP_JNZ:
+                if (stack[--sp] != 0) {
+                    pc = in->arg;
+                }
+                break;
+            case OP_JMP:
+                pc = in->arg;
+                break;
+            case OP_POP:
+                sp--;
+                break;
+            default:
+                b = stack[--sp];
+                a = stack[sp - 1];
+                switch ((ArithOp)in->op) {
+                    case OP_ADD: a = (int64_t)((uint64_t)a + (uint64_t)b); break;
+                    case OP_SUB: a = (int64_t)((uint64_t)a - (uint64_t)b); break;
+                    case OP_MUL: a = (int64_t)((uint64_t)a * (uint64_t)b); break;
+                    case OP_DIV:
+                    case OP_MOD:
+                        if (b == 0) {
+                            fprintf(stderr, "myshell: %s: division by 0\n", prog->source);
+                            return -1;
+                        }
+                        if (b == -1) {
+                            a = in->op == OP_DIV ? (int64_t)(0 - (uint64_t)a) : 0; // INT64_MIN / -1
+                        } else {
+                            a = in->op == OP_DIV ? a / b : a % b;
+                        }
+                        break;
+                    case OP_POW:
+                        if (b < 0) {
+                            fprintf(stderr, "myshell: %s: exponent less than 0\n", prog->source);
+                            return -1;
+                        }
+                        a = power(a, b);
+                        break;
+                    case OP_SHL: a = (int64_t)((uint64_t)a << (b & 63)); break;
+                    case OP_SHR: a = a >> (b & 63); break;
+                    case OP_LT: a = a < b; break;
+                    case OP_LE: a = a <= b; break;
+                    case OP_GT: a = a > b; break;
+                    case OP_GE: a = a >= b; break;
+                    case OP_EQ: a = a == b; break;
+                    case OP_NE: a = a != b; break;
+                    case OP_BITAND: a = a & b; break;
+                    case OP_BITXOR: a = a ^ b; break;
+                    case OP_BITOR: a = a | b; break;
+                    default: break;
+                }
+                stack[sp - 1] = a;
+                break;
+        }
+    }
+    *result = sp > 0 ? stack[sp - 1] : 0;
+    return 0;
+}
+
+static size_t source_hash(const char *s, size_t len) {
+    size_t h = 5381;
+    for (size_t i = 0; i < len; i++) {
+        h = h * 33 + (unsigned char)s[i];
+    }
+    return h;
+}
+
+// コンパイル済みの式を探し、なければコンパイルして覚える
+static ArithProgram* arith_lookup(const char *text, size_t len) {
+    size_t start = source_hash(text, len) & (ARITH_CACHE_SIZE - 1);
+    size_t slot = ARITH_CACHE_SIZE;
+    for (size_t n = 0, i = start; n < ARITH_CACHE_SIZE; n++, i = (i + 1) & (ARITH_CACHE_SIZE - 1)) {
+        if (cache[i] == NULL) {
+            slot = i;
+            break;
+        }
+        if (strncmp(cache[i]->source, text, len) == 0 && cache[i]->source[len] == '\0') {
+            return cache[i];
+        }
+    }
+    ArithProgram *prog = arith_compile(text, len);
+    if (prog == NULL) {
+        return NULL;
+    }
+    if (slot == ARITH_CACHE_SIZE) {
+        // 満杯なら全部捨てる (ループの中の式はすぐにまた入る)
+        for (size_t i = 0; i < ARITH_CACHE_SIZE; i++) {
+            arith_program_free(cache[i]);
+            cache[i] = NULL;
+        }
+        slot = start;
+    }
+    cache[slot] = prog;
+    return prog;
+}
+
+// 先に文字列として展開する必要がある式か ($x・$(...)・引用符など)
+// $x は x の値を式の文字列に埋め込む (x="1+2" なら $x*2 は 1+2*2) ので、名前の読み出しにはできない
+static int needs_expansion(const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        if (c == '$' || c == '`' || c == '"' || c == '\'' || c == '\\') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int arith_eval_depth(const char *text, size_t len, int64_t *result, int depth) {
+    if (depth > ARITH_MAX_RECURSION) {
+        fprintf(stderr, "myshell: %.*s: expression recursion level exceeded\n", (int)len, text);
+        return -1;
+    }
+    if (!needs_expansion(text, len)) {
+        ArithProgram *prog = arith_lookup(text, len);
+        return prog != NULL ? arith_run(prog, result, depth) : -1;
+    }
+    char *raw = strndup(text, len);
+    char *expanded = raw ? expand_word_string(raw) : NULL;
+    free(raw);
+    if (expanded == NULL) {
+        return -1;
+    }
+    ArithProgram *prog = arith_compile(expanded, strlen(expanded));
+    free(expanded);
+    int r = prog != NULL ? arith_run(prog, result, depth) : -1;
+    arith_program_free(prog);
+    return r;
+}
+
+/**
+ * @brief 算術式を評価する ($(( )) と (( )) の中身、let の引数)
+ *
+ * @param text 式 (展開前の文字列)
+ * @param len text の長さ
+ * @param result 結果
+ * @return 成功時0、エラー時-1 (メッセージは出力済み)
+ */
+int arith_eval(const char *text, size_t len, int64_t *result) {
+    return arith_eval_depth(text, len, result, 0);
+}
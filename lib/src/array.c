@@ -0,0 +1,348 @@
+#define STATS_SUBSYSTEM STATS_VARS
+#include <shell.h>
+
+/*
+ * 配列変数 (a=(x y z)、declare -A m)
+ *
+ * 添字配列は添字をそのまま位置にした連続した領域に置く (歯抜けは NULL)。
+ * 連想配列は開番地法のハッシュ表で、1つのスロットは32バイト。
+ * キーと値が合わせて24バイトに収まるものはスロットの中に直接置くので、
+ * 短いキーの表を引くときはスロットを読むだけで済む (長いものだけ別に確保する)。
+ * bash の配列は連結リストで、添字で引くたびに先頭からたどるが、ここではどちらも O(1)。
+ */
+
+#define ARRAY_MAX_INDEX (1LL << 24)   /* 添字配列の添字の上限 (連続した領域に置くため) */
+#define ASSOC_INLINE 24               /* スロットに直接置けるキーと値の長さ ('\0' を含む) */
+
+typedef struct AssocSlot {
+    uint32_t hash;              // 0なら空きスロット
+    uint16_t key_len;           // 0xffff 以上のキーは 0xffff (比較のときは strcmp)
+    uint8_t heap;               // 1なら data.ptr に確保した領域
+    uint8_t unused;
+    union {
+        char buf[ASSOC_INLINE]; // "key\0value\0"
+        char *ptr;
+    } data;
+} AssocSlot;
+
+struct ShArray {
+    int assoc;
+    size_t count;               // 設定されている要素の数
+    // 添字配列
+    char **items;
+    size_t size, cap;           // size は一番大きい添字 + 1
+    // 連想配列
+    AssocSlot *slots;
+    size_t nslots;              // 2の累乗
+};
+
+/**
+ * @brief 空の配列を作る
+ * @param assoc 連想配列なら1
+ * @return 配列。失敗時はNULL
+ */
+ShArray* array_new(int assoc) {
+    ShArray *a = (ShArray *)calloc(1, sizeof(ShArray));
+    if (a == NULL) {
+        perror("Failed to allocate array");
+        return NULL;
+    }
+    a->assoc = assoc;
+    return a;
+}
+
+static const char* slot_key(const AssocSlot *s) {
+    return s->heap ? s->data.ptr : s->data.buf;
+}
+
+static const char* slot_value(const AssocSlot *s) {
+    const char *key = slot_key(s);
+    return key + (s->key_len < 0xffff ? s->key_len : strlen(key)) + 1;
+}
+
+/**
+ * @brief 要素をすべて削除する
+ */
+void array_clear(ShArray *a) {
+    for (size_t i = 0; i < a->size; i++) {
+        free(a->items[i]);
+    }
+    free(a->items);
+    for (size_t i = 0; i < a->nslots; i++) {
+        if (a->slots[i].hash != 0 && a->slots[i].heap) {
+            free(a->slots[i].data.ptr);
+        }
+    }
+    free(a->slots);
+    int assoc = a->assoc;
+    memset(a, 0, sizeof(*a));
+    a->assoc = assoc;
+}
+
+void array_free(ShArray *a) {
+    if (a == NULL) {
+        return;
+    }
+    array_clear(a);
+    free(a);
+}
+
+int array_is_assoc(const ShArray *a) {
+    return a->assoc;
+}
+
+/**
+ * @brief 設定されている要素の数 (${#a[@]})
+ */
+size_t array_count(const ShArray *a) {
+    return a->count;
+}
+
+/**
+ * @brief 添字配列の一番大きい添字 + 1 (a+=(x) はここに追加する)
+ */
+int64_t array_end(const ShArray *a) {
+    return a->assoc ? (int64_t)a->count : (int64_t)a->size;
+}
+
+/* ---------- 添字配列 ---------- */
+
+const char* array_get_index(const ShArray *a, int64_t index) {
+    return index >= 0 && (size_t)index < a->size ? a->items[index] : NULL;
+}
+
+/**
+ * @brief 添字配列の要素を設定する
+ * @param value NULLなら要素を削除する
+ * @return 成功時0、失敗時-1
+ */
+int array_set_index(ShArray *a, int64_t index, const char *value) {
+    if (index < 0 || index >= ARRAY_MAX_INDEX) {
+        fprintf(stderr, "myshell: [%lld]: bad array subscript\n", (long long)index);
+        return -1;
+    }
+    if (value == NULL) {
+        if ((size_t)index < a->size && a->items[index] != NULL) {
+            free(a->items[index]);
+            a->items[index] = NULL;
+            a->count--;
+            while (a->size > 0 && a->items[a->size - 1] == NULL) {
+                a->size--;
+            }
+        }
+        return 0;
+    }
+    if ((size_t)index >= a->cap) {
+        size_t new_cap = a->cap ? a->cap : 8;
+        while (new_cap <= (size_t)index) {
+            new_cap *= 2;
+        }
+        char **items = (char **)realloc(a->items, new_cap * sizeof(char *));
+        if (items == NULL) {
+            perror("Failed to allocate array");
+            return -1;
+        }
+        memset(items + a->cap, 0, (new_cap - a->cap) * sizeof(char *));
+        a->items = items;
+        a->cap = new_cap;
+    }
+    char *copy = strdup(value);
+    if (copy == NULL) {
+        perror("Failed to allocate array element");
+        return -1;
+    }
+    if (a->items[index] == NULL) {
+        a->count++;
+    }
+    free(a->items[index]);
+    a->items[index] = copy;
+    if ((size_t)index >= a->size) {
+        a->size = (size_t)index + 1;
+    }
+    return 0;
+}
+
+/* ---------- 連想配列 ---------- */
+
+static uint32_t key_hash(const char *key, size_t len) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return h != 0 ? h : 1;
+}
+
+static AssocSlot* assoc_find(const ShArray *a, const char *key, size_t len, uint32_t hash) {
+    if (a->nslots == 0) {
+        return NULL;
+    }
+    size_t mask = a->nslots - 1;
+    uint16_t short_len = len < 0xffff ? (uint16_t)len : 0xffff;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        AssocSlot *s = &a->slots[i];
+        if (s->hash == 0) {
+            return NULL;
+        }
+        if (s->hash == hash && s->key_len == short_len && memcmp(slot_key(s), key, len) == 0 &&
+            slot_key(s)[len] == '\0') {
+            return s;
+        }
+    }
+}
+
+// 空きスロットに置く (表に余裕があることは呼び出し側が保証する)
+static void assoc_place(AssocSlot *slots, size_t nslots, const AssocSlot *entry) {
+    size_t mask = nslots - 1;
+    size_t i = entry->hash & mask;
+    while (slots[i].hash != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = *entry;
+}
+
+static int assoc_grow(ShArray *a) {
+    size_t new_n = a->nslots ? a->nslots * 2 : 16;
+    AssocSlot *slots = (AssocSlot *)calloc(new_n, sizeof(AssocSlot));
+    if (slots == NULL) {
+        perror("Failed to allocate array");
+        return -1;
+    }
+    for (size_t i = 0; i < a->nslots; i++) {
+        if (a->slots[i].hash != 0) {
+            assoc_place(slots, new_n, &a->slots[i]);
+        }
+    }
+    free(a->slots);
+    a->slots = slots;
+    a->nslots = new_n;
+    return 0;
+}
+
+// キーと値を "key\0value\0" の形でスロットに入れる (短ければスロットの中に置く)。
+// 前の領域は解放しない (呼び出し側が扱う)
+static int slot_store(AssocSlot *s, const char *key, size_t key_len, const char *value) {
+    size_t value_len = strlen(value);
+    size_t total = key_len + value_len + 2;
+    char *dst;
+    char *heap = NULL;
+    if (total <= ASSOC_INLINE) {
+        dst = s->data.buf;
+    } else if ((heap = (char *)malloc(total)) == NULL) {
+        perror("Failed to allocate array element");
+        return -1;
+    } else {
+        dst = heap;
+    }
+    memmove(dst, key, key_len); // key は同じスロットの中を指していることがある
+    dst[key_len] = '\0';
+    memcpy(dst + key_len + 1, value, value_len + 1);
+    s->heap = heap != NULL;
+    if (heap != NULL) {
+        s->data.ptr = heap;
+    }
+    s->key_len = key_len < 0xffff ? (uint16_t)key_len : 0xffff;
+    return 0;
+}
+
+const char* array_get_key(const ShArray *a, const char *key) {
+    size_t len = strlen(key);
+    const AssocSlot *s = assoc_find(a, key, len, key_hash(key, len));
+    return s ? slot_value(s) : NULL;
+}
+
+/**
+ * @brief 連想配列の要素を設定する
+ * @param value NULLなら要素を削除する
+ * @return 成功時0、失敗時-1
+ */
+int array_set_key(ShArray *a, const char *key, const char *value) {
+    size_t len = strlen(key);
+    uint32_t hash = key_hash(key, len);
+    AssocSlot *s = assoc_find(a, key, len, hash);
+    if (value == NULL) {
+        if (s == NULL) {
+            return 0;
+        }
+        // スロットを空け、後ろに続くスロットを置き直す
+        size_t mask = a->nslots - 1;
+        size_t i = (size_t)(s - a->slots);
+        if (s->heap) {
+            free(s->data.ptr);
+        }
+        memset(s, 0, sizeof(*s));
+        a->count--;
+        for (size_t j = (i + 1) & mask; a->slots[j].hash != 0; j = (j + 1) & mask) {
+            AssocSlot moved = a->slots[j];
+            memset(&a->slots[j], 0, sizeof(AssocSlot));
+            assoc_place(a->slots, a->nslots, &moved);
+        }
+        return 0;
+    }
+    if (s != NULL) {
+        char *old = s->heap ? s->data.ptr : NULL;
+        char key_copy[ASSOC_INLINE];
+        const char *k = slot_key(s);
+        if (!s->heap) {
+            memcpy(key_copy, k, len + 1); // 値を書き換えるとスロットの中のキーも動く
+            k = key_copy;
+        }
+        s->heap = 0;
+        int r = slot_store(s, k, len, value);
+        if (r != 0) {
+            s->heap = old != NULL;
+            return -1;
+        }
+        if (old != NULL && (!s->heap || s->data.ptr != old)) {
+            free(old);
+        }
+        return 0;
+    }
+    if ((a->count + 1) * 2 > a->nslots && assoc_grow(a) != 0) {
+        return -1;
+    }
+    AssocSlot entry = {0};
+    entry.hash = hash;
+    if (slot_store(&entry, key, len, value) != 0) {
+        return -1;
+    }
+    assoc_place(a->slots, a->nslots, &entry);
+    a->count++;
+    return 0;
+}
+
+/* ---------- 共通 ---------- */
+
+/**
+ * @brief 要素を順に取り出す (添字配列は添字の順、連想配列は表の順)
+ *
+ * @param pos 0から始めた位置 (呼び出しごとに進む)
+ * @param key 連想配列のキー (添字配列ではNULL)
+ * @param index 添字配列の添字
+ * @param value 値
+ * @return 要素があれば1、終わりなら0
+ */
+int array_iter(const ShArray *a, size_t *pos, const char **key, int64_t *index, const char **value) {
+    if (a->assoc) {
+        for (; *pos < a->nslots; (*pos)++) {
+            const AssocSlot *s = &a->slots[*pos];
+            if (s->hash != 0) {
+                *key = slot_key(s);
+                *index = 0;
+                *value = slot_value(s);
+                (*pos)++;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (; *pos < a->size; (*pos)++) {
+        if (a->items[*pos] != NULL) {
+            *key = NULL;
+            *index = (int64_t)*pos;
+            *value = a->items[*pos];
+            (*pos)++;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// break / continue の共通部分。n はループの段数 (既定は1)
+static int loop_control(char **argv, int is_continue) {
+    const char *name = is_continue ? "continue" : "break";
+    int levels = 1;
+    if (argv[1] != NULL) {
+        char *end;
+        long value = strtol(argv[1], &end, 10);
+        if (argv[1][0] == '\0' || *end != '\0' || value < 1) {
+            fprintf(stderr, "%s: %s: loop count out of range\n", name, argv[1]);
+            return 1;
+        }
+        levels = value > INT_MAX ? INT_MAX : (int)value;
+    }
+    if (interp_loop_depth() == 0) {
+        fprintf(stderr, "%s: only meaningful in a `for', `while', or `until' loop\n", name);
+        return 0;
+    }
+    interp_break(levels, is_continue);
+    return 0;
+}
+
+// break [n] : ループを抜ける
+int builtin_break(char **argv) {
+    return loop_control(argv, 0);
+}
+
+// continue [n] : ループの次の繰り返しに進む
+int builtin_continue(char **argv) {
+    return loop_control(argv, 1);
+}
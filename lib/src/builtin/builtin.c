@@ -0,0 +1,101 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// 組み込みコマンドの一覧 (名前の順。find_builtin が二分探索する)
+static const Builtin builtins[] = {
+    {".", builtin_source},
+    {":", builtin_true},
+    {"[", builtin_test},
+    {"break", builtin_break},
+    {"cd", builtin_cd},
+    {"continue", builtin_continue},
+    {"declare", builtin_declare},
+    {"echo", builtin_echo},
+    {"enable", builtin_enable},
+    {"exit", builtin_exit},
+    {"export", builtin_export},
+    {"false", builtin_false},
+    {"let", builtin_let},
+    {"local", builtin_local},
+    {"memo", builtin_memo},
+    {"pipesched", builtin_pipesched},
+    {"return", builtin_return},
+    {"shellstats", builtin_shellstats},
+    {"shift", builtin_shift},
+    {"source", builtin_source},
+    {"test", builtin_test},
+    {"timeout", builtin_timeout},
+    {"true", builtin_true},
+    {"typeset", builtin_declare},
+    {"unset", builtin_unset},
+};
+
+static int builtin_compare(const void *key, const void *elem) {
+    return strcmp((const char *)key, ((const Builtin *)elem)->name);
+}
+
+/**
+ * @brief 名前から組み込みコマンドを探す
+ * @param name コマンド名
+ * @return 見つかった組み込みコマンド。なければNULL
+ */
+const Builtin* find_builtin(const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+    const Builtin *loaded = find_loaded_builtin(name); // enable -f で読み込んだものが優先
+    if (loaded != NULL) {
+        return loaded;
+    }
+    return (const Builtin *)bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+                                    sizeof(builtins[0]), builtin_compare);
+}
+
+/**
+ * @brief 全ての組み込みコマンドの名前について fn を呼ぶ (補完候補の登録用)
+ */
+void builtin_foreach(void (*fn)(const char *name)) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        fn(builtins[i].name);
+    }
+    loaded_builtin_foreach(fn);
+}
+
+/**
+ * @brief 出力を out_write で書く (stdio を使わない) 組み込みコマンドか
+ */
+int builtin_uses_out_buffer(const Builtin *builtin) {
+    return builtin != NULL && builtin->func == builtin_echo;
+}
+
+// 何も出力しない組み込みコマンドか (エラーは stderr)
+static int is_silent(const Builtin *builtin) {
+    BuiltinFunc f = builtin->func;
+    return f == builtin_true || f == builtin_false || f == builtin_let || f == builtin_shift ||
+           f == builtin_test || f == builtin_break || f == builtin_continue || f == builtin_return ||
+           f == builtin_unset;
+}
+
+/**
+ * @brief 組み込みコマンドを実行する
+ *
+ * stdio で書くコマンドの前には out_write で溜めた出力を書き出し、後には stdout を flush して、
+ * 出力の順序を保つ。
+ *
+ * @return 終了ステータス
+ */
+int builtin_call(const Builtin *builtin, char **argv) {
+    if (builtin_uses_out_buffer(builtin)) {
+        int status = builtin->func(argv);
+        return out_command_done() != 0 ? 1 : status;
+    }
+    int silent = is_silent(builtin);
+    if (!silent) {
+        out_flush();
+    }
+    int status = builtin->func != NULL ? builtin->func(argv) : loaded_builtin_call(builtin, argv);
+    if (!silent) {
+        fflush(stdout);
+    }
+    return status;
+}
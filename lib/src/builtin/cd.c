@@ -0,0 +1,42 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// cd [dir] : 引数がなければ $HOME、"-" なら直前のディレクトリへ移動する
+int builtin_cd(char **argv) {
+    const char *dir = argv[1];
+    int print_dir = 0;
+    if (dir == NULL) {
+        dir = getenv("HOME");
+        if (dir == NULL) {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        }
+    } else if (strcmp(dir, "-") == 0) {
+        dir = getenv("OLDPWD");
+        if (dir == NULL) {
+            fprintf(stderr, "cd: OLDPWD not set\n");
+            return 1;
+        }
+        print_dir = 1;
+    }
+
+    char old[MAX_PATH];
+    if (getcwd(old, sizeof(old)) == NULL) {
+        old[0] = '\0';
+    }
+    if (chdir(dir) != 0) {
+        fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    char cwd[MAX_PATH];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        setenv("PWD", cwd, 1);
+        if (print_dir) {
+            printf("%s\n", cwd);
+        }
+    }
+    if (old[0] != '\0') {
+        setenv("OLDPWD", old, 1);
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+/*
+ * declare [-a|-A] NAME[=VALUE]...
+ *
+ * -a は添字配列、-A は連想配列を作る。NAME=(...) で要素をまとめて設定できる。
+ * 関数の中では local と同じく関数のスコープに作る。typeset も同じ。
+ */
+
+int builtin_declare(char **argv) {
+    int kind = 0;
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *p = argv[i] + 1; *p; p++) {
+            if (*p != 'a' && *p != 'A') {
+                fprintf(stderr, "%s: -%c: invalid option\n", argv[0], *p);
+                fprintf(stderr, "usage: %s [-a|-A] NAME[=VALUE]...\n", argv[0]);
+                return 2;
+            }
+            kind = *p;
+        }
+    }
+    int local = interp_in_function();
+    int status = 0;
+    for (; argv[i] != NULL; i++) {
+        size_t len = strcspn(argv[i], "=");
+        len -= len > 0 && argv[i][len] == '=' && argv[i][len - 1] == '+';
+        if (!var_is_name(argv[i], len)) {
+            fprintf(stderr, "%s: `%s': not a valid identifier\n", argv[0], argv[i]);
+            status = 1;
+        } else if (var_declare(argv[i], kind, local) != 0) {
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,73 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// \ で始まるエスケープを1文字出力し、読んだ文字数を返す。\c なら -1
+static int echo_escape(const char *p) {
+    switch (p[1]) {
+        case 'n': out_putc('\n'); return 2;
+        case 't': out_putc('\t'); return 2;
+        case 'r': out_putc('\r'); return 2;
+        case 'a': out_putc('\a'); return 2;
+        case 'b': out_putc('\b'); return 2;
+        case 'e': out_putc('\033'); return 2;
+        case 'f': out_putc('\f'); return 2;
+        case 'v': out_putc('\v'); return 2;
+        case '\\': out_putc('\\'); return 2;
+        case 'c': return -1;
+        case '0': {
+            int value = 0, n = 2;
+            while (n < 5 && p[n] >= '0' && p[n] <= '7') {
+                value = value * 8 + (p[n++] - '0');
+            }
+            out_putc(value);
+            return n;
+        }
+        default:
+            out_putc('\\');
+            return 1;
+    }
+}
+
+// echo [-neE] [ARGS...] : 引数を空白で区切って出力する
+int builtin_echo(char **argv) {
+    int newline = 1, escapes = 0;
+    int i = 1;
+    // -n / -e / -E (とその組み合わせ) だけからなる引数をオプションとみなす
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        const char *p = argv[i] + 1;
+        if (strspn(p, "neE") != strlen(p)) {
+            break;
+        }
+        for (; *p; p++) {
+            if (*p == 'n') {
+                newline = 0;
+            } else {
+                escapes = *p == 'e';
+            }
+        }
+    }
+    for (int first = i; argv[i] != NULL; i++) {
+        if (i > first) {
+            out_putc(' ');
+        }
+        if (!escapes) {
+            out_puts(argv[i]);
+            continue;
+        }
+        for (const char *p = argv[i]; *p;) {
+            if (*p != '\\') {
+                out_putc(*p++);
+                continue;
+            }
+            int n = echo_escape(p);
+            if (n < 0) {
+                return 0;
+            }
+            p += n;
+        }
+    }
+    if (newline) {
+        out_putc('\n');
+    }
+    return 0;
+}
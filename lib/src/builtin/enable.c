@@ -0,0 +1,244 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <myshell_builtin.h>
+#include <dlfcn.h>
+
+/*
+ * enable [-f FILE NAME...] [-d NAME...]
+ *
+ * -f は共有ライブラリ FILE を dlopen し、NAME ごとに myshell_builtin_NAME を
+ * 組み込みコマンドとして登録する (NAME の英数字以外は '_' に読み替える)。
+ * 登録したコマンドは find_builtin から普通の組み込みコマンドと同じように見つかり、
+ * fork も exec もせずシェルのプロセスの中で呼ばれる。同じ名前の組み込みコマンドより優先する。
+ * -d は読み込んだコマンドを削除する。引数がなければ組み込みコマンドの一覧を出力する。
+ * ライブラリ側の書き方は myshell_builtin.h を参照。
+ */
+
+typedef struct LoadedBuiltin {
+    Builtin entry;              // find_builtin が返す (entry.func はNULL)
+    MyshellBuiltinFunc func;
+    void *handle;               // dlopen の参照 (コマンドごとに1つ持つ)
+    char *path;
+} LoadedBuiltin;
+
+static LoadedBuiltin **loaded;  // 名前の順
+static size_t loaded_count, loaded_cap;
+
+static int loaded_compare(const void *key, const void *elem) {
+    return strcmp((const char *)key, (*(LoadedBuiltin *const *)elem)->entry.name);
+}
+
+// 名前の入る位置 (見つかれば *found を1にする)
+static size_t loaded_position(const char *name, int *found) {
+    size_t lo = 0, hi = loaded_count;
+    *found = 0;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = strcmp(name, loaded[mid]->entry.name);
+        if (c == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (c < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief enable -f で読み込んだコマンドを探す
+ * @return 見つかったコマンド。なければNULL
+ */
+const Builtin* find_loaded_builtin(const char *name) {
+    if (loaded_count == 0) {
+        return NULL;
+    }
+    LoadedBuiltin **l = (LoadedBuiltin **)bsearch(name, loaded, loaded_count, sizeof(loaded[0]),
+                                                   loaded_compare);
+    return l != NULL ? &(*l)->entry : NULL;
+}
+
+void loaded_builtin_foreach(void (*fn)(const char *name)) {
+    for (size_t i = 0; i < loaded_count; i++) {
+        fn(loaded[i]->entry.name);
+    }
+}
+
+static const char* api_get_var(const char *name) {
+    return var_get(name);
+}
+
+static int api_set_var(const char *name, const char *value) {
+    return var_set(name, value);
+}
+
+static int api_unset_var(const char *name) {
+    return var_unset(name);
+}
+
+/**
+ * @brief 読み込んだコマンドを呼ぶ
+ *
+ * リダイレクトやパイプは呼び出し側で 0, 1, 2 に dup2 してあるので、それをそのまま渡す。
+ * ライブラリが stdio を使っても順序が崩れないよう、呼ぶ前と後に stdout を flush する。
+ */
+int loaded_builtin_call(const Builtin *builtin, char **argv) {
+    static const MyshellBuiltinApi api = {
+        MYSHELL_BUILTIN_ABI_VERSION, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO,
+        api_get_var, api_set_var, api_unset_var,
+    };
+    const LoadedBuiltin *l = (const LoadedBuiltin *)builtin;
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    int status = l->func(argc, argv, &api);
+    fflush(stdout);
+    fflush(stderr);
+    return status & 0xff;
+}
+
+static void loaded_free(LoadedBuiltin *l) {
+    dlclose(l->handle);
+    free((char *)l->entry.name);
+    free(l->path);
+    free(l);
+}
+
+// FILE から NAME を読み込んで登録する
+static int enable_load(const char *path, const char *name) {
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "enable: %s\n", dlerror());
+        return 1;
+    }
+    const int *abi = (const int *)dlsym(handle, "myshell_builtin_abi");
+    if (abi == NULL || *abi != MYSHELL_BUILTIN_ABI_VERSION) {
+        fprintf(stderr, "enable: %s: %s\n", path,
+                abi == NULL ? "not a myshell loadable builtin" : "incompatible builtin ABI version");
+        dlclose(handle);
+        return 1;
+    }
+    char symbol[256];
+    int n = snprintf(symbol, sizeof(symbol), "myshell_builtin_%s", name);
+    for (char *p = symbol + strlen("myshell_builtin_"); *p != '\0'; p++) {
+        if (!isalnum((unsigned char)*p)) {
+            *p = '_';
+        }
+    }
+    MyshellBuiltinFunc func = NULL;
+    if (n > 0 && (size_t)n < sizeof(symbol)) {
+        *(void **)&func = dlsym(handle, symbol);
+    }
+    if (func == NULL) {
+        fprintf(stderr, "enable: %s: cannot find %s in %s\n", name, symbol, path);
+        dlclose(handle);
+        return 1;
+    }
+    if (loaded_count == loaded_cap) {
+        size_t cap = loaded_cap ? loaded_cap * 2 : 8;
+        LoadedBuiltin **grown = (LoadedBuiltin **)realloc(loaded, cap * sizeof(*loaded));
+        if (grown == NULL) {
+            perror("enable");
+            dlclose(handle);
+            return 1;
+        }
+        loaded = grown;
+        loaded_cap = cap;
+    }
+    LoadedBuiltin *l = (LoadedBuiltin *)calloc(1, sizeof(LoadedBuiltin));
+    char *name_copy = strdup(name);
+    char *path_copy = strdup(path);
+    if (l == NULL || name_copy == NULL || path_copy == NULL) {
+        perror("enable");
+        free(l);
+        free(name_copy);
+        free(path_copy);
+        dlclose(handle);
+        return 1;
+    }
+    l->entry.name = name_copy;
+    l->entry.func = NULL;
+    l->func = func;
+    l->handle = handle;
+    l->path = path_copy;
+    int found;
+    size_t pos = loaded_position(name, &found);
+    if (found) {
+        loaded_free(loaded[pos]);
+        loaded[pos] = l;
+        return 0;
+    }
+    memmove(loaded + pos + 1, loaded + pos, (loaded_count - pos) * sizeof(*loaded));
+    loaded[pos] = l;
+    loaded_count++;
+    return 0;
+}
+
+static int enable_delete(const char *name) {
+    int found;
+    size_t pos = loaded_position(name, &found);
+    if (!found) {
+        fprintf(stderr, "enable: %s: not a dynamically loaded builtin\n", name);
+        return 1;
+    }
+    loaded_free(loaded[pos]);
+    memmove(loaded + pos, loaded + pos + 1, (loaded_count - pos - 1) * sizeof(*loaded));
+    loaded_count--;
+    return 0;
+}
+
+static void print_enabled(const char *name) {
+    if (find_loaded_builtin(name) == NULL) {
+        printf("enable %s\n", name);
+    }
+}
+
+int builtin_enable(char **argv) {
+    const char *path = NULL;
+    int delete = 0;
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-f") == 0 && argv[i + 1] != NULL) {
+            path = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            delete = 1;
+        } else {
+            fprintf(stderr, "enable: %s: invalid option\n", argv[i]);
+            fprintf(stderr, "usage: enable [-f FILE NAME...] [-d NAME...]\n");
+            return 2;
+        }
+    }
+    if (argv[i] == NULL) {
+        if (path != NULL || delete) {
+            fprintf(stderr, "usage: enable [-f FILE NAME...] [-d NAME...]\n");
+            return 2;
+        }
+        builtin_foreach(print_enabled);
+        for (size_t j = 0; j < loaded_count; j++) {
+            printf("enable -f %s %s\n", loaded[j]->path, loaded[j]->entry.name);
+        }
+        return 0;
+    }
+    int status = 0;
+    for (; argv[i] != NULL; i++) {
+        if (delete) {
+            status |= enable_delete(argv[i]);
+        } else if (path != NULL) {
+            status |= enable_load(path, argv[i]);
+        } else if (find_builtin(argv[i]) == NULL) {
+            fprintf(stderr, "enable: %s: not a shell builtin\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,24 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// exit [n] : シェルを終了する。引数がなければ直前の終了ステータスを使う
+int builtin_exit(char **argv) {
+    int status = last_exit_status;
+    if (argv[1] != NULL) {
+        char *end;
+        long value = strtol(argv[1], &end, 10);
+        if (*end != '\0') {
+            fprintf(stderr, "exit: %s: numeric argument required\n", argv[1]);
+            status = 2;
+        } else {
+            status = (int)(value & 0xff);
+        }
+    }
+    if (getpid() != shell_pid) {
+        // パイプラインの段やサブシェルの中: 親の atexit 処理 (履歴の書き出しなど) は走らせない
+        fflush(NULL);
+        _exit(status);
+    }
+    last_exit_status = status; // セッションの記録などが終了ステータスを参照する
+    exit(status); // atexit で履歴の書き出しなどが行われる
+}
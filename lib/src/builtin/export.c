@@ -0,0 +1,31 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+extern char **environ;
+
+// export [NAME[=VALUE]...] : 変数を環境変数にする。引数がなければ一覧を出力する
+int builtin_export(char **argv) {
+    if (argv[1] == NULL) {
+        for (char **env = environ; *env != NULL; env++) {
+            printf("export %s\n", *env);
+        }
+        fflush(stdout);
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; argv[i] != NULL; i++) {
+        char *eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!var_is_name(argv[i], len)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        char *name = strndup(argv[i], len);
+        if (name == NULL || var_export(name, eq ? eq + 1 : NULL) != 0) {
+            status = 1;
+        }
+        free(name);
+    }
+    return status;
+}
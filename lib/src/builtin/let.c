@@ -0,0 +1,23 @@
+#define STATS_SUBSYSTEM STATS_EXPAND
+#include <shell.h>
+
+/*
+ * let EXPR...
+ *
+ * 引数を1つずつ算術式として評価する (arith.c)。
+ * 最後の式の値が0なら1、0以外なら0を返す。式の誤りは1。
+ */
+
+int builtin_let(char **argv) {
+    if (argv[1] == NULL) {
+        fprintf(stderr, "let: expression expected\n");
+        return 1;
+    }
+    int64_t value = 0;
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (arith_eval(argv[i], strlen(argv[i]), &value) != 0) {
+            return 1;
+        }
+    }
+    return value != 0 ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// local [-a|-A] NAME[=VALUE]... : 関数の中だけで有効な変数 (-a/-A なら配列) を作る
+int builtin_local(char **argv) {
+    if (!interp_in_function()) {
+        fprintf(stderr, "local: can only be used in a function\n");
+        return 1;
+    }
+    int kind = 0;
+    int i = 1;
+    for (; argv[i] != NULL && (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "-A") == 0); i++) {
+        kind = argv[i][1];
+    }
+    int status = 0;
+    for (; argv[i] != NULL; i++) {
+        char *eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!var_is_name(argv[i], len)) {
+            fprintf(stderr, "local: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        if (var_declare(argv[i], kind, 1) != 0) {
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,456 @@
+#define _GNU_SOURCE /* memfd_create */
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+/*
+ * memo [-c] [-s] [-i FILE]... [-e VAR]... [--] COMMAND [ARGS...]
+ * memo --clear
+ *
+ * 決まった入力に対して決まった出力を返すコマンドの標準出力・標準エラー出力・終了ステータスを
+ * キャッシュする。キーは argv、カレントディレクトリ、-e で指定した環境変数、
+ * -i で指定した入力ファイルと標準入力 (< のリダイレクト先) の状態から作る。
+ * 入力ファイルは既定では mtime・大きさ・inode で、-c を付けると内容のハッシュで比較する。
+ * 標準入力がパイプなどファイル以外のときは、-s を付けたときだけ最後まで読んで内容をキーに
+ * 含める。付けなければ memo は標準入力を読まず、コマンドには /dev/null をつなぐ
+ * (キーに含まれない入力で結果が変わらないように、また後のコマンドの入力を奪わないように)。
+ * 結果はキーのハッシュを名前にしたディレクトリに保存し、合計が上限を超えたら
+ * 最後に使われたのが古いものから削除する。
+ */
+
+#define MEMO_DEFAULT_MAX (256L * 1024 * 1024) /* キャッシュの既定の上限 (バイト) */
+#define MEMO_MAX_ARGS 64                      /* -i / -e の最大数 */
+
+typedef unsigned __int128 MemoHash;
+
+// FNV-1a (128bit)
+static void memo_hash_bytes(MemoHash *h, const void *data, size_t len) {
+    const MemoHash prime = ((MemoHash)0x0000000001000000ULL << 64) | 0x000000000000013BULL;
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        *h ^= p[i];
+        *h *= prime;
+    }
+}
+
+// 長さを前置して混ぜる ("ab","c" と "a","bc" を区別するため)
+static void memo_hash_field(MemoHash *h, const void *data, size_t len) {
+    uint64_t n = len;
+    memo_hash_bytes(h, &n, sizeof(n));
+    memo_hash_bytes(h, data, len);
+}
+
+static void memo_hash_string(MemoHash *h, const char *s) {
+    memo_hash_field(h, s, strlen(s));
+}
+
+static int memo_hash_fd_content(MemoHash *h, int fd) {
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        memo_hash_bytes(h, buf, (size_t)n);
+    }
+    return n < 0 ? -1 : 0;
+}
+
+// ファイルの状態 (または内容) をキーに混ぜる
+static int memo_hash_file(MemoHash *h, int fd, const struct stat *st, int by_content) {
+    if (by_content) {
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        int r = memo_hash_fd_content(h, fd);
+        if (pos >= 0) {
+            lseek(fd, pos, SEEK_SET);
+        }
+        return r;
+    }
+    uint64_t meta[5] = {
+        (uint64_t)st->st_dev, (uint64_t)st->st_ino, (uint64_t)st->st_size,
+        (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec,
+    };
+    memo_hash_bytes(h, meta, sizeof(meta));
+    return 0;
+}
+
+static int memo_cache_dir(char *out, size_t size) {
+    const char *dir = getenv("MYSHELL_MEMO_DIR");
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+    if (dir != NULL && dir[0] != '\0') {
+        n = snprintf(out, size, "%s", dir);
+    } else if (xdg != NULL && xdg[0] != '\0') {
+        n = snprintf(out, size, "%s/myshell/memo", xdg);
+    } else if (home != NULL) {
+        n = snprintf(out, size, "%s/.cache/myshell/memo", home);
+    } else {
+        return -1;
+    }
+    if (n < 0 || (size_t)n >= size) {
+        return -1;
+    }
+    // 途中のディレクトリも作る (mkdir -p)
+    for (char *p = out + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(out, 0700);
+            *p = '/';
+        }
+    }
+    if (mkdir(out, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+static long memo_size_limit(void) {
+    const char *s = getenv("MYSHELL_MEMO_MAX");
+    if (s == NULL || s[0] == '\0') {
+        return MEMO_DEFAULT_MAX;
+    }
+    char *end;
+    long value = strtol(s, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': value *= 1024L; break;
+        case 'M': case 'm': value *= 1024L * 1024; break;
+        case 'G': case 'g': value *= 1024L * 1024 * 1024; break;
+        default: break;
+    }
+    return value > 0 ? value : MEMO_DEFAULT_MAX;
+}
+
+// dir/name を組み立てる。長すぎる場合は-1
+static int memo_path(char *out, size_t size, const char *dir, const char *name) {
+    int n = snprintf(out, size, "%s/%s", dir, name);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+static int copy_file_to_fd(const char *path, int out_fd) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    off_t remaining = st.st_size;
+    while (remaining > 0) {
+        ssize_t n = sendfile(out_fd, fd, NULL, (size_t)remaining);
+        if (n <= 0) {
+            // sendfileが使えない出力先 (一部のtty等) は read/write で送る
+            char buf[65536];
+            while ((n = read(fd, buf, sizeof(buf))) > 0) {
+                if (write(out_fd, buf, (size_t)n) != n) {
+                    break;
+                }
+            }
+            break;
+        }
+        remaining -= n;
+    }
+    close(fd);
+    return 0;
+}
+
+static void remove_entry(const char *dir) {
+    static const char *files[] = {"stdout", "stderr", "status"};
+    char path[MAX_PATH];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        memo_path(path, sizeof(path), dir, files[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+typedef struct MemoEntry {
+    char name[64];
+    struct timespec used;
+    off_t size;
+} MemoEntry;
+
+static int compare_entry_age(const void *a, const void *b) {
+    const MemoEntry *x = (const MemoEntry *)a;
+    const MemoEntry *y = (const MemoEntry *)b;
+    if (x->used.tv_sec != y->used.tv_sec) {
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    }
+    return x->used.tv_nsec < y->used.tv_nsec ? -1 : (x->used.tv_nsec > y->used.tv_nsec);
+}
+
+/**
+ * @brief キャッシュの合計が上限を超えていれば、最後に使われたのが古い順に削除する
+ *
+ * 使われた時刻はエントリのディレクトリの mtime で表す (ヒットするたびに更新する)。
+ * limit が0ならすべて削除する。
+ */
+static void memo_evict(const char *cache_dir, long limit) {
+    DIR *dir = opendir(cache_dir);
+    if (dir == NULL) {
+        return;
+    }
+    MemoEntry *list = NULL;
+    size_t count = 0, cap = 0;
+    long total = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.' || strlen(ent->d_name) >= sizeof(list[0].name)) {
+            continue;
+        }
+        char path[MAX_PATH];
+        struct stat st, fst;
+        char file[MAX_PATH];
+        if (memo_path(path, sizeof(path), cache_dir, ent->d_name) != 0 ||
+            stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        off_t size = 0;
+        if (memo_path(file, sizeof(file), path, "stdout") == 0 && stat(file, &fst) == 0) {
+            size += fst.st_size;
+        }
+        if (memo_path(file, sizeof(file), path, "stderr") == 0 && stat(file, &fst) == 0) {
+            size += fst.st_size;
+        }
+        if (count == cap) {
+            size_t new_cap = cap ? cap * 2 : 64;
+            MemoEntry *tmp = (MemoEntry *)realloc(list, new_cap * sizeof(MemoEntry));
+            if (tmp == NULL) {
+                break;
+            }
+            list = tmp;
+            cap = new_cap;
+        }
+        memcpy(list[count].name, ent->d_name, strlen(ent->d_name) + 1);
+        list[count].used = st.st_mtim;
+        list[count].size = size;
+        total += size;
+        count++;
+    }
+    closedir(dir);
+    if (total > limit || limit == 0) {
+        qsort(list, count, sizeof(MemoEntry), compare_entry_age);
+        for (size_t i = 0; i < count && (total > limit || limit == 0); i++) {
+            char path[MAX_PATH];
+            memo_path(path, sizeof(path), cache_dir, list[i].name);
+            remove_entry(path);
+            total -= list[i].size;
+        }
+    }
+    free(list);
+}
+
+// 保存済みの結果を出力し、終了ステータスを返す。見つからなければ-1
+static int memo_replay(const char *entry_dir) {
+    char path[MAX_PATH];
+    if (memo_path(path, sizeof(path), entry_dir, "status") != 0) {
+        return -1;
+    }
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    int status;
+    int ok = fscanf(fp, "%d", &status) == 1;
+    fclose(fp);
+    if (!ok) {
+        return -1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    memo_path(path, sizeof(path), entry_dir, "stdout");
+    copy_file_to_fd(path, STDOUT_FILENO);
+    memo_path(path, sizeof(path), entry_dir, "stderr");
+    copy_file_to_fd(path, STDERR_FILENO);
+    utimensat(AT_FDCWD, entry_dir, NULL, 0); // 最後に使われた時刻を更新する (LRU)
+    return status;
+}
+
+/**
+ * @brief コマンドを実行し、結果を一時ディレクトリに書いてから entry_dir に移す
+ * @return コマンドの終了ステータス
+ */
+static int memo_run_and_store(char **argv, int stdin_fd, const char *cache_dir, const char *entry_dir) {
+    static unsigned int counter = 0;
+    char tmp_dir[MAX_PATH], out_path[MAX_PATH], err_path[MAX_PATH], path[MAX_PATH];
+    char tmp_name[64];
+    snprintf(tmp_name, sizeof(tmp_name), ".tmp.%d.%u", (int)getpid(), counter++);
+    if (memo_path(tmp_dir, sizeof(tmp_dir), cache_dir, tmp_name) != 0 ||
+        memo_path(out_path, sizeof(out_path), tmp_dir, "stdout") != 0 ||
+        memo_path(err_path, sizeof(err_path), tmp_dir, "stderr") != 0 ||
+        memo_path(path, sizeof(path), tmp_dir, "status") != 0) {
+        fprintf(stderr, "memo: cache path too long\n");
+        return 1;
+    }
+    if (mkdir(tmp_dir, 0700) != 0) {
+        perror("memo: mkdir");
+        return 1;
+    }
+    int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    int err_fd = open(err_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out_fd < 0 || err_fd < 0) {
+        perror("memo: open");
+        if (out_fd >= 0) {
+            close(out_fd);
+        }
+        if (err_fd >= 0) {
+            close(err_fd);
+        }
+        remove_entry(tmp_dir);
+        return 1;
+    }
+
+    fflush(stdout);
+    pid_t pid = spawn_argv(argv, stdin_fd, out_fd, err_fd);
+    close(out_fd);
+    close(err_fd);
+    if (pid < 0) {
+        remove_entry(tmp_dir);
+        return 1;
+    }
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {
+    }
+    int status = status_to_exit_code(wstatus);
+
+    // 見つからない・実行できない・シグナルで終了した場合は結果を残さない
+    if (status >= 126) {
+        copy_file_to_fd(out_path, STDOUT_FILENO);
+        copy_file_to_fd(err_path, STDERR_FILENO);
+        remove_entry(tmp_dir);
+        return status;
+    }
+    FILE *fp = fopen(path, "w");
+    if (fp != NULL) {
+        fprintf(fp, "%d\n", status);
+        fclose(fp);
+    }
+    if (rename(tmp_dir, entry_dir) != 0) {
+        remove_entry(tmp_dir); // 他のセッションが先に保存した
+    }
+    if (memo_replay(entry_dir) < 0) {
+        return status;
+    }
+    memo_evict(cache_dir, memo_size_limit());
+    return status;
+}
+
+static void memo_usage(void) {
+    fprintf(stderr, "usage: memo [-c] [-s] [-i FILE]... [-e VAR]... [--] COMMAND [ARGS...]\n"
+                    "       memo --clear\n");
+}
+
+int builtin_memo(char **argv) {
+    const char *inputs[MEMO_MAX_ARGS];
+    const char *envs[MEMO_MAX_ARGS];
+    int ninputs = 0, nenvs = 0, by_content = 0, read_stdin = 0;
+    int i = 1;
+    char cache_dir[MAX_PATH];
+
+    if (memo_cache_dir(cache_dir, sizeof(cache_dir)) != 0) {
+        fprintf(stderr, "memo: cannot create cache directory\n");
+        return 1;
+    }
+    if (argv[1] != NULL && strcmp(argv[1], "--clear") == 0) {
+        memo_evict(cache_dir, 0);
+        return 0;
+    }
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            by_content = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            read_stdin = 1;
+        } else if ((strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-e") == 0) && argv[i + 1] != NULL) {
+            int is_input = argv[i][1] == 'i';
+            if ((is_input ? ninputs : nenvs) >= MEMO_MAX_ARGS) {
+                fprintf(stderr, "memo: too many %s options\n", argv[i]);
+                return 2;
+            }
+            if (is_input) {
+                inputs[ninputs++] = argv[++i];
+            } else {
+                envs[nenvs++] = argv[++i];
+            }
+        } else {
+            memo_usage();
+            return 2;
+        }
+    }
+    if (argv[i] == NULL) {
+        memo_usage();
+        return 2;
+    }
+
+    MemoHash h = ((MemoHash)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL;
+    memo_hash_string(&h, "memo-v1");
+    for (int j = i; argv[j] != NULL; j++) {
+        memo_hash_string(&h, argv[j]);
+    }
+    char cwd[MAX_PATH];
+    memo_hash_string(&h, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    for (int j = 0; j < nenvs; j++) {
+        const char *value = getenv(envs[j]);
+        memo_hash_string(&h, envs[j]);
+        memo_hash_string(&h, value ? value : "\x01unset");
+    }
+    for (int j = 0; j < ninputs; j++) {
+        int fd = open(inputs[j], O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        memo_hash_string(&h, inputs[j]);
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            memo_hash_string(&h, "\x01missing");
+        } else {
+            memo_hash_file(&h, fd, &st, by_content);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // 標準入力: ファイルならその状態を、-s ならパイプの内容を読み切ってキーに含める
+    int stdin_fd = -1;
+    struct stat in_st;
+    int have_stdin = fstat(STDIN_FILENO, &in_st) == 0;
+    if (have_stdin && S_ISREG(in_st.st_mode)) {
+        memo_hash_string(&h, "stdin-file");
+        memo_hash_file(&h, STDIN_FILENO, &in_st, by_content);
+    } else if (!read_stdin || !have_stdin || !(S_ISFIFO(in_st.st_mode) || S_ISSOCK(in_st.st_mode))) {
+        stdin_fd = open("/dev/null", O_RDONLY | O_CLOEXEC); // キーに含めない入力は渡さない
+    } else {
+        stdin_fd = memfd_create("myshell-memo-stdin", MFD_CLOEXEC);
+        char buf[65536];
+        ssize_t n;
+        memo_hash_string(&h, "stdin-pipe");
+        while (stdin_fd >= 0 && (n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+            memo_hash_bytes(&h, buf, (size_t)n);
+            if (write(stdin_fd, buf, (size_t)n) != n) {
+                break;
+            }
+        }
+        if (stdin_fd >= 0) {
+            lseek(stdin_fd, 0, SEEK_SET);
+        }
+    }
+
+    char key[33], entry_dir[MAX_PATH];
+    snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)(h >> 64), (unsigned long long)h);
+    if (memo_path(entry_dir, sizeof(entry_dir), cache_dir, key) != 0) {
+        fprintf(stderr, "memo: cache path too long\n");
+        if (stdin_fd >= 0) {
+            close(stdin_fd);
+        }
+        return 1;
+    }
+    int status = memo_replay(entry_dir);
+    if (status < 0) {
+        status = memo_run_and_store(&argv[i], stdin_fd, cache_dir, entry_dir);
+    }
+    if (stdin_fd >= 0) {
+        close(stdin_fd);
+    }
+    return status;
+}
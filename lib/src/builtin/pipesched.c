@@ -0,0 +1,40 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+/*
+ * pipesched [-c CPUS|auto] [-n NICE] [-i IOPRIO]
+ * pipesched -r
+ * pipesched
+ *
+ * これから起動するパイプラインの段ごとに、使う CPU・nice・I/O の優先度を設定する。
+ * 値は段ごとに ':' で区切る (例: -c 0:1:2-3 -n :10)。IOPRIO は idle, be/N, rt/N。
+ * -r で全て解除する。引数がなければ今の設定と、前回のパイプラインの各段の
+ * pid と適用した設定を出力する (子が適用できなかった設定には (failed) を付ける)。
+ * オンラインでない CPU は設定のときに断る。
+ */
+int builtin_pipesched(char **argv) {
+    const char *specs[3] = {NULL, NULL, NULL};
+    static const char *const flags[3] = {"-c", "-n", "-i"};
+    int i = 1;
+    for (; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            specs[0] = specs[1] = specs[2] = "";
+            continue;
+        }
+        int k = 0;
+        while (k < 3 && strcmp(argv[i], flags[k]) != 0) {
+            k++;
+        }
+        if (k == 3 || argv[i + 1] == NULL) {
+            fprintf(stderr, "usage: pipesched [-c CPUS|auto] [-n NICE] [-i IOPRIO] | -r\n");
+            return 2;
+        }
+        specs[k] = argv[++i];
+    }
+    if (i == 1) {
+        stage_sched_print(stdout);
+        fflush(stdout);
+        return 0;
+    }
+    return stage_sched_configure(specs[0], specs[1], specs[2]) == 0 ? 0 : 1;
+}
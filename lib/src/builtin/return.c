@@ -0,0 +1,23 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// return [n] : 関数から戻る。引数がなければ直前の終了ステータスを使う
+int builtin_return(char **argv) {
+    if (!interp_in_function()) {
+        fprintf(stderr, "return: can only `return' from a function or sourced script\n");
+        return 1;
+    }
+    int status = last_exit_status;
+    if (argv[1] != NULL) {
+        char *end;
+        long value = strtol(argv[1], &end, 10);
+        if (argv[1][0] == '\0' || *end != '\0') {
+            fprintf(stderr, "return: %s: numeric argument required\n", argv[1]);
+            status = 2;
+        } else {
+            status = (int)(value & 0xff);
+        }
+    }
+    interp_return(status);
+    return status;
+}
@@ -0,0 +1,15 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// shellstats : 分類ごとのメモリの確保の回数・バイト数・最大値と、先読みの効果を出力する
+int builtin_shellstats(char **argv) {
+    (void)argv;
+#ifdef MYSHELL_STATS
+    stats_report(stdout);
+#else
+    fprintf(stderr, "shellstats: allocation stats not available (build with `make stats')\n");
+#endif
+    prefetch_print_stats(stdout); // 先読みの回数はどのビルドでも数えている
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// shift [n] : 位置パラメータを n 個 (既定は1) ずらす
+int builtin_shift(char **argv) {
+    int n = 1;
+    if (argv[1] != NULL) {
+        char *end;
+        long value = strtol(argv[1], &end, 10);
+        if (argv[1][0] == '\0' || *end != '\0' || value < 0 || value > INT_MAX) {
+            fprintf(stderr, "shift: %s: numeric argument required\n", argv[1]);
+            return 1;
+        }
+        n = (int)value;
+    }
+    return var_shift(n) == 0 ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// '/' を含まない名前は $PATH から探し、なければカレントディレクトリのものを使う
+static void source_path(const char *name, char *out, size_t size) {
+    const char *path_env = var_get("PATH");
+    snprintf(out, size, "%s", name);
+    if (strchr(name, '/') != NULL || path_env == NULL) {
+        return;
+    }
+    for (const char *p = path_env;; p++) {
+        const char *colon = strchr(p, ':');
+        size_t len = colon ? (size_t)(colon - p) : strlen(p);
+        char candidate[MAX_PATH];
+        struct stat st;
+        int n = snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, len ? p : ".", name);
+        if (n > 0 && (size_t)n < sizeof(candidate) && stat(candidate, &st) == 0 &&
+            S_ISREG(st.st_mode) && access(candidate, R_OK) == 0) {
+            snprintf(out, size, "%s", candidate);
+            return;
+        }
+        if (colon == NULL) {
+            return;
+        }
+        p = colon;
+    }
+}
+
+// source FILE / . FILE : FILE を今のシェルで実行する
+int builtin_source(char **argv) {
+    if (argv[1] == NULL || argv[2] != NULL) {
+        fprintf(stderr, "usage: %s FILE\n", argv[0]);
+        return 2;
+    }
+    char path[MAX_PATH];
+    source_path(argv[1], path, sizeof(path));
+    if (rc_snapshot_tracing) {
+        rc_snapshot_note_file(path); // 変わったら設定ファイルのスナップショットを使わない
+    }
+    return run_script(path);
+}
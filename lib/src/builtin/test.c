@@ -0,0 +1,225 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+/*
+ * test EXPR / [ EXPR ]
+ *
+ *   expr := or
+ *   or   := and { -o and }
+ *   and  := not { -a not }
+ *   not  := ! not | primary
+ *   primary := ( expr ) | UNARY ARG | ARG BINARY ARG | ARG
+ *
+ * 戻り値は真なら0、偽なら1、式が正しくなければ2。
+ */
+
+typedef struct TestState {
+    char **argv;
+    int pos, argc;
+    int error;
+} TestState;
+
+static const char* test_peek(TestState *ts, int offset) {
+    int i = ts->pos + offset;
+    return i < ts->argc ? ts->argv[i] : NULL;
+}
+
+static int test_error(TestState *ts, const char *message, const char *arg) {
+    if (!ts->error) {
+        if (arg != NULL) {
+            fprintf(stderr, "test: %s: %s\n", arg, message);
+        } else {
+            fprintf(stderr, "test: %s\n", message);
+        }
+    }
+    ts->error = 1;
+    return 0;
+}
+
+static int parse_integer(TestState *ts, const char *s, long long *out) {
+    char *end;
+    errno = 0;
+    *out = strtoll(s, &end, 10);
+    while (isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (s[0] == '\0' || *end != '\0' || errno != 0) {
+        return test_error(ts, "integer expression expected", s);
+    }
+    return 1;
+}
+
+static int is_unary(const char *op) {
+    return op != NULL && op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+           strchr("bcdefghknprsStuwxzL", op[1]) != NULL;
+}
+
+static int is_binary(const char *op) {
+    static const char *const ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                                      "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+    for (int i = 0; op != NULL && ops[i] != NULL; i++) {
+        if (strcmp(op, ops[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_unary(char op, const char *arg) {
+    struct stat st;
+    if (rc_snapshot_tracing && strchr("nzt", op) == NULL) {
+        rc_snapshot_note_probe(arg); // 結果が変わったら設定ファイルのスナップショットを使わない
+    }
+    switch (op) {
+        case 'n': return arg[0] != '\0';
+        case 'z': return arg[0] == '\0';
+        case 't': return isatty(atoi(arg));
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+        default: break;
+    }
+    if (stat(arg, &st) != 0) {
+        return 0;
+    }
+    switch (op) {
+        case 'e': return 1;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'k': return (st.st_mode & S_ISVTX) != 0;
+        default: return 0;
+    }
+}
+
+static int test_binary(TestState *ts, const char *left, const char *op, const char *right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(left, right) == 0;
+    }
+    if (strcmp(op, "!=") == 0) {
+        return strcmp(left, right) != 0;
+    }
+    if (strcmp(op, "<") == 0) {
+        return strcmp(left, right) < 0;
+    }
+    if (strcmp(op, ">") == 0) {
+        return strcmp(left, right) > 0;
+    }
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        if (rc_snapshot_tracing) {
+            rc_snapshot_note_file(left);
+            rc_snapshot_note_file(right);
+        }
+        struct stat a, b;
+        int ha = stat(left, &a) == 0, hb = stat(right, &b) == 0;
+        if (op[1] == 'e') {
+            return ha && hb && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+        }
+        if (op[1] == 'n') {
+            return ha && (!hb || a.st_mtime > b.st_mtime);
+        }
+        return hb && (!ha || a.st_mtime < b.st_mtime);
+    }
+    long long l, r;
+    if (!parse_integer(ts, left, &l) || !parse_integer(ts, right, &r)) {
+        return 0;
+    }
+    if (strcmp(op, "-eq") == 0) return l == r;
+    if (strcmp(op, "-ne") == 0) return l != r;
+    if (strcmp(op, "-lt") == 0) return l < r;
+    if (strcmp(op, "-le") == 0) return l <= r;
+    if (strcmp(op, "-gt") == 0) return l > r;
+    return l >= r;
+}
+
+static int test_or(TestState *ts);
+
+static int test_primary(TestState *ts) {
+    const char *a = test_peek(ts, 0);
+    if (a == NULL) {
+        return test_error(ts, "argument expected", NULL);
+    }
+    // 3引数の二項演算を先に見る ("-n = x" のような曖昧な形のため)
+    if (is_binary(test_peek(ts, 1)) && test_peek(ts, 2) != NULL) {
+        const char *op = test_peek(ts, 1), *b = test_peek(ts, 2);
+        ts->pos += 3;
+        return test_binary(ts, a, op, b);
+    }
+    if (strcmp(a, "(") == 0) {
+        ts->pos++;
+        int value = test_or(ts);
+        const char *close = test_peek(ts, 0);
+        if (close == NULL || strcmp(close, ")") != 0) {
+            return test_error(ts, "`)' expected", NULL);
+        }
+        ts->pos++;
+        return value;
+    }
+    if (is_unary(a) && test_peek(ts, 1) != NULL) {
+        ts->pos += 2;
+        return test_unary(a[1], test_peek(ts, -1));
+    }
+    ts->pos++;
+    return a[0] != '\0';
+}
+
+static int test_not(TestState *ts) {
+    const char *a = test_peek(ts, 0);
+    if (a != NULL && strcmp(a, "!") == 0 && test_peek(ts, 1) != NULL) {
+        ts->pos++;
+        return !test_not(ts);
+    }
+    return test_primary(ts);
+}
+
+static int test_and(TestState *ts) {
+    int value = test_not(ts);
+    while (!ts->error && test_peek(ts, 0) != NULL && strcmp(test_peek(ts, 0), "-a") == 0) {
+        ts->pos++;
+        int rhs = test_not(ts);
+        value = value && rhs;
+    }
+    return value;
+}
+
+static int test_or(TestState *ts) {
+    int value = test_and(ts);
+    while (!ts->error && test_peek(ts, 0) != NULL && strcmp(test_peek(ts, 0), "-o") == 0) {
+        ts->pos++;
+        int rhs = test_and(ts);
+        value = value || rhs;
+    }
+    return value;
+}
+
+// test EXPR / [ EXPR ] : 条件式を評価する
+int builtin_test(char **argv) {
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    if (strcmp(argv[0], "[") == 0) {
+        if (argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        argc--;
+    }
+    TestState ts = {argv, 1, argc, 0};
+    if (argc == 1) {
+        return 1; // 引数がなければ偽
+    }
+    int value = test_or(&ts);
+    if (!ts.error && ts.pos < ts.argc) {
+        test_error(&ts, "too many arguments", NULL);
+    }
+    return ts.error ? 2 : !value;
+}
@@ -0,0 +1,14 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// true / : : 何もせずに成功する
+int builtin_true(char **argv) {
+    (void)argv;
+    return 0;
+}
+
+// false : 何もせずに失敗する
+int builtin_false(char **argv) {
+    (void)argv;
+    return 1;
+}
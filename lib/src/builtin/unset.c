@@ -0,0 +1,47 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+// NAME[SUB] の形か (unset 'a[i]' は配列の要素を削除する)
+static int is_element(const char *arg) {
+    const char *bracket = strchr(arg, '[');
+    size_t len = strlen(arg);
+    return bracket != NULL && var_is_name(arg, (size_t)(bracket - arg)) && len > 0 && arg[len - 1] == ']';
+}
+
+// unset [-v|-f] NAME... : 変数 (-f なら関数) を削除する
+int builtin_unset(char **argv) {
+    int functions = 0;
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            functions = 1;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            functions = 0;
+        } else if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            fprintf(stderr, "unset: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    int status = 0;
+    for (; argv[i] != NULL; i++) {
+        if (functions) {
+            unset_function(argv[i]);
+        } else if (is_element(argv[i])) {
+            const char *bracket = strchr(argv[i], '[');
+            char *name = strndup(argv[i], (size_t)(bracket - argv[i]));
+            if (name == NULL || var_unset_element(name, bracket + 1, strlen(bracket) - 2) != 0) {
+                status = 1;
+            }
+            free(name);
+        } else if (!var_is_name(argv[i], strlen(argv[i]))) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+        } else {
+            var_unset(argv[i]);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,420 @@
+#define STATS_SUBSYSTEM STATS_PARSE
+#include <shell.h>
+#include <sys/mman.h>
+
+/*
+ * スクリプトのコンパイル結果 (平坦化した構文木)
+ *
+ * 構文木のノードを配列に並べ、子や次の文はインデックスで、単語やリダイレクト先は
+ * 文字列表のオフセットで指す。ポインタを含まないので、そのままファイルに書き出し、
+ * 次回は mmap するだけで実行できる。
+ *
+ * ファイルの形式:
+ *   ProgramHeader | Node[node_count] | uint32_t words[word_count] | char strings[string_size]
+ */
+
+#define BYTECODE_MAGIC "MYSHBC\0\0"
+#define BYTECODE_FORMAT 2   /* Node の形式を変えたら上げる */
+
+typedef struct ProgramHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t root;
+    char shell_version[16];
+    uint64_t source_hash;   // ソースの内容のハッシュ
+    uint64_t source_size;
+    uint32_t node_count;
+    uint32_t word_count;
+    uint32_t string_size;
+    uint32_t reserved;
+} ProgramHeader;
+
+struct ProgramBuilder {
+    Node *nodes;
+    uint32_t node_count, node_cap;
+    uint32_t *words;
+    uint32_t word_count, word_cap;
+    char *strings;
+    uint32_t string_size, string_cap;
+    uint32_t *intern;           // 同じ文字列を1つにまとめるためのハッシュ表 (オフセット+1、0は空き)
+    uint32_t intern_cap, intern_count;
+};
+
+static uint32_t string_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 既に追加した文字列なら、そのオフセットを入れたスロットを返す
+static uint32_t* intern_slot(ProgramBuilder *b, const char *s, size_t len) {
+    uint32_t mask = b->intern_cap - 1;
+    for (uint32_t i = string_hash(s, len) & mask;; i = (i + 1) & mask) {
+        uint32_t *slot = &b->intern[i];
+        if (*slot == 0 || memcmp(b->strings + *slot - 1, s, len + 1) == 0) {
+            return slot;
+        }
+    }
+}
+
+static int intern_grow(ProgramBuilder *b) {
+    uint32_t new_cap = b->intern_cap ? b->intern_cap * 2 : 256;
+    uint32_t *old = b->intern;
+    uint32_t old_cap = b->intern_cap;
+    b->intern = (uint32_t *)calloc(new_cap, sizeof(uint32_t));
+    if (b->intern == NULL) {
+        b->intern = old;
+        return -1;
+    }
+    b->intern_cap = new_cap;
+    for (uint32_t i = 0; i < old_cap; i++) {
+        if (old[i] != 0) {
+            const char *str = b->strings + old[i] - 1;
+            *intern_slot(b, str, strlen(str)) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static int grow(void **buf, uint32_t *cap, uint32_t need, size_t elem) {
+    if (need <= *cap) {
+        return 0;
+    }
+    uint32_t new_cap = *cap ? *cap : 64;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    void *tmp = realloc(*buf, (size_t)new_cap * elem);
+    if (tmp == NULL) {
+        perror("Failed to grow program buffer");
+        return -1;
+    }
+    *buf = tmp;
+    *cap = new_cap;
+    return 0;
+}
+
+ProgramBuilder* program_builder_new(void) {
+    ProgramBuilder *b = (ProgramBuilder *)calloc(1, sizeof(ProgramBuilder));
+    if (b == NULL) {
+        perror("Failed to allocate program builder");
+        return NULL;
+    }
+    program_add_node(b, N_NONE); // インデックス0は「なし」
+    return b;
+}
+
+void program_builder_free(ProgramBuilder *b) {
+    if (b == NULL) {
+        return;
+    }
+    free(b->nodes);
+    free(b->words);
+    free(b->strings);
+    free(b->intern);
+    free(b);
+}
+
+/**
+ * @brief ノードを1つ追加する
+ * @return 追加したノードのインデックス。失敗時は0
+ */
+uint32_t program_add_node(ProgramBuilder *b, NodeType type) {
+    if (grow((void **)&b->nodes, &b->node_cap, b->node_count + 1, sizeof(Node)) != 0) {
+        return 0;
+    }
+    Node *node = &b->nodes[b->node_count];
+    memset(node, 0, sizeof(*node));
+    node->type = (uint16_t)type;
+    for (int i = 0; i < NODE_STRS; i++) {
+        node->str[i] = NO_STRING;
+    }
+    return b->node_count++;
+}
+
+// 次に program_add_node を呼ぶまで有効なポインタを返す
+Node* program_node(ProgramBuilder *b, uint32_t index) {
+    return &b->nodes[index];
+}
+
+/**
+ * @brief 文字列表に文字列を追加する (同じ文字列は共有する)
+ * @return 文字列表のオフセット。s が NULL または失敗時は NO_STRING
+ */
+uint32_t program_add_string(ProgramBuilder *b, const char *s) {
+    if (s == NULL) {
+        return NO_STRING;
+    }
+    if ((b->intern_count + 1) * 2 > b->intern_cap && intern_grow(b) != 0) {
+        return NO_STRING;
+    }
+    size_t len = strlen(s);
+    uint32_t *slot = intern_slot(b, s, len);
+    if (*slot != 0) {
+        return *slot - 1;
+    }
+    if (len + 1 >= UINT32_MAX - b->string_size ||
+        grow((void **)&b->strings, &b->string_cap, b->string_size + (uint32_t)len + 1, 1) != 0) {
+        return NO_STRING;
+    }
+    uint32_t offset = b->string_size;
+    memcpy(b->strings + offset, s, len + 1);
+    b->string_size += (uint32_t)len + 1;
+    *slot = offset + 1;
+    b->intern_count++;
+    return offset;
+}
+
+/**
+ * @brief NULL終端の単語の並びを追加する
+ * @param count 追加した単語の数を返す
+ * @return 先頭の単語のインデックス
+ */
+uint32_t program_add_words(ProgramBuilder *b, char *const *argv, uint32_t *count) {
+    uint32_t first = b->word_count;
+    *count = 0;
+    for (; argv != NULL && argv[*count] != NULL; (*count)++) {
+        if (grow((void **)&b->words, &b->word_cap, b->word_count + 1, sizeof(uint32_t)) != 0) {
+            break;
+        }
+        b->words[b->word_count++] = program_add_string(b, argv[*count]);
+    }
+    return first;
+}
+
+// ヘッダの後ろの各領域を base から指すように設定する
+static void program_bind(Program *prog, const ProgramHeader *hdr) {
+    const char *p = (const char *)(hdr + 1);
+    prog->node_count = hdr->node_count;
+    prog->word_count = hdr->word_count;
+    prog->string_size = hdr->string_size;
+    prog->root = hdr->root;
+    prog->nodes = (const Node *)p;
+    p += (size_t)hdr->node_count * sizeof(Node);
+    prog->words = (const uint32_t *)p;
+    p += (size_t)hdr->word_count * sizeof(uint32_t);
+    prog->strings = p;
+}
+
+/**
+ * @brief 構築したノードを1つのバッファにまとめて Program にする。b は解放される
+ */
+Program* program_builder_finish(ProgramBuilder *b, uint32_t root, uint64_t source_hash, uint64_t source_size) {
+    Program *prog = (Program *)calloc(1, sizeof(Program));
+    size_t size = sizeof(ProgramHeader) + (size_t)b->node_count * sizeof(Node) +
+                  (size_t)b->word_count * sizeof(uint32_t) + b->string_size;
+    char *buf = prog ? (char *)malloc(size) : NULL;
+    if (buf == NULL) {
+        perror("Failed to allocate program");
+        free(prog);
+        program_builder_free(b);
+        return NULL;
+    }
+    ProgramHeader *hdr = (ProgramHeader *)buf;
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, BYTECODE_MAGIC, sizeof(hdr->magic));
+    hdr->format = BYTECODE_FORMAT;
+    hdr->root = root;
+    snprintf(hdr->shell_version, sizeof(hdr->shell_version), "%s", MYSHELL_VERSION);
+    hdr->source_hash = source_hash;
+    hdr->source_size = source_size;
+    hdr->node_count = b->node_count;
+    hdr->word_count = b->word_count;
+    hdr->string_size = b->string_size;
+    char *p = buf + sizeof(ProgramHeader);
+    memcpy(p, b->nodes, (size_t)b->node_count * sizeof(Node));
+    p += (size_t)b->node_count * sizeof(Node);
+    if (b->word_count > 0) {
+        memcpy(p, b->words, (size_t)b->word_count * sizeof(uint32_t));
+    }
+    p += (size_t)b->word_count * sizeof(uint32_t);
+    if (b->string_size > 0) {
+        memcpy(p, b->strings, b->string_size);
+    }
+    program_builder_free(b);
+
+    prog->base = buf;
+    prog->size = size;
+    prog->refs = 1;
+    program_bind(prog, hdr);
+    return prog;
+}
+
+/**
+ * @brief Program をファイルに書き出す (一時ファイルに書いてから rename する)
+ * @return 成功時0、失敗時-1
+ */
+int program_save(const Program *prog, const char *path) {
+    char tmp[MAX_PATH];
+    int n = snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    if (n < 0 || (size_t)n >= sizeof(tmp)) {
+        return -1;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    const char *p = (const char *)prog->base;
+    size_t left = prog->size;
+    while (left > 0) {
+        ssize_t w = write(fd, p, left);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            close(fd);
+            unlink(tmp);
+            return -1;
+        }
+        p += w;
+        left -= (size_t)w;
+    }
+    if (close(fd) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// 読み込んだファイルの中のインデックスやオフセットがすべて範囲内かを確かめる
+static int program_validate(const Program *prog) {
+    if (prog->node_count == 0 || prog->root >= prog->node_count ||
+        (prog->string_size > 0 && prog->strings[prog->string_size - 1] != '\0')) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < prog->word_count; i++) {
+        if (prog->words[i] >= prog->string_size) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < prog->node_count; i++) {
+        const Node *node = &prog->nodes[i];
+        if (node->type > N_ARITH || node->next >= prog->node_count ||
+            node->word > prog->word_count || node->nwords > prog->word_count - node->word) {
+            return -1;
+        }
+        for (int k = 0; k < 3; k++) {
+            if (node->kids[k] >= prog->node_count) {
+                return -1;
+            }
+        }
+        for (int k = 0; k < NODE_STRS; k++) {
+            if (node->str[k] != NO_STRING && node->str[k] >= prog->string_size) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief キャッシュファイルを mmap して Program として使う
+ *
+ * 形式・シェルのバージョン・ソースのハッシュと大きさが一致しない場合や
+ * 壊れている場合は NULL を返す (呼び出し側でコンパイルし直す)。
+ */
+Program* program_load(const char *path, uint64_t source_hash, uint64_t source_size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ProgramHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    const ProgramHeader *hdr = (const ProgramHeader *)base;
+    size_t expect = sizeof(ProgramHeader) + (size_t)hdr->node_count * sizeof(Node) +
+                    (size_t)hdr->word_count * sizeof(uint32_t) + hdr->string_size;
+    Program *prog = NULL;
+    if (memcmp(hdr->magic, BYTECODE_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->format == BYTECODE_FORMAT &&
+        strncmp(hdr->shell_version, MYSHELL_VERSION, sizeof(hdr->shell_version)) == 0 &&
+        hdr->source_hash == source_hash && hdr->source_size == source_size &&
+        expect == (size_t)st.st_size) {
+        prog = (Program *)calloc(1, sizeof(Program));
+    }
+    if (prog == NULL) {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    prog->base = base;
+    prog->size = (size_t)st.st_size;
+    prog->mapped = 1;
+    prog->refs = 1;
+    program_bind(prog, hdr);
+    if (program_validate(prog) != 0) {
+        program_free(prog);
+        return NULL;
+    }
+    return prog;
+}
+
+/**
+ * @brief mmap した領域の中にある Program をそのまま使う (rc のスナップショット)
+ *
+ * @param base ページ境界にある Program の先頭。最後の参照がなくなると munmap する
+ * @param size Program の大きさ
+ * @return Program。形式が違う・壊れている場合はNULL (領域は呼び出し側がそのまま持つ)
+ */
+Program* program_from_image(void *base, size_t size) {
+    const ProgramHeader *hdr = (const ProgramHeader *)base;
+    if (size < sizeof(ProgramHeader)) {
+        return NULL;
+    }
+    size_t expect = sizeof(ProgramHeader) + (size_t)hdr->node_count * sizeof(Node) +
+                    (size_t)hdr->word_count * sizeof(uint32_t) + hdr->string_size;
+    if (memcmp(hdr->magic, BYTECODE_MAGIC, sizeof(hdr->magic)) != 0 || hdr->format != BYTECODE_FORMAT ||
+        strncmp(hdr->shell_version, MYSHELL_VERSION, sizeof(hdr->shell_version)) != 0 || expect != size) {
+        return NULL;
+    }
+    Program *prog = (Program *)calloc(1, sizeof(Program));
+    if (prog == NULL) {
+        return NULL;
+    }
+    prog->base = base;
+    prog->size = size;
+    prog->mapped = 1;
+    prog->refs = 1;
+    program_bind(prog, hdr);
+    if (program_validate(prog) != 0) {
+        free(prog);
+        return NULL;
+    }
+    return prog;
+}
+
+/**
+ * @brief 参照を1つ増やす (関数の定義など、プログラムより長く残るものが持つ)
+ * @return prog
+ */
+Program* program_retain(Program *prog) {
+    if (prog != NULL) {
+        prog->refs++;
+    }
+    return prog;
+}
+
+/**
+ * @brief 参照を1つ減らし、最後の参照なら解放する
+ */
+void program_free(Program *prog) {
+    if (prog == NULL || --prog->refs > 0) {
+        return;
+    }
+    if (prog->mapped) {
+        munmap(prog->base, prog->size);
+    } else {
+        free(prog->base);
+    }
+    free(prog);
+}
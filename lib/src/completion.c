@@ -0,0 +1,703 @@
+#define STATS_SUBSYSTEM STATS_COMPLETION
+#include <shell.h>
+#include <sys/inotify.h>
+
+/*
+ * タブ補完
+ *
+ * コマンド位置では $PATH 上の実行ファイル名をプレフィックス木 (trie) から引き、
+ * それ以外の位置ではディレクトリごとの一覧キャッシュからファイル名を引く。
+ * trie は対話モードの起動時 (init_completion) に一度だけ構築し、以後は inotify の通知で差分更新する。
+ */
+
+#define PATH_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                         IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+#define DIR_CACHE_SLOTS 16  /* ファイル名補完用にキャッシュするディレクトリ数 */
+
+// trieのノード。子は文字コード順に並べた配列で持つ
+typedef struct TrieNode {
+    unsigned char *keys;
+    struct TrieNode **kids;
+    unsigned short nkids;
+    unsigned short cap;
+    unsigned int terminal;  // この名前を提供しているPATHディレクトリ数 (+組み込み)
+} TrieNode;
+
+// 監視中のPATHディレクトリと、その中の実行ファイル名 (ソート済み)
+typedef struct PathDir {
+    char *path;
+    int wd;
+    char **names;
+    size_t count;
+    size_t cap;
+} PathDir;
+
+typedef struct DirEntry {
+    char *name;
+    unsigned char is_dir;
+} DirEntry;
+
+// ファイル名補完用のディレクトリ一覧キャッシュ
+typedef struct DirCache {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    DirEntry *entries; // 名前順にソート済み
+    size_t count;
+    unsigned long last_use;
+} DirCache;
+
+static TrieNode *trie_root = NULL;
+static PathDir *path_dirs = NULL;
+static size_t path_dir_count = 0;
+static char *cached_path_env = NULL;
+static int inotify_fd = -1;
+
+static DirCache dir_cache[DIR_CACHE_SLOTS];
+static unsigned long dir_cache_clock = 0;
+
+// 補完候補 (ジェネレータが1つずつ返す)
+static char **matches = NULL;
+static size_t match_count = 0;
+static size_t match_cap = 0;
+
+/* ---------- trie ---------- */
+
+static TrieNode *trie_new_node(void) {
+    TrieNode *node = (TrieNode *)calloc(1, sizeof(TrieNode));
+    if (node == NULL) {
+        perror("Failed to allocate trie node");
+    }
+    return node;
+}
+
+static void trie_free(TrieNode *node) {
+    if (node == NULL) {
+        return;
+    }
+    for (unsigned short i = 0; i < node->nkids; i++) {
+        trie_free(node->kids[i]);
+    }
+    free(node->keys);
+    free(node->kids);
+    free(node);
+}
+
+// 子ノードの位置を二分探索する。見つからなければ挿入位置を *pos に返す
+static TrieNode *trie_child(TrieNode *node, unsigned char c, unsigned short *pos) {
+    unsigned short lo = 0, hi = node->nkids;
+    while (lo < hi) {
+        unsigned short mid = (unsigned short)((lo + hi) / 2);
+        if (node->keys[mid] < c) {
+            lo = (unsigned short)(mid + 1);
+        } else {
+            hi = mid;
+        }
+    }
+    if (pos) {
+        *pos = lo;
+    }
+    if (lo < node->nkids && node->keys[lo] == c) {
+        return node->kids[lo];
+    }
+    return NULL;
+}
+
+static void trie_insert(const char *name) {
+    TrieNode *node = trie_root;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        unsigned short pos;
+        TrieNode *next = trie_child(node, *p, &pos);
+        if (next == NULL) {
+            if (node->nkids == node->cap) {
+                unsigned short new_cap = node->cap ? (unsigned short)(node->cap * 2) : 2;
+                unsigned char *keys = (unsigned char *)realloc(node->keys, new_cap);
+                if (keys == NULL) {
+                    return;
+                }
+                node->keys = keys;
+                TrieNode **kids = (TrieNode **)realloc(node->kids, new_cap * sizeof(TrieNode *));
+                if (kids == NULL) {
+                    return;
+                }
+                node->kids = kids;
+                node->cap = new_cap;
+            }
+            next = trie_new_node();
+            if (next == NULL) {
+                return;
+            }
+            memmove(&node->keys[pos + 1], &node->keys[pos], node->nkids - pos);
+            memmove(&node->kids[pos + 1], &node->kids[pos], (node->nkids - pos) * sizeof(TrieNode *));
+            node->keys[pos] = *p;
+            node->kids[pos] = next;
+            node->nkids++;
+        }
+        node = next;
+    }
+    node->terminal++;
+}
+
+// 名前の参照を1つ減らす。ノード自体は残す (再作成が多いため)
+static void trie_remove(const char *name) {
+    TrieNode *node = trie_root;
+    for (const unsigned char *p = (const unsigned char *)name; *p && node; p++) {
+        node = trie_child(node, *p, NULL);
+    }
+    if (node && node->terminal > 0) {
+        node->terminal--;
+    }
+}
+
+static void add_match(const char *str) {
+    if (match_count == match_cap) {
+        size_t new_cap = match_cap ? match_cap * 2 : 64;
+        char **tmp = (char **)realloc(matches, new_cap * sizeof(char *));
+        if (tmp == NULL) {
+            return;
+        }
+        matches = tmp;
+        match_cap = new_cap;
+    }
+    char *dup = strdup(str);
+    if (dup != NULL) {
+        matches[match_count++] = dup;
+    }
+}
+
+static void clear_matches(void) {
+    for (size_t i = 0; i < match_count; i++) {
+        free(matches[i]);
+    }
+    match_count = 0;
+}
+
+// nodeより下の名前を辞書順に集める。bufにはlen文字分のプレフィックスが入っている
+static void trie_collect(TrieNode *node, char *buf, size_t len) {
+    if (node->terminal > 0) {
+        buf[len] = '\0';
+        add_match(buf);
+    }
+    if (len >= NAME_MAX) {
+        return;
+    }
+    for (unsigned short i = 0; i < node->nkids; i++) {
+        buf[len] = (char)node->keys[i];
+        trie_collect(node->kids[i], buf, len + 1);
+    }
+}
+
+/* ---------- PATHディレクトリ ---------- */
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// ソート済み配列から名前を探す。見つからなければ挿入位置を *pos に返す
+static int find_name(char **names, size_t count, const char *name, size_t *pos) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = strcmp(names[mid], name);
+        if (cmp == 0) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *pos = lo;
+    return 0;
+}
+
+static int is_executable_in(const char *dir, const char *name) {
+    char full[MAX_PATH];
+    struct stat st;
+    if (snprintf(full, sizeof(full), "%s/%s", dir, name) >= (int)sizeof(full)) {
+        return 0;
+    }
+    if (stat(full, &st) != 0 || S_ISDIR(st.st_mode)) {
+        return 0;
+    }
+    return access(full, X_OK) == 0;
+}
+
+static void path_dir_add(PathDir *pd, const char *name) {
+    size_t pos;
+    if (find_name(pd->names, pd->count, name, &pos)) {
+        return;
+    }
+    if (pd->count == pd->cap) {
+        size_t new_cap = pd->cap ? pd->cap * 2 : 64;
+        char **tmp = (char **)realloc(pd->names, new_cap * sizeof(char *));
+        if (tmp == NULL) {
+            return;
+        }
+        pd->names = tmp;
+        pd->cap = new_cap;
+    }
+    char *dup = strdup(name);
+    if (dup == NULL) {
+        return;
+    }
+    memmove(&pd->names[pos + 1], &pd->names[pos], (pd->count - pos) * sizeof(char *));
+    pd->names[pos] = dup;
+    pd->count++;
+    trie_insert(name);
+}
+
+static void path_dir_remove(PathDir *pd, const char *name) {
+    size_t pos;
+    if (!find_name(pd->names, pd->count, name, &pos)) {
+        return;
+    }
+    trie_remove(name);
+    free(pd->names[pos]);
+    memmove(&pd->names[pos], &pd->names[pos + 1], (pd->count - pos - 1) * sizeof(char *));
+    pd->count--;
+}
+
+// ディレクトリを走査して実行ファイルを登録する (初回構築時のみ)
+static void path_dir_scan(PathDir *pd) {
+    DIR *dir = opendir(pd->path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.' && (ent->d_name[1] == '\0' ||
+            (ent->d_name[1] == '.' && ent->d_name[2] == '\0'))) {
+            continue;
+        }
+        if (ent->d_type == DT_DIR) {
+            continue;
+        }
+        // 通常ファイルはd_typeで分かるので、実行権の確認だけで済ませる
+        if (faccessat(dirfd(dir), ent->d_name, X_OK, 0) != 0) {
+            continue;
+        }
+        if (ent->d_type != DT_REG) {
+            struct stat st;
+            if (fstatat(dirfd(dir), ent->d_name, &st, 0) != 0 || S_ISDIR(st.st_mode)) {
+                continue;
+            }
+        }
+        if (pd->count == pd->cap) {
+            size_t new_cap = pd->cap ? pd->cap * 2 : 64;
+            char **tmp = (char **)realloc(pd->names, new_cap * sizeof(char *));
+            if (tmp == NULL) {
+                break;
+            }
+            pd->names = tmp;
+            pd->cap = new_cap;
+        }
+        char *dup = strdup(ent->d_name);
+        if (dup == NULL) {
+            break;
+        }
+        pd->names[pd->count++] = dup;
+        trie_insert(dup);
+    }
+    closedir(dir);
+    qsort(pd->names, pd->count, sizeof(char *), compare_names);
+}
+
+
+static void path_table_free(void) {
+    for (size_t i = 0; i < path_dir_count; i++) {
+        for (size_t j = 0; j < path_dirs[i].count; j++) {
+            free(path_dirs[i].names[j]);
+        }
+        free(path_dirs[i].names);
+        free(path_dirs[i].path);
+    }
+    free(path_dirs);
+    path_dirs = NULL;
+    path_dir_count = 0;
+    trie_free(trie_root);
+    trie_root = NULL;
+    if (inotify_fd >= 0) {
+        close(inotify_fd); // 監視もまとめて破棄される
+        inotify_fd = -1;
+    }
+    free(cached_path_env);
+    cached_path_env = NULL;
+}
+
+/**
+ * @brief $PATH の全ディレクトリを走査してtrieを構築し、inotifyの監視を登録する
+ */
+static void path_table_build(void) {
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "";
+    }
+    cached_path_env = strdup(path_env);
+    trie_root = trie_new_node();
+    if (cached_path_env == NULL || trie_root == NULL) {
+        return;
+    }
+    builtin_foreach(trie_insert); // 組み込みコマンドも補完の候補にする
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    char *copy = strdup(path_env);
+    if (copy == NULL) {
+        return;
+    }
+    char *rest = copy;
+    char *dir;
+    while ((dir = strsep(&rest, ":")) != NULL) {
+        if (dir[0] == '\0') {
+            dir = "."; // 空要素はカレントディレクトリ
+        }
+        int duplicate = 0;
+        for (size_t i = 0; i < path_dir_count; i++) {
+            if (strcmp(path_dirs[i].path, dir) == 0) {
+                duplicate = 1;
+                break;
+            }
+        }
+        if (duplicate) {
+            continue;
+        }
+        PathDir *tmp = (PathDir *)realloc(path_dirs, (path_dir_count + 1) * sizeof(PathDir));
+        if (tmp == NULL) {
+            break;
+        }
+        path_dirs = tmp;
+        PathDir *pd = &path_dirs[path_dir_count];
+        memset(pd, 0, sizeof(*pd));
+        pd->path = strdup(dir);
+        if (pd->path == NULL) {
+            break;
+        }
+        pd->wd = inotify_fd >= 0 ? inotify_add_watch(inotify_fd, dir, PATH_WATCH_MASK) : -1;
+        path_dir_count++;
+        path_dir_scan(pd);
+    }
+    free(copy);
+}
+
+static PathDir *find_path_dir_by_wd(int wd) {
+    for (size_t i = 0; i < path_dir_count; i++) {
+        if (path_dirs[i].wd == wd) {
+            return &path_dirs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 溜まっているinotifyイベントを読み出してtrieに反映する
+ * @return 全体の再構築が必要な場合は1
+ */
+static int path_table_drain_events(void) {
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            return 0; // EAGAIN: イベントなし
+        }
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                return 1;
+            }
+            PathDir *pd = find_path_dir_by_wd(ev->wd);
+            if (pd == NULL || ev->len == 0) {
+                continue;
+            }
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                path_dir_remove(pd, ev->name);
+            } else if (is_executable_in(pd->path, ev->name)) {
+                path_dir_add(pd, ev->name);
+            } else {
+                path_dir_remove(pd, ev->name); // IN_ATTRIBで実行権が外れた場合
+            }
+        }
+    }
+}
+
+// trieを最新の状態にする。初回と$PATH変更時は全体を構築し直す
+static void path_table_refresh(void) {
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "";
+    }
+    if (trie_root != NULL && cached_path_env != NULL && strcmp(cached_path_env, path_env) == 0) {
+        if (inotify_fd < 0 || !path_table_drain_events()) {
+            return;
+        }
+    }
+    path_table_free();
+    path_table_build();
+}
+
+/**
+ * @brief PATHキャッシュからコマンドのフルパスを引く
+ *
+ * execvp と同じく $PATH の前方のディレクトリを優先する。ディレクトリを読み直さず、
+ * inotifyで更新されたキャッシュだけを参照する。
+ *
+ * @param name コマンド名 ('/' を含まないこと)
+ * @param out フルパスを書き込むバッファ
+ * @param out_size outの大きさ
+ * @return 見つかった場合は1、見つからない場合は0
+ */
+int path_cache_lookup(const char *name, char *out, size_t out_size) {
+    if (name == NULL || name[0] == '\0' || strchr(name, '/') != NULL) {
+        return 0;
+    }
+    // まだ作っていなければ作らない (スクリプトの実行中は fork した子ごとに
+    // PATH の全ディレクトリを読むことになり、execvp より遅くなる)。作るのは path_cache_warm
+    if (trie_root == NULL) {
+        return 0;
+    }
+    // fork した子 (exec_argv) は inotify の fd を親と共有しているので、通知を読むと
+    // 親のキャッシュがその変更を知らないままになる。子では今のキャッシュをそのまま引く
+    if (getpid() == shell_pid) {
+        path_table_refresh();
+    }
+    for (size_t i = 0; i < path_dir_count; i++) {
+        size_t pos;
+        if (find_name(path_dirs[i].names, path_dirs[i].count, name, &pos)) {
+            if (snprintf(out, out_size, "%s/%s", path_dirs[i].path, name) >= (int)out_size) {
+                return 0;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief PATHキャッシュを作る (作ってあれば inotify の通知を取り込んで最新にする)
+ *
+ * path_cache_lookup は作ってあるキャッシュしか引かないので、キャッシュを使うモード
+ * (対話モード・serve) の最初に呼ぶ。
+ */
+void path_cache_warm(void) {
+    path_table_refresh();
+}
+
+/* ---------- ファイル名補完用のディレクトリキャッシュ ---------- */
+
+static void dir_cache_clear(DirCache *dc) {
+    for (size_t i = 0; i < dc->count; i++) {
+        free(dc->entries[i].name);
+    }
+    free(dc->entries);
+    free(dc->path);
+    memset(dc, 0, sizeof(*dc));
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const DirEntry *)a)->name, ((const DirEntry *)b)->name);
+}
+
+static int dir_cache_load(DirCache *dc, const char *path, const struct stat *st) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    size_t cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.' && (ent->d_name[1] == '\0' ||
+            (ent->d_name[1] == '.' && ent->d_name[2] == '\0'))) {
+            continue;
+        }
+        if (dc->count == cap) {
+            size_t new_cap = cap ? cap * 2 : 64;
+            DirEntry *entries = (DirEntry *)realloc(dc->entries, new_cap * sizeof(DirEntry));
+            if (entries == NULL) {
+                break;
+            }
+            dc->entries = entries;
+            cap = new_cap;
+        }
+        DirEntry *de = &dc->entries[dc->count];
+        de->name = strdup(ent->d_name);
+        if (de->name == NULL) {
+            break;
+        }
+        if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK) {
+            // d_typeで判別できない場合だけstatする (シンボリックリンク先がディレクトリか等)
+            struct stat est;
+            de->is_dir = fstatat(dirfd(dir), ent->d_name, &est, 0) == 0 && S_ISDIR(est.st_mode);
+        } else {
+            de->is_dir = ent->d_type == DT_DIR;
+        }
+        dc->count++;
+    }
+    closedir(dir);
+    qsort(dc->entries, dc->count, sizeof(DirEntry), compare_entries);
+    dc->path = strdup(path);
+    dc->dev = st->st_dev;
+    dc->ino = st->st_ino;
+    dc->mtime = st->st_mtim;
+    return 0;
+}
+
+/**
+ * @brief ディレクトリの一覧をキャッシュから返す。mtimeが変わっていれば読み直す
+ */
+static DirCache *dir_cache_get(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    DirCache *victim = &dir_cache[0];
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++) {
+        DirCache *dc = &dir_cache[i];
+        if (dc->path != NULL && strcmp(dc->path, path) == 0) {
+            if (dc->dev == st.st_dev && dc->ino == st.st_ino &&
+                dc->mtime.tv_sec == st.st_mtim.tv_sec && dc->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                dc->last_use = ++dir_cache_clock;
+                return dc;
+            }
+            victim = dc;
+            break;
+        }
+        if (dc->path == NULL || dc->last_use < victim->last_use) {
+            victim = dc;
+        }
+    }
+    dir_cache_clear(victim);
+    if (dir_cache_load(victim, path, &st) != 0) {
+        dir_cache_clear(victim);
+        return NULL;
+    }
+    victim->last_use = ++dir_cache_clock;
+    return victim;
+}
+
+static void collect_filenames(const char *text) {
+    const char *slash = strrchr(text, '/');
+    const char *base = slash ? slash + 1 : text;
+    size_t dir_len = slash ? (size_t)(slash - text) + 1 : 0;
+    char dir_part[MAX_PATH];
+    if (dir_len >= sizeof(dir_part)) {
+        return;
+    }
+    memcpy(dir_part, text, dir_len);
+    dir_part[dir_len] = '\0';
+
+    // 実際に開くパス (~ を展開する)
+    char *lookup = dir_len ? tilde_expand(dir_part) : strdup(".");
+    if (lookup == NULL) {
+        return;
+    }
+    DirCache *dc = dir_cache_get(lookup);
+    free(lookup);
+    if (dc == NULL) {
+        return;
+    }
+
+    // プレフィックスに一致する範囲の先頭を二分探索する
+    size_t base_len = strlen(base);
+    size_t lo = 0, hi = dc->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strcmp(dc->entries[mid].name, base) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    char candidate[MAX_PATH];
+    for (size_t i = lo; i < dc->count && strncmp(dc->entries[i].name, base, base_len) == 0; i++) {
+        // 隠しファイルは明示的に '.' で始めたときだけ候補にする
+        if (dc->entries[i].name[0] == '.' && base[0] != '.') {
+            continue;
+        }
+        if (snprintf(candidate, sizeof(candidate), "%s%s%s", dir_part, dc->entries[i].name,
+                     dc->entries[i].is_dir ? "/" : "") < (int)sizeof(candidate)) {
+            add_match(candidate);
+        }
+    }
+}
+
+static void collect_commands(const char *text) {
+    path_table_refresh();
+    if (trie_root == NULL) {
+        return;
+    }
+    TrieNode *node = trie_root;
+    size_t len = 0;
+    char buf[NAME_MAX + 1];
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (len >= NAME_MAX || (node = trie_child(node, *p, NULL)) == NULL) {
+            return;
+        }
+        buf[len++] = (char)*p;
+    }
+    trie_collect(node, buf, len);
+}
+
+/* ---------- readline との接続 ---------- */
+
+static char *match_generator(const char *text, int state) {
+    static size_t index;
+    (void)text;
+    if (state == 0) {
+        index = 0;
+    }
+    if (index < match_count) {
+        return (strdup)(matches[index++]); // readline が解放するので計測の対象にしない
+    }
+    return NULL;
+}
+
+/**
+ * @brief 補完対象の単語がコマンド名の位置にあるか
+ *
+ * 行頭、| ; & ( ) の後 (&& || も含む)、コマンド位置にある then や do などの予約語の後。
+ * highlight.c の ST_COMMAND と同じ判断をする。
+ */
+static int is_command_position(int start) {
+    int i = start - 1;
+    while (i >= 0 && isspace((unsigned char)rl_line_buffer[i])) {
+        i--;
+    }
+    if (i < 0 || strchr("|;&()", rl_line_buffer[i]) != NULL) {
+        return 1;
+    }
+    int word_end = i + 1;
+    while (i >= 0 && !isspace((unsigned char)rl_line_buffer[i]) && strchr("|;&()", rl_line_buffer[i]) == NULL) {
+        i--;
+    }
+    return syntax_starts_command(rl_line_buffer + i + 1, (size_t)(word_end - i - 1)) && is_command_position(i + 1);
+}
+
+static char **myshell_completion(const char *text, int start, int end) {
+    (void)end;
+    rl_attempted_completion_over = 1; // readline標準のファイル名補完 (毎回readdir) を使わない
+    clear_matches();
+    if (is_command_position(start) && strchr(text, '/') == NULL) {
+        collect_commands(text);
+    } else {
+        collect_filenames(text);
+        // ディレクトリ候補の後ろには空白を入れず、続けて補完できるようにする
+        if (match_count == 1 && matches[0][strlen(matches[0]) - 1] == '/') {
+            rl_completion_append_character = '\0';
+        }
+    }
+    if (match_count == 0) {
+        return NULL;
+    }
+    return rl_completion_matches(text, match_generator);
+}
+
+/**
+ * @brief readline に補完関数を登録する
+ */
+void init_completion(void) {
+    rl_attempted_completion_function = myshell_completion;
+    path_cache_warm();
+}
@@ -0,0 +1,219 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+/*
+ * コマンドの実行期限 (timeout と $MYSHELL_TIMEOUT)
+ *
+ * 期限のあるパイプラインは、各段の pidfd と timerfd を poll して待つ。
+ * 期限になったら段のプロセスグループ (なければ各段) にシグナルを送り、
+ * kill_after の後もまだ終わっていなければ SIGKILL を送る。
+ * 監視のためのプロセスは作らない。pidfd_open が使えないカーネルでは
+ * 短い間隔で waitpid(WNOHANG) を繰り返す。
+ */
+
+#define DEADLINE_DEFAULT_KILL_AFTER 5000000000LL  /* SIGKILL までの既定の猶予 (5秒) */
+#define DEADLINE_POLL_MS 10                       /* pidfd がないときの確認の間隔 */
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+/**
+ * @brief "1.5", "30s", "500ms", "2m", "1h", "1d" の形の時間を読む
+ *
+ * @param s 時間の文字列 (単位がなければ秒)
+ * @param ns 結果 (ナノ秒)
+ * @return 成功時0、書式が正しくなければ-1
+ */
+int parse_duration(const char *s, long long *ns) {
+    char *end;
+    errno = 0;
+    double value = strtod(s, &end);
+    if (end == s || errno != 0 || value < 0) {
+        return -1;
+    }
+    double scale = 1e9;
+    if (strcmp(end, "ms") == 0) {
+        scale = 1e6;
+    } else if (strcmp(end, "m") == 0) {
+        scale = 60e9;
+    } else if (strcmp(end, "h") == 0) {
+        scale = 3600e9;
+    } else if (strcmp(end, "d") == 0) {
+        scale = 86400e9;
+    } else if (end[0] != '\0' && strcmp(end, "s") != 0) {
+        return -1;
+    }
+    if (value * scale > 9e18) {
+        return -1;
+    }
+    *ns = (long long)(value * scale);
+    return 0;
+}
+
+/**
+ * @brief 期限の既定値を設定する (SIGTERM、5秒後に SIGKILL)
+ */
+void deadline_init(Deadline *dl, long long timeout_ns) {
+    dl->timeout_ns = timeout_ns;
+    dl->kill_after_ns = DEADLINE_DEFAULT_KILL_AFTER;
+    dl->signal = SIGTERM;
+    dl->report = 0;
+}
+
+/**
+ * @brief $MYSHELL_TIMEOUT ("DURATION" または "DURATION:KILL_AFTER") から期限を作る
+ * @return 期限があれば1、なければ (空・0・書式の誤り) 0
+ */
+int deadline_from_env(Deadline *dl) {
+    const char *value = var_get("MYSHELL_TIMEOUT");
+    if (value == NULL || value[0] == '\0') {
+        return 0;
+    }
+    char spec[64];
+    snprintf(spec, sizeof(spec), "%s", value);
+    char *colon = strchr(spec, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+    }
+    long long timeout;
+    if (parse_duration(spec, &timeout) != 0 || timeout == 0) {
+        return 0;
+    }
+    deadline_init(dl, timeout);
+    dl->report = 1;
+    if (colon != NULL && parse_duration(colon + 1, &dl->kill_after_ns) != 0) {
+        dl->kill_after_ns = DEADLINE_DEFAULT_KILL_AFTER;
+    }
+    return 1;
+}
+
+static void arm_timer(int tfd, long long ns) {
+    struct itimerspec its = {{0, 0}, {(time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL)}};
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+        its.it_value.tv_nsec = 1; // 0 だとタイマーが止まってしまう
+    }
+    timerfd_settime(tfd, 0, &its, NULL);
+}
+
+// まだ終わっていない段にシグナルを送る
+static void signal_stages(const pid_t *pids, const char *done, size_t count, pid_t pgid, int sig) {
+    if (pgid > 0 && kill(-pgid, sig) == 0) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (pids[i] > 0 && !done[i]) {
+            kill(pids[i], sig);
+        }
+    }
+}
+
+/**
+ * @brief パイプラインの段を期限付きで待つ
+ *
+ * @param pids 段のpid (起動しなかった段は0以下)
+ * @param statuses 段ごとの waitpid の結果を書き込む (起動しなかった段は-1)
+ * @param count 段の数
+ * @param pgid 段のプロセスグループ (0ならpidごとにシグナルを送る)
+ * @param dl 期限
+ * @return 期限で打ち切った場合1、そうでなければ0
+ */
+int deadline_wait(const pid_t *pids, int *statuses, size_t count, pid_t pgid, const Deadline *dl) {
+    struct pollfd *fds = (struct pollfd *)calloc(count + 1, sizeof(struct pollfd));
+    char *done = (char *)calloc(count, 1);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (fds == NULL || done == NULL || tfd < 0) {
+        perror("myshell: deadline");
+    }
+    int fallback = 0;
+    size_t remaining = 0;
+    for (size_t i = 0; i < count; i++) {
+        statuses[i] = -1;
+        if (pids[i] <= 0) {
+            if (done != NULL) {
+                done[i] = 1;
+            }
+            if (fds != NULL) {
+                fds[i].fd = -1;
+            }
+            continue;
+        }
+        remaining++;
+        if (fds != NULL) {
+            fds[i].fd = (int)syscall(SYS_pidfd_open, pids[i], 0);
+            fds[i].events = POLLIN;
+            fallback |= fds[i].fd < 0;
+        }
+    }
+    if (fds == NULL || done == NULL || tfd < 0) {
+        // 期限を守れないので普通に待つ
+        for (size_t i = 0; i < count; i++) {
+            while (pids[i] > 0 && waitpid(pids[i], &statuses[i], 0) < 0 && errno == EINTR) {
+            }
+        }
+        for (size_t i = 0; fds != NULL && i < count; i++) {
+            if (fds[i].fd >= 0) {
+                close(fds[i].fd);
+            }
+        }
+        free(fds);
+        free(done);
+        if (tfd >= 0) {
+            close(tfd);
+        }
+        return 0;
+    }
+    fds[count].fd = tfd;
+    fds[count].events = POLLIN;
+    arm_timer(tfd, dl->timeout_ns);
+
+    int phase = 0; // 0: 実行中、1: dl->signal を送った、2: SIGKILL を送った
+    while (remaining > 0) {
+        int ready = poll(fds, count + 1, fallback ? DEADLINE_POLL_MS : -1);
+        if (ready < 0 && errno != EINTR) {
+            perror("myshell: poll");
+            fallback = 1;
+        }
+        if (ready > 0 && (fds[count].revents & POLLIN)) {
+            uint64_t expirations;
+            if (read(tfd, &expirations, sizeof(expirations)) > 0 && phase < 2) {
+                phase++;
+                int sig = phase == 1 ? dl->signal : SIGKILL;
+                signal_stages(pids, done, count, pgid, sig);
+                if (sig != SIGKILL) {
+                    signal_stages(pids, done, count, pgid, SIGCONT); // 止まっている段も起こす
+                }
+                if (phase == 1 && dl->kill_after_ns > 0 && dl->signal != SIGKILL) {
+                    arm_timer(tfd, dl->kill_after_ns);
+                } else {
+                    phase = 2;
+                }
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (done[i] || (fds[i].fd >= 0 && !(ready > 0 && fds[i].revents))) {
+                continue;
+            }
+            pid_t r = waitpid(pids[i], &statuses[i], fds[i].fd >= 0 ? 0 : WNOHANG);
+            if (r == 0 || (r < 0 && errno == EINTR)) {
+                continue;
+            }
+            done[i] = 1;
+            remaining--;
+            if (fds[i].fd >= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+            }
+        }
+    }
+    close(tfd);
+    free(fds);
+    free(done);
+    if (phase > 0 && dl->report) {
+        fprintf(stderr, "myshell: command timed out after %.3gs\n", (double)dl->timeout_ns / 1e9);
+    }
+    return phase > 0;
+}
@@ -0,0 +1,570 @@
+#define _GNU_SOURCE /* memfd_create, pipe2 */
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <sys/mman.h>
+
+/*
+ * コマンドの実行
+ *
+ * 展開済みの Command の連結リストをパイプラインとして実行する。
+ * パイプのない組み込みコマンド・関数・複合コマンドはシェル自身のプロセスで実行し、
+ * それ以外は段ごとに fork して、外部コマンドは PATH キャッシュで解決したパスを exec する。
+ * フォークサーバー (forkServer.c) が動いていれば、外部コマンドはそこから起動する。
+ */
+
+extern char **environ;
+
+int last_exit_status = 0;
+
+// waitpid の結果をシェルの終了ステータスに変換する
+int status_to_exit_code(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 1;
+}
+
+// ヒアドキュメントの本文を書く無名ファイル (パイプの容量を超えても詰まらない)
+static int heredoc_fd(void) {
+    int fd = memfd_create("myshell-heredoc", MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("memfd_create");
+    }
+    return fd;
+}
+
+// 段ごとの操作の位置 (ops の添字。なければ-1)
+typedef struct RedirectOps {
+    int heredoc, in, out;
+} RedirectOps;
+
+/**
+ * @brief パイプラインの各段のリダイレクトをまとめて開く
+ *
+ * 全段の < と > の open とヒアドキュメントの書き込みを io_batch で一度に発行する。
+ * 段の中では bash と同じく < に失敗したら > は開かない。
+ *
+ * @param head 先頭の段 (next で stages 段分たどる)
+ * @param in_fds 段ごとの入力のfd (リダイレクトがなければ-1)
+ * @param out_fds 段ごとの出力のfd (リダイレクトがなければ-1)
+ * @param failed 段ごとに、リダイレクトに失敗したら1 (その段で開いたfdは閉じてある)
+ */
+static void open_redirects(Command *head, size_t stages, int *in_fds, int *out_fds, char *failed) {
+    IoOp local_ops[3];
+    RedirectOps local_idx[1];
+    IoOp *ops = local_ops;
+    RedirectOps *idx = local_idx;
+    if (stages > 1) {
+        ops = (IoOp *)calloc(stages * 3, sizeof(IoOp));
+        idx = (RedirectOps *)calloc(stages, sizeof(RedirectOps));
+        if (ops == NULL || idx == NULL) {
+            perror("Failed to allocate redirections");
+            free(ops);
+            free(idx);
+            memset(failed, 1, stages);
+            for (size_t i = 0; i < stages; i++) {
+                in_fds[i] = out_fds[i] = -1;
+            }
+            return;
+        }
+    }
+    size_t n = 0;
+    size_t i = 0;
+    for (Command *cmd = head; i < stages; cmd = cmd->next, i++) {
+        in_fds[i] = out_fds[i] = -1;
+        failed[i] = 0;
+        idx[i].heredoc = idx[i].in = idx[i].out = -1;
+        // < があればそちらを優先する (ヒアドキュメントは使わない)
+        if (cmd->heredoc_delimiter != NULL && cmd->redirect_in == NULL) {
+            const char *body = cmd->heredoc_body ? cmd->heredoc_body : "";
+            if ((in_fds[i] = heredoc_fd()) < 0) {
+                failed[i] = 1;
+                continue;
+            }
+            idx[i].heredoc = (int)n;
+            ops[n++] = (IoOp){.kind = IO_WRITE, .fd = in_fds[i], .buf = body, .len = strlen(body)};
+        }
+        if (cmd->redirect_in != NULL) {
+            idx[i].in = (int)n;
+            ops[n++] = (IoOp){.kind = IO_OPEN, .path = cmd->redirect_in, .flags = O_RDONLY | O_CLOEXEC,
+                              .link = cmd->redirect_out != NULL};
+        }
+        if (cmd->redirect_out != NULL) {
+            int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+            flags |= cmd->append_mode == T_REDIR_APPEND ? O_APPEND : O_TRUNC;
+            idx[i].out = (int)n;
+            ops[n++] = (IoOp){.kind = IO_OPEN, .path = cmd->redirect_out, .flags = flags, .mode = 0644};
+        }
+    }
+    io_batch(ops, n);
+    i = 0;
+    for (Command *cmd = head; i < stages; cmd = cmd->next, i++) {
+        if (idx[i].heredoc >= 0 && ops[idx[i].heredoc].result != (int)ops[idx[i].heredoc].len) {
+            perror("heredoc");
+        }
+        if (idx[i].in >= 0) {
+            in_fds[i] = ops[idx[i].in].result;
+            if (in_fds[i] < 0) {
+                fprintf(stderr, "myshell: %s: %s\n", cmd->redirect_in, strerror(-in_fds[i]));
+                failed[i] = 1;
+            }
+        }
+        if (idx[i].out >= 0) {
+            out_fds[i] = ops[idx[i].out].result;
+            if (out_fds[i] < 0 && out_fds[i] != -ECANCELED) {
+                fprintf(stderr, "myshell: %s: %s\n", cmd->redirect_out, strerror(-out_fds[i]));
+                failed[i] = 1;
+            }
+        }
+        if (failed[i]) {
+            if (in_fds[i] >= 0) {
+                close(in_fds[i]);
+            }
+            if (out_fds[i] >= 0) {
+                close(out_fds[i]);
+            }
+            in_fds[i] = out_fds[i] = -1;
+        }
+    }
+    if (ops != local_ops) {
+        free(ops);
+        free(idx);
+    }
+}
+
+/**
+ * @brief argv のコマンドを exec する。戻らない
+ *
+ * '/' を含まない名前は PATH キャッシュで解決し、キャッシュにない場合
+ * (inotify の通知がまだ届いていない場合など) は execvp に任せる。
+ */
+void exec_argv(char **argv) {
+    char path[MAX_PATH];
+    if (strchr(argv[0], '/') != NULL) {
+        execv(argv[0], argv);
+    } else {
+        if (path_cache_lookup(argv[0], path, sizeof(path))) {
+            execv(path, argv);
+        }
+        execvp(argv[0], argv);
+    }
+    if (errno == ENOENT) {
+        fprintf(stderr, "myshell: %s: command not found\n", argv[0]);
+        _exit(127);
+    }
+    fprintf(stderr, "myshell: %s: %s\n", argv[0], strerror(errno));
+    _exit(126);
+}
+
+/**
+ * @brief 標準入出力を差し替えてコマンドを子プロセスで起動する
+ *
+ * @param argv 実行するコマンド
+ * @param in_fd 標準入力にするfd (-1なら継承)
+ * @param out_fd 標準出力にするfd (-1なら継承)
+ * @param err_fd 標準エラー出力にするfd (-1なら継承)
+ * @return 子プロセスのpid。失敗時は-1
+ */
+pid_t spawn_argv(char **argv, int in_fd, int out_fd, int err_fd) {
+    pid_t pid = fork_server_spawn(argv, environ, in_fd, out_fd, err_fd, NULL);
+    if (pid > 0) {
+        return pid;
+    }
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        if ((in_fd >= 0 && dup2(in_fd, STDIN_FILENO) < 0) ||
+            (out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0) ||
+            (err_fd >= 0 && dup2(err_fd, STDERR_FILENO) < 0)) {
+            perror("dup2");
+            _exit(1);
+        }
+        exec_argv(argv);
+    }
+    return pid;
+}
+
+/**
+ * @brief リダイレクトを開いて標準入出力に付け替える (シェル内で実行するコマンド用)
+ *
+ * @param cmd リダイレクトを持つコマンド
+ * @param saved 元の標準入力・標準出力を退避したfd (redirect_pop で戻す)
+ * @return 成功時0、失敗時-1
+ */
+int redirect_push(Command *cmd, int saved[2]) {
+    int in_fd, out_fd;
+    char failed;
+    saved[0] = saved[1] = -1;
+    out_flush(); // > で切り詰める前に、溜めた追記を書く
+    open_redirects(cmd, 1, &in_fd, &out_fd, &failed);
+    if (failed) {
+        return -1;
+    }
+    fflush(stdout);
+    if (in_fd >= 0) {
+        saved[0] = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(in_fd, STDIN_FILENO);
+        close(in_fd);
+    }
+    if (out_fd >= 0) {
+        saved[1] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(out_fd, STDOUT_FILENO);
+        close(out_fd);
+    }
+    return 0;
+}
+
+/**
+ * @brief redirect_push で付け替えた標準入出力を戻す
+ * @return 成功時0。付け替え先への書き込みに失敗していたら-1 (表示済み)
+ */
+int redirect_pop(int saved[2]) {
+    int failed = out_flush() != 0;
+    fflush(stdout);
+    if (saved[0] >= 0) {
+        dup2(saved[0], STDIN_FILENO);
+        close(saved[0]);
+    }
+    if (saved[1] >= 0) {
+        dup2(saved[1], STDOUT_FILENO);
+        close(saved[1]);
+    }
+    return failed ? -1 : 0;
+}
+
+// FOO=bar cmd の代入を一時スコープに置く
+static int push_assigns(Command *cmd) {
+    if (cmd->assigns == NULL) {
+        return 0;
+    }
+    if (vars_push_temp() != 0) {
+        return -1;
+    }
+    for (int i = 0; cmd->assigns[i] != NULL; i++) {
+        int eq = is_assignment_word(cmd->assigns[i]);
+        if (!var_is_name(cmd->assigns[i], (size_t)eq)) {
+            continue; // 配列の要素と += は一時的な代入にできない
+        }
+        cmd->assigns[i][eq] = '\0';
+        var_set_temp(cmd->assigns[i], cmd->assigns[i] + eq + 1);
+        cmd->assigns[i][eq] = '=';
+    }
+    return 0;
+}
+
+// コマンド名のない代入 (FOO=bar) はシェルの変数に代入する。終了ステータスは最後のコマンド置換のもの
+static int apply_assigns(Command *cmd) {
+    int status = cmd->subst_status >= 0 ? cmd->subst_status : 0;
+    for (int i = 0; cmd->assigns != NULL && cmd->assigns[i] != NULL; i++) {
+        int eq = is_assignment_word(cmd->assigns[i]);
+        if (var_assign(cmd->assigns[i], (size_t)eq, cmd->assigns[i] + eq + 1) != 0) {
+            status = 1;
+        }
+    }
+    for (int i = 0; cmd->array_assigns != NULL && cmd->array_assigns[i] != NULL; i++) {
+        if (var_assign_compound(cmd->array_assigns[i], 0, 0) != 0) {
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// シェルのプロセスで実行できる段 (複合コマンド・関数・組み込みコマンド) を実行する
+static int run_body(Command *cmd, int *status) {
+    if (cmd->program != NULL) {
+        *status = execute_program(cmd->program, cmd->node);
+        return 1;
+    }
+    if (call_function(cmd->argv[0], cmd->argv, status)) {
+        return 1;
+    }
+    const Builtin *builtin = find_builtin(cmd->argv[0]);
+    if (builtin != NULL) {
+        *status = builtin_call(builtin, cmd->argv);
+        return 1;
+    }
+    return 0;
+}
+
+// 子プロセスの中で1段分を実行する。戻らない
+static void run_stage(Command *cmd) {
+    int status = 0;
+    if (cmd->program == NULL && cmd->argv[0] == NULL) {
+        _exit(status);
+    }
+    push_assigns(cmd);
+    if (run_body(cmd, &status)) {
+        out_flush();
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    }
+    exec_argv(cmd->argv);
+}
+
+// 外部コマンドの段か (フォークサーバーに任せられるか)
+static int is_external(Command *cmd) {
+    return cmd->program == NULL && cmd->argv[0] != NULL &&
+           !has_function(cmd->argv[0]) && find_builtin(cmd->argv[0]) == NULL;
+}
+
+/**
+ * @brief 外部コマンドの段をフォークサーバーで起動する
+ * @return 子プロセスのpid。フォークサーバーが使えなければ-1
+ */
+static pid_t spawn_external(Command *cmd, int in_fd, int out_fd, const StageSched *sched) {
+    // フォークサーバーの子はプロセス置換の fd を受け継げない
+    if (!fork_server_enabled() || !is_external(cmd) || process_subst_active() || push_assigns(cmd) != 0) {
+        return -1;
+    }
+    pid_t pid = fork_server_spawn(cmd->argv, environ, in_fd, out_fd, -1, sched);
+    if (cmd->assigns != NULL) {
+        vars_pop_scope();
+    }
+    return pid;
+}
+
+// echo ... >> FILE のように、標準出力を付け替えずに out_write の書き先を FILE にできるか
+static int is_buffered_append(Command *cmd) {
+    return cmd->program == NULL && cmd->argv[0] != NULL && cmd->redirect_in == NULL &&
+           cmd->heredoc_delimiter == NULL && cmd->redirect_out != NULL &&
+           cmd->append_mode == T_REDIR_APPEND && !has_function(cmd->argv[0]) &&
+           builtin_uses_out_buffer(find_builtin(cmd->argv[0]));
+}
+
+/**
+ * @brief パイプのない段をシェル内で実行する
+ * @return 実行した場合1。外部コマンドなら何もせず0
+ */
+static int run_in_shell(Command *cmd, int *status) {
+    if (is_external(cmd)) {
+        return 0;
+    }
+    // >> FILE は開いたままにしておき、ループの中の追記を1回の書き込みにまとめる
+    int buffered = is_buffered_append(cmd);
+    int saved[2];
+    if (buffered ? out_append_begin(cmd->redirect_out) != 0 : redirect_push(cmd, saved) != 0) {
+        *status = 1;
+        return 1;
+    }
+    if (cmd->program == NULL && cmd->argv[0] == NULL) {
+        *status = apply_assigns(cmd);
+    } else if (push_assigns(cmd) != 0) {
+        *status = 1;
+    } else {
+        run_body(cmd, status);
+        if (cmd->assigns != NULL) {
+            vars_pop_scope();
+        }
+    }
+    // 溜めた出力の書き込みに失敗したら (echo hi > /dev/full) そのコマンドは失敗にする
+    if ((buffered ? out_append_end() : redirect_pop(saved)) != 0) {
+        *status = 1;
+    }
+    return 1;
+}
+
+/**
+ * @brief 期限のあるパイプラインの段を1つのプロセスグループにまとめるか
+ *
+ * 期限になったら孫のプロセスまでまとめてシグナルを送れるようにする。
+ * パイプラインの段・$(...)・( ) の中の timeout でも同じにする
+ * (端末の前面を渡すのはシェル自身が前面のときだけ)。
+ */
+static int use_process_group(const Deadline *dl) {
+    return dl != NULL;
+}
+
+// 端末の前面をプロセスグループ pgid に渡す (シェルが前面のときだけ)。戻すときは getpgrp()
+static void give_terminal(pid_t pgid) {
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGTTOU); // 背面から tcsetpgrp すると止められるので止めない
+    sigprocmask(SIG_BLOCK, &block, &old);
+    tcsetpgrp(STDIN_FILENO, pgid);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * @brief コマンドリストの各段を起動し、最後の段の終了を待つ
+ *
+ * 起動する段には pipesched の設定 (CPU・nice・I/O の優先度) を exec の前に適用する。
+ *
+ * @param head 展開済みのコマンドリスト
+ * @param dl 実行期限 (NULLなら期限なし)
+ * @return 最後の段の終了ステータス。期限で打ち切った場合は124
+ */
+static int spawn_pipeline(Command *head, const Deadline *dl) {
+    size_t stages = 0;
+    for (Command *cmd = head; cmd != NULL; cmd = cmd->next) {
+        stages++;
+    }
+    pid_t *pids = (pid_t *)calloc(stages, sizeof(pid_t));
+    int *statuses = (int *)calloc(stages, sizeof(int));
+    int *redirect_fds = (int *)calloc(stages * 2, sizeof(int));
+    char *redirect_failed = (char *)calloc(stages, 1);
+    if (pids == NULL || statuses == NULL || redirect_fds == NULL || redirect_failed == NULL) {
+        perror("Failed to allocate pid list");
+        free(pids);
+        free(statuses);
+        free(redirect_fds);
+        free(redirect_failed);
+        return last_exit_status = 1;
+    }
+    // 全段のリダイレクトを先にまとめて開く (溜めた出力は fork の前に書き出しておく)
+    out_flush();
+    open_redirects(head, stages, redirect_fds, redirect_fds + stages, redirect_failed);
+
+    fflush(stdout);
+    stage_sched_begin(stages);
+    int pgroup = use_process_group(dl);
+    int foreground = pgroup && getpid() == shell_pid && isatty(STDIN_FILENO) &&
+                     tcgetpgrp(STDIN_FILENO) == getpgrp();
+    pid_t pgid = 0;
+    int prev_read = -1;
+    size_t i = 0;
+    for (Command *cmd = head; cmd != NULL; cmd = cmd->next, i++) {
+        int pipefd[2] = {-1, -1};
+        int in_fd = redirect_fds[i], out_fd = redirect_fds[stages + i];
+        if (cmd->next != NULL && pipe2(pipefd, O_CLOEXEC) != 0) {
+            perror("pipe");
+            pids[i] = -1;
+            for (size_t j = i; j < stages; j++) { // 起動しない段のリダイレクトを閉じる
+                if (redirect_fds[j] >= 0) {
+                    close(redirect_fds[j]);
+                }
+                if (redirect_fds[stages + j] >= 0) {
+                    close(redirect_fds[stages + j]);
+                }
+            }
+            break;
+        }
+        if (redirect_failed[i]) {
+            pids[i] = -1; // この段は実行しないが、前後の段は動かす (bashと同じ)
+        } else {
+            // リダイレクトはパイプより優先する
+            int stdin_fd = in_fd >= 0 ? in_fd : prev_read;
+            int stdout_fd = out_fd >= 0 ? out_fd : pipefd[1];
+            StageSched sched_buf;
+            const StageSched *sched = stage_sched_plan(i, &sched_buf);
+            if (pgroup) {
+                sched_buf.flags |= STAGE_SET_PGROUP;
+                sched_buf.pgid = pgid;
+                sched = &sched_buf;
+            }
+            pids[i] = spawn_external(cmd, stdin_fd, stdout_fd, sched);
+            if (pids[i] < 0) {
+                pids[i] = fork();
+            }
+            if (pids[i] == 0) {
+                signal(SIGINT, SIG_DFL);
+                if ((stdin_fd >= 0 && dup2(stdin_fd, STDIN_FILENO) < 0) ||
+                    (stdout_fd >= 0 && dup2(stdout_fd, STDOUT_FILENO) < 0)) {
+                    perror("dup2");
+                    _exit(1);
+                }
+                stage_sched_apply(sched);
+                process_subst_inherit();
+                run_stage(cmd);
+            }
+            if (pids[i] < 0) {
+                perror("fork");
+            } else if (pgroup) {
+                // 子の側でも setpgid するが、次の段が入る前にグループができているようにする
+                pgid = pgid == 0 ? pids[i] : pgid;
+                setpgid(pids[i], pgid);
+                if (foreground && pgid == pids[i]) {
+                    give_terminal(pgid);
+                }
+            }
+            stage_sched_record(i, pids[i], cmd, sched);
+            if (in_fd >= 0) {
+                close(in_fd);
+            }
+            if (out_fd >= 0) {
+                close(out_fd);
+            }
+        }
+        if (prev_read >= 0) {
+            close(prev_read);
+        }
+        if (pipefd[1] >= 0) {
+            close(pipefd[1]);
+        }
+        prev_read = pipefd[0];
+    }
+    if (prev_read >= 0) {
+        close(prev_read);
+    }
+
+    int timed_out = 0;
+    if (dl != NULL) {
+        timed_out = deadline_wait(pids, statuses, stages, pgid, dl);
+    } else {
+        for (size_t j = 0; j < stages; j++) {
+            statuses[j] = -1;
+            while (pids[j] > 0 && waitpid(pids[j], &statuses[j], 0) < 0 && errno == EINTR) {
+            }
+        }
+    }
+    if (foreground && pgid > 0) {
+        give_terminal(getpgrp());
+    }
+    int status = pids[stages - 1] > 0 ? statuses[stages - 1] : -1;
+    free(pids);
+    free(statuses);
+    free(redirect_fds);
+    free(redirect_failed);
+    if (timed_out) {
+        return last_exit_status = 124; // coreutils の timeout と同じ
+    }
+    last_exit_status = status < 0 ? 1 : status_to_exit_code(status);
+    return last_exit_status;
+}
+
+/**
+ * @brief コマンドリストをパイプラインとして実行し、最後の段の終了を待つ
+ *
+ * パイプのない関数・組み込みコマンド・複合コマンドはシェルのプロセスで実行する。
+ * $MYSHELL_TIMEOUT が設定されていれば、起動したパイプラインをその期限で打ち切る。
+ *
+ * @param head 展開済みのコマンドリスト
+ * @return 最後の段の終了ステータス (last_exit_status にも保存する)
+ */
+int execute_command_list(Command *head) {
+    if (head == NULL) {
+        return last_exit_status;
+    }
+    if (head->next == NULL) {
+        int status;
+        if (run_in_shell(head, &status)) {
+            last_exit_status = status;
+            return last_exit_status;
+        }
+    }
+    Deadline dl;
+    return spawn_pipeline(head, getpid() == shell_pid && deadline_from_env(&dl) ? &dl : NULL);
+}
+
+/**
+ * @brief コマンドリストを期限付きで実行する (timeout 用)
+ *
+ * 組み込みコマンドや関数も子プロセスで実行するので、期限で打ち切れる。
+ *
+ * @param head 展開済みのコマンドリスト
+ * @param dl 実行期限
+ * @return 最後の段の終了ステータス。期限で打ち切った場合は124
+ */
+int execute_command_deadline(Command *head, const Deadline *dl) {
+    if (head == NULL) {
+        return last_exit_status;
+    }
+    return spawn_pipeline(head, dl);
+}
@@ -0,0 +1,1033 @@
+#define STATS_SUBSYSTEM STATS_EXPAND
+#include <shell.h>
+
+/*
+ * 単語の展開
+ *
+ * 構文木に残した単語 (引用符を含んだまま) を実行のたびに展開する。
+ * 1文字ごとに「引用されていたか」「引用されていない展開の結果か」の印を付けて
+ * バッファに展開し、その印を見てフィールド分割とパス名展開を行ってから引用符を取り除く。
+ */
+
+#define EF_QUOTED 0x01  /* 引用されている (分割・パス名展開をしない) */
+#define EF_SPLIT  0x02  /* 引用されていない展開の結果 (IFS で分割する) */
+#define EF_BREAK  0x04  /* "$@" の区切り。ここで必ずフィールドを分ける (文字としては含めない) */
+
+typedef enum { EXPAND_FIELDS, EXPAND_STRING, EXPAND_PATTERN, EXPAND_HEREDOC } ExpandMode;
+
+typedef struct ExpBuf {
+    char *s;
+    unsigned char *f;   // 各文字の EF_* の印
+    size_t len, cap;
+    int has_quote;      // 引用符があった (空でも1つのフィールドになる)
+    int at_empty;       // 空の "$@" を展開した
+    int failed;
+} ExpBuf;
+
+static void buf_putc(ExpBuf *b, char c, unsigned char flags) {
+    if (b->len == b->cap) {
+        size_t new_cap = b->cap ? b->cap * 2 : 64;
+        char *s = (char *)realloc(b->s, new_cap);
+        unsigned char *f = s ? (unsigned char *)realloc(b->f, new_cap) : NULL;
+        if (f == NULL) {
+            if (s != NULL) {
+                b->s = s;
+            }
+            b->failed = 1;
+            return;
+        }
+        b->s = s;
+        b->f = f;
+        b->cap = new_cap;
+    }
+    b->s[b->len] = c;
+    b->f[b->len++] = flags;
+}
+
+static void buf_puts(ExpBuf *b, const char *s, unsigned char flags) {
+    for (; *s; s++) {
+        buf_putc(b, *s, flags);
+    }
+}
+
+static void buf_free(ExpBuf *b) {
+    free(b->s);
+    free(b->f);
+}
+
+// 展開した値を追加する。引用されていなければ分割の対象にする
+static void put_value(ExpBuf *b, const char *value, int quoted) {
+    if (value != NULL) {
+        buf_puts(b, value, quoted ? EF_QUOTED : EF_SPLIT);
+    }
+}
+
+static const char* ifs_chars(void) {
+    const char *ifs = var_get("IFS");
+    return ifs ? ifs : " \t\n";
+}
+
+// $@ と $* を展開する
+static void put_params(ExpBuf *b, int at, int quoted) {
+    int n = var_positional_count();
+    if (n == 0 && at && quoted) {
+        b->at_empty = 1;
+        return;
+    }
+    const char *ifs = ifs_chars();
+    for (int i = 1; i <= n; i++) {
+        if (i > 1) {
+            if (at && quoted) {
+                buf_putc(b, '\0', EF_BREAK);
+            } else if (quoted) {
+                if (ifs[0] != '\0') {
+                    buf_putc(b, ifs[0], EF_QUOTED);
+                }
+            } else {
+                buf_putc(b, ' ', EF_SPLIT);
+            }
+        }
+        put_value(b, var_positional(i), quoted);
+    }
+}
+
+// 名前 (または特殊パラメータ) の値を追加する
+static void put_param(ExpBuf *b, const char *name, size_t len, int quoted) {
+    char tmp[32];
+    if (len == 1) {
+        switch (name[0]) {
+            case '?':
+                snprintf(tmp, sizeof(tmp), "%d", last_exit_status);
+                put_value(b, tmp, quoted);
+                return;
+            case '$':
+                snprintf(tmp, sizeof(tmp), "%d", (int)shell_pid);
+                put_value(b, tmp, quoted);
+                return;
+            case '#':
+                snprintf(tmp, sizeof(tmp), "%d", var_positional_count());
+                put_value(b, tmp, quoted);
+                return;
+            case '@':
+            case '*':
+                put_params(b, name[0] == '@', quoted);
+                return;
+            case '!':
+            case '-':
+                return;
+            default:
+                break;
+        }
+    }
+    if (isdigit((unsigned char)name[0])) {
+        put_value(b, var_positional(atoi(name)), quoted);
+        return;
+    }
+    char *key = strndup(name, len);
+    if (key == NULL) {
+        b->failed = 1;
+        return;
+    }
+    put_value(b, var_get(key), quoted);
+    free(key);
+}
+
+// コマンド置換の出力を追加する
+static void put_substitution(ExpBuf *b, const char *text, size_t len, int quoted) {
+    char *out = command_substitute(text, len);
+    if (out == NULL) {
+        b->failed = 1;
+        return;
+    }
+    put_value(b, out, quoted);
+    free(out);
+}
+
+// ${ の直後から対応する '}' を探す (引用符と入れ子の展開を読み飛ばす)
+static const char* scan_brace(const char *p, const char *end) {
+    while (p < end) {
+        if (*p == '}') {
+            return p;
+        }
+        if (*p == '\\') {
+            p += p + 1 < end ? 2 : 1;
+        } else if (*p == '\'' || *p == '"' || *p == '`') {
+            const char *q = p + 1;
+            while (q < end && *q != *p) {
+                q += *q == '\\' && *p != '\'' && q + 1 < end ? 2 : 1;
+            }
+            if (q >= end) {
+                return NULL;
+            }
+            p = q + 1;
+        } else if (*p == '$' && p + 1 < end && (p[1] == '(' || p[1] == '{')) {
+            const char *close = p[1] == '(' ? scan_command_subst(p + 2, end) : scan_brace(p + 2, end);
+            if (close == NULL) {
+                return NULL;
+            }
+            p = close + 1;
+        } else {
+            p++;
+        }
+    }
+    return NULL;
+}
+
+// 長さ len の値を追加する
+static void put_value_len(ExpBuf *b, const char *value, size_t len, int quoted) {
+    for (size_t i = 0; i < len; i++) {
+        buf_putc(b, value[i], quoted ? EF_QUOTED : EF_SPLIT);
+    }
+}
+
+// $@ と $* の要素の区切りを追加する (put_params と同じ規則)
+static void put_param_separator(ExpBuf *b, int at, int quoted) {
+    if (at && quoted) {
+        buf_putc(b, '\0', EF_BREAK);
+    } else if (quoted) {
+        const char *ifs = ifs_chars();
+        if (ifs[0] != '\0') {
+            buf_putc(b, ifs[0], EF_QUOTED);
+        }
+    } else {
+        buf_putc(b, ' ', EF_SPLIT);
+    }
+}
+
+/**
+ * @brief ${...} の中のスカラーのパラメータの値を得る
+ * @param tmp 数を文字列にするための領域
+ * @return 値。設定されていなければNULL
+ */
+static const char* param_lookup(const char *name, size_t len, char *tmp, size_t tmp_size) {
+    if (len == 1 && strchr("?$#", name[0]) != NULL) {
+        long value = name[0] == '?' ? last_exit_status : name[0] == '$' ? (long)shell_pid : var_positional_count();
+        snprintf(tmp, tmp_size, "%ld", value);
+        return tmp;
+    }
+    if (isdigit((unsigned char)name[0])) {
+        return var_positional(atoi(name));
+    }
+    if (len >= tmp_size || !var_is_name(name, len)) {
+        return NULL;
+    }
+    memcpy(tmp, name, len);
+    tmp[len] = '\0';
+    return var_get(tmp);
+}
+
+// $@・$*・${a[@]}・${!a[@]} の要素の並び (値は変数が持つものを指すだけで写さない)
+typedef struct ParamList {
+    const char **items;
+    int64_t *indexes;       // 添字 (位置パラメータは番号、連想配列は順番)
+    size_t count;
+    char *pool;             // ${!a[@]} の添字を文字列にした領域
+} ParamList;
+
+static void list_free(ParamList *l) {
+    free(l->items);
+    free(l->indexes);
+    free(l->pool);
+}
+
+/**
+ * @brief 要素の並びを作る
+ * @param name NULLなら位置パラメータ、そうでなければ配列の名前
+ * @param keys 値ではなく添字 (キー) を並べる
+ * @return 成功時0、失敗時-1
+ */
+static int list_collect(ParamList *l, const char *name, int keys) {
+    memset(l, 0, sizeof(*l));
+    ShArray *a = name ? var_get_array(name) : NULL;
+    size_t cap = name == NULL ? (size_t)var_positional_count() : a ? array_count(a) : 1;
+    l->items = (const char **)malloc((cap + 1) * sizeof(char *));
+    l->indexes = (int64_t *)malloc((cap + 1) * sizeof(int64_t));
+    if (l->items == NULL || l->indexes == NULL || (keys && a && (l->pool = (char *)malloc(cap * 21 + 1)) == NULL)) {
+        list_free(l);
+        return -1;
+    }
+    if (name == NULL) {
+        for (size_t i = 0; i < cap; i++) {
+            l->items[i] = var_positional((int)i + 1);
+            l->indexes[i] = (int64_t)i + 1;
+        }
+        l->count = cap;
+    } else if (a == NULL) {
+        const char *value = var_get(name); // スカラーは要素0だけの配列
+        if (value != NULL) {
+            l->items[0] = keys ? "0" : value;
+            l->indexes[0] = 0;
+            l->count = 1;
+        }
+    } else {
+        size_t pos = 0;
+        const char *key, *value;
+        int64_t index;
+        char *o = l->pool;
+        while (l->count < cap && array_iter(a, &pos, &key, &index, &value)) {
+            if (keys && key == NULL) {
+                l->items[l->count] = o;
+                o += sprintf(o, "%lld", (long long)index) + 1;
+            } else {
+                l->items[l->count] = keys ? key : value;
+            }
+            l->indexes[l->count] = key ? (int64_t)l->count : index;
+            l->count++;
+        }
+    }
+    return 0;
+}
+
+// 並びを追加する。sep は '@' なら "$@"、'*' なら "$*" と同じ区切り
+static void put_list(ExpBuf *b, const ParamList *l, size_t from, size_t to, char sep, int quoted) {
+    for (size_t i = from; i < to; i++) {
+        if (i > from) {
+            put_param_separator(b, sep == '@', quoted);
+        }
+        put_value(b, l->items[i], quoted);
+    }
+    b->at_empty |= from == to && sep == '@' && quoted;
+}
+
+// ${...} の中の単語 (既定値・パターン・置換文字列) を展開する
+static char* expand_part(const char *s, size_t len, ExpandMode mode) {
+    char *raw = strndup(s, len);
+    if (raw == NULL) {
+        return NULL;
+    }
+    char *out = mode == EXPAND_PATTERN ? expand_word_pattern(raw) : expand_word_string(raw);
+    free(raw);
+    return out;
+}
+
+// 置換のパターンの終わり (引用されていない '/') を探す
+static const char* pattern_end(const char *p, const char *end) {
+    while (p < end && *p != '/') {
+        if (*p == '\\' && p + 1 < end) {
+            p += 2;
+        } else if (*p == '\'' || *p == '"') {
+            const char *q = memchr(p + 1, *p, (size_t)(end - p - 1));
+            p = q ? q + 1 : end;
+        } else if (*p == '$' && p + 1 < end && (p[1] == '(' || p[1] == '{')) {
+            const char *close = p[1] == '(' ? scan_command_subst(p + 2, end) : scan_brace(p + 2, end);
+            p = close ? close + 1 : end;
+        } else {
+            p++;
+        }
+    }
+    return p;
+}
+
+// ${var:offset:length} の offset と length を算術式として評価する
+static int substring_range(const char *s, const char *end, size_t n, size_t *start, size_t *count) {
+    const char *colon = s;
+    int nest = 0;
+    for (; colon < end && (*colon != ':' || nest > 0); colon++) {
+        nest += *colon == '(' ? 1 : *colon == ')' ? -1 : 0;
+    }
+    int64_t off, len = (int64_t)n;
+    if (arith_eval(s, (size_t)(colon - s), &off) != 0 ||
+        (colon < end && arith_eval(colon + 1, (size_t)(end - colon - 1), &len) != 0)) {
+        return -1;
+    }
+    if (off < 0) {
+        off = (int64_t)n + off < 0 ? 0 : (int64_t)n + off;
+    }
+    if ((size_t)off > n) {
+        off = (int64_t)n;
+    }
+    if (len < 0) {
+        len = (int64_t)n + len - off; // 負の長さは末尾からの位置
+        if (len < 0) {
+            fprintf(stderr, "myshell: %.*s: substring expression < 0\n", (int)(end - colon - 1), colon + 1);
+            return -1;
+        }
+    }
+    *start = (size_t)off;
+    *count = (size_t)len < n - (size_t)off ? (size_t)len : n - (size_t)off;
+    return 0;
+}
+
+// パターンを使う編集 (${name#pat} ${name/pat/rep} ${name^^pat} など) の内容
+typedef struct BraceEdit {
+    char kind;              // '#' '%' '/' '^' ','
+    int twice;              // ## %% // ^^ ,,
+    int anchor;             // ${name/#pat/rep} は '#'、${name/%pat/rep} は '%'
+    const GlobMatcher *m;   // NULLならパターンなし
+    const char *rep;
+} BraceEdit;
+
+// 値を編集した結果を追加する。値の一部をそのまま写すので途中の文字列を作らない
+static void put_edited(ExpBuf *b, const char *value, const BraceEdit *e, int quoted) {
+    size_t n = strlen(value);
+    if (e->kind == '#' || e->kind == '%') {
+        ssize_t cut = glob_matcher_anchored(e->m, value, n, e->kind == '%', e->twice);
+        cut = cut < 0 ? 0 : cut;
+        put_value_len(b, value + (e->kind == '#' ? (size_t)cut : 0), n - (size_t)cut, quoted);
+        return;
+    }
+    if (e->kind == '^' || e->kind == ',') {
+        for (size_t i = 0; i < n; i++) {
+            char c = value[i];
+            if ((i == 0 || e->twice) && (e->m == NULL || glob_matcher_match(e->m, &c, 1))) {
+                c = (char)(e->kind == '^' ? toupper((unsigned char)c) : tolower((unsigned char)c));
+            }
+            buf_putc(b, c, quoted ? EF_QUOTED : EF_SPLIT);
+        }
+        return;
+    }
+    size_t i = 0;
+    if (e->anchor) {
+        // 空のパターンは先頭 (末尾) の長さ0の部分に一致する: ${v/#/pre-} は前に付け足す
+        ssize_t hit = e->m != NULL ? glob_matcher_anchored(e->m, value, n, e->anchor == '%', 1) : 0;
+        if (hit >= 0) {
+            size_t at = e->anchor == '%' ? n - (size_t)hit : 0;
+            put_value_len(b, value, at, quoted);
+            put_value(b, e->rep, quoted);
+            i = at + (size_t)hit;
+        }
+    } else if (e->m != NULL) { // 空のパターンは何も置き換えない
+        size_t start;
+        ssize_t hit;
+        while (i < n && (hit = glob_matcher_search(e->m, value + i, n - i, &start)) > 0) {
+            put_value_len(b, value + i, start, quoted);
+            put_value(b, e->rep, quoted);
+            i += start + (size_t)hit;
+            if (!e->twice) {
+                break;
+            }
+        }
+    }
+    put_value_len(b, value + i, n - i, quoted);
+}
+
+/**
+ * @brief ${...} を展開する
+ *
+ * ${#name}、${name:-word} などの既定値、${name#pat} ${name%pat} の除去、
+ * ${name/pat/rep} の置換、${name:off:len} の部分文字列、${name^^} などの大文字・小文字の変換。
+ * 配列は ${a[i]}、${a[@]}、${#a[@]}、${!a[@]} (添字の並び)。
+ * パターンは case と同じコンパイル済みのマッチャーで照合する。
+ * $@・$*・${a[@]} では要素の1つずつに適用する (${@:off:len} は添字の範囲)。
+ *
+ * @param s "${" の直後
+ * @param end 対応する '}'
+ */
+static void expand_brace(ExpBuf *b, const char *s, const char *end, int quoted) {
+    const char *whole = s;
+    int length = 0, keys = 0;
+    if (s[0] == '#' && end - s > 1) {
+        length = 1; // ${#name}
+        s++;
+    } else if (s[0] == '!' && end - s > 1) {
+        keys = 1; // ${!a[@]}
+        s++;
+    }
+    const char *q = s;
+    if (q < end && strchr("?$#@*!-", *q) != NULL) {
+        q++;
+    } else if (q < end && isdigit((unsigned char)*q)) {
+        while (q < end && isdigit((unsigned char)*q)) {
+            q++;
+        }
+    } else {
+        while (q < end && (isalnum((unsigned char)*q) || *q == '_')) {
+            q++;
+        }
+    }
+    size_t len = (size_t)(q - s);
+    int named = len > 0 && var_is_name(s, len);
+    const char *sub = NULL;
+    size_t sub_len = 0;
+    if (named && q < end && *q == '[') {
+        int nest = 0;
+        const char *close = q + 1;
+        for (; close < end && (*close != ']' || nest > 0); close++) {
+            nest += *close == '[' ? 1 : *close == ']' ? -1 : 0;
+        }
+        if (close < end) {
+            sub = q + 1;
+            sub_len = (size_t)(close - sub);
+            q = close + 1;
+        }
+    }
+    int sub_all = sub != NULL && sub_len == 1 && (*sub == '@' || *sub == '*');
+    if (len == 0 || ((length || keys) && q != end) || (keys && !sub_all) ||
+        (isalpha((unsigned char)*s) && !named)) {
+        fprintf(stderr, "myshell: ${%.*s}: bad substitution\n", (int)(end - whole), whole);
+        b->failed = 1;
+        return;
+    }
+    if (q == end && !length && !keys && sub == NULL) {
+        put_param(b, s, len, quoted);
+        return;
+    }
+
+    // 値 (または要素の並び) を得る
+    int list = sub_all || (sub == NULL && len == 1 && (*s == '@' || *s == '*'));
+    char sep = sub_all ? *sub : *s;
+    char tmp[128];
+    ParamList l = {0};
+    const char *value = NULL;
+    if (list) {
+        if (sub != NULL) {
+            memcpy(tmp, s, len);
+            tmp[len] = '\0';
+        }
+        if (list_collect(&l, sub ? tmp : NULL, keys) != 0) {
+            b->failed = 1;
+            return;
+        }
+    } else if (sub != NULL) {
+        int error;
+        memcpy(tmp, s, len);
+        tmp[len] = '\0';
+        value = var_get_element(tmp, sub, sub_len, &error);
+        if (error) {
+            b->failed = 1;
+            return;
+        }
+    } else {
+        value = param_lookup(s, len, tmp, sizeof(tmp));
+    }
+    size_t n = value ? strlen(value) : 0;
+    if (length) {
+        snprintf(tmp, sizeof(tmp), "%zu", list ? l.count : n);
+        put_value(b, tmp, quoted);
+        list_free(&l);
+        return;
+    }
+    if (q == end) {
+        if (list) {
+            put_list(b, &l, 0, l.count, sep, quoted);
+        } else {
+            put_value_len(b, value ? value : "", n, quoted);
+        }
+        list_free(&l);
+        return;
+    }
+
+    // ${name:-word} ${name-word} など
+    int colon = *q == ':';
+    const char *op = q + colon;
+    if (op < end && strchr("-=+?", *op) != NULL) {
+        int is_set = list ? l.count > 0 : value != NULL;
+        int is_null = list ? l.count == 0 || (l.count == 1 && l.items[0][0] == '\0') : n == 0;
+        int use_word = *op == '+' ? (is_set && !(colon && is_null)) : (!is_set || (colon && is_null));
+        if (!use_word) {
+            if (*op != '+' && list) {
+                put_list(b, &l, 0, l.count, sep, quoted);
+            } else if (*op != '+') {
+                put_value_len(b, value, n, quoted);
+            }
+            list_free(&l);
+            return;
+        }
+        list_free(&l);
+        char *word = expand_part(op + 1, (size_t)(end - op - 1), EXPAND_STRING);
+        if (word == NULL) {
+            b->failed = 1;
+            return;
+        }
+        if (*op == '?') {
+            fprintf(stderr, "myshell: %.*s: %s\n", (int)(q - s), s, word[0] ? word : "parameter null or not set");
+            b->failed = 1;
+        } else if (*op == '=') {
+            if (!named || list) {
+                fprintf(stderr, "myshell: $%.*s: cannot assign in this way\n", (int)(q - s), s);
+                b->failed = 1;
+            } else {
+                var_assign(s, (size_t)(q - s), word);
+                put_value(b, word, quoted);
+            }
+        } else {
+            put_value(b, word, quoted);
+        }
+        free(word);
+        return;
+    }
+    if (value == NULL) {
+        value = "";
+    }
+    if (colon && !list) {
+        size_t start, count;
+        if (substring_range(q + 1, end, n, &start, &count) != 0) {
+            b->failed = 1;
+        } else {
+            put_value_len(b, value + start, count, quoted);
+        }
+        return;
+    }
+    if (colon) {
+        // ${@:off:len} と ${a[@]:off:len}: 添字が off 以上の要素から len 個
+        int64_t limit = sub ? (l.count ? l.indexes[l.count - 1] + 1 : 0) : (int64_t)l.count + 1;
+        size_t start, count;
+        if (substring_range(q + 1, end, (size_t)limit, &start, &count) != 0) {
+            b->failed = 1;
+        } else {
+            if (sub == NULL && start == 0 && count > 0) {
+                put_value(b, var_positional(0), quoted); // ${@:0} は $0 から
+                if (--count > 0 && l.count > 0) {
+                    put_param_separator(b, sep == '@', quoted);
+                }
+            }
+            size_t from = 0;
+            while (from < l.count && l.indexes[from] < (int64_t)start) {
+                from++;
+            }
+            put_list(b, &l, from, from + count < l.count ? from + count : l.count, sep, quoted);
+        }
+        list_free(&l);
+        return;
+    }
+
+    // 残りはパターンを使う編集
+    BraceEdit e = {*q, q + 1 < end && q[1] == *q, 0, NULL, NULL};
+    const char *pat = q + 1 + e.twice;
+    const char *pat_end = end;
+    if (e.kind == '/') {
+        if (!e.twice && pat < end && (*pat == '#' || *pat == '%')) {
+            e.anchor = *pat++;
+        }
+        pat_end = pattern_end(pat, end);
+    } else if (strchr("#%^,", e.kind) == NULL) {
+        fprintf(stderr, "myshell: ${%.*s}: bad substitution\n", (int)(end - whole), whole);
+        b->failed = 1;
+        list_free(&l);
+        return;
+    }
+    if (pat < pat_end || e.kind == '#' || e.kind == '%') {
+        char *pattern = expand_part(pat, (size_t)(pat_end - pat), EXPAND_PATTERN);
+        e.m = pattern ? pattern_matcher(pattern) : NULL;
+        free(pattern);
+        if (e.m == NULL) {
+            b->failed = 1;
+            list_free(&l);
+            return;
+        }
+    }
+    char *rep = NULL;
+    if (e.kind == '/') {
+        rep = pat_end < end ? expand_part(pat_end + 1, (size_t)(end - pat_end - 1), EXPAND_STRING) : strdup("");
+        if (rep == NULL) {
+            b->failed = 1;
+            list_free(&l);
+            return;
+        }
+        e.rep = rep;
+    }
+    if (!list) {
+        put_edited(b, value, &e, quoted);
+    } else {
+        for (size_t i = 0; i < l.count; i++) {
+            if (i > 0) {
+                put_param_separator(b, sep == '@', quoted);
+            }
+            put_edited(b, l.items[i], &e, quoted);
+        }
+        b->at_empty |= l.count == 0 && sep == '@' && quoted;
+    }
+    free(rep);
+    list_free(&l);
+}
+
+/**
+ * @brief '$' から始まる展開を処理する
+ * @return 展開の直後の位置
+ */
+static const char* expand_dollar(ExpBuf *b, const char *p, int quoted) {
+    const char *end = p + strlen(p);
+    if (p[1] == '(' && p[2] == '(') {
+        // $(( 式 )) (閉じ括弧が "))" でなければ $( (...) ) のコマンド置換)
+        const char *close = scan_command_subst(p + 3, end);
+        if (close != NULL && close[1] == ')') {
+            int64_t value;
+            if (arith_eval(p + 3, (size_t)(close - p - 3), &value) != 0) {
+                b->failed = 1;
+                return close + 2;
+            }
+            char num[32];
+            snprintf(num, sizeof(num), "%lld", (long long)value);
+            put_value(b, num, quoted);
+            return close + 2;
+        }
+    }
+    if (p[1] == '(') {
+        const char *close = scan_command_subst(p + 2, end);
+        if (close == NULL) {
+            buf_putc(b, '$', quoted ? EF_QUOTED : 0);
+            return p + 1;
+        }
+        put_substitution(b, p + 2, (size_t)(close - p - 2), quoted);
+        return close + 1;
+    }
+    if (p[1] == '{') {
+        const char *close = scan_brace(p + 2, end);
+        if (close == NULL) {
+            buf_putc(b, '$', quoted ? EF_QUOTED : 0);
+            return p + 1;
+        }
+        expand_brace(b, p + 2, close, quoted);
+        return close + 1;
+    }
+    if (p[1] != '\0' && strchr("?$#@*!-", p[1]) != NULL) {
+        put_param(b, p + 1, 1, quoted);
+        return p + 2;
+    }
+    if (isdigit((unsigned char)p[1])) {
+        put_param(b, p + 1, 1, quoted);
+        return p + 2;
+    }
+    size_t len = 0;
+    while (isalnum((unsigned char)p[1 + len]) || p[1 + len] == '_') {
+        len++;
+    }
+    if (len == 0 || !var_is_name(p + 1, len)) {
+        buf_putc(b, '$', quoted ? EF_QUOTED : 0);
+        return p + 1;
+    }
+    put_param(b, p + 1, len, quoted);
+    return p + 1 + len;
+}
+
+// `...` のコマンド置換。\` \\ \$ のエスケープを外してから実行する
+static const char* expand_backquote(ExpBuf *b, const char *p, int quoted) {
+    const char *q = p + 1;
+    char *text = (char *)malloc(strlen(q) + 1);
+    size_t len = 0;
+    if (text == NULL) {
+        b->failed = 1;
+        return q + strlen(q);
+    }
+    for (; *q && *q != '`'; q++) {
+        if (*q == '\\' && (q[1] == '`' || q[1] == '\\' || q[1] == '$')) {
+            q++;
+        }
+        text[len++] = *q;
+    }
+    put_substitution(b, text, len, quoted);
+    free(text);
+    return *q == '`' ? q + 1 : q;
+}
+
+// <(...) と >(...) のプロセス置換。/dev/fd/N に置き換える
+static const char* expand_process_subst(ExpBuf *b, const char *p) {
+    const char *end = p + strlen(p);
+    const char *close = scan_command_subst(p + 2, end);
+    if (close == NULL) {
+        buf_putc(b, *p, 0);
+        return p + 1;
+    }
+    char *path = process_substitute(p + 2, (size_t)(close - p - 2), *p == '>');
+    if (path == NULL) {
+        b->failed = 1;
+        return close + 1;
+    }
+    buf_puts(b, path, EF_QUOTED);
+    free(path);
+    return close + 1;
+}
+
+// 単語の先頭の ~ と ~user
+static const char* expand_tilde(ExpBuf *b, const char *p) {
+    size_t len = strcspn(p + 1, "/");
+    for (size_t i = 1; i <= len; i++) {
+        if (strchr("'\"\\$`", p[i]) != NULL) {
+            return p; // 引用されたユーザー名は展開しない
+        }
+    }
+    const char *home = NULL;
+    if (len == 0) {
+        home = var_get("HOME");
+    } else {
+        char *user = strndup(p + 1, len);
+        struct passwd *pw = user ? getpwnam(user) : NULL;
+        free(user);
+        home = pw ? pw->pw_dir : NULL;
+    }
+    if (home == NULL) {
+        return p;
+    }
+    buf_puts(b, home, EF_QUOTED);
+    return p + 1 + len;
+}
+
+static void expand_raw(ExpBuf *b, const char *raw, ExpandMode mode) {
+    const char *p = raw;
+    int dq = 0;
+    if (mode != EXPAND_HEREDOC && *p == '~') {
+        p = expand_tilde(b, p);
+    }
+    while (*p && !b->failed) {
+        char c = *p;
+        if (mode == EXPAND_HEREDOC) {
+            if (c == '\\' && (p[1] == '$' || p[1] == '`' || p[1] == '\\')) {
+                buf_putc(b, p[1], EF_QUOTED);
+                p += 2;
+            } else if (c == '$') {
+                p = expand_dollar(b, p, 1);
+            } else if (c == '`') {
+                p = expand_backquote(b, p, 1);
+            } else {
+                buf_putc(b, c, EF_QUOTED);
+                p++;
+            }
+            continue;
+        }
+        if (!dq) {
+            if (c == '\'') {
+                b->has_quote = 1;
+                for (p++; *p && *p != '\''; p++) {
+                    buf_putc(b, *p, EF_QUOTED);
+                }
+                p += *p == '\'';
+            } else if (c == '"') {
+                b->has_quote = 1;
+                dq = 1;
+                p++;
+            } else if (c == '\\') {
+                if (p[1] == '\n') {
+                    p += 2; // 行の継続
+                } else if (p[1] != '\0') {
+                    buf_putc(b, p[1], EF_QUOTED);
+                    p += 2;
+                } else {
+                    buf_putc(b, c, EF_QUOTED);
+                    p++;
+                }
+            } else if (c == '$') {
+                p = expand_dollar(b, p, 0);
+            } else if (c == '`') {
+                p = expand_backquote(b, p, 0);
+            } else if ((c == '<' || c == '>') && p[1] == '(') {
+                p = expand_process_subst(b, p);
+            } else {
+                buf_putc(b, c, 0);
+                p++;
+            }
+        } else {
+            if (c == '"') {
+                dq = 0;
+                p++;
+            } else if (c == '\\' && p[1] != '\0' && strchr("$`\"\\\n", p[1]) != NULL) {
+                if (p[1] != '\n') {
+                    buf_putc(b, p[1], EF_QUOTED);
+                }
+                p += 2;
+            } else if (c == '$') {
+                p = expand_dollar(b, p, 1);
+            } else if (c == '`') {
+                p = expand_backquote(b, p, 1);
+            } else {
+                buf_putc(b, c, EF_QUOTED);
+                p++;
+            }
+        }
+    }
+}
+
+// 区切りや "$@" の印を空白にして1つの文字列にまとめる
+static char* buf_to_string(ExpBuf *b) {
+    char *out = (char *)malloc(b->len + 1);
+    if (out == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < b->len; i++) {
+        out[i] = (b->f[i] & EF_BREAK) ? ' ' : b->s[i];
+    }
+    out[b->len] = '\0';
+    return out;
+}
+
+static int is_glob_char(char c) {
+    return c == '*' || c == '?' || c == '[' || c == ']' || c == '\\';
+}
+
+// [start, end) を、引用された特殊文字を \ でエスケープしたパターンにする
+static char* slice_to_pattern(ExpBuf *b, size_t start, size_t end) {
+    char *out = (char *)malloc((end - start) * 2 + 1);
+    if (out == NULL) {
+        return NULL;
+    }
+    char *o = out;
+    for (size_t i = start; i < end; i++) {
+        if (b->f[i] & EF_BREAK) {
+            continue;
+        }
+        if ((b->f[i] & EF_QUOTED) && is_glob_char(b->s[i])) {
+            *o++ = '\\';
+        }
+        *o++ = b->s[i];
+    }
+    *o = '\0';
+    return out;
+}
+
+typedef struct Fields {
+    char **items;
+    size_t count, cap;
+    int failed;
+} Fields;
+
+static void fields_push(Fields *fl, char *s) {
+    if (s == NULL) {
+        fl->failed = 1;
+        return;
+    }
+    if (fl->count + 1 >= fl->cap) {
+        size_t new_cap = fl->cap ? fl->cap * 2 : 8;
+        char **tmp = (char **)realloc(fl->items, new_cap * sizeof(char *));
+        if (tmp == NULL) {
+            free(s);
+            fl->failed = 1;
+            return;
+        }
+        fl->items = tmp;
+        fl->cap = new_cap;
+    }
+    fl->items[fl->count++] = s;
+    fl->items[fl->count] = NULL;
+}
+
+// 1つのフィールドにパス名展開を行って追加する
+static void emit_field(Fields *fl, ExpBuf *b, size_t start, size_t end) {
+    int meta = 0;
+    for (size_t i = start; i < end; i++) {
+        if (!(b->f[i] & (EF_QUOTED | EF_BREAK)) && (b->s[i] == '*' || b->s[i] == '?' || b->s[i] == '[')) {
+            meta = 1;
+            break;
+        }
+    }
+    if (meta) {
+        char *pattern = slice_to_pattern(b, start, end);
+        size_t n = 0;
+        char **matched = pattern ? glob_expand(pattern, &n) : NULL;
+        free(pattern);
+        if (matched != NULL) {
+            for (size_t i = 0; i < n; i++) {
+                fields_push(fl, matched[i]);
+            }
+            free(matched);
+            return;
+        }
+    }
+    fields_push(fl, strndup(b->s + start, end - start));
+}
+
+/**
+ * @brief 単語を展開し、フィールド分割とパス名展開をした結果を返す
+ *
+ * @param raw 構文木に保存された単語
+ * @param count フィールドの数を返す
+ * @return NULL終端のフィールドの配列 (0個でも空の配列)。失敗時はNULL
+ */
+char** expand_word_fields(const char *raw, size_t *count) {
+    ExpBuf b = {0};
+    Fields fl = {0};
+    expand_raw(&b, raw, EXPAND_FIELDS);
+    if (b.failed) {
+        buf_free(&b);
+        return NULL;
+    }
+    const char *ifs = ifs_chars();
+    size_t start = 0;
+    int started = 0;
+    for (size_t i = 0; i < b.len; i++) {
+        if (b.f[i] & EF_BREAK) {
+            emit_field(&fl, &b, start, i);
+            start = i + 1;
+            started = 0;
+        } else if ((b.f[i] & EF_SPLIT) && strchr(ifs, b.s[i]) != NULL) {
+            if (started) {
+                emit_field(&fl, &b, start, i);
+            }
+            start = i + 1;
+            started = 0;
+        } else {
+            started = 1;
+        }
+    }
+    if (started || (fl.count == 0 && b.has_quote && !b.at_empty)) {
+        emit_field(&fl, &b, start, b.len);
+    }
+    buf_free(&b);
+    if (fl.failed || (fl.items == NULL && (fl.items = (char **)calloc(1, sizeof(char *))) == NULL)) {
+        for (size_t i = 0; i < fl.count; i++) {
+            free(fl.items[i]);
+        }
+        free(fl.items);
+        return NULL;
+    }
+    *count = fl.count;
+    return fl.items;
+}
+
+static char* expand_to_string(const char *raw, ExpandMode mode) {
+    ExpBuf b = {0};
+    expand_raw(&b, raw, mode);
+    char *out = NULL;
+    if (!b.failed) {
+        out = mode == EXPAND_PATTERN ? slice_to_pattern(&b, 0, b.len) : buf_to_string(&b);
+    }
+    buf_free(&b);
+    return out;
+}
+
+/**
+ * @brief 分割やパス名展開をせずに1つの文字列へ展開する (代入の値、リダイレクト先など)
+ * @return 展開した文字列。失敗時はNULL
+ */
+char* expand_word_string(const char *raw) {
+    return expand_to_string(raw, EXPAND_STRING);
+}
+
+/**
+ * @brief case のパターンとして展開する (引用された * ? [ はエスケープする)
+ */
+char* expand_word_pattern(const char *raw) {
+    return expand_to_string(raw, EXPAND_PATTERN);
+}
+
+/**
+ * @brief ヒアドキュメントの本文の $ と ` を展開する
+ */
+char* expand_heredoc(const char *body) {
+    return expand_to_string(body, EXPAND_HEREDOC);
+}
+
+/**
+ * @brief NAME=value の形の単語なら '=' の位置を返す
+ *
+ * NAME+=value (追加)、NAME[SUB]=value (配列の要素) も代入とする。
+ *
+ * @return '=' の位置。代入でなければ0
+ */
+int is_assignment_word(const char *word) {
+    const char *p = word;
+    while (isalnum((unsigned char)*p) || *p == '_') {
+        p++;
+    }
+    if (!var_is_name(word, (size_t)(p - word))) {
+        return 0;
+    }
+    if (*p == '[') {
+        int nest = 0;
+        for (p++; *p && (*p != ']' || nest > 0); p++) {
+            nest += *p == '[' ? 1 : *p == ']' ? -1 : 0;
+        }
+        if (*p++ != ']') {
+            return 0;
+        }
+    }
+    p += *p == '+' && p[1] == '=';
+    return *p == '=' ? (int)(p - word) : 0;
+}
+
+/**
+ * @brief NAME=(...) または NAME+=(...) の配列の複合代入か
+ */
+int is_compound_assignment(const char *word) {
+    int eq = is_assignment_word(word);
+    return eq > 0 && word[eq + 1] == '(' && memchr(word, '[', (size_t)eq) == NULL &&
+           word[strlen(word) - 1] == ')';
+}
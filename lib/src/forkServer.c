@@ -0,0 +1,332 @@
+#define _GNU_SOURCE /* execvpe */
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <malloc.h> /* malloc_trim (shell.h の malloc の置き換えより前に読む) */
+#include <shell.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+
+/*
+ * フォークサーバー (zygote)
+ *
+ * $MYSHELL_FORK_SERVER が設定されていると、起動の直後 (履歴やキャッシュを読み込む前) に
+ * 小さな補助プロセスを作り、外部コマンドはそこから起動する。
+ * fork のコストはページテーブルの大きさに比例するので、シェルのヒープが
+ * 履歴やキャッシュで大きくなっても、起動にかかる時間は変わらない。
+ *
+ * シェルと補助プロセスは SOCK_SEQPACKET の socketpair でつながっており、
+ * 1回の起動要求は1つのメッセージになる:
+ *   ForkRequest | [StageSched] | argv[0]\0 ... argv[argc-1]\0 | envp[0]\0 ... envp[envc-1]\0
+ * StageSched (pipesched の段の設定) は ForkRequest.sched が1のときだけ付き、子が exec の前に適用する。
+ * 標準入力・標準出力・標準エラー出力とカレントディレクトリは SCM_RIGHTS で渡す。
+ * 補助プロセスは CLONE_PARENT 付きで clone するので、起動したコマンドは
+ * シェルの子プロセスになり、シェルはいつも通り waitpid で待てる。
+ *
+ * umask やリソース制限など、fd と環境変数以外のプロセスの状態は引き継がれない
+ * (補助プロセスを作った時点のものになる)。
+ */
+
+#define FORK_SERVER_MAX_REQUEST (128 * 1024) /* これより大きい要求は直接 fork する */
+#define FORK_SERVER_FDS 4                    /* stdin, stdout, stderr, カレントディレクトリ */
+
+typedef struct ForkRequest {
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t len;               // 後ろに続く StageSched と文字列の大きさ
+    uint32_t sched;             // StageSched が付いているか
+} ForkRequest;
+
+typedef struct ForkReply {
+    int32_t pid;                // 失敗時は-1
+    int32_t error;              // 失敗時の errno
+} ForkReply;
+
+static int server_fd = -1;      // シェル側のソケット
+static pid_t server_pid = -1;
+static pid_t owner_pid = -1;    // 補助プロセスを作ったプロセス (サブシェルなどからは使わない)
+
+// NUL区切りの文字列の並びをポインタの配列にする
+static int split_strings(char *p, char *end, uint32_t count, char **out) {
+    for (uint32_t i = 0; i < count; i++) {
+        char *nul = memchr(p, '\0', (size_t)(end - p));
+        if (nul == NULL) {
+            return -1;
+        }
+        out[i] = p;
+        p = nul + 1;
+    }
+    out[count] = NULL;
+    return 0;
+}
+
+// 補助プロセスの中で起動されたコマンドの側。戻らない
+static void server_child(char **argv, char **envp, const int *fds, const StageSched *sched) {
+    // server_main で無視にしたものを戻す (無視は exec の後も残る)
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    if (fchdir(fds[3]) != 0 ||
+        dup2(fds[0], STDIN_FILENO) < 0 || dup2(fds[1], STDOUT_FILENO) < 0 ||
+        dup2(fds[2], STDERR_FILENO) < 0) {
+        perror("myshell: fork server");
+        _exit(126);
+    }
+    for (int i = 0; i < FORK_SERVER_FDS; i++) {
+        if (fds[i] > STDERR_FILENO) {
+            close(fds[i]);
+        }
+    }
+    stage_sched_apply(sched);
+    execvpe(argv[0], argv, envp);
+    int err = errno;
+    fprintf(stderr, "myshell: %s: %s\n", argv[0], err == ENOENT ? "command not found" : strerror(err));
+    _exit(err == ENOENT ? 127 : 126);
+}
+
+// 要求を1つ処理する。ソケットが閉じられたら-1を返す
+static int server_handle(int sock, char *buf) {
+    int fds[FORK_SERVER_FDS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {buf, FORK_SERVER_MAX_REQUEST};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) {
+        return 0;
+    }
+    if (n <= 0) {
+        return -1;
+    }
+    int nfds = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        nfds = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds, CMSG_DATA(cmsg), (size_t)nfds * sizeof(int));
+    }
+
+    ForkReply reply = {-1, EINVAL};
+    ForkRequest req;
+    if (nfds == FORK_SERVER_FDS && (size_t)n >= sizeof(req)) {
+        memcpy(&req, buf, sizeof(req));
+        StageSched sched;
+        size_t sched_len = req.sched ? sizeof(sched) : 0;
+        char *strings = buf + sizeof(req) + sched_len;
+        char *end = buf + n;
+        char **argv = NULL, **envp = NULL;
+        if (sched_len > 0 && (size_t)n >= sizeof(req) + sched_len) {
+            memcpy(&sched, buf + sizeof(req), sizeof(sched));
+        }
+        if (req.len == (size_t)n - sizeof(req) && req.len > sched_len && req.argc > 0 &&
+            req.argc + req.envc < FORK_SERVER_MAX_REQUEST / 2) {
+            argv = (char **)malloc((req.argc + 1) * sizeof(char *));
+            envp = (char **)malloc((req.envc + 1) * sizeof(char *));
+        }
+        if (argv != NULL && envp != NULL && split_strings(strings, end, req.argc, argv) == 0 &&
+            split_strings(argv[req.argc - 1] + strlen(argv[req.argc - 1]) + 1, end, req.envc, envp) == 0) {
+            // CLONE_PARENT: 新しいプロセスの親をシェルにする (fork と同じくメモリは複製する)
+            long pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+            if (pid == 0) {
+                server_child(argv, envp, fds, sched_len > 0 ? &sched : NULL);
+            }
+            reply.pid = (int32_t)pid;
+            reply.error = pid < 0 ? errno : 0;
+        }
+        free(argv);
+        free(envp);
+    }
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+    while (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) < 0 && errno == EINTR) {
+    }
+    return 0;
+}
+
+// 補助プロセスの本体。戻らない
+static void server_main(int sock) {
+    // 端末からの Ctrl-C はシェルと同じプロセスグループに届くので無視する
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    prctl(PR_SET_NAME, "myshell-zygote");
+    malloc_trim(0);
+    char *buf = (char *)malloc(FORK_SERVER_MAX_REQUEST);
+    if (buf == NULL) {
+        _exit(1);
+    }
+    while (server_handle(sock, buf) == 0) {
+    }
+    _exit(0);
+}
+
+/**
+ * @brief フォークサーバーを起動する
+ *
+ * なるべく早く (シェルのヒープが小さいうちに) 呼ぶ。
+ *
+ * @return 成功時0、失敗時-1
+ */
+int fork_server_start(void) {
+    if (server_fd >= 0) {
+        return 0;
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+        perror("fork server: socketpair");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork server: fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        server_main(sv[1]);
+    }
+    close(sv[1]);
+    server_fd = sv[0];
+    server_pid = pid;
+    owner_pid = getpid();
+    return 0;
+}
+
+/**
+ * @brief $MYSHELL_FORK_SERVER が設定されていればフォークサーバーを起動する
+ */
+void fork_server_init(void) {
+    const char *opt = getenv("MYSHELL_FORK_SERVER");
+    if (opt == NULL || opt[0] == '\0' || strcmp(opt, "0") == 0) {
+        return;
+    }
+    fork_server_start();
+}
+
+int fork_server_enabled(void) {
+    // fork した子 (サブシェル・コマンド置換) から起動すると、起動したプロセスが
+    // 子にならず待てないので使わない
+    return server_fd >= 0 && getpid() == owner_pid;
+}
+
+/**
+ * @brief フォークサーバーを止める (ソケットを閉じると補助プロセスは終了する)
+ */
+void fork_server_stop(void) {
+    if (!fork_server_enabled()) {
+        return;
+    }
+    close(server_fd);
+    server_fd = -1;
+    while (waitpid(server_pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+    server_pid = -1;
+}
+
+// 補助プロセスが死んでいたら使うのをやめる
+static void fork_server_lost(void) {
+    fprintf(stderr, "myshell: fork server exited; spawning directly\n");
+    fork_server_stop();
+}
+
+/**
+ * @brief フォークサーバーでコマンドを起動する
+ *
+ * 起動されたプロセスはシェルの子プロセスになる。PATH の検索は envp の PATH で行う。
+ *
+ * @param argv 実行するコマンド
+ * @param envp 環境変数
+ * @param in_fd 標準入力にするfd (-1なら今の標準入力)
+ * @param out_fd 標準出力にするfd (-1なら今の標準出力)
+ * @param err_fd 標準エラー出力にするfd (-1なら今の標準エラー出力)
+ * @param sched 子が exec の前に適用する段の設定 (NULLなら何もしない)
+ * @return 子プロセスのpid。フォークサーバーが使えないときは-1 (呼び出し側で直接 fork する)
+ */
+pid_t fork_server_spawn(char *const argv[], char *const envp[], int in_fd, int out_fd, int err_fd,
+                        const StageSched *sched) {
+    if (!fork_server_enabled() || argv[0] == NULL) {
+        return -1;
+    }
+    static char *buf = NULL;
+    if (buf == NULL && (buf = (char *)malloc(FORK_SERVER_MAX_REQUEST)) == NULL) {
+        return -1;
+    }
+    ForkRequest req = {0, 0, 0, sched != NULL};
+    size_t len = sizeof(req);
+    if (sched != NULL) {
+        memcpy(buf + len, sched, sizeof(*sched));
+        len += sizeof(*sched);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        char *const *list = pass == 0 ? argv : envp;
+        for (size_t i = 0; list[i] != NULL; i++) {
+            size_t n = strlen(list[i]) + 1;
+            if (len + n > FORK_SERVER_MAX_REQUEST) {
+                return -1;
+            }
+            memcpy(buf + len, list[i], n);
+            len += n;
+            if (pass == 0) {
+                req.argc++;
+            } else {
+                req.envc++;
+            }
+        }
+    }
+    req.len = (uint32_t)(len - sizeof(req));
+    memcpy(buf, &req, sizeof(req));
+
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd < 0) {
+        return -1;
+    }
+    int fds[FORK_SERVER_FDS] = {
+        in_fd >= 0 ? in_fd : STDIN_FILENO,
+        out_fd >= 0 ? out_fd : STDOUT_FILENO,
+        err_fd >= 0 ? err_fd : STDERR_FILENO,
+        cwd,
+    };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {buf, len};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t n;
+    while ((n = sendmsg(server_fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    close(cwd);
+    if (n < 0) {
+        if (errno == EPIPE || errno == ECONNRESET) {
+            fork_server_lost();
+        }
+        return -1;
+    }
+    ForkReply reply;
+    while ((n = recv(server_fd, &reply, sizeof(reply), 0)) < 0 && errno == EINTR) {
+    }
+    if (n != (ssize_t)sizeof(reply)) {
+        fork_server_lost();
+        return -1;
+    }
+    if (reply.pid < 0) {
+        errno = reply.error;
+        return -1;
+    }
+    return (pid_t)reply.pid;
+}
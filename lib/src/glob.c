@@ -0,0 +1,1055 @@
+#define _GNU_SOURCE /* memmem */
+#define STATS_SUBSYSTEM STATS_EXPAND
+#include <shell.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+/*
+ * パス名展開 (*, ?, [...], **)
+ *
+ * パターンは '/' で区切った要素ごとに一度だけ GlobMatcher へコンパイルする。
+ * よくある形 ("*.c", "foo*", "a*b" など) はリテラル比較だけで判定できる高速経路に落とし、
+ * それ以外は命令列を一度の走査 (最後の * への後戻りのみ) で照合する。
+ * ディレクトリは getdents64 を大きなバッファで読み、d_type を使って entry ごとの stat を避ける。
+ */
+
+#define GLOB_GETDENTS_BUF (128 * 1024) /* getdents64 の読み込みバッファ */
+#define GLOB_DIR_CACHE_SLOTS 32        /* 一覧をキャッシュするディレクトリ数 */
+#define GLOB_MAX_THREADS 4             /* ** の並列走査に使うスレッド数の上限 */
+
+typedef enum {
+    GOP_CHAR,   // 1文字
+    GOP_ANY,    // ?
+    GOP_STAR,   // *
+    GOP_CLASS   // [...]
+} GlobOpType;
+
+typedef struct GlobOp {
+    unsigned char type;
+    unsigned char ch;
+    unsigned short cls; // GOP_CLASS のときの classes の添字
+} GlobOp;
+
+typedef enum {
+    GM_LITERAL,       // メタ文字なし
+    GM_ALL,           // * のみ
+    GM_PREFIX,        // lit*
+    GM_SUFFIX,        // *lit
+    GM_PREFIX_SUFFIX, // lit*lit
+    GM_GENERAL        // それ以外
+} GlobMatcherKind;
+
+struct GlobMatcher {
+    GlobMatcherKind kind;
+    char *prefix;          // GM_LITERAL では文字列全体
+    size_t prefix_len;
+    char *suffix;
+    size_t suffix_len;
+    GlobOp *ops;
+    size_t nops;
+    size_t nstars;         // 0なら一致する長さは nops に決まる
+    unsigned char (*classes)[32]; // 256bitのビットマップ
+    size_t nclasses;
+};
+
+// ディレクトリの一覧。名前は1つの領域に詰めて持つ
+typedef struct GlobDirList {
+    char *pool;
+    size_t pool_len;
+    size_t pool_cap;
+    size_t *offsets;
+    unsigned char *types;
+    size_t count;
+    size_t cap;
+} GlobDirList;
+
+typedef struct GlobDirCache {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    GlobDirList list;
+    unsigned long last_use;
+} GlobDirCache;
+
+typedef struct StrVec {
+    char **items;
+    size_t count;
+    size_t cap;
+} StrVec;
+
+// パターンを '/' で分けた各要素
+typedef struct GlobSegment {
+    GlobMatcher *matcher; // ** の場合はNULL
+    int globstar;
+    int match_dot;        // 先頭の '.' を明示しているか
+} GlobSegment;
+
+typedef struct GlobPath {
+    GlobSegment *segs;
+    size_t nsegs;
+    int absolute;
+    int dirs_only;        // パターンが '/' で終わる
+} GlobPath;
+
+// getdents64 が返すレコード
+struct linux_dirent64 {
+    ino_t d_ino;
+    off_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static GlobDirCache glob_dir_cache[GLOB_DIR_CACHE_SLOTS];
+static unsigned long glob_dir_clock = 0;
+
+/* ---------- マッチャー ---------- */
+
+static void class_set(unsigned char *bits, unsigned char c) {
+    bits[c >> 3] |= (unsigned char)(1u << (c & 7));
+}
+
+static int class_test(const unsigned char *bits, unsigned char c) {
+    return (bits[c >> 3] >> (c & 7)) & 1;
+}
+
+// [:alpha:] などの名前付きクラスを追加する。認識できなければ0
+static int class_add_named(unsigned char *bits, const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        int (*fn)(int);
+    } named[] = {
+        {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+        {"lower", islower}, {"space", isspace}, {"punct", ispunct}, {"xdigit", isxdigit},
+        {"blank", isblank}, {"cntrl", iscntrl}, {"print", isprint}, {"graph", isgraph},
+    };
+    for (size_t i = 0; i < sizeof(named) / sizeof(named[0]); i++) {
+        if (strlen(named[i].name) == len && strncmp(named[i].name, name, len) == 0) {
+            for (int c = 0; c < 256; c++) {
+                if (named[i].fn(c)) {
+                    class_set(bits, (unsigned char)c);
+                }
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief [...] を解析してビットマップを作る
+ * @param p '[' の次の文字を指すポインタ
+ * @param end パターンの終端
+ * @param bits 結果のビットマップ
+ * @return ']' の次を指すポインタ。閉じていなければNULL
+ */
+static const char *parse_class(const char *p, const char *end, unsigned char *bits) {
+    int negate = 0;
+    memset(bits, 0, 32);
+    if (p < end && (*p == '!' || *p == '^')) {
+        negate = 1;
+        p++;
+    }
+    int first = 1;
+    while (p < end && (*p != ']' || first)) {
+        first = 0;
+        if (*p == '[' && p + 1 < end && p[1] == ':') {
+            const char *close = p + 2;
+            while (close + 1 < end && !(close[0] == ':' && close[1] == ']')) {
+                close++;
+            }
+            if (close + 1 < end && class_add_named(bits, p + 2, (size_t)(close - (p + 2)))) {
+                p = close + 2;
+                continue;
+            }
+        }
+        unsigned char lo = (unsigned char)*p;
+        if (*p == '\\' && p + 1 < end) {
+            lo = (unsigned char)*++p;
+        }
+        p++;
+        if (p + 1 < end && *p == '-' && p[1] != ']') {
+            unsigned char hi = (unsigned char)p[1];
+            if (hi == '\\' && p + 2 < end) {
+                hi = (unsigned char)p[2];
+                p++;
+            }
+            p += 2;
+            for (unsigned int c = lo; c <= hi; c++) {
+                class_set(bits, (unsigned char)c);
+            }
+        } else {
+            class_set(bits, lo);
+        }
+    }
+    if (p >= end) {
+        return NULL;
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) {
+            bits[i] = (unsigned char)~bits[i];
+        }
+    }
+    return p + 1;
+}
+
+static char *ops_to_literal(const GlobOp *ops, size_t n) {
+    char *s = (char *)malloc(n + 1);
+    if (s == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        s[i] = (char)ops[i].ch;
+    }
+    s[n] = '\0';
+    return s;
+}
+
+/**
+ * @brief パターン文字列 (スラッシュを含まない前提) をマッチャーにコンパイルする
+ *
+ * @param pattern パターンの先頭
+ * @param len パターンの長さ
+ * @return 新しく割り当てたマッチャー。呼び出し側が glob_matcher_free で解放する。失敗時はNULL。
+ */
+GlobMatcher *glob_matcher_compile(const char *pattern, size_t len) {
+    GlobMatcher *m = (GlobMatcher *)calloc(1, sizeof(GlobMatcher));
+    if (m == NULL) {
+        perror("Failed to allocate glob matcher");
+        return NULL;
+    }
+    m->ops = (GlobOp *)malloc((len + 1) * sizeof(GlobOp));
+    if (m->ops == NULL) {
+        free(m);
+        return NULL;
+    }
+    const char *p = pattern;
+    const char *end = pattern + len;
+    size_t stars = 0, others = 0;
+    while (p < end) {
+        GlobOp *op = &m->ops[m->nops];
+        if (*p == '*') {
+            p++;
+            if (m->nops > 0 && m->ops[m->nops - 1].type == GOP_STAR) {
+                continue; // 連続する * は1つにまとめる
+            }
+            op->type = GOP_STAR;
+            stars++;
+        } else if (*p == '?') {
+            p++;
+            op->type = GOP_ANY;
+            others++;
+        } else if (*p == '[') {
+            unsigned char bits[32];
+            const char *next = parse_class(p + 1, end, bits);
+            if (next == NULL) {
+                op->type = GOP_CHAR; // 閉じていない [ は通常の文字
+                op->ch = (unsigned char)*p++;
+            } else {
+                unsigned char (*cls)[32] = (unsigned char (*)[32])realloc(m->classes, (m->nclasses + 1) * 32);
+                if (cls == NULL) {
+                    glob_matcher_free(m);
+                    return NULL;
+                }
+                m->classes = cls;
+                memcpy(m->classes[m->nclasses], bits, 32);
+                op->type = GOP_CLASS;
+                op->cls = (unsigned short)m->nclasses++;
+                p = next;
+                others++;
+            }
+        } else {
+            if (*p == '\\' && p + 1 < end) {
+                p++;
+            }
+            op->type = GOP_CHAR;
+            op->ch = (unsigned char)*p++;
+        }
+        m->nops++;
+    }
+
+    // 命令列の形から高速経路を選ぶ
+    m->nstars = stars;
+    m->kind = GM_GENERAL;
+    if (others == 0) {
+        if (stars == 0) {
+            m->kind = GM_LITERAL;
+            m->prefix = ops_to_literal(m->ops, m->nops);
+            m->prefix_len = m->nops;
+        } else if (stars == 1) {
+            size_t star = 0;
+            while (m->ops[star].type != GOP_STAR) {
+                star++;
+            }
+            m->prefix = ops_to_literal(m->ops, star);
+            m->prefix_len = star;
+            m->suffix = ops_to_literal(m->ops + star + 1, m->nops - star - 1);
+            m->suffix_len = m->nops - star - 1;
+            if (m->prefix_len == 0 && m->suffix_len == 0) {
+                m->kind = GM_ALL;
+            } else if (m->suffix_len == 0) {
+                m->kind = GM_PREFIX;
+            } else if (m->prefix_len == 0) {
+                m->kind = GM_SUFFIX;
+            } else {
+                m->kind = GM_PREFIX_SUFFIX;
+            }
+        }
+        if (m->kind != GM_GENERAL && (m->prefix == NULL || (stars == 1 && m->suffix == NULL))) {
+            glob_matcher_free(m);
+            return NULL;
+        }
+    }
+    return m;
+}
+
+void glob_matcher_free(GlobMatcher *m) {
+    if (m == NULL) {
+        return;
+    }
+    free(m->prefix);
+    free(m->suffix);
+    free(m->ops);
+    free(m->classes);
+    free(m);
+}
+
+static int op_matches(const GlobMatcher *m, const GlobOp *op, unsigned char c) {
+    switch (op->type) {
+        case GOP_CHAR: return op->ch == c;
+        case GOP_ANY: return 1;
+        case GOP_CLASS: return class_test(m->classes[op->cls], c);
+        default: return 0;
+    }
+}
+
+/**
+ * @brief 長さnの文字列sがパターン全体に一致するか判定する
+ * @return 一致すれば1
+ */
+int glob_matcher_match(const GlobMatcher *m, const char *s, size_t n) {
+    switch (m->kind) {
+        case GM_LITERAL:
+            return n == m->prefix_len && memcmp(s, m->prefix, n) == 0;
+        case GM_ALL:
+            return 1;
+        case GM_PREFIX:
+            return n >= m->prefix_len && memcmp(s, m->prefix, m->prefix_len) == 0;
+        case GM_SUFFIX:
+            return n >= m->suffix_len && memcmp(s + n - m->suffix_len, m->suffix, m->suffix_len) == 0;
+        case GM_PREFIX_SUFFIX:
+            return n >= m->prefix_len + m->suffix_len &&
+                   memcmp(s, m->prefix, m->prefix_len) == 0 &&
+                   memcmp(s + n - m->suffix_len, m->suffix, m->suffix_len) == 0;
+        case GM_GENERAL:
+            break;
+    }
+
+    // 直前の * の位置だけを覚えて後戻りする (指数的な後戻りは起こらない)
+    size_t pi = 0, si = 0;
+    size_t star_pi = (size_t)-1, star_si = 0;
+    while (si < n) {
+        if (pi < m->nops && m->ops[pi].type != GOP_STAR && op_matches(m, &m->ops[pi], (unsigned char)s[si])) {
+            pi++;
+            si++;
+        } else if (pi < m->nops && m->ops[pi].type == GOP_STAR) {
+            star_pi = pi++;
+            star_si = si;
+        } else if (star_pi != (size_t)-1) {
+            pi = star_pi + 1;
+            si = ++star_si;
+        } else {
+            return 0;
+        }
+    }
+    while (pi < m->nops && m->ops[pi].type == GOP_STAR) {
+        pi++;
+    }
+    return pi == m->nops;
+}
+
+#define GLOB_NFA_WORDS 4   /* 状態の集合をスタックに置ける大きさ (64 * 4 - 1 命令まで) */
+
+// 命令列を前から (rev なら後ろから) 見たときの k 番目
+static const GlobOp *nfa_op(const GlobMatcher *m, size_t k, int rev) {
+    return &m->ops[rev ? m->nops - 1 - k : k];
+}
+
+// * は空にも一致するので、* の状態にいれば次の状態にもいる
+static void nfa_close(const GlobMatcher *m, uint64_t *set, int rev) {
+    for (size_t k = 0; k < m->nops; k++) {
+        if ((set[k / 64] >> (k % 64) & 1) && nfa_op(m, k, rev)->type == GOP_STAR) {
+            set[(k + 1) / 64] |= 1ULL << ((k + 1) % 64);
+        }
+    }
+}
+
+/**
+ * @brief 命令列を NFA として1文字ずつ進め、先頭 (rev なら末尾) から一致する長さを求める
+ *
+ * 状態は「何個目の命令まで一致したか」の集合で、1文字あたり命令数に比例する時間で進む。
+ * 集合が空になったらそれ以上長い一致はないので打ち切る。
+ */
+static ssize_t nfa_anchored(const GlobMatcher *m, const char *s, size_t n, int rev, int longest) {
+    uint64_t local[2][GLOB_NFA_WORDS];
+    size_t words = m->nops / 64 + 1;
+    uint64_t *cur = local[0], *next = local[1];
+    if (words > GLOB_NFA_WORDS) {
+        cur = (uint64_t *)malloc(2 * words * sizeof(uint64_t));
+        if (cur == NULL) {
+            return -1;
+        }
+        next = cur + words;
+    }
+    memset(cur, 0, words * sizeof(uint64_t));
+    cur[0] = 1;
+    nfa_close(m, cur, rev);
+    ssize_t best = -1;
+    for (size_t i = 0;; i++) {
+        if (cur[m->nops / 64] >> (m->nops % 64) & 1) {
+            best = (ssize_t)i;
+            if (!longest) {
+                break;
+            }
+        }
+        if (i == n) {
+            break;
+        }
+        unsigned char c = (unsigned char)s[rev ? n - 1 - i : i];
+        int alive = 0;
+        memset(next, 0, words * sizeof(uint64_t));
+        for (size_t k = 0; k < m->nops; k++) {
+            if (!(cur[k / 64] >> (k % 64) & 1)) {
+                continue;
+            }
+            const GlobOp *op = nfa_op(m, k, rev);
+            size_t to = op->type == GOP_STAR ? k : k + 1;
+            if (op->type == GOP_STAR || op_matches(m, op, c)) {
+                next[to / 64] |= 1ULL << (to % 64);
+                alive = 1;
+            }
+        }
+        if (!alive) {
+            break;
+        }
+        nfa_close(m, next, rev);
+        uint64_t *tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+    if (words > GLOB_NFA_WORDS) {
+        free(cur < next ? cur : next);
+    }
+    return best;
+}
+
+// * のないパターンが s にちょうど nops 文字で一致するか
+static int fixed_matches(const GlobMatcher *m, const char *s) {
+    for (size_t k = 0; k < m->nops; k++) {
+        if (!op_matches(m, &m->ops[k], (unsigned char)s[k])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief 文字列の先頭 (at_end なら末尾) でパターンに一致する部分の長さを求める
+ *
+ * ${var#pat} などで使う。リテラルのパターンは1回の比較で済ませる。
+ * * のないパターンは一致する長さが決まっているのでその1通りだけを調べ、
+ * それ以外は NFA で1回走査する (文字列の長さに対して線形時間)。
+ *
+ * @param at_end 末尾に一致する部分を探す
+ * @param longest 最長一致 (0なら最短一致)
+ * @return 一致した長さ。一致しなければ-1
+ */
+ssize_t glob_matcher_anchored(const GlobMatcher *m, const char *s, size_t n, int at_end, int longest) {
+    if (m->kind == GM_LITERAL) {
+        if (n < m->prefix_len) {
+            return -1;
+        }
+        const char *at = at_end ? s + n - m->prefix_len : s;
+        return memcmp(at, m->prefix, m->prefix_len) == 0 ? (ssize_t)m->prefix_len : -1;
+    }
+    if (m->kind != GM_GENERAL) {
+        // 高速経路の形は候補の長さごとの判定が定数時間 (GM_ALL・GM_PREFIX はすぐ決まる)
+        for (size_t k = 0; k <= n; k++) {
+            size_t len = longest ? n - k : k;
+            if (glob_matcher_match(m, at_end ? s + n - len : s, len)) {
+                return (ssize_t)len;
+            }
+        }
+        return -1;
+    }
+    if (m->nstars == 0) {
+        if (n < m->nops) {
+            return -1;
+        }
+        return fixed_matches(m, at_end ? s + n - m->nops : s) ? (ssize_t)m->nops : -1;
+    }
+    return nfa_anchored(m, s, n, at_end, longest);
+}
+
+/**
+ * @brief s の中でパターンに一致する最初の部分を探す (位置ごとに最長一致)
+ *
+ * ? や [...] だけのパターンは各位置を命令数の比較だけで調べる ([0-9] なら1回の走査)。
+ * * を含むパターンは各位置から NFA を進め、一致しえなくなった時点で次の位置に移る。
+ *
+ * @param start 一致した位置
+ * @return 一致した長さ (空には一致しない)。見つからなければ-1
+ */
+ssize_t glob_matcher_search(const GlobMatcher *m, const char *s, size_t n, size_t *start) {
+    if (m->kind == GM_LITERAL) {
+        const char *hit = m->prefix_len > 0 ? memmem(s, n, m->prefix, m->prefix_len) : NULL;
+        if (hit == NULL) {
+            return -1;
+        }
+        *start = (size_t)(hit - s);
+        return (ssize_t)m->prefix_len;
+    }
+    if (m->kind == GM_GENERAL && m->nstars == 0) {
+        for (size_t i = 0; i + m->nops <= n; i++) {
+            if (fixed_matches(m, s + i)) {
+                *start = i;
+                return (ssize_t)m->nops;
+            }
+        }
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        // 先頭の文字で一致しえない位置は飛ばす
+        if (m->prefix_len > 0 && (unsigned char)s[i] != (unsigned char)m->prefix[0]) {
+            continue;
+        }
+        if (m->kind == GM_GENERAL && m->nops > 0 && m->ops[0].type != GOP_STAR &&
+            !op_matches(m, &m->ops[0], (unsigned char)s[i])) {
+            continue;
+        }
+        ssize_t len = glob_matcher_anchored(m, s + i, n - i, 0, 1);
+        if (len > 0) {
+            *start = i;
+            return len;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 文字列にエスケープされていないグロブのメタ文字が含まれるか
+ */
+int glob_has_meta(const char *s) {
+    for (; *s; s++) {
+        if (*s == '\\' && s[1] != '\0') {
+            s++;
+        } else if (*s == '*' || *s == '?' || *s == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* ---------- ディレクトリの読み込み ---------- */
+
+static void dir_list_free(GlobDirList *list) {
+    free(list->pool);
+    free(list->offsets);
+    free(list->types);
+    memset(list, 0, sizeof(*list));
+}
+
+static int dir_list_push(GlobDirList *list, const char *name, unsigned char type) {
+    size_t len = strlen(name) + 1;
+    if (list->pool_len + len > list->pool_cap) {
+        size_t new_cap = list->pool_cap ? list->pool_cap * 2 : 4096;
+        while (new_cap < list->pool_len + len) {
+            new_cap *= 2;
+        }
+        char *pool = (char *)realloc(list->pool, new_cap);
+        if (pool == NULL) {
+            return -1;
+        }
+        list->pool = pool;
+        list->pool_cap = new_cap;
+    }
+    if (list->count == list->cap) {
+        size_t new_cap = list->cap ? list->cap * 2 : 64;
+        size_t *offsets = (size_t *)realloc(list->offsets, new_cap * sizeof(size_t));
+        if (offsets == NULL) {
+            return -1;
+        }
+        list->offsets = offsets;
+        unsigned char *types = (unsigned char *)realloc(list->types, new_cap);
+        if (types == NULL) {
+            return -1;
+        }
+        list->types = types;
+        list->cap = new_cap;
+    }
+    memcpy(list->pool + list->pool_len, name, len);
+    list->offsets[list->count] = list->pool_len;
+    list->types[list->count] = type;
+    list->pool_len += len;
+    list->count++;
+    return 0;
+}
+
+/**
+ * @brief getdents64 でディレクトリ全体を読み込む ("." と ".." は除く)
+ */
+static int dir_list_read(const char *path, GlobDirList *list) {
+    int fd = open(path[0] ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    char *buf = (char *)malloc(GLOB_GETDENTS_BUF);
+    if (buf == NULL) {
+        close(fd);
+        return -1;
+    }
+    int result = 0;
+    for (;;) {
+        long nread = syscall(SYS_getdents64, fd, buf, GLOB_GETDENTS_BUF);
+        if (nread <= 0) {
+            if (nread < 0) {
+                result = -1;
+            }
+            break;
+        }
+        for (long off = 0; off < nread; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+                (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+                continue;
+            }
+            if (dir_list_push(list, d->d_name, d->d_type) != 0) {
+                result = -1;
+                break;
+            }
+        }
+        if (result != 0) {
+            break;
+        }
+    }
+    free(buf);
+    close(fd);
+    return result;
+}
+
+/**
+ * @brief 一覧をキャッシュから返す。ディレクトリのmtimeが変わっていれば読み直す
+ */
+static GlobDirList *dir_list_cached(const char *path) {
+    struct stat st;
+    if (stat(path[0] ? path : ".", &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    GlobDirCache *victim = &glob_dir_cache[0];
+    for (int i = 0; i < GLOB_DIR_CACHE_SLOTS; i++) {
+        GlobDirCache *dc = &glob_dir_cache[i];
+        if (dc->path != NULL && strcmp(dc->path, path) == 0) {
+            if (dc->dev == st.st_dev && dc->ino == st.st_ino &&
+                dc->mtime.tv_sec == st.st_mtim.tv_sec && dc->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                dc->last_use = ++glob_dir_clock;
+                return &dc->list;
+            }
+            victim = dc;
+            break;
+        }
+        if (dc->path == NULL || dc->last_use < victim->last_use) {
+            victim = dc;
+        }
+    }
+    free(victim->path);
+    dir_list_free(&victim->list);
+    victim->path = strdup(path);
+    if (victim->path == NULL || dir_list_read(path, &victim->list) != 0) {
+        free(victim->path);
+        victim->path = NULL;
+        dir_list_free(&victim->list);
+        return NULL;
+    }
+    victim->dev = st.st_dev;
+    victim->ino = st.st_ino;
+    victim->mtime = st.st_mtim;
+    victim->last_use = ++glob_dir_clock;
+    return &victim->list;
+}
+
+/* ---------- 展開 ---------- */
+
+static int strvec_push(StrVec *v, char *s) {
+    if (s == NULL) {
+        return -1;
+    }
+    if (v->count == v->cap) {
+        size_t new_cap = v->cap ? v->cap * 2 : 16;
+        char **items = (char **)realloc(v->items, new_cap * sizeof(char *));
+        if (items == NULL) {
+            free(s);
+            return -1;
+        }
+        v->items = items;
+        v->cap = new_cap;
+    }
+    v->items[v->count++] = s;
+    return 0;
+}
+
+static void strvec_free(StrVec *v) {
+    for (size_t i = 0; i < v->count; i++) {
+        free(v->items[i]);
+    }
+    free(v->items);
+    memset(v, 0, sizeof(*v));
+}
+
+static char *path_join(const char *dir, const char *name) {
+    size_t dlen = strlen(dir);
+    size_t nlen = strlen(name);
+    int need_slash = dlen > 0 && dir[dlen - 1] != '/';
+    char *s = (char *)malloc(dlen + need_slash + nlen + 1);
+    if (s == NULL) {
+        return NULL;
+    }
+    memcpy(s, dir, dlen);
+    if (need_slash) {
+        s[dlen] = '/';
+    }
+    memcpy(s + dlen + need_slash, name, nlen + 1);
+    return s;
+}
+
+// d_typeで判別できないときだけstatしてディレクトリか調べる
+static int entry_is_dir(const char *dir, const char *name, unsigned char type, int follow_links) {
+    if (type == DT_DIR) {
+        return 1;
+    }
+    if (type != DT_UNKNOWN && !(type == DT_LNK && follow_links)) {
+        return 0;
+    }
+    char *full = path_join(dir, name);
+    struct stat st;
+    int is_dir = full != NULL &&
+                 (follow_links ? stat(full, &st) : lstat(full, &st)) == 0 && S_ISDIR(st.st_mode);
+    free(full);
+    return is_dir;
+}
+
+static void expand_segments(const GlobPath *gp, const char *dir, size_t seg, StrVec *out, int use_cache);
+
+static void add_result(const GlobPath *gp, const char *path, StrVec *out) {
+    if (gp->dirs_only) {
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            return;
+        }
+        strvec_push(out, path_join(path, "")); // 末尾に '/' を付ける
+        return;
+    }
+    strvec_push(out, strdup(path));
+}
+
+static int list_acquire(const char *dir, int use_cache, GlobDirList *tmp, GlobDirList **list) {
+    if (use_cache) {
+        *list = dir_list_cached(dir);
+        return *list ? 0 : -1;
+    }
+    memset(tmp, 0, sizeof(*tmp));
+    if (dir_list_read(dir, tmp) != 0) {
+        dir_list_free(tmp);
+        return -1;
+    }
+    *list = tmp;
+    return 0;
+}
+
+// ** 以降を1つのディレクトリについて展開する (再帰)
+static void expand_globstar(const GlobPath *gp, const char *dir, size_t seg, StrVec *out, int use_cache) {
+    int last = seg + 1 == gp->nsegs;
+    if (!last) {
+        expand_segments(gp, dir, seg + 1, out, use_cache); // 0階層に一致する場合
+    }
+    GlobDirList tmp, *list;
+    if (list_acquire(dir, use_cache, &tmp, &list) != 0) {
+        return;
+    }
+    // キャッシュは再帰中に入れ替わる可能性があるので、先に必要な名前を取り出す
+    StrVec subdirs = {0};
+    for (size_t i = 0; i < list->count; i++) {
+        const char *name = list->pool + list->offsets[i];
+        if (name[0] == '.') {
+            continue;
+        }
+        char *full = path_join(dir, name);
+        if (full == NULL) {
+            continue;
+        }
+        if (last) {
+            add_result(gp, full, out);
+        }
+        if (entry_is_dir(dir, name, list->types[i], 0)) {
+            strvec_push(&subdirs, full); // シンボリックリンクは辿らない (循環防止)
+        } else {
+            free(full);
+        }
+    }
+    if (!use_cache) {
+        dir_list_free(&tmp);
+    }
+    for (size_t i = 0; i < subdirs.count; i++) {
+        expand_globstar(gp, subdirs.items[i], seg, out, 0);
+    }
+    strvec_free(&subdirs);
+}
+
+typedef struct GlobWork {
+    const GlobPath *gp;
+    size_t seg;
+    StrVec *dirs;
+    size_t next;      // 次に処理するディレクトリの添字 (スレッド間で共有)
+} GlobWork;
+
+typedef struct GlobWorker {
+    pthread_t thread;
+    GlobWork *work;
+    StrVec out;
+} GlobWorker;
+
+static void *glob_worker_main(void *arg) {
+    GlobWorker *w = (GlobWorker *)arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&w->work->next, 1, __ATOMIC_RELAXED)) < w->work->dirs->count) {
+        expand_globstar(w->work->gp, w->work->dirs->items[i], w->work->seg, &w->out, 0);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 最上位の ** の配下を、サブディレクトリ単位で小さなスレッドプールに分配する
+ */
+static void expand_globstar_parallel(const GlobPath *gp, const char *dir, size_t seg, StrVec *out) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = ncpu > GLOB_MAX_THREADS ? GLOB_MAX_THREADS : (int)ncpu;
+    int last = seg + 1 == gp->nsegs;
+
+    GlobDirList *list = dir_list_cached(dir);
+    if (nthreads < 2 || list == NULL) {
+        expand_globstar(gp, dir, seg, out, 1);
+        return;
+    }
+    if (!last) {
+        expand_segments(gp, dir, seg + 1, out, 1);
+        list = dir_list_cached(dir); // 上の展開でキャッシュが入れ替わっている可能性がある
+        if (list == NULL) {
+            return;
+        }
+    }
+    StrVec subdirs = {0};
+    for (size_t i = 0; i < list->count; i++) {
+        const char *name = list->pool + list->offsets[i];
+        if (name[0] == '.') {
+            continue;
+        }
+        char *full = path_join(dir, name);
+        if (full == NULL) {
+            continue;
+        }
+        if (last) {
+            add_result(gp, full, out);
+        }
+        if (entry_is_dir(dir, name, list->types[i], 0)) {
+            strvec_push(&subdirs, full);
+        } else {
+            free(full);
+        }
+    }
+    if (subdirs.count < 2) {
+        for (size_t i = 0; i < subdirs.count; i++) {
+            expand_globstar(gp, subdirs.items[i], seg, out, 0);
+        }
+        strvec_free(&subdirs);
+        return;
+    }
+
+    GlobWork work = {gp, seg, &subdirs, 0};
+    GlobWorker workers[GLOB_MAX_THREADS];
+    int started = 0;
+    memset(workers, 0, sizeof(workers));
+    for (int t = 0; t < nthreads; t++) {
+        workers[t].work = &work;
+        if (pthread_create(&workers[t].thread, NULL, glob_worker_main, &workers[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        glob_worker_main(&workers[0]); // スレッドを作れなければ自分で処理する
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    for (int t = 0; t < (started ? started : 1); t++) {
+        for (size_t i = 0; i < workers[t].out.count; i++) {
+            strvec_push(out, workers[t].out.items[i]);
+        }
+        free(workers[t].out.items);
+    }
+    strvec_free(&subdirs);
+}
+
+/**
+ * @brief dir を起点に seg 番目以降の要素を展開して out に追加する
+ */
+static void expand_segments(const GlobPath *gp, const char *dir, size_t seg, StrVec *out, int use_cache) {
+    if (seg == gp->nsegs) {
+        add_result(gp, dir, out);
+        return;
+    }
+    const GlobSegment *s = &gp->segs[seg];
+    int last = seg + 1 == gp->nsegs;
+
+    if (s->globstar) {
+        if (use_cache) {
+            expand_globstar_parallel(gp, dir, seg, out);
+        } else {
+            expand_globstar(gp, dir, seg, out, 0);
+        }
+        return;
+    }
+    if (s->matcher->kind == GM_LITERAL) {
+        // メタ文字のない要素はディレクトリを読まずに連結する
+        char *full = path_join(dir, s->matcher->prefix);
+        if (full == NULL) {
+            return;
+        }
+        if (last) {
+            struct stat st;
+            if (lstat(full, &st) == 0) {
+                add_result(gp, full, out);
+            }
+        } else {
+            expand_segments(gp, full, seg + 1, out, use_cache);
+        }
+        free(full);
+        return;
+    }
+
+    GlobDirList tmp, *list;
+    if (list_acquire(dir, use_cache, &tmp, &list) != 0) {
+        return;
+    }
+    StrVec hits = {0};
+    for (size_t i = 0; i < list->count; i++) {
+        const char *name = list->pool + list->offsets[i];
+        if (name[0] == '.' && !s->match_dot) {
+            continue;
+        }
+        if (!glob_matcher_match(s->matcher, name, strlen(name))) {
+            continue;
+        }
+        if (!last && !entry_is_dir(dir, name, list->types[i], 1)) {
+            continue;
+        }
+        strvec_push(&hits, path_join(dir, name));
+    }
+    if (!use_cache) {
+        dir_list_free(&tmp);
+    }
+    for (size_t i = 0; i < hits.count; i++) {
+        if (last) {
+            add_result(gp, hits.items[i], out);
+        } else {
+            expand_segments(gp, hits.items[i], seg + 1, out, use_cache);
+        }
+    }
+    strvec_free(&hits);
+}
+
+static void glob_path_free(GlobPath *gp) {
+    for (size_t i = 0; i < gp->nsegs; i++) {
+        glob_matcher_free(gp->segs[i].matcher);
+    }
+    free(gp->segs);
+}
+
+static int glob_path_compile(const char *pattern, GlobPath *gp) {
+    memset(gp, 0, sizeof(*gp));
+    gp->absolute = pattern[0] == '/';
+    size_t plen = strlen(pattern);
+    gp->dirs_only = plen > 1 && pattern[plen - 1] == '/';
+
+    const char *p = pattern;
+    while (*p) {
+        while (*p == '/') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        const char *start = p;
+        while (*p && *p != '/') {
+            p++;
+        }
+        GlobSegment *segs = (GlobSegment *)realloc(gp->segs, (gp->nsegs + 1) * sizeof(GlobSegment));
+        if (segs == NULL) {
+            glob_path_free(gp);
+            return -1;
+        }
+        gp->segs = segs;
+        GlobSegment *s = &gp->segs[gp->nsegs];
+        memset(s, 0, sizeof(*s));
+        if (p - start == 2 && start[0] == '*' && start[1] == '*') {
+            // 連続する ** は1つで十分
+            if (gp->nsegs > 0 && gp->segs[gp->nsegs - 1].globstar) {
+                continue;
+            }
+            s->globstar = 1;
+        } else {
+            s->matcher = glob_matcher_compile(start, (size_t)(p - start));
+            if (s->matcher == NULL) {
+                glob_path_free(gp);
+                return -1;
+            }
+            s->match_dot = start[0] == '.' || (start[0] == '\\' && start[1] == '.');
+        }
+        gp->nsegs++;
+    }
+    return 0;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief パス名パターンを展開する
+ *
+ * @param pattern 展開するパターン
+ * @param count 一致したパスの数を格納するポインタ
+ * @return 辞書順に並べたパスの配列。一致しない場合やメタ文字がない場合はNULL。
+ * 呼び出し側は free_split_tokens で解放する必要があります。
+ */
+char **glob_expand(const char *pattern, size_t *count) {
+    *count = 0;
+    if (pattern == NULL || !glob_has_meta(pattern)) {
+        return NULL;
+    }
+    GlobPath gp;
+    if (glob_path_compile(pattern, &gp) != 0) {
+        return NULL;
+    }
+    StrVec out = {0};
+    expand_segments(&gp, gp.absolute ? "/" : "", 0, &out, 1);
+    glob_path_free(&gp);
+    if (out.count == 0) {
+        free(out.items);
+        return NULL;
+    }
+    qsort(out.items, out.count, sizeof(char *), compare_strings);
+    *count = out.count;
+    return out.items;
+}
@@ -1,3 +1,4 @@
+#define STATS_SUBSYSTEM STATS_PARSE
 #include <shell.h>
 
 void appendCommand(struct Command** head, char **argv, char *redirect_in, char *redirect_out) {
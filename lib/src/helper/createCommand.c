@@ -1,3 +1,4 @@
+#define STATS_SUBSYSTEM STATS_PARSE
 #include <shell.h>
 
 Command* create_command_node(void) {
@@ -12,6 +13,12 @@ Command* create_command_node(void) {
     new_cmd->redirect_out = NULL;
     new_cmd->append_mode = T_WORD; // デフォルト値（リダイレクトなしを示す）
     new_cmd->heredoc_delimiter = NULL;
+    new_cmd->heredoc_body = NULL;
+    new_cmd->assigns = NULL;
+    new_cmd->array_assigns = NULL;
+    new_cmd->program = NULL;
+    new_cmd->node = 0;
+    new_cmd->subst_status = -1;
     new_cmd->next = NULL;
     return new_cmd;
 }
\ No newline at end of file
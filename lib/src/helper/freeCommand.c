@@ -1,3 +1,4 @@
+#define STATS_SUBSYSTEM STATS_PARSE
 #include <shell.h>
 void free_command(Command* cmd) {
     if (cmd == NULL) {
@@ -13,6 +14,19 @@ void free_command(Command* cmd) {
     free(cmd->redirect_in);
     free(cmd->redirect_out);
     free(cmd->heredoc_delimiter);
+    free(cmd->heredoc_body);
+    if (cmd->assigns) {
+        for (int i = 0; cmd->assigns[i] != NULL; i++) {
+            free(cmd->assigns[i]);
+        }
+        free(cmd->assigns);
+    }
+    if (cmd->array_assigns) {
+        for (int i = 0; cmd->array_assigns[i] != NULL; i++) {
+            free(cmd->array_assigns[i]);
+        }
+        free(cmd->array_assigns);
+    }
     free(cmd); // Command構造体自体を解放
 }
 
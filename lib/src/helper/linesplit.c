@@ -1,3 +1,4 @@
+#define STATS_SUBSYSTEM STATS_LEX
 #include <shell.h>
 
 /**
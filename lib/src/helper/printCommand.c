@@ -1,3 +1,4 @@
+#define STATS_SUBSYSTEM STATS_PARSE
 #include <shell.h>
 
 // Command構造体の内容を表示するヘルパー関数 (デバッグ用)
@@ -5,23 +6,23 @@ void print_command_list(Command* head) {
     int cmd_index = 0;
     Command* current_cmd = head;
     while (current_cmd != NULL) {
-        printf("--- Command %d ---\n", cmd_index++);
-        printf("  argv: { ");
+        out_printf("--- Command %d ---\n", cmd_index++);
+        out_printf("  argv: { ");
         if (current_cmd->argv) {
             for (int i = 0; current_cmd->argv[i] != NULL; i++) {
-                printf("\"%s\"%s", current_cmd->argv[i], current_cmd->argv[i+1] != NULL ? ", " : "");
+                out_printf("\"%s\"%s", current_cmd->argv[i], current_cmd->argv[i+1] != NULL ? ", " : "");
             }
         }
-        printf(" }\n");
-        printf("  redirect_in: %s\n", current_cmd->redirect_in ? current_cmd->redirect_in : "(null)");
-        printf("  redirect_out: %s (Mode: %s)\n", 
-               current_cmd->redirect_out ? current_cmd->redirect_out : "(null)",
-               current_cmd->redirect_out ? token_type_to_string(current_cmd->append_mode) : "(N/A)");
-        printf("  heredoc_delimiter: %s\n", current_cmd->heredoc_delimiter ? current_cmd->heredoc_delimiter : "(null)");
+        out_printf(" }\n");
+        out_printf("  redirect_in: %s\n", current_cmd->redirect_in ? current_cmd->redirect_in : "(null)");
+        out_printf("  redirect_out: %s (Mode: %s)\n", 
+                   current_cmd->redirect_out ? current_cmd->redirect_out : "(null)",
+                   current_cmd->redirect_out ? token_type_to_string(current_cmd->append_mode) : "(N/A)");
+        out_printf("  heredoc_delimiter: %s\n", current_cmd->heredoc_delimiter ? current_cmd->heredoc_delimiter : "(null)");
         
         current_cmd = current_cmd->next;
         if (current_cmd != NULL) {
-            printf("  -> Piped to next command\n");
+            out_printf("  -> Piped to next command\n");
         }
     }
 } 
\ No newline at end of file
@@ -1,3 +1,4 @@
+#define STATS_SUBSYSTEM STATS_LEX
 #include <shell.h>
 
 void free_split_tokens(char** tokens, size_t num_tokens) { // num_tokens を size_t に変更
@@ -0,0 +1,528 @@
+#define _GNU_SOURCE /* wcwidth */
+#define STATS_SUBSYSTEM STATS_COMPLETION
+#include <shell.h>
+#include <wchar.h>
+
+/*
+ * 入力中の行のシンタックスハイライト
+ *
+ * readline の再描画 (rl_redisplay_function) の後で、入力中の行を字句ごとに色を付けて
+ * 上書きする。単語の区切りは syntax.c の字句解析と同じ (syntax_scan_word)。
+ * コマンド位置の単語は組み込み・関数・PATH キャッシュで引き、見つからなければ赤にする。
+ * 実行すれば構文エラーになるもの (先頭の | や ;、リダイレクトの後の演算子、単独の &)
+ * は Enter を押す前に赤い背景で示す。
+ *
+ * 貼り付けた長い行でも1回の再描画を 1ms 以内に収めるため、前回の字句の列を残しておき、
+ * 変わった部分から字句解析をやり直して、前回と同じ字句・同じ状態に戻ったところで
+ * 残りは位置をずらして使い回す。端末への出力も、短い行を除いて変わった位置から後ろだけにする。
+ *
+ * 行が画面の幅で折り返しても描けるが、タブや制御文字を含む行と、端末の右端で
+ * ちょうど終わる行 (カーソルの位置が端末によって違う) はハイライトしない。
+ * 端末にカーソルを上げる機能 (termcap の up) がなければ、折り返す行もハイライトしない。
+ * $MYSHELL_HIGHLIGHT=0 で無効になる。
+ */
+
+#define HIGHLIGHT_FULL_REPAINT 256  /* これより短い行は毎回すべて描き直す */
+
+typedef enum {
+    HL_ARG,
+    HL_COMMAND,
+    HL_UNKNOWN,         // 見つからないコマンド
+    HL_BUILTIN,         // 組み込みコマンドとシェル関数
+    HL_RESERVED,
+    HL_ASSIGN,
+    HL_STRING,
+    HL_OPERATOR,        // | || && ; ;; ( )
+    HL_REDIRECT,        // < > >> << <<-
+    HL_TARGET,          // リダイレクト先
+    HL_COMMENT,
+    HL_ERROR
+} HlClass;
+
+static const char *const hl_colors[] = {
+    [HL_ARG] = "",
+    [HL_COMMAND] = "\033[32m",
+    [HL_UNKNOWN] = "\033[31m",
+    [HL_BUILTIN] = "\033[36m",
+    [HL_RESERVED] = "\033[1;35m",
+    [HL_ASSIGN] = "\033[34m",
+    [HL_STRING] = "\033[33m",
+    [HL_OPERATOR] = "\033[1m",
+    [HL_REDIRECT] = "\033[1m",
+    [HL_TARGET] = "\033[4m",
+    [HL_COMMENT] = "\033[90m",
+    [HL_ERROR] = "\033[97;41m",
+};
+
+// 字句の後の状態 (次の字句の解釈に使う)
+#define ST_COMMAND 0x01     // 次の単語はコマンド位置
+#define ST_TARGET 0x02      // 次の単語はリダイレクト先
+#define ST_EMPTY 0x04       // パイプラインにまだコマンドがない (ここで | や ; は構文エラー)
+#define ST_NAME 0x08        // for / case の直後 (次の単語は名前)
+#define ST_AFTER_NAME 0x10  // for / case の名前の直後 (次の in は予約語)
+#define ST_INITIAL (ST_COMMAND | ST_EMPTY)
+
+typedef struct HlToken {
+    uint32_t start, len;
+    uint8_t cls;
+    uint8_t state;          // この字句の後の状態
+} HlToken;
+
+typedef struct HlLine {
+    HlToken *tokens;
+    size_t count, cap;
+} HlLine;
+
+static HlLine current = {NULL, 0, 0};
+static char *last_text = NULL;          // current を作った行
+static size_t last_len = 0;
+static const char *last_prompt = NULL;  // 前回描いたときの rl_prompt (変われば全部描き直す)
+static int enabled = 1;
+static int can_move_up = 1;             // 端末がカーソルを上の行に動かせるか
+static rl_voidfunc_t *saved_redisplay = NULL;
+static rl_hook_func_t *saved_pre_input = NULL;
+
+#ifdef DEBUG
+static double max_update_us = 0;
+#endif
+
+static int hl_push(HlLine *l, HlToken tok) {
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 64;
+        HlToken *tmp = (HlToken *)realloc(l->tokens, cap * sizeof(HlToken));
+        if (tmp == NULL) {
+            return -1;
+        }
+        l->tokens = tmp;
+        l->cap = cap;
+    }
+    l->tokens[l->count++] = tok;
+    return 0;
+}
+
+/* ---------- 字句の分類 ---------- */
+
+static int is_reserved_word(const char *w) {
+    static const char *const words[] = {
+        "if", "then", "else", "elif", "fi", "do", "done", "while", "until",
+        "for", "case", "esac", "{", "}", "!",
+    };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (strcmp(w, words[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// コマンド位置の単語を分類する
+static HlClass classify_command(const char *w, size_t len, int quoted) {
+    char name[NAME_MAX + 1];
+    if (len > NAME_MAX) {
+        return HL_UNKNOWN;
+    }
+    memcpy(name, w, len);
+    name[len] = '\0';
+    // 引用符や展開を含む名前は実行するまで分からない
+    if (quoted || strpbrk(name, "$`") != NULL) {
+        return HL_COMMAND;
+    }
+    if (find_builtin(name) != NULL || has_function(name)) {
+        return HL_BUILTIN;
+    }
+    if (strchr(name, '/') != NULL) {
+        struct stat st;
+        return stat(name, &st) == 0 && !S_ISDIR(st.st_mode) && access(name, X_OK) == 0 ? HL_COMMAND : HL_UNKNOWN;
+    }
+    char path[MAX_PATH];
+    return path_cache_lookup(name, path, sizeof(path)) ? HL_COMMAND : HL_UNKNOWN;
+}
+
+static uint8_t classify_word(HlToken *tok, const char *w, uint8_t state, int quoted) {
+    char word[8];
+    size_t len = tok->len;
+    int short_word = len < sizeof(word) && !quoted;
+    if (short_word) {
+        memcpy(word, w, len);
+        word[len] = '\0';
+    }
+    if (state & ST_TARGET) {
+        tok->cls = HL_TARGET;
+        return state & ~ST_TARGET;
+    }
+    if (state & ST_NAME) {
+        tok->cls = HL_ARG;
+        return (state & ~(ST_NAME | ST_COMMAND | ST_EMPTY)) | ST_AFTER_NAME;
+    }
+    if ((state & ST_AFTER_NAME) && short_word && strcmp(word, "in") == 0) {
+        tok->cls = HL_RESERVED;
+        return state & ~ST_AFTER_NAME;
+    }
+    state &= ~ST_AFTER_NAME;
+    if (!(state & ST_COMMAND)) {
+        tok->cls = w[0] == '\'' || w[0] == '"' ? HL_STRING : HL_ARG;
+        return state;
+    }
+    if (short_word && is_reserved_word(word)) {
+        tok->cls = HL_RESERVED;
+        if (strcmp(word, "for") == 0 || strcmp(word, "case") == 0) {
+            return ST_NAME;
+        }
+        if (strcmp(word, "fi") == 0 || strcmp(word, "done") == 0 ||
+            strcmp(word, "esac") == 0 || strcmp(word, "}") == 0) {
+            return 0;
+        }
+        return ST_INITIAL;
+    }
+    const char *eq = memchr(w, '=', len);
+    if (eq != NULL && eq != w && var_is_name(w, (size_t)(eq - w))) {
+        tok->cls = HL_ASSIGN;
+        return (state | ST_COMMAND) & ~ST_EMPTY;
+    }
+    tok->cls = classify_command(w, len, quoted);
+    return 0;
+}
+
+/**
+ * @brief pos から字句を1つ読む
+ *
+ * @param prev 直前の字句 (なければNULL)。関数定義の名前やエラーは後から書き換える
+ * @return 字句を読んだら1、行の終わりなら0
+ */
+static int lex_token(const char *line, size_t len, size_t *pos, uint8_t state, HlToken *prev, HlToken *tok) {
+    size_t p = *pos;
+    while (p < len && (line[p] == ' ' || line[p] == '\t')) {
+        p++;
+    }
+    if (p >= len) {
+        *pos = p;
+        return 0;
+    }
+    tok->start = (uint32_t)p;
+    char c = line[p];
+    size_t n = 1;
+    int two = p + 1 < len;
+    if (c == '#') {
+        tok->cls = HL_COMMENT;
+        tok->len = (uint32_t)(len - p);
+        tok->state = state;
+        *pos = len;
+        return 1;
+    }
+    if (c == '|' || c == '&' || c == ';' || c == '(' || c == ')') {
+        n = two && line[p + 1] == c && c != '(' && c != ')' ? 2 : 1;
+        tok->cls = HL_OPERATOR;
+        int is_dsemi = c == ';' && n == 2;
+        if ((c == '&' && n == 1) || (state & ST_TARGET) ||
+            ((state & ST_EMPTY) && (c == '|' || c == '&' || c == ';') && !is_dsemi)) {
+            tok->cls = HL_ERROR;
+            if ((state & ST_TARGET) && prev != NULL) {
+                prev->cls = HL_ERROR;
+            }
+        }
+        if (c == '(' && prev != NULL && (prev->cls == HL_COMMAND || prev->cls == HL_UNKNOWN)) {
+            prev->cls = HL_BUILTIN; // name () { ...; } の関数名
+        }
+        tok->state = c == ')' ? ST_COMMAND : ST_INITIAL;
+    } else if ((c == '<' || c == '>') && !syntax_is_process_subst(line + p, line + len)) {
+        if (two && line[p + 1] == c) {
+            n = c == '<' && p + 2 < len && line[p + 2] == '-' ? 3 : 2;
+        }
+        tok->cls = HL_REDIRECT;
+        if (state & ST_TARGET) {
+            tok->cls = HL_ERROR;
+            if (prev != NULL) {
+                prev->cls = HL_ERROR;
+            }
+        }
+        tok->state = (state | ST_TARGET) & ~ST_EMPTY;
+    } else {
+        int quoted = 0;
+        const char *end = syntax_scan_word(line + p, line + len, &quoted);
+        n = end != NULL ? (size_t)(end - (line + p)) : len - p;
+        if (n == 0) {
+            n = 1; // 貼り付けた改行など、単語にならないメタ文字
+        }
+        tok->len = (uint32_t)n;
+        tok->state = classify_word(tok, line + p, state, quoted);
+        if (end == NULL) {
+            tok->cls = HL_STRING; // 閉じていない引用符
+        }
+    }
+    tok->len = (uint32_t)n;
+    *pos = p + n;
+    return 1;
+}
+
+/**
+ * @brief 前回の字句の列を使い回して、新しい行の字句の列を作る
+ * @return 色が変わったかもしれない最初のバイト位置
+ */
+static size_t relex(const char *line, size_t len) {
+    size_t prefix = 0;
+    size_t common = last_len < len ? last_len : len;
+    while (prefix < common && last_text[prefix] == line[prefix]) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix < common - prefix && last_text[last_len - 1 - suffix] == line[len - 1 - suffix]) {
+        suffix++;
+    }
+    if (prefix == len && len == last_len) {
+        return len;
+    }
+    long delta = (long)len - (long)last_len;
+    size_t old_changed_end = last_len - suffix;
+
+    // 変わった位置に触れる最初の字句の1つ前から読み直す (後の字句で書き換わることがあるため)
+    size_t r = 0;
+    while (r < current.count && current.tokens[r].start + current.tokens[r].len < prefix) {
+        r++;
+    }
+    if (r > 0) {
+        r--;
+    }
+    HlLine next = {NULL, 0, 0};
+    next.cap = current.count + 16;
+    next.tokens = (HlToken *)malloc(next.cap * sizeof(HlToken));
+    if (next.tokens == NULL) {
+        return 0;
+    }
+    memcpy(next.tokens, current.tokens, r * sizeof(HlToken));
+    next.count = r;
+    size_t repaint = prefix;
+    size_t pos = r < current.count ? current.tokens[r].start : (r > 0 ? current.tokens[r - 1].start + current.tokens[r - 1].len : 0);
+    if (pos > len) {
+        pos = len;
+    }
+    size_t j = r; // 新しい字句と同じ位置から始まる古い字句を探す
+    HlToken tok;
+    for (;;) {
+        uint8_t state = next.count > 0 ? next.tokens[next.count - 1].state : ST_INITIAL;
+        HlToken *prev = next.count > 0 ? &next.tokens[next.count - 1] : NULL;
+        uint8_t prev_cls = prev != NULL ? prev->cls : 0;
+        if (!lex_token(line, len, &pos, state, prev, &tok)) {
+            break;
+        }
+        if (prev != NULL && prev->cls != prev_cls && prev->start < repaint) {
+            repaint = prev->start;
+        }
+        if (tok.start < prefix && next.count < current.count &&
+            current.tokens[next.count].start == tok.start && current.tokens[next.count].cls != tok.cls) {
+            repaint = tok.start < repaint ? tok.start : repaint;
+        }
+        if (hl_push(&next, tok) != 0) {
+            break;
+        }
+        // 変わった部分より後ろで、前回と同じ字句・同じ状態になれば残りは使い回す
+        if (tok.start < prefix || (long)tok.start - delta < (long)old_changed_end) {
+            continue;
+        }
+        while (j < current.count && (long)current.tokens[j].start + delta < (long)tok.start) {
+            j++;
+        }
+        if (j < current.count && (long)current.tokens[j].start + delta == (long)tok.start) {
+            const HlToken *old = &current.tokens[j];
+            if (old->len == tok.len && old->cls == tok.cls && old->state == tok.state) {
+                for (size_t k = j + 1; k < current.count; k++) {
+                    HlToken moved = current.tokens[k];
+                    moved.start = (uint32_t)((long)moved.start + delta);
+                    if (hl_push(&next, moved) != 0) {
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+    }
+    free(current.tokens);
+    current = next;
+    return repaint;
+}
+
+/* ---------- 端末への出力 ---------- */
+
+/**
+ * @brief 表示したときの幅 (桁数) を返す。タブや制御文字を含めば -1
+ */
+static long display_width(const char *s, size_t n, int skip_ignored) {
+    long width = 0;
+    mbstate_t mbs;
+    memset(&mbs, 0, sizeof(mbs));
+    for (size_t i = 0; i < n;) {
+        unsigned char c = (unsigned char)s[i];
+        if (skip_ignored && c == RL_PROMPT_START_IGNORE) {
+            while (i < n && s[i] != RL_PROMPT_END_IGNORE) {
+                i++;
+            }
+            i++;
+            continue;
+        }
+        if (c < 0x80) {
+            if (c < 0x20 || c == 0x7f) {
+                return -1;
+            }
+            width++;
+            i++;
+            continue;
+        }
+        wchar_t wc;
+        size_t len = mbrtowc(&wc, s + i, n - i, &mbs);
+        if (len == (size_t)-1 || len == (size_t)-2 || len == 0) {
+            return -1;
+        }
+        int w = wcwidth(wc);
+        width += w > 0 ? w : 0;
+        i += len;
+    }
+    return width;
+}
+
+static void move_cursor(FILE *out, long from, long to, long cols) {
+    long row_from = from / cols, row_to = to / cols;
+    if (row_to < row_from) {
+        fprintf(out, "\033[%ldA", row_from - row_to);
+    } else if (row_to > row_from) {
+        fprintf(out, "\033[%ldB", row_to - row_from);
+    }
+    fputc('\r', out);
+    if (to % cols > 0) {
+        fprintf(out, "\033[%ldC", to % cols);
+    }
+}
+
+// 行の from バイト目から最後までを色付きで描き直し、カーソルを rl_point に戻す
+static void paint(const char *line, size_t len, size_t from) {
+    int rows, cols;
+    rl_get_screen_size(&rows, &cols);
+    const char *prompt = rl_display_prompt != NULL ? rl_display_prompt : "";
+    const char *last_line = strrchr(prompt, '\n');
+    last_line = last_line != NULL ? last_line + 1 : prompt;
+    long prompt_width = display_width(last_line, strlen(last_line), 1);
+    long start = display_width(line, from, 0);
+    long point = display_width(line, (size_t)rl_point, 0);
+    long end = start >= 0 ? display_width(line + from, len - from, 0) : -1;
+    if (cols <= 0 || prompt_width < 0 || start < 0 || point < 0 || end < 0) {
+        return;
+    }
+    start += prompt_width;
+    point += prompt_width;
+    end += start;
+    if (end > 0 && end % cols == 0) {
+        return;
+    }
+    if (end >= cols - 1 && !can_move_up) {
+        return; // 端末にカーソルを上げる機能がなければ readline は行を横にずらして表示する
+    }
+    FILE *out = rl_outstream != NULL ? rl_outstream : stdout;
+    move_cursor(out, point, start, cols);
+    // from を含む字句から順に色を付けて出力する
+    size_t lo = 0, hi = current.count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (current.tokens[mid].start + current.tokens[mid].len <= from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t pos = from;
+    for (size_t i = lo; i < current.count && pos < len; i++) {
+        const HlToken *tok = &current.tokens[i];
+        if (tok->start > pos) {
+            fwrite(line + pos, 1, tok->start - pos, out);
+            pos = tok->start;
+        }
+        size_t tok_end = tok->start + tok->len;
+        fputs(hl_colors[tok->cls], out);
+        fwrite(line + pos, 1, tok_end - pos, out);
+        if (hl_colors[tok->cls][0] != '\0') {
+            fputs("\033[0m", out);
+        }
+        pos = tok_end;
+    }
+    if (pos < len) {
+        fwrite(line + pos, 1, len - pos, out);
+    }
+    move_cursor(out, end, point, cols);
+    fflush(out);
+}
+
+static void highlight_redisplay(void) {
+    saved_redisplay();
+    if (!enabled || rl_line_buffer == NULL || rl_display_prompt != rl_prompt) {
+        return; // インクリメンタルサーチ中などは rl_message の表示を崩さない
+    }
+    const char *hscroll = rl_variable_value("horizontal-scroll-mode");
+    if (hscroll != NULL && strcmp(hscroll, "on") == 0) {
+        return; // 行を横にずらして表示しているときは位置が合わない
+    }
+    const char *up = rl_get_termcap("up");
+    can_move_up = up != NULL && up[0] != '\0';
+#ifdef DEBUG
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+#endif
+    size_t len = (size_t)rl_end;
+    if (last_text == NULL) {
+        last_text = strdup("");
+        last_len = 0;
+    }
+    size_t from = relex(rl_line_buffer, len);
+    char *copy = (char *)realloc(last_text, len + 1);
+    if (copy != NULL) {
+        memcpy(copy, rl_line_buffer, len);
+        copy[len] = '\0';
+        last_text = copy;
+        last_len = len;
+    }
+    // プロンプトが書き直された (prompt.c) 直後や短い行は全体を描き直す
+    if (rl_prompt != last_prompt || len <= HIGHLIGHT_FULL_REPAINT) {
+        from = 0;
+        last_prompt = rl_prompt;
+    }
+    if (from < len) {
+        paint(rl_line_buffer, len, from);
+    }
+#ifdef DEBUG
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double us = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+    if (us > max_update_us) {
+        max_update_us = us;
+    }
+#endif
+}
+
+// readline が新しい行を読み始めるたびに前回の行を忘れる
+static int highlight_pre_input(void) {
+    current.count = 0;
+    last_len = 0;
+    last_prompt = NULL;
+    return saved_pre_input != NULL ? saved_pre_input() : 0;
+}
+
+#ifdef DEBUG
+static void print_stats_at_exit(void) {
+    fprintf(stderr, "highlight: slowest redisplay %.1f us\n", max_update_us);
+}
+#endif
+
+/**
+ * @brief 再描画のフックを登録する
+ */
+void highlight_init(void) {
+    const char *opt = getenv("MYSHELL_HIGHLIGHT");
+    const char *term = getenv("TERM");
+    if ((opt != NULL && strcmp(opt, "0") == 0) || (term != NULL && strcmp(term, "dumb") == 0) ||
+        !isatty(STDOUT_FILENO)) {
+        enabled = 0;
+        return;
+    }
+    saved_redisplay = rl_redisplay_function;
+    rl_redisplay_function = highlight_redisplay;
+    saved_pre_input = rl_pre_input_hook;
+    rl_pre_input_hook = highlight_pre_input;
+#ifdef DEBUG
+    atexit(print_stats_at_exit);
+#endif
+}
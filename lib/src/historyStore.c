@@ -0,0 +1,605 @@
+#define _GNU_SOURCE /* memmem */
+#define STATS_SUBSYSTEM STATS_HISTORY
+#include <shell.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/*
+ * 永続化するコマンド履歴
+ *
+ * 履歴ファイルは追記専用で、ヘッダの後に次のレコードが並ぶ。
+ *   uint32 長さ / uint32 チェックサム / int64 時刻 / 本文 / 8バイト境界までの詰め物
+ * 起動時はファイルをmmapしてレコードの位置だけを拾い、本文はコピーしない。
+ * 逆方向検索は3文字組 (trigram) の転置索引で候補を絞る。ファイルから読んだ分の索引は
+ * 起動後に別スレッドで作り、できるまでは後ろから順に調べる。以後は追加された分だけを足す。
+ * ファイルへの書き込みも専用スレッドがまとめて行う。
+ */
+
+#define HISTORY_MAGIC "MYSHHIST"
+#define HISTORY_VERSION 1
+#define HISTORY_LOAD_COUNT 1000   /* 起動時にreadlineへ渡す件数 */
+#define HISTORY_BATCH 32          /* これだけ溜まったら待たずに書き出す */
+#define HISTORY_FLUSH_MS 200      /* 書き出しを待つ最大時間 */
+#define HISTORY_MAX_ENTRY 65536   /* 1件の最大長 */
+#define HISTORY_QUERY_MAX 256     /* 検索文字列の最大長 */
+#define HISTORY_CHUNK_BITS 16     /* 履歴の位置を持つ配列の1ブロックの大きさ (2^n件) */
+#define HISTORY_MAX_CHUNKS 65536
+
+typedef struct HistoryFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} HistoryFileHeader;
+
+typedef struct HistoryRecordHeader {
+    uint32_t len;
+    uint32_t checksum;
+    int64_t timestamp;
+} HistoryRecordHeader;
+
+typedef struct HistoryEntry {
+    const char *text;   // mmap領域またはheap上の本文 (NUL終端とは限らない)
+    uint32_t len;
+} HistoryEntry;
+
+// trigram -> 履歴番号の昇順リスト
+typedef struct Posting {
+    uint32_t key;       // 0は空きスロット
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *ids;
+} Posting;
+
+// 書き出し待ちのレコード
+typedef struct PendingRecord {
+    struct PendingRecord *next;
+    size_t size;
+    char data[];
+} PendingRecord;
+
+static char *history_path = NULL;
+static int history_fd = -1;
+static void *map_base = NULL;
+static size_t map_size = 0;
+
+// 索引スレッドが読んでいる間も動かないよう、固定長のブロック単位で確保する
+static HistoryEntry *entry_chunks[HISTORY_MAX_CHUNKS];
+static size_t entry_count = 0;
+
+static Posting *postings = NULL;
+static size_t posting_cap = 0;   // 2のべき乗
+static size_t posting_used = 0;
+static size_t indexed_upto = 0;  // ここまでの履歴番号は索引に入っている
+static pthread_t index_thread;
+static int index_thread_running = 0;
+static int index_ready = 0;      // 索引スレッドが終わったら1 (スレッド間で共有)
+
+static pthread_t writer_thread;
+static int writer_running = 0;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static PendingRecord *pending_head = NULL;
+static PendingRecord **pending_tail = &pending_head;
+static size_t pending_count = 0;
+static int writer_stop = 0;
+
+static uint32_t history_checksum(const char *s, size_t n) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t record_size(size_t len) {
+    return (sizeof(HistoryRecordHeader) + len + 7) & ~(size_t)7;
+}
+
+static HistoryEntry *entry_at(size_t id) {
+    return &entry_chunks[id >> HISTORY_CHUNK_BITS][id & ((1u << HISTORY_CHUNK_BITS) - 1)];
+}
+
+static int entries_push(const char *text, uint32_t len) {
+    size_t chunk = entry_count >> HISTORY_CHUNK_BITS;
+    if (chunk >= HISTORY_MAX_CHUNKS) {
+        return -1;
+    }
+    if (entry_chunks[chunk] == NULL) {
+        entry_chunks[chunk] = (HistoryEntry *)malloc(sizeof(HistoryEntry) << HISTORY_CHUNK_BITS);
+        if (entry_chunks[chunk] == NULL) {
+            return -1;
+        }
+    }
+    HistoryEntry *e = entry_at(entry_count);
+    e->text = text;
+    e->len = len;
+    entry_count++;
+    return 0;
+}
+
+/* ---------- trigram索引 ---------- */
+
+static uint32_t trigram_key(const char *s) {
+    return ((uint32_t)(unsigned char)s[0] << 16) | ((uint32_t)(unsigned char)s[1] << 8) |
+           (uint32_t)(unsigned char)s[2];
+}
+
+static size_t trigram_slot(uint32_t key, size_t cap) {
+    return (size_t)((key * 2654435761u) & (cap - 1));
+}
+
+static Posting *posting_find(uint32_t key) {
+    if (posting_cap == 0) {
+        return NULL;
+    }
+    for (size_t i = trigram_slot(key, posting_cap); postings[i].key != 0; i = (i + 1) & (posting_cap - 1)) {
+        if (postings[i].key == key) {
+            return &postings[i];
+        }
+    }
+    return NULL;
+}
+
+static int posting_grow(void) {
+    size_t new_cap = posting_cap ? posting_cap * 2 : 4096;
+    Posting *table = (Posting *)calloc(new_cap, sizeof(Posting));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < posting_cap; i++) {
+        if (postings[i].key == 0) {
+            continue;
+        }
+        size_t j = trigram_slot(postings[i].key, new_cap);
+        while (table[j].key != 0) {
+            j = (j + 1) & (new_cap - 1);
+        }
+        table[j] = postings[i];
+    }
+    free(postings);
+    postings = table;
+    posting_cap = new_cap;
+    return 0;
+}
+
+static void posting_add(uint32_t key, uint32_t id) {
+    if ((posting_used + 1) * 10 > posting_cap * 7 && posting_grow() != 0) {
+        return;
+    }
+    size_t i = trigram_slot(key, posting_cap);
+    while (postings[i].key != 0 && postings[i].key != key) {
+        i = (i + 1) & (posting_cap - 1);
+    }
+    Posting *p = &postings[i];
+    if (p->key == 0) {
+        p->key = key;
+        posting_used++;
+    }
+    if (p->count > 0 && p->ids[p->count - 1] == id) {
+        return; // 同じ履歴の中で繰り返し出てくるtrigram
+    }
+    if (p->count == p->cap) {
+        uint32_t new_cap = p->cap ? p->cap * 2 : 4;
+        uint32_t *ids = (uint32_t *)realloc(p->ids, new_cap * sizeof(uint32_t));
+        if (ids == NULL) {
+            return;
+        }
+        p->ids = ids;
+        p->cap = new_cap;
+    }
+    p->ids[p->count++] = id;
+}
+
+// upto より前でまだ索引に入っていない履歴を追加する
+static void index_catch_up(size_t upto) {
+    for (; indexed_upto < upto; indexed_upto++) {
+        const HistoryEntry *e = entry_at(indexed_upto);
+        for (uint32_t i = 0; i + 3 <= e->len; i++) {
+            posting_add(trigram_key(e->text + i), (uint32_t)indexed_upto);
+        }
+    }
+}
+
+// 起動時に読み込んだ分の索引を作るスレッド。終わるまで索引には触れない
+static void *index_main(void *arg) {
+    index_catch_up((size_t)arg);
+    __atomic_store_n(&index_ready, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// 索引が使えるか。索引スレッドが終わっていれば回収して最新の履歴まで追いつかせる
+static int index_usable(void) {
+    if (index_thread_running) {
+        if (!__atomic_load_n(&index_ready, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        pthread_join(index_thread, NULL);
+        index_thread_running = 0;
+    }
+    index_catch_up(entry_count);
+    return 1;
+}
+
+/**
+ * @brief before より古い履歴から query を含む最新のものを探す
+ *
+ * @param query 検索文字列
+ * @param before この履歴番号より前だけを探す
+ * @return 見つかった履歴番号。見つからなければ-1
+ */
+long history_store_search(const char *query, long before) {
+    size_t qlen = strlen(query);
+    if (before > (long)entry_count) {
+        before = (long)entry_count;
+    }
+    if (qlen == 0 || before <= 0) {
+        return -1;
+    }
+    if (qlen < 3 || !index_usable()) {
+        // trigramが作れないほど短いか索引がまだない場合は後ろから順に調べる
+        for (long id = before - 1; id >= 0; id--) {
+            const HistoryEntry *e = entry_at((size_t)id);
+            if (memmem(e->text, e->len, query, qlen) != NULL) {
+                return id;
+            }
+        }
+        return -1;
+    }
+
+    // 最も出現の少ないtrigramのリストだけを辿り、候補を本文で確かめる
+    Posting *rarest = NULL;
+    for (size_t i = 0; i + 3 <= qlen; i++) {
+        Posting *p = posting_find(trigram_key(query + i));
+        if (p == NULL) {
+            return -1;
+        }
+        if (rarest == NULL || p->count < rarest->count) {
+            rarest = p;
+        }
+    }
+    size_t lo = 0, hi = rarest->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if ((long)rarest->ids[mid] < before) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo-- > 0) {
+        const HistoryEntry *e = entry_at(rarest->ids[lo]);
+        if (memmem(e->text, e->len, query, qlen) != NULL) {
+            return (long)rarest->ids[lo];
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 履歴番号に対応する本文をNUL終端の文字列で返す
+ * @return 新しく割り当てた文字列。呼び出し側が解放する。範囲外ならNULL
+ */
+char *history_store_get(long id) {
+    if (id < 0 || (size_t)id >= entry_count) {
+        return NULL;
+    }
+    const HistoryEntry *e = entry_at((size_t)id);
+    return strndup(e->text, e->len);
+}
+
+/* ---------- 書き出しスレッド ---------- */
+
+static void write_batch(PendingRecord *batch) {
+    struct iovec iov[HISTORY_BATCH];
+    while (batch != NULL) {
+        int n = 0;
+        PendingRecord *start = batch;
+        for (; batch != NULL && n < HISTORY_BATCH; batch = batch->next) {
+            iov[n].iov_base = batch->data;
+            iov[n].iov_len = batch->size;
+            n++;
+        }
+        // O_APPENDなので他のセッションと同時に書いてもレコードは混ざらない
+        if (writev(history_fd, iov, n) < 0) {
+            perror("history: writev");
+        }
+        while (start != batch) {
+            PendingRecord *next = start->next;
+            free(start);
+            start = next;
+        }
+    }
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&writer_lock);
+    for (;;) {
+        while (pending_head == NULL && !writer_stop) {
+            pthread_cond_wait(&writer_cond, &writer_lock);
+        }
+        if (pending_head != NULL && pending_count < HISTORY_BATCH && !writer_stop) {
+            // 少し待って、続けて入力された行とまとめて書く
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += HISTORY_FLUSH_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (pending_count < HISTORY_BATCH && !writer_stop &&
+                   pthread_cond_timedwait(&writer_cond, &writer_lock, &deadline) == 0) {
+            }
+        }
+        PendingRecord *batch = pending_head;
+        pending_head = NULL;
+        pending_tail = &pending_head;
+        pending_count = 0;
+        int stop = writer_stop;
+        pthread_mutex_unlock(&writer_lock);
+        write_batch(batch);
+        pthread_mutex_lock(&writer_lock);
+        if (stop && pending_head == NULL) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&writer_lock);
+    return NULL;
+}
+
+// 行を検索対象に加える
+static int remember(const char *line, size_t len) {
+    if (len == 0 || len > HISTORY_MAX_ENTRY) {
+        return -1;
+    }
+    char *copy = strndup(line, len);
+    if (copy == NULL || entries_push(copy, (uint32_t)len) != 0) {
+        free(copy);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 他のセッションで入力された行を検索対象に加える (ファイルには書かない)
+ */
+void history_store_import(const char *line) {
+    remember(line, strlen(line));
+}
+
+/**
+ * @brief 行を履歴に追加し、ファイルへの書き出しを依頼する (ブロックしない)
+ */
+void history_store_append(const char *line) {
+    size_t len = strlen(line);
+    if (remember(line, len) != 0 || history_fd < 0) {
+        return;
+    }
+
+    size_t size = record_size(len);
+    PendingRecord *rec = (PendingRecord *)calloc(1, sizeof(PendingRecord) + size);
+    if (rec == NULL) {
+        return;
+    }
+    HistoryRecordHeader hdr = {(uint32_t)len, history_checksum(line, len), (int64_t)time(NULL)};
+    memcpy(rec->data, &hdr, sizeof(hdr));
+    memcpy(rec->data + sizeof(hdr), line, len);
+    rec->size = size;
+
+    pthread_mutex_lock(&writer_lock);
+    *pending_tail = rec;
+    pending_tail = &rec->next;
+    pending_count++;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+}
+
+/* ---------- 読み込み ---------- */
+
+/**
+ * @brief mmapした履歴ファイルからレコードの位置を拾う
+ *
+ * 途中で落ちたセッションの書きかけレコードがあった場合は、1バイトずつずらして
+ * 次の正しいレコードを探す (別のセッションが追記中の可能性があるので切り詰めない)。
+ */
+static void scan_records(const char *base, size_t size) {
+    size_t off = sizeof(HistoryFileHeader);
+    while (off + sizeof(HistoryRecordHeader) <= size) {
+        HistoryRecordHeader hdr;
+        memcpy(&hdr, base + off, sizeof(hdr));
+        size_t rsize = record_size(hdr.len);
+        const char *text = base + off + sizeof(hdr);
+        if (hdr.len == 0 || hdr.len > HISTORY_MAX_ENTRY || off + rsize > size ||
+            history_checksum(text, hdr.len) != hdr.checksum) {
+            off++;
+            continue;
+        }
+        if (entries_push(text, hdr.len) != 0) {
+            break;
+        }
+        off += rsize;
+    }
+}
+
+static int open_history_file(void) {
+    history_fd = open(history_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (history_fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(history_fd, &st) != 0) {
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(HistoryFileHeader)) {
+        HistoryFileHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, HISTORY_MAGIC, sizeof(hdr.magic));
+        hdr.version = HISTORY_VERSION;
+        if (ftruncate(history_fd, 0) != 0 || write(history_fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    map_size = (size_t)st.st_size;
+    map_base = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, history_fd, 0);
+    if (map_base == MAP_FAILED) {
+        map_base = NULL;
+        map_size = 0;
+        return -1;
+    }
+    const HistoryFileHeader *hdr = (const HistoryFileHeader *)map_base;
+    if (memcmp(hdr->magic, HISTORY_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != HISTORY_VERSION) {
+        fprintf(stderr, "history: %s is not a myshell history file\n", history_path);
+        return -1;
+    }
+    madvise(map_base, map_size, MADV_SEQUENTIAL);
+    scan_records((const char *)map_base, map_size);
+    madvise(map_base, map_size, MADV_RANDOM); // 以後は検索でランダムに参照する
+    return 0;
+}
+
+/* ---------- readline との接続 ---------- */
+
+static void show_search(const char *query, long id) {
+    char *text = history_store_get(id);
+    rl_message("(reverse-i-search)`%s': %s", query, text ? text : "");
+    free(text);
+}
+
+/**
+ * @brief Ctrl-R に割り当てる逐次逆方向検索
+ */
+static int history_isearch(int count, int key) {
+    (void)count;
+    (void)key;
+    char query[HISTORY_QUERY_MAX + 1] = "";
+    size_t qlen = 0;
+    long match = -1;
+    char *saved = rl_copy_text(0, rl_end);
+
+    show_search(query, match);
+    for (;;) {
+        int c = rl_read_key();
+        if (c == CTRL('r')) {
+            long next = history_store_search(query, match >= 0 ? match : (long)entry_count);
+            if (next >= 0) {
+                match = next;
+            } else {
+                rl_ding();
+            }
+        } else if (c == CTRL('g') || c == ESC) {
+            rl_replace_line(saved, 0);
+            rl_point = rl_end;
+            break;
+        } else if (c == RUBOUT || c == CTRL('h')) {
+            if (qlen > 0) {
+                query[--qlen] = '\0';
+                match = qlen ? history_store_search(query, (long)entry_count) : -1;
+            }
+        } else if (isprint(c) && qlen < HISTORY_QUERY_MAX) {
+            query[qlen++] = (char)c;
+            query[qlen] = '\0';
+            // 現在の一致がまだ条件を満たすならそこに留まる
+            long next = history_store_search(query, match >= 0 ? match + 1 : (long)entry_count);
+            if (next >= 0) {
+                match = next;
+            } else {
+                rl_ding();
+            }
+        } else {
+            // それ以外のキーでは一致した行を確定し、キー自体は通常どおり処理させる
+            char *text = history_store_get(match);
+            if (text != NULL) {
+                rl_replace_line(text, 0);
+                rl_point = rl_end;
+                free(text);
+            }
+            if (c == NEWLINE || c == RETURN) {
+                rl_done = 1;
+            } else {
+                rl_execute_next(c);
+            }
+            break;
+        }
+        show_search(query, match);
+    }
+    free(saved);
+    rl_clear_message();
+    rl_redisplay();
+    return 0;
+}
+
+/**
+ * @brief 履歴ファイルを開き、直近の履歴をreadlineに読み込む
+ *
+ * ファイルは $MYSHELL_HISTFILE、未設定なら ~/.myshell_history。
+ * 開けない場合でも、そのセッションの中だけの履歴として動作する。
+ */
+void history_store_init(void) {
+    const char *path = getenv("MYSHELL_HISTFILE");
+    char buf[MAX_PATH];
+    if (path == NULL || path[0] == '\0') {
+        const char *home = getenv("HOME");
+        if (home != NULL && snprintf(buf, sizeof(buf), "%s/.myshell_history", home) < (int)sizeof(buf)) {
+            path = buf;
+        }
+    }
+    rl_bind_keyseq("\\C-r", history_isearch);
+    if (path == NULL) {
+        return;
+    }
+    history_path = strdup(path);
+    if (history_path == NULL) {
+        return;
+    }
+    if (open_history_file() != 0) {
+        if (history_fd >= 0) {
+            close(history_fd);
+            history_fd = -1;
+        }
+        return;
+    }
+
+    size_t first = entry_count > HISTORY_LOAD_COUNT ? entry_count - HISTORY_LOAD_COUNT : 0;
+    for (size_t i = first; i < entry_count; i++) {
+        char *text = strndup(entry_at(i)->text, entry_at(i)->len);
+        if (text != NULL) {
+            add_history(text);
+            free(text);
+        }
+    }
+    if (entry_count > 0 &&
+        pthread_create(&index_thread, NULL, index_main, (void *)entry_count) == 0) {
+        index_thread_running = 1;
+    }
+
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) == 0) {
+        writer_running = 1;
+        atexit(history_store_close);
+    } else {
+        close(history_fd); // 書き出せないので、このセッションの履歴は保存しない
+        history_fd = -1;
+    }
+}
+
+/**
+ * @brief 書き出し待ちの履歴をすべてファイルに書いてから閉じる
+ */
+void history_store_close(void) {
+    if (writer_running) {
+        pthread_mutex_lock(&writer_lock);
+        writer_stop = 1;
+        pthread_cond_signal(&writer_cond);
+        pthread_mutex_unlock(&writer_lock);
+        pthread_join(writer_thread, NULL);
+        writer_running = 0;
+    }
+    if (history_fd >= 0) {
+        close(history_fd);
+        history_fd = -1;
+    }
+}
@@ -0,0 +1,940 @@
+#define _GNU_SOURCE /* pipe2 */
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+
+/*
+ * インタプリタ
+ *
+ * コンパイル済みの構文木 (Program) をシェル自身のプロセスで実行する。
+ * ループ・条件分岐・関数呼び出しは fork せず、ループの本体は毎回
+ * 同じノードを実行し直すだけで字句解析や構文解析はやり直さない。
+ * 外部コマンドとパイプラインだけが executor.c で fork される。
+ */
+
+#define FUNCTION_MAX_DEPTH 1000     /* 関数呼び出しの最大の深さ */
+#define SUBST_CACHE_SIZE 64         /* コンパイル済みのコマンド置換を覚えておく数 */
+#define MATCHER_CACHE_SIZE 256      /* case のパターンを覚えておく数 */
+
+pid_t shell_pid = 0;
+
+static int break_levels = 0;        // break n の残り
+static int continue_levels = 0;     // continue n の残り
+static int returning = 0;           // return が実行された
+static int return_status = 0;
+static int loop_depth = 0;          // 今の関数の中で実行中のループの数
+static int function_depth = 0;
+
+typedef struct ShellFunction {
+    char *name;                     // NULLなら空きスロット
+    Program *prog;                  // 定義を含むプログラム (参照を持つ)
+    uint32_t body;
+} ShellFunction;
+
+static ShellFunction *functions = NULL;
+static size_t function_cap = 0, function_count = 0;
+
+typedef struct CacheEntry {
+    char *key;
+    void *value;
+} CacheEntry;
+
+static CacheEntry subst_cache[SUBST_CACHE_SIZE];
+static CacheEntry matcher_cache[MATCHER_CACHE_SIZE];
+
+static size_t string_hash(const char *s, size_t len) {
+    size_t h = 5381;
+    for (size_t i = 0; i < len; i++) {
+        h = h * 33 + (unsigned char)s[i];
+    }
+    return h;
+}
+
+/* ---------- 関数 ---------- */
+
+static ShellFunction* function_slot(const char *name) {
+    if (function_cap == 0) {
+        return NULL;
+    }
+    for (size_t i = string_hash(name, strlen(name)) & (function_cap - 1);; i = (i + 1) & (function_cap - 1)) {
+        if (functions[i].name == NULL || strcmp(functions[i].name, name) == 0) {
+            return &functions[i];
+        }
+    }
+}
+
+int has_function(const char *name) {
+    ShellFunction *f = function_slot(name);
+    return f != NULL && f->name != NULL && f->prog != NULL;
+}
+
+/**
+ * @brief N_FUNCDEF ノードの関数を定義する (同じ名前があれば置き換える)
+ * @return 成功時0、失敗時-1
+ */
+int define_function(const Program *prog, uint32_t node) {
+    const Node *n = &prog->nodes[node];
+    return function_set(prog->strings + prog->words[n->word], prog, n->kids[0]);
+}
+
+/**
+ * @brief 関数を定義する (同じ名前があれば置き換える)
+ * @param prog 本体を含むプログラム (参照を1つ持つ)
+ * @param body 本体のノード
+ * @return 成功時0、失敗時-1
+ */
+int function_set(const char *name, const Program *prog, uint32_t body) {
+    if (rc_snapshot_tracing) {
+        rc_snapshot_note_function(name);
+    }
+    if ((function_count + 1) * 2 > function_cap) {
+        size_t new_cap = function_cap ? function_cap * 2 : 16;
+        ShellFunction *table = (ShellFunction *)calloc(new_cap, sizeof(ShellFunction));
+        if (table == NULL) {
+            perror("Failed to allocate function table");
+            return -1;
+        }
+        ShellFunction *old = functions;
+        size_t old_cap = function_cap;
+        functions = table;
+        function_cap = new_cap;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i].name != NULL) {
+                *function_slot(old[i].name) = old[i];
+            }
+        }
+        free(old);
+    }
+    ShellFunction *f = function_slot(name);
+    if (f->name == NULL) {
+        f->name = strdup(name);
+        if (f->name == NULL) {
+            return -1;
+        }
+        function_count++;
+    }
+    Program *old = f->prog;
+    f->prog = program_retain((Program *)prog);
+    f->body = body;
+    program_free(old);
+    return 0;
+}
+
+/**
+ * @brief 関数の定義を返す (rc のスナップショットに書き出すため)
+ * @return 定義されていれば1
+ */
+int function_definition(const char *name, const Program **prog, uint32_t *body) {
+    ShellFunction *f = function_slot(name);
+    if (f == NULL || f->name == NULL || f->prog == NULL) {
+        return 0;
+    }
+    *prog = f->prog;
+    *body = f->body;
+    return 1;
+}
+
+/**
+ * @brief 関数の定義を取り消す
+ * @return 定義されていた場合1
+ */
+int unset_function(const char *name) {
+    if (rc_snapshot_tracing) {
+        rc_snapshot_note_function(name);
+    }
+    ShellFunction *f = function_slot(name);
+    if (f == NULL || f->name == NULL || f->prog == NULL) {
+        return 0;
+    }
+    program_free(f->prog);
+    f->prog = NULL; // 名前はスロットに残す (開番地法の探索を途切れさせないため)
+    return 1;
+}
+
+/**
+ * @brief 関数が定義されていれば呼び出す
+ *
+ * @param name 関数名
+ * @param argv 引数 (argv[0] は関数名。argv[1] 以降が $1 以降になる)
+ * @param status 関数の終了ステータスを返す
+ * @return 関数を呼んだ場合1、そのような関数がなければ0
+ */
+int call_function(const char *name, char **argv, int *status) {
+    ShellFunction *f = function_slot(name);
+    if (f == NULL || f->name == NULL || f->prog == NULL) {
+        return 0;
+    }
+    if (function_depth >= FUNCTION_MAX_DEPTH) {
+        fprintf(stderr, "myshell: %s: maximum function nesting level exceeded\n", name);
+        *status = 1;
+        return 1;
+    }
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    if (vars_push_function(argc - 1, argv + 1) != 0) {
+        *status = 1;
+        return 1;
+    }
+    // 実行中に関数自身が定義し直されても消えないよう参照を持つ
+    Program *prog = program_retain(f->prog);
+    uint32_t body = f->body;
+    int saved_loop_depth = loop_depth;
+    loop_depth = 0;
+    function_depth++;
+    *status = execute_program(prog, body);
+    if (returning) {
+        *status = return_status;
+        returning = 0;
+    }
+    break_levels = continue_levels = 0;
+    function_depth--;
+    loop_depth = saved_loop_depth;
+    vars_pop_scope();
+    program_free(prog);
+    last_exit_status = *status;
+    return 1;
+}
+
+/* ---------- break / continue / return ---------- */
+
+void interp_break(int levels, int is_continue) {
+    if (levels > loop_depth) {
+        levels = loop_depth;
+    }
+    if (is_continue) {
+        continue_levels = levels;
+    } else {
+        break_levels = levels;
+    }
+}
+
+void interp_return(int status) {
+    returning = 1;
+    return_status = status;
+}
+
+int interp_in_function(void) {
+    return function_depth > 0;
+}
+
+int interp_loop_depth(void) {
+    return loop_depth;
+}
+
+// break / continue / return の途中なら1 (残りの文を実行しない)
+static int interp_pending(void) {
+    return break_levels > 0 || continue_levels > 0 || returning;
+}
+
+// ループの本体を実行した後に呼ぶ。ループを抜けるなら1を返す
+static int loop_should_exit(void) {
+    if (returning) {
+        return 1;
+    }
+    if (break_levels > 0) {
+        break_levels--;
+        return 1;
+    }
+    if (continue_levels > 0) {
+        continue_levels--;
+        return continue_levels > 0; // continue 2 なら外側のループへ
+    }
+    return 0;
+}
+
+/* ---------- コマンド置換 ---------- */
+
+static CacheEntry* cache_slot(CacheEntry *cache, size_t size, const char *key, size_t len) {
+    size_t start = string_hash(key, len) & (size - 1);
+    for (size_t n = 0, i = start; n < size; n++, i = (i + 1) & (size - 1)) {
+        if (cache[i].key == NULL || (strncmp(cache[i].key, key, len) == 0 && cache[i].key[len] == '\0')) {
+            return &cache[i];
+        }
+    }
+    return NULL; // 満杯
+}
+
+// $( ) の中身をコンパイルする。同じ文字列は一度だけコンパイルする
+static Program* compile_substitution(const char *text, size_t len) {
+    CacheEntry *slot = cache_slot(subst_cache, SUBST_CACHE_SIZE, text, len);
+    if (slot != NULL && slot->key != NULL) {
+        return program_retain((Program *)slot->value);
+    }
+    Program *prog;
+    SyntaxStatus st = syntax_compile(text, len, NULL, 0, &prog);
+    if (st != SYNTAX_OK) {
+        if (st == SYNTAX_INCOMPLETE) {
+            fprintf(stderr, "myshell: syntax error: unexpected end of command substitution\n");
+        }
+        return NULL;
+    }
+    if (slot == NULL) {
+        // 満杯なら全部捨てて作り直す
+        for (size_t i = 0; i < SUBST_CACHE_SIZE; i++) {
+            free(subst_cache[i].key);
+            program_free((Program *)subst_cache[i].value);
+            subst_cache[i].key = NULL;
+            subst_cache[i].value = NULL;
+        }
+        slot = cache_slot(subst_cache, SUBST_CACHE_SIZE, text, len);
+    }
+    slot->key = strndup(text, len);
+    if (slot->key != NULL) {
+        slot->value = program_retain(prog);
+    }
+    return prog;
+}
+
+static unsigned command_subst_runs = 0; // 実行したコマンド置換の数 (終了ステータスを拾うため)
+
+/**
+ * @brief コマンド置換 $(...) を実行し、標準出力を返す (末尾の改行は取り除く)
+ *
+ * 子プロセスの中で同じインタプリタを使って実行する。
+ *
+ * @return 出力の文字列。失敗時は空文字列 (メモリ不足時のみNULL)
+ */
+char* command_substitute(const char *text, size_t len) {
+    command_subst_runs++;
+    Program *prog = compile_substitution(text, len);
+    if (prog == NULL) {
+        last_exit_status = 2;
+        return strdup("");
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("pipe");
+        program_free(prog);
+        return strdup("");
+    }
+    out_flush();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        program_free(prog);
+        return strdup("");
+    }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        int status = execute_program(prog, prog->root);
+        out_flush();
+        fflush(stdout);
+        _exit(status);
+    }
+    close(fds[1]);
+    program_free(prog);
+    size_t used = 0, cap = 256;
+    char *out = (char *)malloc(cap);
+    ssize_t n;
+    while (out != NULL) {
+        if (used + 1 == cap) {
+            char *tmp = (char *)realloc(out, cap * 2);
+            if (tmp == NULL) {
+                free(out);
+                out = NULL;
+                break;
+            }
+            out = tmp;
+            cap *= 2;
+        }
+        n = read(fds[0], out + used, cap - used - 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+    close(fds[0]);
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {
+    }
+    last_exit_status = status_to_exit_code(wstatus);
+    if (out == NULL) {
+        return NULL;
+    }
+    while (used > 0 && out[used - 1] == '\n') {
+        used--;
+    }
+    out[used] = '\0';
+    return out;
+}
+
+/* ---------- プロセス置換 ---------- */
+
+typedef struct ProcessSubst {
+    int fd;                         // シェル側のパイプの端 (/dev/fd/N の N)
+    pid_t pid;
+    int output;                     // >(...) なら1
+} ProcessSubst;
+
+static ProcessSubst *process_substs = NULL;
+static size_t process_subst_count = 0, process_subst_cap = 0;
+static pid_t *lingering = NULL;     // 読み手が閉じた後もまだ終わっていない <(...) の生成側
+static size_t lingering_count = 0, lingering_cap = 0;
+
+/**
+ * @brief プロセス置換 <(text) / >(text) を起動する
+ *
+ * パイプの片方を子プロセスの標準出力 (>(...) なら標準入力) にして text を実行し、
+ * もう片方をシェルに残して "/dev/fd/N" を返す。生成側と読み手は同時に動くので、
+ * 一時ファイルは作らない。残した fd は close-on-exec のままにしておき、
+ * コマンドの子プロセスだけが process_subst_inherit で受け継ぐ。
+ *
+ * @param text 括弧の中のコマンド
+ * @param len text の長さ
+ * @param output >(...) なら1
+ * @return "/dev/fd/N" (呼び出し側で解放する)。失敗時はNULL
+ */
+char* process_substitute(const char *text, size_t len, int output) {
+    if (process_subst_count == process_subst_cap) {
+        size_t new_cap = process_subst_cap ? process_subst_cap * 2 : 4;
+        ProcessSubst *tmp = (ProcessSubst *)realloc(process_substs, new_cap * sizeof(ProcessSubst));
+        if (tmp == NULL) {
+            perror("process substitution");
+            return NULL;
+        }
+        process_substs = tmp;
+        process_subst_cap = new_cap;
+    }
+    Program *prog = compile_substitution(text, len);
+    if (prog == NULL) {
+        last_exit_status = 2;
+        return NULL;
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("pipe");
+        program_free(prog);
+        return NULL;
+    }
+    int keep = output ? fds[1] : fds[0];
+    int give = output ? fds[0] : fds[1];
+    char *path = (char *)malloc(32);
+    out_flush();
+    fflush(stdout);
+    pid_t pid = path ? fork() : -1;
+    if (pid < 0) {
+        perror("fork");
+        free(path);
+        close(fds[0]);
+        close(fds[1]);
+        program_free(prog);
+        return NULL;
+    }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        close(keep);
+        // 先に作ったプロセス置換の fd を持ったままだと、その読み手に EOF が届かない
+        for (size_t i = 0; i < process_subst_count; i++) {
+            close(process_substs[i].fd);
+        }
+        dup2(give, output ? STDIN_FILENO : STDOUT_FILENO);
+        close(give);
+        int status = execute_program(prog, prog->root);
+        out_flush();
+        fflush(stdout);
+        _exit(status);
+    }
+    close(give);
+    program_free(prog);
+    snprintf(path, 32, "/dev/fd/%d", keep);
+    process_substs[process_subst_count++] = (ProcessSubst){keep, pid, output};
+    return path;
+}
+
+// コマンドを展開する前の位置 (process_subst_finish に渡す)
+size_t process_subst_mark(void) {
+    return process_subst_count;
+}
+
+// 開いているプロセス置換があるか (フォークサーバーは fd を受け継げないので使わない)
+int process_subst_active(void) {
+    return process_subst_count > 0;
+}
+
+/**
+ * @brief コマンドの子プロセスで、プロセス置換の fd を exec の後も残す
+ */
+void process_subst_inherit(void) {
+    for (size_t i = 0; i < process_subst_count; i++) {
+        fcntl(process_substs[i].fd, F_SETFD, 0);
+    }
+}
+
+static void lingering_reap(void) {
+    size_t kept = 0;
+    for (size_t i = 0; i < lingering_count; i++) {
+        if (waitpid(lingering[i], NULL, WNOHANG) == 0) {
+            lingering[kept++] = lingering[i];
+        }
+    }
+    lingering_count = kept;
+}
+
+/**
+ * @brief コマンドが終わった後、mark の後に起動したプロセス置換を片付ける
+ *
+ * シェル側の fd を閉じ、>(...) は読み手が最後まで処理するのを待つ
+ * (コマンドが返ったときには出力が書き終わっているようにする)。
+ * <(...) は読み手が途中でやめたかもしれないので待たず、後で回収する。
+ */
+void process_subst_finish(size_t mark) {
+    // >(...) の読み手はすべての書き口が閉じるまで終わらないので、待つ前に全部閉じる
+    for (size_t i = mark; i < process_subst_count; i++) {
+        close(process_substs[i].fd);
+    }
+    for (size_t i = mark; i < process_subst_count; i++) {
+        ProcessSubst *ps = &process_substs[i];
+        if (ps->output) {
+            while (waitpid(ps->pid, NULL, 0) < 0 && errno == EINTR) {
+            }
+        } else if (waitpid(ps->pid, NULL, WNOHANG) == 0) {
+            if (lingering_count == lingering_cap) {
+                size_t new_cap = lingering_cap ? lingering_cap * 2 : 8;
+                pid_t *tmp = (pid_t *)realloc(lingering, new_cap * sizeof(pid_t));
+                if (tmp == NULL) {
+                    continue; // 回収できないがゾンビが残るだけ
+                }
+                lingering = tmp;
+                lingering_cap = new_cap;
+            }
+            lingering[lingering_count++] = ps->pid;
+        }
+    }
+    if (mark < process_subst_count) {
+        process_subst_count = mark;
+    }
+    lingering_reap();
+}
+
+/* ---------- 実行 ---------- */
+
+static const char* node_word(const Program *prog, const Node *n, uint32_t i) {
+    return prog->strings + prog->words[n->word + i];
+}
+
+static char* node_str(const Program *prog, const Node *n, int slot) {
+    return n->str[slot] == NO_STRING ? NULL : (char *)prog->strings + n->str[slot];
+}
+
+static int has_redirects(const Node *n) {
+    return n->str[STR_REDIRECT_IN] != NO_STRING || n->str[STR_REDIRECT_OUT] != NO_STRING ||
+           n->str[STR_HEREDOC_DELIMITER] != NO_STRING;
+}
+
+// ノードのリダイレクト先を展開して cmd に設定する
+static int expand_redirects(const Program *prog, const Node *n, Command *cmd) {
+    char *in = node_str(prog, n, STR_REDIRECT_IN);
+    char *out = node_str(prog, n, STR_REDIRECT_OUT);
+    char *delim = node_str(prog, n, STR_HEREDOC_DELIMITER);
+    char *body = node_str(prog, n, STR_HEREDOC_BODY);
+    if (in != NULL && (cmd->redirect_in = expand_word_string(in)) == NULL) {
+        return -1;
+    }
+    if (out != NULL) {
+        if ((cmd->redirect_out = expand_word_string(out)) == NULL) {
+            return -1;
+        }
+        cmd->append_mode = (n->flags & NODE_APPEND) ? T_REDIR_APPEND : T_REDIR_OUT;
+    }
+    if (delim != NULL) {
+        cmd->heredoc_delimiter = strdup(delim);
+        cmd->heredoc_body = (n->flags & NODE_HEREDOC_QUOTED) ? strdup(body ? body : "")
+                                                             : expand_heredoc(body ? body : "");
+        if (cmd->heredoc_delimiter == NULL || cmd->heredoc_body == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 文字列の配列に1つ追加する (NULL終端を保つ)
+static int push_string(char ***list, size_t *count, char *s) {
+    char **tmp = s ? (char **)realloc(*list, (*count + 2) * sizeof(char *)) : NULL;
+    if (tmp == NULL) {
+        free(s);
+        return -1;
+    }
+    tmp[(*count)++] = s;
+    tmp[*count] = NULL;
+    *list = tmp;
+    return 0;
+}
+
+// 引数の NAME=(...) を展開せずに渡すコマンドか
+static int is_declaration(const char *name) {
+    return strcmp(name, "declare") == 0 || strcmp(name, "local") == 0 || strcmp(name, "typeset") == 0;
+}
+
+/**
+ * @brief N_COMMAND ノードを展開して実行用の Command を作る
+ *
+ * 先頭の NAME=value は assigns に (NAME=(...) は array_assigns に)、残りの単語は展開して argv に入れる。
+ */
+static Command* build_simple_command(const Program *prog, uint32_t node) {
+    const Node *n = &prog->nodes[node];
+    Command *cmd = create_command_node();
+    if (cmd == NULL) {
+        return NULL;
+    }
+    size_t argc = 0, nassign = 0;
+    unsigned substs_before = command_subst_runs;
+    cmd->argv = (char **)calloc(1, sizeof(char *));
+    if (cmd->argv == NULL) {
+        free_command(cmd);
+        return NULL;
+    }
+    size_t narray = 0;
+    uint32_t i = 0;
+    for (; i < n->nwords; i++) {
+        const char *word = node_word(prog, n, i);
+        int eq = is_assignment_word(word);
+        if (eq == 0) {
+            break;
+        }
+        if (is_compound_assignment(word)) {
+            // 要素は代入するときに展開する
+            if (push_string(&cmd->array_assigns, &narray, strdup(word)) != 0) {
+                free_command(cmd);
+                return NULL;
+            }
+            continue;
+        }
+        char *value = expand_word_string(word + eq + 1);
+        char *assign = value ? (char *)malloc((size_t)eq + strlen(value) + 2) : NULL;
+        if (assign == NULL) {
+            free(value);
+            free_command(cmd);
+            return NULL;
+        }
+        memcpy(assign, word, (size_t)eq + 1);
+        strcpy(assign + eq + 1, value);
+        free(value);
+        if (push_string(&cmd->assigns, &nassign, assign) != 0) {
+            free_command(cmd);
+            return NULL;
+        }
+    }
+    for (; i < n->nwords; i++) {
+        const char *word = node_word(prog, n, i);
+        if (argc > 0 && is_declaration(cmd->argv[0]) && is_compound_assignment(word)) {
+            // declare -A m=(...) の要素は declare が展開する
+            if (push_string(&cmd->argv, &argc, strdup(word)) != 0) {
+                free_command(cmd);
+                return NULL;
+            }
+            continue;
+        }
+        size_t count;
+        char **fields = expand_word_fields(word, &count);
+        if (fields == NULL) {
+            free_command(cmd);
+            return NULL;
+        }
+        for (size_t k = 0; k < count; k++) {
+            if (push_string(&cmd->argv, &argc, fields[k]) != 0) {
+                for (size_t j = k + 1; j < count; j++) {
+                    free(fields[j]);
+                }
+                free(fields);
+                free_command(cmd);
+                return NULL;
+            }
+        }
+        free(fields);
+    }
+    if (expand_redirects(prog, n, cmd) != 0) {
+        free_command(cmd);
+        return NULL;
+    }
+    if (command_subst_runs != substs_before) {
+        cmd->subst_status = last_exit_status; // x=$(cmd) の終了ステータスは cmd のもの
+    }
+    return cmd;
+}
+
+// パイプラインの段として実行する複合コマンド (リダイレクトは execute_program が扱う)
+static Command* build_compound_command(const Program *prog, uint32_t node) {
+    Command *cmd = create_command_node();
+    if (cmd == NULL) {
+        return NULL;
+    }
+    cmd->argv = (char **)calloc(1, sizeof(char *));
+    if (cmd->argv == NULL) {
+        free_command(cmd);
+        return NULL;
+    }
+    cmd->program = prog;
+    cmd->node = node;
+    return cmd;
+}
+
+static int run_pipeline(const Program *prog, uint32_t node) {
+    const Node *n = &prog->nodes[node];
+    size_t mark = process_subst_mark();
+    Command *head = NULL, **tail = &head;
+    for (uint32_t i = n->kids[0]; i != 0; i = prog->nodes[i].next) {
+        Command *cmd = prog->nodes[i].type == N_COMMAND ? build_simple_command(prog, i)
+                                                        : build_compound_command(prog, i);
+        if (cmd == NULL) {
+            free_command_list(head);
+            process_subst_finish(mark);
+            return last_exit_status = 1;
+        }
+        *tail = cmd;
+        tail = &cmd->next;
+    }
+    int status = execute_command_list(head);
+    free_command_list(head);
+    process_subst_finish(mark);
+    if (n->flags & NODE_NEGATE) {
+        status = status == 0;
+    }
+    return last_exit_status = status;
+}
+
+/**
+ * @brief パターンをコンパイルしたマッチャーを返す (case と ${var#pat} など)
+ *
+ * コンパイルの結果は覚えておくので、ループの中で同じパターンを何度使ってもよい。
+ *
+ * @return マッチャー (キャッシュが持つので解放しない)。失敗時はNULL
+ */
+GlobMatcher* pattern_matcher(const char *pattern) {
+    size_t len = strlen(pattern);
+    CacheEntry *slot = cache_slot(matcher_cache, MATCHER_CACHE_SIZE, pattern, len);
+    if (slot != NULL && slot->key != NULL) {
+        return (GlobMatcher *)slot->value;
+    }
+    GlobMatcher *m = glob_matcher_compile(pattern, len);
+    if (m == NULL) {
+        return NULL;
+    }
+    if (slot == NULL) {
+        for (size_t i = 0; i < MATCHER_CACHE_SIZE; i++) {
+            free(matcher_cache[i].key);
+            glob_matcher_free((GlobMatcher *)matcher_cache[i].value);
+            matcher_cache[i].key = NULL;
+            matcher_cache[i].value = NULL;
+        }
+        slot = cache_slot(matcher_cache, MATCHER_CACHE_SIZE, pattern, len);
+    }
+    slot->key = strdup(pattern);
+    if (slot->key == NULL) {
+        glob_matcher_free(m);
+        return NULL;
+    }
+    slot->value = m;
+    return m;
+}
+
+static int run_case(const Program *prog, const Node *n) {
+    char *subject = expand_word_string(node_word(prog, n, 0));
+    if (subject == NULL) {
+        return 1;
+    }
+    size_t subject_len = strlen(subject);
+    int status = 0;
+    for (uint32_t item = n->kids[0]; item != 0; item = prog->nodes[item].next) {
+        const Node *it = &prog->nodes[item];
+        for (uint32_t k = 0; k < it->nwords; k++) {
+            char *pattern = expand_word_pattern(node_word(prog, it, k));
+            GlobMatcher *m = pattern ? pattern_matcher(pattern) : NULL;
+            free(pattern);
+            if (m != NULL && glob_matcher_match(m, subject, subject_len)) {
+                status = it->kids[0] ? execute_program(prog, it->kids[0]) : 0;
+                free(subject);
+                return status;
+            }
+        }
+    }
+    free(subject);
+    return status;
+}
+
+static int run_for(const Program *prog, const Node *n) {
+    const char *name = node_word(prog, n, 0);
+    char **items = NULL;
+    size_t count = 0;
+    if (n->flags & NODE_FOR_ARGS) {
+        for (int i = 1; i <= var_positional_count(); i++) {
+            if (push_string(&items, &count, strdup(var_positional(i))) != 0) {
+                break;
+            }
+        }
+    } else {
+        for (uint32_t i = 1; i < n->nwords; i++) {
+            size_t nf;
+            char **fields = expand_word_fields(node_word(prog, n, i), &nf);
+            if (fields == NULL) {
+                break;
+            }
+            for (size_t k = 0; k < nf; k++) {
+                push_string(&items, &count, fields[k]);
+            }
+            free(fields);
+        }
+    }
+    int status = 0;
+    loop_depth++;
+    for (size_t i = 0; i < count; i++) {
+        var_set(name, items[i]);
+        status = execute_program(prog, n->kids[0]);
+        if (loop_should_exit()) {
+            break;
+        }
+    }
+    loop_depth--;
+    for (size_t i = 0; i < count; i++) {
+        free(items[i]);
+    }
+    free(items);
+    return status;
+}
+
+static int run_while(const Program *prog, const Node *n) {
+    int status = 0;
+    int until = (n->flags & NODE_UNTIL) != 0;
+    loop_depth++;
+    for (;;) {
+        int cond = execute_program(prog, n->kids[0]);
+        if (loop_should_exit()) {
+            break;
+        }
+        if ((cond == 0) == until) {
+            break;
+        }
+        status = execute_program(prog, n->kids[1]);
+        if (loop_should_exit()) {
+            break;
+        }
+    }
+    loop_depth--;
+    return status;
+}
+
+static int run_subshell(const Program *prog, const Node *n) {
+    out_flush();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        int status = execute_program(prog, n->kids[0]);
+        out_flush();
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    }
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {
+    }
+    return status_to_exit_code(wstatus);
+}
+
+static int execute_node(const Program *prog, uint32_t node) {
+    const Node *n = &prog->nodes[node];
+    switch (n->type) {
+        case N_LIST: {
+            int status = last_exit_status;
+            for (uint32_t i = n->kids[0]; i != 0 && !interp_pending(); i = prog->nodes[i].next) {
+                status = execute_program(prog, i);
+            }
+            return status;
+        }
+        case N_PIPELINE:
+            return run_pipeline(prog, node);
+        case N_COMMAND: {
+            // パイプラインを経由しない単純コマンド (通常は N_PIPELINE の中にある)
+            size_t mark = process_subst_mark();
+            Command *cmd = build_simple_command(prog, node);
+            if (cmd == NULL) {
+                process_subst_finish(mark);
+                return 1;
+            }
+            int status = execute_command_list(cmd);
+            free_command(cmd);
+            process_subst_finish(mark);
+            return status;
+        }
+        case N_AND:
+        case N_OR: {
+            int status = execute_program(prog, n->kids[0]);
+            if (!interp_pending() && (status == 0) == (n->type == N_AND)) {
+                status = execute_program(prog, n->kids[1]);
+            }
+            return status;
+        }
+        case N_IF: {
+            int cond = execute_program(prog, n->kids[0]);
+            if (interp_pending()) {
+                return cond;
+            }
+            if (cond == 0) {
+                return execute_program(prog, n->kids[1]);
+            }
+            return n->kids[2] ? execute_program(prog, n->kids[2]) : 0;
+        }
+        case N_WHILE:
+            return run_while(prog, n);
+        case N_FOR:
+            return run_for(prog, n);
+        case N_CASE:
+            return run_case(prog, n);
+        case N_GROUP:
+            return execute_program(prog, n->kids[0]);
+        case N_SUBSHELL:
+            return run_subshell(prog, n);
+        case N_FUNCDEF:
+            return define_function(prog, node) == 0 ? 0 : 1;
+        case N_ARITH: {
+            const char *expr = node_word(prog, n, 0);
+            int64_t value;
+            return arith_eval(expr, strlen(expr), &value) == 0 && value != 0 ? 0 : 1;
+        }
+        default:
+            return last_exit_status;
+    }
+}
+
+/**
+ * @brief Program のノードを実行する
+ *
+ * 複合コマンドに付いたリダイレクト (while ...; done < file など) はここで適用する。
+ *
+ * @param prog 実行するプログラム
+ * @param node 実行するノード (通常は prog->root)
+ * @return 終了ステータス (last_exit_status にも保存する)
+ */
+int execute_program(const Program *prog, uint32_t node) {
+    const Node *n = &prog->nodes[node];
+    int status;
+    if (n->type > N_COMMAND && has_redirects(n)) {
+        Command *cmd = create_command_node();
+        int saved[2];
+        if (cmd == NULL || expand_redirects(prog, n, cmd) != 0 || redirect_push(cmd, saved) != 0) {
+            free_command(cmd);
+            return last_exit_status = 1;
+        }
+        status = execute_node(prog, node);
+        if (redirect_pop(saved) != 0 && status == 0) {
+            status = 1; // 本体の出力を書けなかった
+        }
+        free_command(cmd);
+    } else {
+        status = execute_node(prog, node);
+    }
+    return last_exit_status = status;
+}
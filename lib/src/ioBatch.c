@@ -0,0 +1,266 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * シェル自身の入出力のまとめ発行 (io_uring)
+ *
+ * パイプラインのリダイレクト先を開く・ヒアドキュメントを書くといった操作を IoOp の配列に
+ * 並べて io_batch に渡すと、io_uring の1回の io_uring_enter でまとめて発行し、
+ * すべての完了を待つ。ネットワークファイルシステムのようにメタデータの操作が遅い場合でも、
+ * 待ち時間は1つずつ順に開くときの合計ではなく一番遅いものの分で済む。
+ *
+ * ローカルのファイルシステムでは open は io_uring でも結局カーネルのワーカーに回されるので、
+ * 普通のシステムコールより遅くなる。そのため操作1つあたりにかかった時間を平均しておき、
+ * それが IO_RING_SLOW_NS を超えたとき (遅いファイルシステムを使っているとき) だけ
+ * io_uring を使う。$MYSHELL_IO_URING=1 なら常に、0 なら決して使わない。
+ * カーネルが io_uring (または openat / write の操作) に対応していない、seccomp で
+ * 禁止されている場合と、操作が1つだけの場合は普通のシステムコールで実行する。
+ * リングはシェルのプロセスのものなので、fork した子では使わない (子は普通のシステムコール)。
+ */
+
+#define IO_RING_ENTRIES 32      /* リングの大きさ (これを超える操作は分けて発行する) */
+#define IO_RING_SLOW_NS 50000   /* 操作1つの平均がこれを超えたら io_uring を使う (50us) */
+#define IO_NOT_RUN INT_MIN      /* まだ実行していない操作の result */
+
+typedef struct IoRing {
+    int fd;                     // -1: まだ作っていない、-2: 使えない
+    pid_t owner;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+} IoRing;
+
+static IoRing ring = {.fd = -1};
+static long long average_ns = 0;   // 操作1つにかかった時間の移動平均
+
+static int ring_setup(void);
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// このまとめ発行に io_uring を使うか
+static int ring_wanted(size_t n) {
+    if (n < 2 || ring.fd == -2) {
+        return 0;
+    }
+    const char *opt = getenv("MYSHELL_IO_URING");
+    if (opt != NULL && strcmp(opt, "0") == 0) {
+        return 0;
+    }
+    if ((opt == NULL || strcmp(opt, "1") != 0) && average_ns <= IO_RING_SLOW_NS) {
+        return 0;
+    }
+    if (ring.fd == -1 && ring_setup() != 0) {
+        ring.fd = -2;
+    }
+    return ring.fd >= 0 && ring.owner == getpid();
+}
+
+static int ring_setup(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &p);
+    if (fd < 0) {
+        return -1;
+    }
+    // openat と write が使えるか (5.6 より前のカーネルには probe もない)
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probe_size);
+    int supported = probe != NULL &&
+                    syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    probe->last_op >= IORING_OP_OPENAT && probe->last_op >= IORING_OP_WRITE &&
+                    (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(fd);
+        return -1;
+    }
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+    char *base = (char *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              fd, IORING_OFF_SQ_RING);
+    void *sqes = base == MAP_FAILED ? MAP_FAILED :
+                 mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (base != MAP_FAILED) {
+            munmap(base, ring_size);
+        }
+        close(fd);
+        return -1;
+    }
+    ring.sq_head = (unsigned *)(base + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(base + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(base + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(base + p.sq_off.array);
+    ring.cq_head = (unsigned *)(base + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(base + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(base + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+    ring.sqes = (struct io_uring_sqe *)sqes;
+    ring.entries = p.sq_entries;
+    ring.owner = getpid();
+    ring.fd = fd; // io_uring の fd は最初から close-on-exec
+    return 0;
+}
+
+// 1つの操作を普通のシステムコールで実行する
+static int run_sync(const IoOp *op) {
+    int r = -1;
+    switch (op->kind) {
+        case IO_OPEN:
+            r = open(op->path, op->flags, op->mode);
+            break;
+        case IO_WRITE:
+            r = (int)pwrite(op->fd, op->buf, op->len, op->offset);
+            break;
+    }
+    return r < 0 ? -errno : r;
+}
+
+static void fill_sqe(struct io_uring_sqe *sqe, const IoOp *op, size_t index, int last) {
+    memset(sqe, 0, sizeof(*sqe));
+    switch (op->kind) {
+        case IO_OPEN:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)op->path;
+            sqe->len = (uint32_t)op->mode;
+            sqe->open_flags = (uint32_t)op->flags;
+            break;
+        case IO_WRITE:
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = op->fd;
+            sqe->addr = (uint64_t)(uintptr_t)op->buf;
+            sqe->len = (uint32_t)op->len;
+            sqe->off = (uint64_t)op->offset;
+            break;
+    }
+    if (op->link && !last) {
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    sqe->user_data = index;
+}
+
+// 届いた完了を ops の result に入れ、その数を返す
+static size_t ring_reap(IoOp *ops, size_t n) {
+    size_t done = 0;
+    unsigned head = *ring.cq_head;
+    unsigned cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != cq_tail; head++) {
+        const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        if (cqe->user_data < n) {
+            ops[cqe->user_data].result = cqe->res;
+            done++;
+        }
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return done;
+}
+
+/**
+ * @brief ops を1回で発行して完了を待つ (n はリングの大きさ以下)
+ *
+ * io_uring_enter が失敗したら、カーネルが受け取らなかった操作を取り下げ、
+ * 受け取った操作の完了だけを待って-1を返す。取り下げた操作の result は IO_NOT_RUN のまま
+ * (呼び出し側が普通のシステムコールで実行する)。受け取った操作は二重に実行しないよう、
+ * 完了を待てなければ -EIO にする。
+ */
+static int ring_submit(IoOp *ops, size_t n) {
+    unsigned start = *ring.sq_tail;
+    unsigned tail = start;
+    for (size_t i = 0; i < n; i++, tail++) {
+        unsigned slot = tail & *ring.sq_mask;
+        ops[i].result = IO_NOT_RUN;
+        fill_sqe(&ring.sqes[slot], &ops[i], i, i + 1 == n);
+        ring.sq_array[slot] = slot;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+    size_t done = 0;
+    unsigned to_submit = (unsigned)n;
+    while (done < n) {
+        int r = (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, (unsigned)(n - done),
+                             IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0 && errno != EINTR) {
+            break;
+        }
+        if (r > 0) {
+            to_submit -= (unsigned)r < to_submit ? (unsigned)r : to_submit;
+        }
+        done += ring_reap(ops, n);
+    }
+    if (done == n) {
+        return 0;
+    }
+    // SQE は順に受け取られるので、受け取られたのは先頭の accepted 個
+    size_t accepted = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) - start;
+    __atomic_store_n(ring.sq_tail, start + (unsigned)accepted, __ATOMIC_RELEASE);
+    while (done < accepted) {
+        int r = (int)syscall(__NR_io_uring_enter, ring.fd, 0, (unsigned)(accepted - done),
+                             IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0 && errno != EINTR) {
+            break;
+        }
+        done += ring_reap(ops, n);
+    }
+    for (size_t i = 0; i < accepted; i++) {
+        if (ops[i].result == IO_NOT_RUN) {
+            ops[i].result = -EIO;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 操作をまとめて発行し、すべての完了を待つ
+ *
+ * 各操作の結果は result に入る (open は fd、write は書いたバイト数、失敗時は -errno)。
+ * link が1の操作が失敗すると、次の操作は実行されず -ECANCELED になる。
+ *
+ * @param ops 操作の配列
+ * @param n 操作の数
+ */
+void io_batch(IoOp *ops, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    long long started = now_ns();
+    int use_ring = ring_wanted(n);
+    size_t i = 0;
+    while (use_ring && i < n) {
+        size_t chunk = n - i < ring.entries ? n - i : ring.entries;
+        while (chunk > 1 && i + chunk < n && ops[i + chunk - 1].link) {
+            chunk--; // つながった操作を分けない
+        }
+        if (ring_submit(ops + i, chunk) != 0) {
+            close(ring.fd);
+            ring.fd = -2; // 以後は使わず、残りは普通のシステムコールで実行する
+            size_t end = i + chunk;
+            while (i < end && ops[i].result != IO_NOT_RUN) {
+                i++; // カーネルが受け取った操作は実行済み
+            }
+            break;
+        }
+        i += chunk;
+    }
+    for (size_t j = i; j < n; j++) {
+        if (j > 0 && ops[j - 1].link && ops[j - 1].result < 0) {
+            ops[j].result = -ECANCELED;
+        } else {
+            ops[j].result = run_sync(&ops[j]);
+        }
+    }
+    // io_uring ではまとめて待った時間がそのまま1つ分の待ち時間になる
+    long long sample = (now_ns() - started) / (use_ring ? 1 : (long long)n);
+    average_ns += (sample - average_ns) / 8;
+}
@@ -0,0 +1,236 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <stdarg.h>
+#include <sys/uio.h>
+
+/*
+ * 組み込みコマンドの出力のバッファ
+ *
+ * echo などは stdio ではなく out_write で書く。出力はここで溜めておき、バッファが一杯に
+ * なったときに溜めた分と新しい分を writev の1回で書く。ループの中の echo が1行ごとに
+ * write を呼ばなくなる。
+ *
+ * 書き先は2つある。標準出力 (fd 1) と、`echo ... >> FILE` のときに開いたままにしておく
+ * FILE (out_append_begin)。後者では dup2 で標準出力を付け替えず、同じ FILE への次の追記は
+ * 開き直さずに同じバッファに溜める。順序を崩さないよう、書き先を切り替えるときは
+ * 前の書き先に溜めた分を先に書く。
+ *
+ * 溜めた出力は次のときに out_flush で書き出す (FILE も閉じる):
+ * 子プロセスを作る前 (fork で溜めた分が複製されないように)、標準出力を付け替える前、
+ * out_write を使わない組み込みコマンドの前、端末から行を読む前、シェルの終了時。
+ * 書き先が端末なら、コマンドごとにすぐ書く。
+ *
+ * 書き込みに失敗したら (ディスクが一杯など) 次に書き出すときに "write error" を表示し、
+ * out_flush などが-1を返す。呼び出し側はそのコマンドの終了ステータスを1にする。
+ */
+
+#define OUT_BUF_SIZE 65536
+
+typedef struct OutTarget {
+    int fd;                     // -1: 開いていない
+    int tty;                    // コマンドごとにすぐ書くか (端末など。-1: まだ調べていない)
+    char *path;                 // >> のファイル名 (標準出力ならNULL)
+    char *buf;
+    size_t len;
+    int error;                  // 書き込みに失敗したときのerrno (0: 失敗していない)
+} OutTarget;
+
+static OutTarget std_target = {STDOUT_FILENO, -1, NULL, NULL, 0, 0};
+static OutTarget append_target = {-1, -1, NULL, NULL, 0, 0};
+static OutTarget *current = &std_target;
+static int exit_hook_registered = 0;
+
+static void flush_at_exit(void) {
+    out_flush();
+}
+
+// iov をすべて書く (途中で失敗したら残りは捨てて、errno を t->error に残す)
+static void write_all(OutTarget *t, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(t->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (t->error == 0) {
+                t->error = errno;
+            }
+            return;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+}
+
+static void target_flush(OutTarget *t) {
+    if (t->len == 0) {
+        return;
+    }
+    struct iovec iov = {t->buf, t->len};
+    write_all(t, &iov, 1);
+    t->len = 0;
+}
+
+// 書き込みの失敗を表示する (1回の失敗につき1度だけ)。失敗していたら-1
+static int report_error(OutTarget *t) {
+    if (t->error == 0) {
+        return 0;
+    }
+    fprintf(stderr, "myshell: write error: %s\n", strerror(t->error));
+    errno = t->error;
+    t->error = 0;
+    return -1;
+}
+
+static void target_write(OutTarget *t, const char *data, size_t len) {
+    if (t->buf == NULL) {
+        if (!exit_hook_registered) {
+            atexit(flush_at_exit);
+            exit_hook_registered = 1;
+        }
+        t->buf = (char *)malloc(OUT_BUF_SIZE);
+    }
+    if (t->buf != NULL && t->len + len <= OUT_BUF_SIZE) {
+        memcpy(t->buf + t->len, data, len);
+        t->len += len;
+        return;
+    }
+    // 溜めた分と合わせて1回で書く
+    struct iovec iov[2] = {{t->buf, t->len}, {(void *)data, len}};
+    write_all(t, iov, 2);
+    t->len = 0;
+}
+
+/**
+ * @brief 組み込みコマンドの出力を今の書き先に書く (溜めておき、まとめて書く)
+ * @param data 書く内容
+ * @param len バイト数
+ */
+void out_write(const void *data, size_t len) {
+    OutTarget *other = current == &std_target ? &append_target : &std_target;
+    target_flush(other); // 同じファイルかもしれないので、先に溜めた分を書く
+    target_write(current, (const char *)data, len);
+}
+
+void out_putc(int c) {
+    char ch = (char)c;
+    out_write(&ch, 1);
+}
+
+void out_puts(const char *s) {
+    out_write(s, strlen(s));
+}
+
+void out_printf(const char *fmt, ...) {
+    char local[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(local, sizeof(local), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n < sizeof(local)) {
+        out_write(local, (size_t)n);
+        return;
+    }
+    char *big = (char *)malloc((size_t)n + 1);
+    if (big == NULL) {
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(big, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    out_write(big, (size_t)n);
+    free(big);
+}
+
+static int append_close(void) {
+    target_flush(&append_target);
+    int r = report_error(&append_target);
+    if (append_target.fd >= 0) {
+        close(append_target.fd);
+    }
+    free(append_target.path);
+    append_target.fd = -1;
+    append_target.path = NULL;
+    return r;
+}
+
+/**
+ * @brief 溜めた出力をすべて書き出し、開いたままの >> のファイルを閉じる
+ *
+ * 標準出力が付け替えられるかもしれないので、端末かどうかも調べ直す。
+ *
+ * @return 成功時0。書き込みに失敗していたら "write error" を表示して-1
+ */
+int out_flush(void) {
+    target_flush(&std_target);
+    int failed = report_error(&std_target) != 0;
+    failed |= append_close() != 0;
+    std_target.tty = -1;
+    current = &std_target;
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief 以後の out_write の書き先を FILE への追記にする (echo ... >> FILE)
+ *
+ * 直前と同じ FILE なら開いたままのものを使う。out_append_end で標準出力に戻す。
+ *
+ * @param path 追記するファイル
+ * @return 成功時0。開けなければエラーを表示して-1
+ */
+int out_append_begin(const char *path) {
+    if (append_target.path == NULL || strcmp(append_target.path, path) != 0) {
+        append_close();
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        append_target.path = strdup(path);
+        if (append_target.path == NULL) {
+            close(fd);
+            return -1;
+        }
+        append_target.fd = fd;
+        // 通常のファイルでなければ (端末や /dev/full など) コマンドごとに書き、失敗をそのコマンドに返す
+        struct stat st;
+        append_target.tty = fstat(fd, &st) != 0 || !S_ISREG(st.st_mode);
+    }
+    current = &append_target;
+    return 0;
+}
+
+/**
+ * @brief out_write の書き先を標準出力に戻す
+ * @return 成功時0。FILE への書き込みに失敗していたら "write error" を表示して-1
+ */
+int out_append_end(void) {
+    current = &std_target;
+    return report_error(&append_target);
+}
+
+/**
+ * @brief 組み込みコマンドが終わったときに呼ぶ (書き先が端末ならすぐ書く)
+ * @return 成功時0。書き込みに失敗していたら "write error" を表示して-1
+ */
+int out_command_done(void) {
+    if (current->len > 0) {
+        if (current->tty < 0) {
+            current->tty = isatty(current->fd);
+        }
+        if (current->tty) {
+            target_flush(current);
+        }
+    }
+    return report_error(current);
+}
@@ -1,3 +1,4 @@
+#define STATS_SUBSYSTEM STATS_PARSE
 #include <shell.h>
 /* "ls -l > out.txt | grep .c"
 ↓
@@ -165,8 +166,7 @@ Command* parser(char* line){
 		return NULL; //must modify
 	}
 	Command* command_list_head = parse_tokens_to_commands(token_list_head);
-	if(!command_list_head){
-		exit(EXIT_FAILURE); //must modify
-	}
+	free_token_list(token_list_head); // argvなどは複製済み
+	// 構文エラーはメッセージを出して NULL を返す (シェルを終了させない)
     return command_list_head;
 }
\ No newline at end of file
@@ -0,0 +1,440 @@
+#define _GNU_SOURCE /* readahead */
+#define STATS_SUBSYSTEM STATS_COMPLETION
+#include <shell.h>
+#include <elf.h>
+#include <pthread.h>
+
+/*
+ * 入力中のコマンドの先読み
+ *
+ * readlineの再描画のたびに入力途中の行を軽く字句解析し、コマンド位置の単語が
+ * PATHキャッシュで実行ファイルに解決できたら、その実行ファイルと依存する共有ライブラリを
+ * 別スレッドで readahead しておく。Enter を押す前にページキャッシュへ載せることで、
+ * キャッシュが冷えているときの最初の exec を速くする。
+ */
+
+#define PREFETCH_RECENT 64        /* 最近先読みしたパスを覚えておく数 */
+#define PREFETCH_LINE_MAX 16      /* 1行の中で先読みを記録するコマンド数 */
+#define PREFETCH_SCAN_MAX 4096    /* 解析する行の先頭からの長さ */
+#define PREFETCH_MAX_LIBS 64      /* 1つの実行ファイルについて辿るライブラリ数 */
+
+typedef struct PrefetchStats {
+    unsigned long binaries;     // 先読みした実行ファイル数
+    unsigned long libraries;    // 先読みした共有ライブラリ数
+    unsigned long useful;       // 先読みしたものが実際に実行された回数
+    unsigned long wasted;       // 先読みしたが実行されなかった回数
+    unsigned long missed;       // 先読みが間に合わなかった (されていなかった) 回数
+} PrefetchStats;
+
+static PrefetchStats stats;
+
+// 最近先読みしたパス (同じものを何度も要求しない)
+static char recent[PREFETCH_RECENT][MAX_PATH];
+static int recent_next = 0;
+
+// 編集中の行で先読みしたパス (実行時に当たり外れを数える)
+static char line_paths[PREFETCH_LINE_MAX][MAX_PATH];
+static int line_path_count = 0;
+
+static pthread_t worker;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static char queued_path[MAX_PATH];
+static int queued = 0;
+
+static rl_voidfunc_t *saved_redisplay = NULL;
+
+/* ---------- ELFの解析 ---------- */
+
+// 仮想アドレスをファイル上のオフセットに変換する
+static int vaddr_to_offset(const Elf64_Phdr *ph, int phnum, Elf64_Addr addr, off_t *off) {
+    for (int i = 0; i < phnum; i++) {
+        if (ph[i].p_type == PT_LOAD && addr >= ph[i].p_vaddr && addr < ph[i].p_vaddr + ph[i].p_filesz) {
+            *off = (off_t)(ph[i].p_offset + (addr - ph[i].p_vaddr));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int file_exists(const char *path) {
+    return access(path, R_OK) == 0;
+}
+
+// ライブラリ名を検索パスから探す
+static int resolve_library(const char *name, const char *runpath, const char *origin, char *out, size_t out_size) {
+    static const char *default_dirs[] = {
+        "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib/aarch64-linux-gnu",
+        "/usr/lib/aarch64-linux-gnu", "/lib64", "/usr/lib64", "/lib", "/usr/lib", "/usr/local/lib",
+    };
+    if (strchr(name, '/') != NULL) {
+        snprintf(out, out_size, "%s", name);
+        return file_exists(out);
+    }
+    const char *lists[2] = {runpath, getenv("LD_LIBRARY_PATH")};
+    for (int l = 0; l < 2; l++) {
+        const char *p = lists[l];
+        while (p != NULL && *p) {
+            const char *end = strchr(p, ':');
+            size_t len = end ? (size_t)(end - p) : strlen(p);
+            char dir[MAX_PATH];
+            if (len < sizeof(dir)) {
+                memcpy(dir, p, len);
+                dir[len] = '\0';
+                if (strncmp(dir, "$ORIGIN", 7) == 0) {
+                    char tmp[MAX_PATH];
+                    snprintf(tmp, sizeof(tmp), "%s%s", origin, dir + 7);
+                    snprintf(dir, sizeof(dir), "%s", tmp);
+                }
+                if (dir[0] != '\0' && snprintf(out, out_size, "%s/%s", dir, name) < (int)out_size &&
+                    file_exists(out)) {
+                    return 1;
+                }
+            }
+            p = end ? end + 1 : NULL;
+        }
+    }
+    for (size_t i = 0; i < sizeof(default_dirs) / sizeof(default_dirs[0]); i++) {
+        if (snprintf(out, out_size, "%s/%s", default_dirs[i], name) < (int)out_size && file_exists(out)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+typedef struct LibList {
+    char paths[PREFETCH_MAX_LIBS][MAX_PATH];
+    int count;
+} LibList;
+
+static int lib_list_add(LibList *libs, const char *path) {
+    for (int i = 0; i < libs->count; i++) {
+        if (strcmp(libs->paths[i], path) == 0) {
+            return 0;
+        }
+    }
+    if (libs->count >= PREFETCH_MAX_LIBS) {
+        return 0;
+    }
+    snprintf(libs->paths[libs->count++], MAX_PATH, "%s", path);
+    return 1;
+}
+
+/**
+ * @brief ファイル全体の先読みを依頼し、ELFなら PT_INTERP と DT_NEEDED を libs に集める
+ */
+static void prefetch_file(const char *path, LibList *libs) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return;
+    }
+    if (readahead(fd, 0, (size_t)st.st_size) != 0) {
+        posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+    }
+
+    Elf64_Ehdr eh;
+    if (pread(fd, &eh, sizeof(eh), 0) != (ssize_t)sizeof(eh) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh.e_ident[EI_CLASS] != ELFCLASS64 || eh.e_phnum == 0 || eh.e_phnum > 64) {
+        close(fd);
+        return; // スクリプトや32bitのバイナリはファイル自体の先読みだけ
+    }
+    Elf64_Phdr ph[64];
+    size_t ph_size = (size_t)eh.e_phnum * sizeof(Elf64_Phdr);
+    if (pread(fd, ph, ph_size, (off_t)eh.e_phoff) != (ssize_t)ph_size) {
+        close(fd);
+        return;
+    }
+
+    char origin[MAX_PATH];
+    snprintf(origin, sizeof(origin), "%s", path);
+    char *slash = strrchr(origin, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+    }
+
+    Elf64_Dyn dyn[512];
+    ssize_t dyn_bytes = 0;
+    for (int i = 0; i < eh.e_phnum; i++) {
+        if (ph[i].p_type == PT_INTERP && ph[i].p_filesz < MAX_PATH) {
+            char interp[MAX_PATH];
+            if (pread(fd, interp, ph[i].p_filesz, (off_t)ph[i].p_offset) == (ssize_t)ph[i].p_filesz) {
+                interp[ph[i].p_filesz ? ph[i].p_filesz - 1 : 0] = '\0';
+                lib_list_add(libs, interp);
+            }
+        } else if (ph[i].p_type == PT_DYNAMIC) {
+            size_t want = ph[i].p_filesz < sizeof(dyn) ? ph[i].p_filesz : sizeof(dyn);
+            dyn_bytes = pread(fd, dyn, want, (off_t)ph[i].p_offset);
+        }
+    }
+    if (dyn_bytes <= 0) {
+        close(fd);
+        return;
+    }
+
+    int ndyn = (int)(dyn_bytes / (ssize_t)sizeof(Elf64_Dyn));
+    Elf64_Addr strtab = 0;
+    Elf64_Xword runpath_off = (Elf64_Xword)-1;
+    for (int i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        if (dyn[i].d_tag == DT_STRTAB) {
+            strtab = dyn[i].d_un.d_ptr;
+        } else if (dyn[i].d_tag == DT_RUNPATH || (dyn[i].d_tag == DT_RPATH && runpath_off == (Elf64_Xword)-1)) {
+            runpath_off = dyn[i].d_un.d_val;
+        }
+    }
+    off_t strtab_off;
+    if (strtab == 0 || vaddr_to_offset(ph, eh.e_phnum, strtab, &strtab_off) != 0) {
+        close(fd);
+        return;
+    }
+    char runpath[MAX_PATH] = "";
+    if (runpath_off != (Elf64_Xword)-1) {
+        ssize_t n = pread(fd, runpath, sizeof(runpath) - 1, strtab_off + (off_t)runpath_off);
+        runpath[n > 0 ? n : 0] = '\0';
+    }
+    for (int i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        if (dyn[i].d_tag != DT_NEEDED) {
+            continue;
+        }
+        char name[NAME_MAX + 1];
+        ssize_t n = pread(fd, name, sizeof(name) - 1, strtab_off + (off_t)dyn[i].d_un.d_val);
+        if (n <= 0) {
+            continue;
+        }
+        name[n] = '\0';
+        char resolved[MAX_PATH];
+        if (resolve_library(name, runpath[0] ? runpath : NULL, origin, resolved, sizeof(resolved))) {
+            lib_list_add(libs, resolved);
+        }
+    }
+    close(fd);
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    char path[MAX_PATH];
+    LibList *libs = (LibList *)malloc(sizeof(LibList));
+    if (libs == NULL) {
+        return NULL;
+    }
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (!queued) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        memcpy(path, queued_path, sizeof(path));
+        queued = 0;
+        pthread_mutex_unlock(&queue_lock);
+
+        // 実行ファイル → 依存ライブラリ → その依存、の順に幅優先で辿る
+        libs->count = 0;
+        prefetch_file(path, libs);
+        for (int i = 0; i < libs->count; i++) {
+            prefetch_file(libs->paths[i], libs);
+        }
+        __atomic_add_fetch(&stats.binaries, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats.libraries, (unsigned long)libs->count, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* ---------- 入力中の行の監視 ---------- */
+
+static int seen_recently(const char *path) {
+    for (int i = 0; i < PREFETCH_RECENT; i++) {
+        if (strcmp(recent[i], path) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void request_prefetch(const char *path) {
+    for (int i = 0; i < line_path_count; i++) {
+        if (strcmp(line_paths[i], path) == 0) {
+            return;
+        }
+    }
+    if (line_path_count < PREFETCH_LINE_MAX) {
+        snprintf(line_paths[line_path_count++], MAX_PATH, "%s", path);
+    }
+    if (seen_recently(path)) {
+        return; // 既にページキャッシュに載っているはず
+    }
+    snprintf(recent[recent_next], MAX_PATH, "%s", path);
+    recent_next = (recent_next + 1) % PREFETCH_RECENT;
+
+    pthread_mutex_lock(&queue_lock);
+    snprintf(queued_path, sizeof(queued_path), "%s", path);
+    queued = 1;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// コマンド位置の単語を解決できれば先読みする
+static void prefetch_word(const char *start, size_t len) {
+    char word[NAME_MAX + 1];
+    char resolved[MAX_PATH];
+    if (len >= sizeof(word)) {
+        return;
+    }
+    memcpy(word, start, len);
+    word[len] = '\0';
+    if (strchr(word, '/') != NULL) {
+        if (access(word, X_OK) == 0 && realpath(word, resolved) != NULL) {
+            request_prefetch(resolved);
+        }
+    } else if (path_cache_lookup(word, resolved, sizeof(resolved))) {
+        request_prefetch(resolved);
+    }
+}
+
+/**
+ * @brief 入力途中の行からコマンド位置の単語を取り出し、解決できたものを先読みする
+ *
+ * 行頭、| ; & ( ) の後 (&& || も含む)、then や do などの予約語の後がコマンド位置。
+ * VAR=1 のような代入とリダイレクト (> FILE) は飛ばし、その後の単語をコマンド名とみる。
+ */
+static void prefetch_scan_line(const char *line) {
+    int command_pos = 1;
+    int target = 0;             // 次の単語はリダイレクトの対象
+    const char *p = line;
+    const char *limit = line + strnlen(line, PREFETCH_SCAN_MAX);
+    while (p < limit) {
+        if (isspace((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        if (*p == '#') {
+            break;
+        }
+        if (strchr("|&;()", *p) != NULL) {
+            command_pos = 1;
+            target = 0;
+            p++;
+            continue;
+        }
+        if ((*p == '<' || *p == '>') && !syntax_is_process_subst(p, limit)) {
+            while (p < limit && strchr("<>&|-", *p) != NULL) {
+                p++;
+            }
+            target = 1;
+            continue;
+        }
+        int quoted = 0;
+        const char *start = p;
+        const char *end = syntax_scan_word(p, limit, &quoted);
+        p = end != NULL ? end : limit;
+        if (p == start) {
+            p++; // 単語にならないメタ文字
+            continue;
+        }
+        size_t len = (size_t)(p - start);
+        if (target) {
+            target = 0;
+            continue;
+        }
+        if (!command_pos) {
+            continue;
+        }
+        if (end == NULL || quoted || syntax_starts_command(start, len)) {
+            command_pos = end != NULL && !quoted;
+            continue;
+        }
+        const char *eq = memchr(start, '=', len);
+        if (eq != NULL && eq != start && var_is_name(start, (size_t)(eq - start))) {
+            continue; // VAR=1 cmd
+        }
+        prefetch_word(start, len);
+        command_pos = 0;
+    }
+}
+
+static void prefetch_redisplay(void) {
+    if (rl_line_buffer != NULL && rl_end > 0) {
+        prefetch_scan_line(rl_line_buffer);
+    }
+    saved_redisplay();
+}
+
+/**
+ * @brief 実行された行のコマンドについて、先読みの当たり外れを数える
+ *
+ * @param prog 実行する行をコンパイルしたもの (単純コマンドの先頭の単語を見る)
+ */
+void prefetch_account(const Program *prog) {
+    int used[PREFETCH_LINE_MAX] = {0};
+    for (uint32_t n = 1; n < prog->node_count; n++) {
+        const Node *node = &prog->nodes[n];
+        if (node->type != N_COMMAND) {
+            continue;
+        }
+        // VAR=1 cmd の代入は飛ばす
+        uint32_t w = 0;
+        while (w < node->nwords && is_assignment_word(prog->strings + prog->words[node->word + w])) {
+            w++;
+        }
+        if (w == node->nwords) {
+            continue;
+        }
+        const char *name = prog->strings + prog->words[node->word + w];
+        char resolved[MAX_PATH];
+        int ok = strchr(name, '/') != NULL ? realpath(name, resolved) != NULL
+                                           : path_cache_lookup(name, resolved, sizeof(resolved));
+        if (!ok) {
+            continue;
+        }
+        int hit = 0;
+        for (int i = 0; i < line_path_count; i++) {
+            if (strcmp(line_paths[i], resolved) == 0) {
+                used[i] = hit = 1;
+            }
+        }
+        if (hit) {
+            stats.useful++;
+        } else {
+            stats.missed++;
+        }
+    }
+    for (int i = 0; i < line_path_count; i++) {
+        if (!used[i]) {
+            stats.wasted++;
+        }
+    }
+    line_path_count = 0;
+}
+
+/**
+ * @brief 先読みの統計を表示する (shellstats と、DEBUG ビルドでは終了時)
+ */
+void prefetch_print_stats(FILE *out) {
+    fprintf(out, "prefetch: binaries=%lu libraries=%lu useful=%lu wasted=%lu missed=%lu\n",
+            __atomic_load_n(&stats.binaries, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats.libraries, __ATOMIC_RELAXED),
+            stats.useful, stats.wasted, stats.missed);
+}
+
+#ifdef DEBUG
+static void print_stats_at_exit(void) {
+    prefetch_print_stats(stderr);
+}
+#endif
+
+/**
+ * @brief 再描画のフックと先読みスレッドを準備する
+ */
+void prefetch_init(void) {
+    if (pthread_create(&worker, NULL, worker_main, NULL) != 0) {
+        return;
+    }
+    pthread_detach(worker);
+    saved_redisplay = rl_redisplay_function;
+    rl_redisplay_function = prefetch_redisplay;
+#ifdef DEBUG
+    atexit(print_stats_at_exit);
+#endif
+}
@@ -0,0 +1,477 @@
+#define _GNU_SOURCE /* pipe2 */
+#define STATS_SUBSYSTEM STATS_EXPAND
+#include <shell.h>
+#include <poll.h>
+
+/*
+ * プロンプト ($PS1 / $PS2)
+ *
+ * バックスラッシュのエスケープ (\u \h \H \w \W \$ \t \n \e \a \[ \] \\) を展開し、
+ * $VAR を展開する。$PS1 の中の $(...) (ブランチ名や kube のコンテキストなど) は
+ * 「セグメント」として子プロセスで実行する。プロンプトを出すときは全セグメントを起動して
+ * $MYSHELL_PROMPT_BUDGET ミリ秒 (既定 30) だけ結果を待ち、間に合わなかったものは
+ * 前回の値 (同じカレントディレクトリで得た値) のまま表示する。遅れて終わった結果は
+ * readline の rl_event_hook で受け取り、表示中のプロンプトをその場で書き直す。
+ * 実行中のセグメントは次のプロンプトでも起動し直さないので、遅いファイルシステムで
+ * プロンプトのコマンドが溜まっていくことはない。
+ */
+
+#define PROMPT_MAX_SEGMENTS 8
+#define PROMPT_CWD_SLOTS 8              /* セグメントごとに覚えるカレントディレクトリの数 */
+#define PROMPT_DEFAULT_BUDGET_MS 30
+#define PROMPT_JOB_TIMEOUT_MS 10000     /* これより長くかかるセグメントは止める */
+#define PROMPT_OUTPUT_MAX 1024
+
+typedef struct SegmentValue {
+    char *cwd;
+    char *value;
+    unsigned long used;                 // 最後に使った世代 (LRU)
+} SegmentValue;
+
+typedef struct Segment {
+    char *text;                         // $( ) の中身
+    SegmentValue values[PROMPT_CWD_SLOTS];
+    pid_t pid;                          // 実行中の子プロセス (なければ0)
+    int fd;
+    char *job_cwd;                      // 実行を始めたときのカレントディレクトリ
+    long long job_started;
+    char output[PROMPT_OUTPUT_MAX];
+    size_t output_len;
+} Segment;
+
+static Segment segments[PROMPT_MAX_SEGMENTS];
+static int segment_count = 0;
+static char *segments_ps1 = NULL;       // segments を作ったときの $PS1
+static unsigned long generation = 0;
+
+static char *current_prompt = NULL;     // 表示中の $PS1 のプロンプト
+static int showing_primary = 0;
+static rl_hook_func_t *saved_event_hook = NULL;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* ---------- セグメントの実行 ---------- */
+
+static void segment_clear(Segment *seg) {
+    if (seg->pid > 0) {
+        kill(seg->pid, SIGKILL);
+        close(seg->fd);
+        waitpid(seg->pid, NULL, 0);
+    }
+    for (int i = 0; i < PROMPT_CWD_SLOTS; i++) {
+        free(seg->values[i].cwd);
+        free(seg->values[i].value);
+    }
+    free(seg->job_cwd);
+    free(seg->text);
+    memset(seg, 0, sizeof(*seg));
+}
+
+static SegmentValue* segment_lookup(Segment *seg, const char *cwd) {
+    for (int i = 0; i < PROMPT_CWD_SLOTS; i++) {
+        if (seg->values[i].cwd != NULL && strcmp(seg->values[i].cwd, cwd) == 0) {
+            return &seg->values[i];
+        }
+    }
+    return NULL;
+}
+
+static void segment_store(Segment *seg, const char *cwd, const char *value) {
+    SegmentValue *slot = segment_lookup(seg, cwd);
+    if (slot == NULL) {
+        slot = &seg->values[0];
+        for (int i = 1; i < PROMPT_CWD_SLOTS; i++) {
+            if (seg->values[i].used < slot->used) {
+                slot = &seg->values[i];
+            }
+        }
+        free(slot->cwd);
+        slot->cwd = strdup(cwd);
+    }
+    free(slot->value);
+    slot->value = strdup(value);
+    slot->used = generation;
+}
+
+/**
+ * @brief セグメントを子プロセスで実行し始める
+ *
+ * コマンド置換と同じくシェル自身を fork して実行するので、シェル関数も使える。
+ * 標準入力と標準エラー出力は /dev/null にする (端末の入力を奪わず、行を乱さない)。
+ */
+static void segment_start(Segment *seg, const char *cwd) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+        return;
+    }
+    out_flush();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        Program *prog = NULL;
+        if (syntax_compile(seg->text, strlen(seg->text), NULL, 0, &prog) != SYNTAX_OK) {
+            _exit(2);
+        }
+        fcntl(STDOUT_FILENO, F_SETFL, 0);
+        int status = execute_program(prog, prog->root);
+        out_flush();
+        fflush(stdout);
+        _exit(status);
+    }
+    close(fds[1]);
+    seg->pid = pid;
+    seg->fd = fds[0];
+    seg->output_len = 0;
+    seg->job_started = now_ms();
+    free(seg->job_cwd);
+    seg->job_cwd = strdup(cwd);
+}
+
+/**
+ * @brief 実行中のセグメントの出力を読む
+ * @return セグメントが終わって値が変わったら1
+ */
+static int segment_collect(Segment *seg) {
+    ssize_t n;
+    for (;;) {
+        size_t room = sizeof(seg->output) - 1 - seg->output_len;
+        if (room == 0) {
+            char discard[256]; // 長すぎる出力は切り捨てる
+            n = read(seg->fd, discard, sizeof(discard));
+        } else {
+            n = read(seg->fd, seg->output + seg->output_len, room);
+        }
+        if (n > 0) {
+            seg->output_len += room == 0 ? 0 : (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+    if (n < 0) { // EAGAIN: まだ終わっていない
+        if (now_ms() - seg->job_started < PROMPT_JOB_TIMEOUT_MS) {
+            return 0;
+        }
+        kill(seg->pid, SIGKILL);
+    }
+    int wstatus;
+    close(seg->fd);
+    while (waitpid(seg->pid, &wstatus, 0) < 0 && errno == EINTR) {
+    }
+    seg->pid = 0;
+    // シグナルで止まった (タイムアウトや Ctrl-C) なら前の値を残す
+    if (n < 0 || WIFSIGNALED(wstatus) || seg->job_cwd == NULL) {
+        return 0;
+    }
+    while (seg->output_len > 0 && seg->output[seg->output_len - 1] == '\n') {
+        seg->output_len--;
+    }
+    seg->output[seg->output_len] = '\0';
+    SegmentValue *old = segment_lookup(seg, seg->job_cwd);
+    int changed = old == NULL || old->value == NULL || strcmp(old->value, seg->output) != 0;
+    segment_store(seg, seg->job_cwd, seg->output);
+    return changed;
+}
+
+// timeout_ms まで実行中のセグメントを待つ。結果が変わったセグメントがあれば1
+static int segments_wait(int timeout_ms) {
+    long long deadline = now_ms() + timeout_ms;
+    int changed = 0;
+    for (;;) {
+        struct pollfd pfds[PROMPT_MAX_SEGMENTS];
+        Segment *running[PROMPT_MAX_SEGMENTS];
+        int n = 0;
+        for (int i = 0; i < segment_count; i++) {
+            if (segments[i].pid > 0) {
+                pfds[n].fd = segments[i].fd;
+                pfds[n].events = POLLIN;
+                running[n++] = &segments[i];
+            }
+        }
+        long long left = deadline - now_ms();
+        if (n == 0 || poll(pfds, (nfds_t)n, left > 0 ? (int)left : 0) <= 0) {
+            // 時間切れでも、止めるべきものがあれば止める
+            for (int i = 0; i < n; i++) {
+                changed |= segment_collect(running[i]);
+            }
+            return changed;
+        }
+        for (int i = 0; i < n; i++) {
+            if (pfds[i].revents != 0) {
+                changed |= segment_collect(running[i]);
+            }
+        }
+    }
+}
+
+// $PS1 の $( ) を取り出して segments を作り直す (前と同じ $PS1 なら何もしない)
+static void segments_update(const char *ps1) {
+    if (segments_ps1 != NULL && strcmp(segments_ps1, ps1) == 0) {
+        return;
+    }
+    for (int i = 0; i < segment_count; i++) {
+        segment_clear(&segments[i]);
+    }
+    segment_count = 0;
+    free(segments_ps1);
+    segments_ps1 = strdup(ps1);
+    const char *end = ps1 + strlen(ps1);
+    for (const char *p = ps1; *p && segment_count < PROMPT_MAX_SEGMENTS; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (p[0] == '$' && p[1] == '(') {
+            const char *close = scan_command_subst(p + 2, end);
+            if (close == NULL) {
+                break;
+            }
+            segments[segment_count++].text = strndup(p + 2, (size_t)(close - p - 2));
+            p = close;
+        }
+    }
+}
+
+/* ---------- 展開 ---------- */
+
+typedef struct Buffer {
+    char *data;
+    size_t len, cap;
+} Buffer;
+
+static void buf_append(Buffer *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 64;
+        while (b->len + n + 1 > cap) {
+            cap *= 2;
+        }
+        char *tmp = (char *)realloc(b->data, cap);
+        if (tmp == NULL) {
+            return;
+        }
+        b->data = tmp;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+}
+
+static void buf_puts(Buffer *b, const char *s) {
+    buf_append(b, s, strlen(s));
+}
+
+// \w : $HOME の下なら ~ に置き換える
+static void append_cwd(Buffer *b, const char *cwd, int base_only) {
+    const char *home = getenv("HOME");
+    size_t home_len = home != NULL ? strlen(home) : 0;
+    if (base_only) {
+        const char *slash = strrchr(cwd, '/');
+        buf_puts(b, home_len > 0 && strcmp(cwd, home) == 0 ? "~" :
+                    (slash != NULL && slash[1] != '\0' ? slash + 1 : cwd));
+    } else if (home_len > 1 && strncmp(cwd, home, home_len) == 0 &&
+               (cwd[home_len] == '\0' || cwd[home_len] == '/')) {
+        buf_puts(b, "~");
+        buf_puts(b, cwd + home_len);
+    } else {
+        buf_puts(b, cwd);
+    }
+}
+
+// バックスラッシュのエスケープを1つ展開する。p は '\\' の次の文字
+static void append_escape(Buffer *b, char c, const char *cwd) {
+    char tmp[256];
+    switch (c) {
+        case 'u': {
+            struct passwd *pw = getpwuid(getuid());
+            buf_puts(b, pw != NULL ? pw->pw_name : "");
+            break;
+        }
+        case 'h':
+        case 'H':
+            if (gethostname(tmp, sizeof(tmp)) == 0) {
+                tmp[sizeof(tmp) - 1] = '\0';
+                if (c == 'h') {
+                    tmp[strcspn(tmp, ".")] = '\0';
+                }
+                buf_puts(b, tmp);
+            }
+            break;
+        case 'w':
+        case 'W':
+            append_cwd(b, cwd, c == 'W');
+            break;
+        case '$':
+            buf_puts(b, getuid() == 0 ? "#" : "$");
+            break;
+        case 't': {
+            time_t now = time(NULL);
+            struct tm tm;
+            localtime_r(&now, &tm);
+            strftime(tmp, sizeof(tmp), "%H:%M:%S", &tm);
+            buf_puts(b, tmp);
+            break;
+        }
+        case 'n': buf_puts(b, "\n"); break;
+        case 'e': buf_puts(b, "\033"); break;
+        case 'a': buf_puts(b, "\a"); break;
+        case '[': buf_puts(b, "\001"); break; // RL_PROMPT_START_IGNORE
+        case ']': buf_puts(b, "\002"); break; // RL_PROMPT_END_IGNORE
+        case '\\': buf_puts(b, "\\"); break;
+        default:
+            tmp[0] = '\\';
+            tmp[1] = c;
+            buf_append(b, tmp, 2);
+            break;
+    }
+}
+
+// $PS1 の $( ) 以外の部分を展開する
+static void append_text(Buffer *b, const char *s, size_t len, const char *cwd) {
+    Buffer text = {NULL, 0, 0};
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\\' && i + 1 < len) {
+            append_escape(&text, s[++i], cwd);
+        } else {
+            buf_append(&text, s + i, 1);
+        }
+    }
+    if (text.data == NULL) {
+        return;
+    }
+    char *expanded = strchr(text.data, '$') != NULL ? expand_heredoc(text.data) : NULL;
+    buf_puts(b, expanded != NULL ? expanded : text.data);
+    free(expanded);
+    free(text.data);
+}
+
+// 各セグメントの値 (なければ空) を埋めてプロンプトを組み立てる
+static char* render(const char *ps1, const char *cwd) {
+    Buffer b = {NULL, 0, 0};
+    const char *end = ps1 + strlen(ps1);
+    const char *start = ps1;
+    int index = 0;
+    for (const char *p = ps1; *p; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (p[0] == '$' && p[1] == '(' && index < segment_count) {
+            const char *close = scan_command_subst(p + 2, end);
+            if (close == NULL) {
+                break;
+            }
+            append_text(&b, start, (size_t)(p - start), cwd);
+            SegmentValue *v = segment_lookup(&segments[index++], cwd);
+            if (v != NULL && v->value != NULL) {
+                v->used = generation;
+                buf_puts(&b, v->value);
+            }
+            p = close;
+            start = close + 1;
+        }
+    }
+    append_text(&b, start, strlen(start), cwd);
+    return b.data != NULL ? b.data : strdup("");
+}
+
+/* ---------- readline との接続 ---------- */
+
+static int prompt_event_hook(void) {
+    if (saved_event_hook != NULL) {
+        saved_event_hook();
+    }
+    if (!showing_primary || !segments_wait(0)) {
+        return 0;
+    }
+    char cwd[MAX_PATH];
+    const char *ps1 = var_get("PS1");
+    if (ps1 == NULL || segments_ps1 == NULL || strcmp(ps1, segments_ps1) != 0 || getcwd(cwd, sizeof(cwd)) == NULL) {
+        return 0;
+    }
+    char *prompt = render(ps1, cwd);
+    if (current_prompt != NULL && strcmp(prompt, current_prompt) == 0) {
+        free(prompt);
+        return 0;
+    }
+    free(current_prompt);
+    current_prompt = prompt;
+    // 表示中の行を消してから、新しいプロンプトで入力中の行を描き直す
+    rl_clear_visible_line();
+    rl_set_prompt(current_prompt);
+    rl_forced_update_display();
+    return 0;
+}
+
+/**
+ * @brief 遅れて終わったセグメントでプロンプトを書き直すフックを登録する
+ */
+void prompt_init(void) {
+    saved_event_hook = rl_event_hook;
+    rl_event_hook = prompt_event_hook;
+}
+
+/**
+ * @brief $PS1 を展開したプロンプトを返す
+ *
+ * セグメントを起動し、時間内に終わらなかったものは前回の値で表示する。
+ * 返した文字列は次の呼び出しまで有効。
+ */
+const char* prompt_primary(void) {
+    const char *ps1 = var_get("PS1");
+    if (ps1 == NULL) {
+        ps1 = "myshell> ";
+    }
+    char cwd[MAX_PATH];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        strcpy(cwd, "?");
+    }
+    generation++;
+    segments_update(ps1);
+    for (int i = 0; i < segment_count; i++) {
+        if (segments[i].pid == 0) {
+            segment_start(&segments[i], cwd);
+        }
+    }
+    if (segment_count > 0) {
+        const char *opt = getenv("MYSHELL_PROMPT_BUDGET");
+        segments_wait(opt != NULL ? atoi(opt) : PROMPT_DEFAULT_BUDGET_MS);
+    }
+    free(current_prompt);
+    current_prompt = render(ps1, cwd);
+    showing_primary = 1;
+    return current_prompt;
+}
+
+/**
+ * @brief 続きの行のプロンプト ($PS2、既定は "> ") を返す。セグメントは実行しない
+ */
+const char* prompt_continuation(void) {
+    static char *ps2_prompt = NULL;
+    const char *ps2 = var_get("PS2");
+    char cwd[MAX_PATH];
+    showing_primary = 0;
+    if (ps2 == NULL) {
+        return "> ";
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        strcpy(cwd, "?");
+    }
+    Buffer b = {NULL, 0, 0};
+    append_text(&b, ps2, strlen(ps2), cwd);
+    free(ps2_prompt);
+    ps2_prompt = b.data != NULL ? b.data : strdup("");
+    return ps2_prompt;
+}
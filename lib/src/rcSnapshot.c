@@ -0,0 +1,715 @@
+#define STATS_SUBSYSTEM STATS_VARS
+#include <shell.h>
+#include <sys/mman.h>
+
+/*
+ * 設定ファイル ($MYSHELLRC、なければ ~/.myshellrc) とそのスナップショット
+ *
+ * 対話シェルは起動時に設定ファイルを source する。設定ファイルが
+ * MYSHELL_RC_SNAPSHOT=1 を設定していると、読み終えた後の状態
+ * (設定ファイルが変えた変数・配列・export と定義した関数) を
+ * $XDG_CACHE_HOME/myshell/rc/ にスナップショットとして書き出す。
+ * 次の起動では、設定ファイルと source したファイルがすべて変わっておらず、
+ * test -f などで調べたファイルのあるなし・種類・権限も同じで (なかったファイルが
+ * できていたら使わない)、設定ファイルが読んだ環境変数の値も同じなら、設定ファイルを実行せずに
+ * スナップショットを mmap して状態を戻す。関数の本体はコンパイル済みのプログラムを
+ * そのまま置いておき、ページ境界に揃えた領域をそれぞれ mmap して使う。
+ *
+ * 戻すのは変数と関数だけで、cd や umask のようなその他の状態や出力は戻らない。
+ * 設定ファイルの中で実行したコマンドの結果に依存する場合は MYSHELL_RC_SNAPSHOT を
+ * 設定しないこと。起動時に MYSHELL_RC_SNAPSHOT=0 ならスナップショットを使わない。
+ *
+ * ファイルの形式:
+ *   SnapshotHeader | 記録 (タグ1バイト + 中身) ... 'E' | (SNAPSHOT_ALIGN に揃えて) Program ...
+ */
+
+#define SNAPSHOT_MAGIC "MYSHRC\0\0"
+#define SNAPSHOT_FORMAT 1
+#define SNAPSHOT_ALIGN 65536    /* Program を置く境界 (どのページサイズでも mmap できる) */
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t program_count;
+    char shell_version[16];
+    uint64_t record_size;       // ヘッダーの後ろの記録の大きさ
+    uint64_t programs_offset;   // 最初の Program の位置 (SNAPSHOT_ALIGN の倍数)
+} SnapshotHeader;
+
+#define TRACE_READ 0x1          // 設定ファイルが書き換える前に読んだ
+#define TRACE_HAS_VALUE 0x2     // 読んだときに値があった
+#define TRACE_WRITTEN 0x4       // 設定ファイルが変数を書き換えた
+#define TRACE_FUNCTION 0x8      // 設定ファイルが関数を定義した (または消した)
+
+typedef struct TraceName {
+    char *name;                 // NULLなら空きスロット
+    char *value;                // TRACE_HAS_VALUE のとき読んだ値
+    unsigned flags;
+} TraceName;
+
+typedef struct TraceFile {
+    char *path;
+    struct stat st;             // probe なら st_mode (なければ0) と st_size だけを使う
+    int probe;                  // あるなしと種類・権限だけを見る (test -f や、なかった source)
+} TraceFile;
+
+int rc_snapshot_tracing = 0;    // 設定ファイルを実行している間1 (vars.c と interp.c が記録する)
+
+static TraceName *trace_names;
+static size_t trace_cap, trace_count;
+static TraceFile *trace_files;
+static size_t trace_file_count;
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* ---------- 設定ファイルが触ったものの記録 ---------- */
+
+static TraceName* trace_slot(const char *name) {
+    if ((trace_count + 1) * 2 > trace_cap) {
+        size_t new_cap = trace_cap ? trace_cap * 2 : 64;
+        TraceName *table = (TraceName *)calloc(new_cap, sizeof(TraceName));
+        if (table == NULL) {
+            return NULL;
+        }
+        for (size_t i = 0; i < trace_cap; i++) {
+            if (trace_names[i].name != NULL) {
+                size_t j = hash_bytes(0xcbf29ce484222325ULL, trace_names[i].name,
+                                      strlen(trace_names[i].name)) & (new_cap - 1);
+                while (table[j].name != NULL) {
+                    j = (j + 1) & (new_cap - 1);
+                }
+                table[j] = trace_names[i];
+            }
+        }
+        free(trace_names);
+        trace_names = table;
+        trace_cap = new_cap;
+    }
+    size_t mask = trace_cap - 1;
+    size_t i = hash_bytes(0xcbf29ce484222325ULL, name, strlen(name)) & mask;
+    for (; trace_names[i].name != NULL; i = (i + 1) & mask) {
+        if (strcmp(trace_names[i].name, name) == 0) {
+            return &trace_names[i];
+        }
+    }
+    if ((trace_names[i].name = strdup(name)) == NULL) {
+        return NULL;
+    }
+    trace_count++;
+    return &trace_names[i];
+}
+
+/**
+ * @brief 設定ファイルが変数を読んだことを記録する (書き換える前に読んだものだけ)
+ */
+void rc_snapshot_note_read(const char *name) {
+    TraceName *t = trace_slot(name);
+    if (t == NULL || (t->flags & (TRACE_READ | TRACE_WRITTEN))) {
+        return;
+    }
+    t->flags |= TRACE_READ;
+    const char *value = getenv(name); // 設定ファイルより前の値は環境変数にしかない
+    if (value != NULL && (t->value = strdup(value)) != NULL) {
+        t->flags |= TRACE_HAS_VALUE;
+    }
+}
+
+void rc_snapshot_note_write(const char *name) {
+    TraceName *t = trace_slot(name);
+    if (t != NULL) {
+        t->flags |= TRACE_WRITTEN;
+    }
+}
+
+void rc_snapshot_note_function(const char *name) {
+    TraceName *t = trace_slot(name);
+    if (t != NULL) {
+        t->flags |= TRACE_FUNCTION;
+    }
+}
+
+static void trace_file_add(const char *path, const struct stat *st, int probe) {
+    TraceFile *files = (TraceFile *)realloc(trace_files, (trace_file_count + 1) * sizeof(TraceFile));
+    if (files == NULL) {
+        return;
+    }
+    trace_files = files;
+    if ((files[trace_file_count].path = strdup(path)) != NULL) {
+        files[trace_file_count].st = *st;
+        files[trace_file_count++].probe = probe;
+    }
+}
+
+/**
+ * @brief 設定ファイルが読んだファイル (設定ファイル自身と source したもの) を記録する
+ *
+ * ないファイルは、できたら使わないように rc_snapshot_note_probe と同じく記録する。
+ */
+void rc_snapshot_note_file(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        rc_snapshot_note_probe(path);
+        return;
+    }
+    trace_file_add(path, &st, 0);
+}
+
+/**
+ * @brief 設定ファイルが調べたファイル (test -e, -f, -r など) のあるなしと種類・権限を記録する
+ */
+void rc_snapshot_note_probe(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    trace_file_add(path, &st, 1);
+}
+
+static void trace_free(void) {
+    for (size_t i = 0; i < trace_cap; i++) {
+        free(trace_names[i].name);
+        free(trace_names[i].value);
+    }
+    free(trace_names);
+    trace_names = NULL;
+    trace_cap = trace_count = 0;
+    for (size_t i = 0; i < trace_file_count; i++) {
+        free(trace_files[i].path);
+    }
+    free(trace_files);
+    trace_files = NULL;
+    trace_file_count = 0;
+}
+
+/* ---------- 書き出し ---------- */
+
+typedef struct SnapBuf {
+    char *data;
+    size_t len, cap;
+    int failed;
+} SnapBuf;
+
+static void put_bytes(SnapBuf *b, const void *data, size_t len) {
+    if (b->failed) {
+        return;
+    }
+    if (b->len + len > b->cap) {
+        size_t new_cap = b->cap ? b->cap * 2 : 4096;
+        while (new_cap < b->len + len) {
+            new_cap *= 2;
+        }
+        char *tmp = (char *)realloc(b->data, new_cap);
+        if (tmp == NULL) {
+            b->failed = 1;
+            return;
+        }
+        b->data = tmp;
+        b->cap = new_cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void put_u8(SnapBuf *b, uint8_t v) {
+    put_bytes(b, &v, 1);
+}
+
+static void put_u64(SnapBuf *b, uint64_t v) {
+    put_bytes(b, &v, sizeof(v));
+}
+
+static void put_str(SnapBuf *b, const char *s) {
+    uint32_t len = (uint32_t)strlen(s);
+    put_bytes(b, &len, sizeof(len));
+    put_bytes(b, s, (size_t)len + 1);
+}
+
+static void put_file_stat(SnapBuf *b, const struct stat *st) {
+    put_u64(b, (uint64_t)st->st_dev);
+    put_u64(b, (uint64_t)st->st_ino);
+    put_u64(b, (uint64_t)st->st_size);
+    put_u64(b, (uint64_t)st->st_mtim.tv_sec);
+    put_u64(b, (uint64_t)st->st_mtim.tv_nsec);
+}
+
+// 配列の要素を 'A' の記録にする
+static void put_array(SnapBuf *b, const char *name, const ShArray *a) {
+    put_u8(b, 'A');
+    put_u8(b, (uint8_t)array_is_assoc(a));
+    put_u64(b, array_count(a));
+    put_str(b, name);
+    size_t pos = 0;
+    const char *key, *value;
+    int64_t index;
+    while (array_iter(a, &pos, &key, &index, &value)) {
+        if (key != NULL) {
+            put_str(b, key);
+        } else {
+            put_u64(b, (uint64_t)index);
+        }
+        put_str(b, value);
+    }
+}
+
+static size_t align_up(size_t n) {
+    return (n + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+}
+
+static int write_all(int fd, const void *data, size_t len, off_t offset) {
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t w = pwrite(fd, p, len, offset);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+        offset += w;
+    }
+    return 0;
+}
+
+// 記録した名前とファイルから今の状態を書き出す (一時ファイルに書いてから rename する)
+static int snapshot_save(const char *path) {
+    SnapBuf b = {0};
+    const Program **programs = NULL;
+    uint32_t program_count = 0;
+    size_t program_end = 0;     // programs_offset からの大きさ
+    for (size_t i = 0; i < trace_file_count; i++) {
+        if (trace_files[i].probe) {
+            put_u8(&b, 'M');
+            put_u64(&b, (uint64_t)trace_files[i].st.st_mode);
+            put_u8(&b, trace_files[i].st.st_size > 0);
+        } else {
+            put_u8(&b, 'F');
+            put_file_stat(&b, &trace_files[i].st);
+        }
+        put_str(&b, trace_files[i].path);
+    }
+    for (size_t i = 0; i < trace_cap; i++) {
+        const TraceName *t = &trace_names[i];
+        if (t->name == NULL) {
+            continue;
+        }
+        if (t->flags & TRACE_READ) {
+            put_u8(&b, 'R');
+            put_u8(&b, (t->flags & TRACE_HAS_VALUE) != 0);
+            put_str(&b, t->name);
+            if (t->flags & TRACE_HAS_VALUE) {
+                put_str(&b, t->value);
+            }
+        }
+        if (t->flags & TRACE_WRITTEN) {
+            const char *value;
+            const ShArray *array;
+            int state = var_global_state(t->name, &value, &array);
+            if (array != NULL) {
+                put_array(&b, t->name, array);
+            } else if (state == 0) {
+                put_u8(&b, 'U');
+                put_str(&b, t->name);
+            } else {
+                put_u8(&b, 'V');
+                put_u8(&b, state == 2);
+                put_str(&b, t->name);
+                put_str(&b, value);
+            }
+        }
+        const Program *prog;
+        uint32_t body;
+        if ((t->flags & TRACE_FUNCTION) && function_definition(t->name, &prog, &body)) {
+            uint32_t k = 0;
+            while (k < program_count && programs[k] != prog) {
+                k++;
+            }
+            if (k == program_count) {
+                const Program **tmp = (const Program **)realloc(programs, (k + 1) * sizeof(*programs));
+                if (tmp == NULL) {
+                    b.failed = 1;
+                    break;
+                }
+                programs = tmp;
+                programs[program_count++] = prog;
+                put_u8(&b, 'P');
+                put_u64(&b, program_end);
+                put_u64(&b, prog->size);
+                program_end = align_up(program_end + prog->size);
+            }
+            put_u8(&b, 'D');
+            put_u64(&b, k);
+            put_u64(&b, body);
+            put_str(&b, t->name);
+        }
+    }
+    put_u8(&b, 'E');
+
+    char tmp[MAX_PATH];
+    int n = snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    int fd = b.failed || n < 0 || (size_t)n >= sizeof(tmp) ? -1 :
+             open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    int result = -1;
+    if (fd >= 0) {
+        SnapshotHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+        hdr.format = SNAPSHOT_FORMAT;
+        hdr.program_count = program_count;
+        snprintf(hdr.shell_version, sizeof(hdr.shell_version), "%s", MYSHELL_VERSION);
+        hdr.record_size = b.len;
+        hdr.programs_offset = align_up(sizeof(hdr) + b.len);
+        result = write_all(fd, &hdr, sizeof(hdr), 0) == 0 &&
+                 write_all(fd, b.data, b.len, sizeof(hdr)) == 0 ? 0 : -1;
+        // Program の間は書かずに穴にする
+        size_t offset = 0;
+        for (uint32_t i = 0; i < program_count && result == 0; i++) {
+            result = write_all(fd, programs[i]->base, programs[i]->size,
+                               (off_t)(hdr.programs_offset + offset));
+            offset = align_up(offset + programs[i]->size);
+        }
+        if (close(fd) != 0 || result != 0 || rename(tmp, path) != 0) {
+            unlink(tmp);
+            result = -1;
+        }
+    }
+    free(b.data);
+    free(programs);
+    return result;
+}
+
+/* ---------- 読み込み ---------- */
+
+typedef struct SnapReader {
+    const char *p, *end;
+    int bad;
+} SnapReader;
+
+static const void* get_bytes(SnapReader *r, size_t len) {
+    if (r->bad || (size_t)(r->end - r->p) < len) {
+        r->bad = 1;
+        return NULL;
+    }
+    const void *data = r->p;
+    r->p += len;
+    return data;
+}
+
+static uint8_t get_u8(SnapReader *r) {
+    const uint8_t *v = (const uint8_t *)get_bytes(r, 1);
+    return v ? *v : 0;
+}
+
+static uint64_t get_u64(SnapReader *r) {
+    uint64_t v = 0;
+    const void *data = get_bytes(r, sizeof(v));
+    if (data != NULL) {
+        memcpy(&v, data, sizeof(v));
+    }
+    return v;
+}
+
+static const char* get_str(SnapReader *r) {
+    uint32_t len = 0;
+    const void *data = get_bytes(r, sizeof(len));
+    if (data == NULL) {
+        return "";
+    }
+    memcpy(&len, data, sizeof(len));
+    const char *s = (const char *)get_bytes(r, (size_t)len + 1);
+    if (s == NULL || s[len] != '\0') {
+        r->bad = 1;
+        return "";
+    }
+    return s;
+}
+
+// 'A' の記録を読む (apply が0なら読み飛ばすだけ)
+static void get_array(SnapReader *r, int apply) {
+    int assoc = get_u8(r);
+    uint64_t count = get_u64(r);
+    const char *name = get_str(r);
+    ShArray *a = NULL;
+    if (apply && !r->bad) {
+        var_unset(name);
+        a = var_make_array(name, assoc ? 'A' : 'a', 0);
+    }
+    for (uint64_t i = 0; i < count && !r->bad; i++) {
+        const char *key = assoc ? get_str(r) : NULL;
+        int64_t index = assoc ? 0 : (int64_t)get_u64(r);
+        const char *value = get_str(r);
+        if (a != NULL && !r->bad) {
+            if (assoc) {
+                array_set_key(a, key, value);
+            } else {
+                array_set_index(a, index, value);
+            }
+        }
+    }
+}
+
+// test -f などで調べたときと同じ結果になるか (mode が0なら、そのときはなかった)
+static int probe_matches(const char *path, uint64_t mode, int nonempty) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return mode == 0;
+    }
+    return (uint64_t)st.st_mode == mode && (st.st_size > 0) == nonempty;
+}
+
+/**
+ * @brief 記録をたどる
+ *
+ * apply が0のときは、ファイルと環境変数が書き出したときと同じかを確かめ、Program の
+ * 位置が正しいかを数える。1のときは変数と関数を設定する。
+ *
+ * @return 使えるなら0、使えなければ-1
+ */
+static int snapshot_walk(const char *records, size_t size, Program **programs, uint32_t program_count,
+                         size_t file_size, uint64_t programs_offset, int apply) {
+    SnapReader r = {records, records + size, 0};
+    uint32_t seen_programs = 0;
+    for (;;) {
+        uint8_t tag = get_u8(&r);
+        if (r.bad) {
+            return -1;
+        }
+        switch (tag) {
+            case 'E':
+                return seen_programs == program_count ? 0 : -1;
+            case 'F': {
+                uint64_t dev = get_u64(&r), ino = get_u64(&r), fsize = get_u64(&r);
+                uint64_t sec = get_u64(&r), nsec = get_u64(&r);
+                const char *path = get_str(&r);
+                struct stat st;
+                if (!apply && (r.bad || stat(path, &st) != 0 || (uint64_t)st.st_dev != dev ||
+                               (uint64_t)st.st_ino != ino || (uint64_t)st.st_size != fsize ||
+                               (uint64_t)st.st_mtim.tv_sec != sec || (uint64_t)st.st_mtim.tv_nsec != nsec)) {
+                    return -1;
+                }
+                break;
+            }
+            case 'M': {
+                uint64_t mode = get_u64(&r);
+                int nonempty = get_u8(&r);
+                const char *path = get_str(&r);
+                if (!apply && (r.bad || !probe_matches(path, mode, nonempty))) {
+                    return -1;
+                }
+                break;
+            }
+            case 'R': {
+                int has_value = get_u8(&r);
+                const char *name = get_str(&r);
+                const char *value = has_value ? get_str(&r) : NULL;
+                const char *now = getenv(name);
+                if (!apply && (r.bad || (now == NULL) != (value == NULL) ||
+                               (now != NULL && strcmp(now, value) != 0))) {
+                    return -1;
+                }
+                break;
+            }
+            case 'V': {
+                int exported = get_u8(&r);
+                const char *name = get_str(&r);
+                const char *value = get_str(&r);
+                if (apply && !r.bad) {
+                    var_unset(name);
+                    if (exported) {
+                        var_export(name, value);
+                    } else {
+                        var_set(name, value);
+                    }
+                }
+                break;
+            }
+            case 'U': {
+                const char *name = get_str(&r);
+                if (apply && !r.bad) {
+                    var_unset(name);
+                }
+                break;
+            }
+            case 'A':
+                get_array(&r, apply);
+                break;
+            case 'P': {
+                uint64_t offset = get_u64(&r), psize = get_u64(&r);
+                if (offset % SNAPSHOT_ALIGN != 0 || psize > file_size ||
+                    programs_offset + offset > file_size - psize || seen_programs >= program_count) {
+                    return -1;
+                }
+                seen_programs++;
+                break;
+            }
+            case 'D': {
+                uint64_t k = get_u64(&r), body = get_u64(&r);
+                const char *name = get_str(&r);
+                if (r.bad || k >= seen_programs) {
+                    return -1;
+                }
+                if (apply) {
+                    if (body >= programs[k]->node_count) {
+                        return -1;
+                    }
+                    function_set(name, programs[k], (uint32_t)body);
+                }
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+}
+
+// Program の位置と大きさを記録の中から順に取り出す
+static int next_program(SnapReader *r, uint64_t *offset, uint64_t *size) {
+    for (;;) {
+        uint8_t tag = get_u8(r);
+        if (r->bad || tag == 'E') {
+            return 0;
+        }
+        switch (tag) {
+            case 'F':
+                get_bytes(r, 5 * sizeof(uint64_t));
+                get_str(r);
+                break;
+            case 'M':
+                get_u64(r);
+                get_u8(r);
+                get_str(r);
+                break;
+            case 'R':
+                if (get_u8(r)) {
+                    get_str(r);
+                }
+                get_str(r);
+                break;
+            case 'V':
+                get_u8(r);
+                get_str(r);
+                get_str(r);
+                break;
+            case 'U':
+                get_str(r);
+                break;
+            case 'A':
+                get_array(r, 0);
+                break;
+            case 'P':
+                *offset = get_u64(r);
+                *size = get_u64(r);
+                return !r->bad;
+            case 'D':
+                get_u64(r);
+                get_u64(r);
+                get_str(r);
+                break;
+            default:
+                r->bad = 1;
+                return 0;
+        }
+    }
+}
+
+// スナップショットが使えれば状態を戻す
+static int snapshot_load(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    SnapshotHeader hdr;
+    if (fstat(fd, &st) != 0 || pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0 || hdr.format != SNAPSHOT_FORMAT ||
+        strncmp(hdr.shell_version, MYSHELL_VERSION, sizeof(hdr.shell_version)) != 0 ||
+        hdr.record_size > (uint64_t)st.st_size - sizeof(hdr) ||
+        hdr.programs_offset < sizeof(hdr) + hdr.record_size || hdr.programs_offset % SNAPSHOT_ALIGN != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t head_size = sizeof(hdr) + hdr.record_size;
+    char *head = (char *)mmap(NULL, head_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (head == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    const char *records = head + sizeof(hdr);
+    Program **programs = (Program **)calloc(hdr.program_count + 1, sizeof(Program *));
+    int result = programs != NULL ? snapshot_walk(records, hdr.record_size, programs, hdr.program_count,
+                                                  (size_t)st.st_size, hdr.programs_offset, 0) : -1;
+    // Program はそれぞれ別に mmap する (関数が残っている間だけ残る)
+    SnapReader r = {records, records + hdr.record_size, 0};
+    uint64_t offset, size;
+    for (uint32_t i = 0; result == 0 && i < hdr.program_count; i++) {
+        void *base = next_program(&r, &offset, &size) ?
+                     mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t)(hdr.programs_offset + offset)) :
+                     MAP_FAILED;
+        if (base == MAP_FAILED) {
+            result = -1;
+        } else if ((programs[i] = program_from_image(base, size)) == NULL) {
+            munmap(base, size);
+            result = -1;
+        }
+    }
+    close(fd);
+    if (result == 0) {
+        result = snapshot_walk(records, hdr.record_size, programs, hdr.program_count,
+                               (size_t)st.st_size, hdr.programs_offset, 1);
+    }
+    for (uint32_t i = 0; programs != NULL && i < hdr.program_count; i++) {
+        program_free(programs[i]); // 関数が参照を持っていなければ munmap される
+    }
+    free(programs);
+    munmap(head, head_size);
+    return result;
+}
+
+/* ---------- 起動時の読み込み ---------- */
+
+/**
+ * @brief 対話シェルの起動時に設定ファイルを読む
+ *
+ * 使えるスナップショットがあればそれから状態を戻し、なければ設定ファイルを実行する。
+ */
+void rc_load(void) {
+    char rc[MAX_PATH];
+    const char *env = getenv("MYSHELLRC");
+    const char *home = getenv("HOME");
+    if (env != NULL && env[0] != '\0') {
+        snprintf(rc, sizeof(rc), "%s", env);
+    } else if (home != NULL) {
+        snprintf(rc, sizeof(rc), "%s/.myshellrc", home);
+    } else {
+        return;
+    }
+    if (access(rc, R_OK) != 0) {
+        return;
+    }
+    char file[32], snapshot[MAX_PATH];
+    snprintf(file, sizeof(file), "%016llx.snap",
+             (unsigned long long)hash_bytes(0xcbf29ce484222325ULL, rc, strlen(rc)));
+    const char *use = getenv("MYSHELL_RC_SNAPSHOT");
+    int usable = (use == NULL || strcmp(use, "0") != 0) &&
+                 cache_path("rc", file, snapshot, sizeof(snapshot)) == 0;
+    if (usable && snapshot_load(snapshot) == 0) {
+        return;
+    }
+    rc_snapshot_tracing = 1;
+    rc_snapshot_note_file(rc);
+    run_script(rc);
+    rc_snapshot_tracing = 0;
+    const char *want = var_get("MYSHELL_RC_SNAPSHOT");
+    if (usable && want != NULL && strcmp(want, "1") == 0) {
+        snapshot_save(snapshot); // 書き出せなくても次回は設定ファイルを実行するだけ
+    }
+    trace_free();
+}
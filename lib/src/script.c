@@ -0,0 +1,124 @@
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <sys/mman.h>
+
+/*
+ * スクリプトの実行
+ *
+ * myshell script.sh で渡されたファイルを syntax.c で解析して
+ * 平坦化した構文木 (bytecode.c) にコンパイルし、interp.c で実行する。
+ * コンパイル結果は $XDG_CACHE_HOME/myshell/bytecode/ に
+ * 「シェルのバージョン + スクリプトの内容」のハッシュを名前にして保存し、
+ * 次回からは解析を飛ばして mmap したものをそのまま実行する。
+ */
+
+// FNV-1a (64bit)
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief キャッシュのディレクトリ ($XDG_CACHE_HOME/myshell/SUBDIR) の中のファイルのパスを作る
+ *
+ * ディレクトリがなければ途中のものも含めて作る。
+ *
+ * @return 成功時0、HOME もなくパスを決められない場合などは-1
+ */
+int cache_path(const char *subdir, const char *file, char *out, size_t size) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[MAX_PATH];
+    int n;
+    if (xdg != NULL && xdg[0] != '\0') {
+        n = snprintf(dir, sizeof(dir), "%s/myshell/%s", xdg, subdir);
+    } else if (home != NULL) {
+        n = snprintf(dir, sizeof(dir), "%s/.cache/myshell/%s", home, subdir);
+    } else {
+        return -1;
+    }
+    if (n < 0 || (size_t)n >= sizeof(dir)) {
+        return -1;
+    }
+    // 途中のディレクトリも作る (mkdir -p)
+    for (char *p = dir + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(dir, 0700);
+            *p = '/';
+        }
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    n = snprintf(out, size, "%s/%s", dir, file);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+static int script_cache_path(uint64_t hash, char *out, size_t size) {
+    char file[32];
+    snprintf(file, sizeof(file), "%016llx.mbc", (unsigned long long)hash);
+    return cache_path("bytecode", file, out, size);
+}
+
+/**
+ * @brief スクリプトファイルを実行する
+ *
+ * キャッシュがあればそれを mmap して実行し、なければコンパイルして保存する。
+ *
+ * @return スクリプトの終了ステータス
+ */
+int run_script(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return 126;
+    }
+    size_t len = (size_t)st.st_size;
+    const char *text = "";
+    void *map = NULL;
+    if (len > 0) {
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            return 126;
+        }
+        text = (const char *)map;
+    }
+    close(fd);
+
+    uint64_t hash = hash_bytes(0xcbf29ce484222325ULL, MYSHELL_VERSION, sizeof(MYSHELL_VERSION));
+    hash = hash_bytes(hash, text, len);
+    char cache_path[MAX_PATH];
+    int cacheable = script_cache_path(hash, cache_path, sizeof(cache_path)) == 0;
+    Program *prog = cacheable ? program_load(cache_path, hash, len) : NULL;
+    if (prog == NULL) {
+        SyntaxStatus result = syntax_compile(text, len, path, hash, &prog);
+        if (result == SYNTAX_INCOMPLETE) {
+            fprintf(stderr, "myshell: %s: syntax error: unexpected end of file\n", path);
+        }
+        if (result == SYNTAX_OK && cacheable) {
+            program_save(prog, cache_path); // 保存できなくても実行はできる
+        }
+    }
+    if (map != NULL) {
+        munmap(map, len);
+    }
+    if (prog == NULL) {
+        return 2;
+    }
+    int status = execute_program(prog, prog->root);
+    program_free(prog);
+    return status;
+}
@@ -0,0 +1,128 @@
+#include <shell.h>
+
+/*
+ * セッションの記録
+ *
+ * $MYSHELL_RECORD にファイル名が設定されていると、実行した入力を1つずつ追記する。
+ * 性能の回帰テスト (test/perfcheck.c) はこのファイルを読んで同じ入力を再生する。
+ *
+ * 形式 (1行に1件、タブ区切り):
+ *   # myshell session 1
+ *   <開始からの経過ms>\t<実行にかかったms>\t<終了ステータス>\t<入力>
+ * 入力の中の '\\'、改行、タブはそれぞれ "\\\\"、"\\n"、"\\t" と書く。
+ * 対話モードでは完結した入力 (続きの行を含む) ごとに、スクリプトの実行では
+ * スクリプト全体を1件として記録する。
+ */
+
+#define SESSION_RECORD_VERSION 1
+
+static int record_fd = -1;
+static long long session_start = 0;
+static char *script_path = NULL;    // スクリプトの実行を記録する場合のパス
+static long long script_started = 0;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief $MYSHELL_RECORD が設定されていれば記録するファイルを開く
+ */
+void session_record_init(void) {
+    const char *path = getenv("MYSHELL_RECORD");
+    if (path == NULL || path[0] == '\0' || record_fd >= 0) {
+        return;
+    }
+    record_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (record_fd < 0) {
+        fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(record_fd, &st) == 0 && st.st_size == 0) {
+        dprintf(record_fd, "# myshell session %d\n", SESSION_RECORD_VERSION);
+    }
+    session_start = now_ns();
+}
+
+/**
+ * @brief 入力の実行を始める時刻を返す (session_record に渡す)
+ */
+long long session_record_start(void) {
+    return record_fd >= 0 ? now_ns() : 0;
+}
+
+/**
+ * @brief 実行した入力を1件記録する
+ *
+ * @param text 入力 (複数行でもよい)
+ * @param status 終了ステータス
+ * @param started session_record_start の値
+ */
+void session_record(const char *text, int status, long long started) {
+    if (record_fd < 0 || text == NULL || text[0] == '\0') {
+        return;
+    }
+    long long now = now_ns();
+    size_t len = strlen(text);
+    char *line = (char *)malloc(len * 2 + 96);
+    if (line == NULL) {
+        return;
+    }
+    int n = snprintf(line, 96, "%lld\t%lld\t%d\t", (started - session_start) / 1000000,
+                     (now - started) / 1000000, status);
+    char *p = line + n;
+    for (const char *s = text; *s; s++) {
+        if (*s == '\\' || *s == '\n' || *s == '\t') {
+            *p++ = '\\';
+            *p++ = *s == '\\' ? '\\' : (*s == '\n' ? 'n' : 't');
+        } else {
+            *p++ = *s;
+        }
+    }
+    *p++ = '\n';
+    // O_APPEND の1回の write なので、複数のシェルが同じファイルに記録しても行は混ざらない
+    if (write(record_fd, line, (size_t)(p - line)) < 0) {
+        perror("myshell: session record");
+    }
+    free(line);
+}
+
+static void record_script_at_exit(void) {
+    if (getpid() != shell_pid) {
+        return;
+    }
+    int fd = open(script_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    char *text = (char *)malloc((size_t)st.st_size + 1);
+    ssize_t n = text ? read(fd, text, (size_t)st.st_size) : -1;
+    close(fd);
+    if (n >= 0) {
+        text[n] = '\0';
+        session_record(text, last_exit_status, script_started);
+    }
+    free(text);
+}
+
+/**
+ * @brief スクリプトの実行を記録する (exit で終わっても記録されるよう atexit で書く)
+ */
+void session_record_script(const char *path) {
+    if (record_fd < 0 || script_path != NULL) {
+        return;
+    }
+    script_path = strdup(path);
+    if (script_path == NULL) {
+        return;
+    }
+    script_started = now_ns();
+    atexit(record_script_at_exit);
+}
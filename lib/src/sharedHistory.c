@@ -0,0 +1,191 @@
+#define STATS_SUBSYSTEM STATS_HISTORY
+#include <shell.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+ * セッション間で共有する履歴
+ *
+ * $MYSHELL_SHARED_HISTORY が設定されていると、同じユーザーのmyshell同士で
+ * /dev/shm 上のリングバッファを共有する。追記はロックを使わず、
+ * 次の通し番号を fetch_add で確保してスロットに書き、最後に番号を公開する。
+ * 読む側は自分が読んだ番号から先頭までを、スロットの番号が書き込みの前後で
+ * 変わっていないこと (seqlock) を確かめながら取り込む。
+ */
+
+#define SHARED_HISTORY_MAGIC 0x4d59534852494e47ULL /* "MYSHRING" */
+#define SHARED_HISTORY_INITIALIZING 1ULL
+#define SHARED_HISTORY_VERSION 1
+#define SHARED_HISTORY_SLOTS 4096   /* 2のべき乗 */
+#define SHARED_HISTORY_SLOT_SIZE 512
+#define SHARED_HISTORY_STALL_POLLS 100  /* 公開されないスロットを読み飛ばすまでに待つ取り込みの回数 */
+
+typedef struct RingHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t reserved;
+    uint64_t head;          // 次に確保される通し番号
+} RingHeader;
+
+typedef struct RingSlot {
+    uint64_t seq;           // 公開済みなら通し番号+1、書き込み中は0
+    uint32_t pid;
+    uint32_t len;
+    char text[SHARED_HISTORY_SLOT_SIZE - 16];
+} RingSlot;
+
+typedef struct Ring {
+    RingHeader header;
+    char pad[64 - sizeof(RingHeader)]; // スロットをキャッシュラインの境界から始める
+    RingSlot slots[SHARED_HISTORY_SLOTS];
+} Ring;
+
+static Ring *ring = NULL;
+static uint64_t next_seq = 0;       // 次に読む通し番号
+static unsigned stalled_polls = 0;  // next_seq のスロットが公開されるのを待った回数
+static uint32_t self_pid = 0;
+
+// 最初に開いたセッションだけがヘッダを初期化する
+static int ring_setup_header(void) {
+    uint64_t expected = 0;
+    if (__atomic_compare_exchange_n(&ring->header.magic, &expected, SHARED_HISTORY_INITIALIZING,
+                                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        ring->header.version = SHARED_HISTORY_VERSION;
+        ring->header.slot_count = SHARED_HISTORY_SLOTS;
+        ring->header.slot_size = SHARED_HISTORY_SLOT_SIZE;
+        __atomic_store_n(&ring->header.magic, SHARED_HISTORY_MAGIC, __ATOMIC_RELEASE);
+        return 0;
+    }
+    // 他のセッションが初期化中なら終わるのを待つ
+    for (int i = 0; i < 1000 && expected == SHARED_HISTORY_INITIALIZING; i++) {
+        usleep(1000);
+        expected = __atomic_load_n(&ring->header.magic, __ATOMIC_ACQUIRE);
+    }
+    if (expected != SHARED_HISTORY_MAGIC || ring->header.version != SHARED_HISTORY_VERSION ||
+        ring->header.slot_count != SHARED_HISTORY_SLOTS ||
+        ring->header.slot_size != SHARED_HISTORY_SLOT_SIZE) {
+        fprintf(stderr, "shared history: incompatible ring buffer\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 他のセッションが追加した履歴を取り込む
+ *
+ * readlineの入力待ちの間にも呼ばれるため、新しい履歴がなければ
+ * 共有領域の先頭番号を1回読むだけで戻る。
+ *
+ * @return readlineのイベントフックとしての戻り値 (常に0)
+ */
+int shared_history_poll(void) {
+    if (ring == NULL) {
+        return 0;
+    }
+    uint64_t head = __atomic_load_n(&ring->header.head, __ATOMIC_ACQUIRE);
+    if (head - next_seq > SHARED_HISTORY_SLOTS) {
+        next_seq = head - SHARED_HISTORY_SLOTS; // 読み遅れた分は上書きされている
+    }
+    char text[sizeof(ring->slots[0].text) + 1];
+    for (; next_seq < head; next_seq++) {
+        RingSlot *slot = &ring->slots[next_seq & (SHARED_HISTORY_SLOTS - 1)];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0 || seq < next_seq + 1) {
+            // まだ書き込み中。次の呼び出しで読むが、書き手が公開の前に死んだなら読み飛ばす
+            if (++stalled_polls < SHARED_HISTORY_STALL_POLLS) {
+                break;
+            }
+            stalled_polls = 0;
+            continue;
+        }
+        stalled_polls = 0;
+        if (seq != next_seq + 1) {
+            continue; // 既に一周して上書きされた
+        }
+        uint32_t pid = slot->pid;
+        uint32_t len = slot->len;
+        if (len >= sizeof(text)) {
+            continue;
+        }
+        memcpy(text, slot->text, len);
+        text[len] = '\0';
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+            continue; // 読んでいる間に書き換えられた
+        }
+        if (pid != self_pid) {
+            add_history(text);
+            history_store_import(text);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 入力された行を共有リングに公開する
+ *
+ * スロットに収まらない長い行は公開しない (履歴ファイルには残る)。
+ */
+void shared_history_publish(const char *line) {
+    if (ring == NULL) {
+        return;
+    }
+    size_t len = strlen(line);
+    if (len == 0 || len > sizeof(ring->slots[0].text)) {
+        return;
+    }
+    uint64_t seq = __atomic_fetch_add(&ring->header.head, 1, __ATOMIC_ACQ_REL);
+    RingSlot *slot = &ring->slots[seq & (SHARED_HISTORY_SLOTS - 1)];
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->pid = self_pid;
+    slot->len = (uint32_t)len;
+    memcpy(slot->text, line, len);
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief $MYSHELL_SHARED_HISTORY が設定されていれば共有リングに接続する
+ */
+void shared_history_init(void) {
+    const char *opt = getenv("MYSHELL_SHARED_HISTORY");
+    if (opt == NULL || opt[0] == '\0' || strcmp(opt, "0") == 0) {
+        return;
+    }
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "/dev/shm/myshell-history-%u", (unsigned int)getuid());
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (fd < 0) {
+        perror("shared history: open");
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_uid != getuid()) {
+        fprintf(stderr, "shared history: %s is not owned by the current user\n", path);
+        close(fd);
+        return;
+    }
+    // 同時に作成しても同じ大きさに揃えるだけなので競合しない
+    if ((size_t)st.st_size < sizeof(Ring) && ftruncate(fd, sizeof(Ring)) != 0) {
+        perror("shared history: ftruncate");
+        close(fd);
+        return;
+    }
+    void *base = mmap(NULL, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("shared history: mmap");
+        return;
+    }
+    ring = (Ring *)base;
+    if (ring_setup_header() != 0) {
+        munmap(base, sizeof(Ring));
+        ring = NULL;
+        return;
+    }
+    self_pid = (uint32_t)getpid();
+    next_seq = __atomic_load_n(&ring->header.head, __ATOMIC_ACQUIRE);
+    rl_event_hook = shared_history_poll;
+}
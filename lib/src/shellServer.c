@@ -0,0 +1,554 @@
+#define _GNU_SOURCE /* accept4, clearenv */
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
+
+/*
+ * サーバーモード
+ *
+ *   myshell --serve SOCKET [INIT_SCRIPT]
+ *   myshell --client SOCKET -c COMMAND [ARG0 ARGS...]
+ *   myshell --client SOCKET SCRIPT [ARGS...]
+ *
+ * サーバーは Unix ソケットで要求を待ち、送られてきたスクリプトを main() と同じ
+ * syntax_compile / execute_program で実行する。要求ごとに fork した子で実行するので、
+ * cd や変数の変更が次の要求に残ることはないが、サーバーのプロセスに温まった状態
+ * (PATH キャッシュ、コンパイル済みのスクリプト、INIT_SCRIPT で定義した関数や変数) は
+ * そのまま引き継がれる。
+ *
+ * クライアントは標準入力・標準出力・標準エラー出力とカレントディレクトリの fd を
+ * SCM_RIGHTS で渡すので、出力はサーバーを経由せずにクライアントの fd に直接書かれる。
+ * 実行が終わると、サーバーは終了ステータスを返してから接続を閉じる。
+ *
+ * 要求の形式:
+ *   ServeRequest | argv[0]\0 ... | envp[0]\0 ... | スクリプトの本文
+ */
+
+#define SERVE_MAGIC 0x5653594du             /* "MYSV" */
+#define SERVE_MAX_REQUEST (64 * 1024 * 1024) /* 要求の大きさの上限 */
+#define SERVE_PLAN_CACHE 128                /* コンパイル済みのスクリプトを覚えておく数 */
+#define SERVE_FDS 4                         /* stdin, stdout, stderr, カレントディレクトリ */
+#define SERVE_SCRIPT_FILE 0x1               /* argv[0] がスクリプトのファイル名 (エラー表示用) */
+
+typedef struct ServeRequest {
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t strings_len;       // argv と envp の大きさ
+    uint32_t script_len;
+} ServeRequest;
+
+typedef struct Plan {
+    uint64_t hash;
+    char *text;                 // NULLなら空き
+    size_t len;
+    Program *prog;
+    uint64_t last_used;
+} Plan;
+
+typedef struct Worker {
+    pid_t pid;
+    int conn;                   // 終了ステータスを返す接続
+} Worker;
+
+static Plan plans[SERVE_PLAN_CACHE];
+static uint64_t plan_clock = 0;
+static Worker *workers = NULL;
+static size_t worker_count = 0, worker_cap = 0;
+
+// FNV-1a (64bit)
+static uint64_t serve_hash(const char *data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    char *p = (char *)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int split_strings(char *p, char *end, uint32_t count, char **out, char **next) {
+    for (uint32_t i = 0; i < count; i++) {
+        char *nul = memchr(p, '\0', (size_t)(end - p));
+        if (nul == NULL) {
+            return -1;
+        }
+        out[i] = p;
+        p = nul + 1;
+    }
+    out[count] = NULL;
+    *next = p;
+    return 0;
+}
+
+/* ---------- コンパイル済みスクリプトのキャッシュ ---------- */
+
+/**
+ * @brief スクリプトをコンパイルする (同じ本文は前回の結果を使う)
+ *
+ * @param err_fd 構文エラーを書き出す fd (クライアントの標準エラー出力)
+ * @return コンパイル結果 (参照を1つ持つ)。構文エラーならNULL
+ */
+static Program* plan_get(const char *text, size_t len, const char *name, int err_fd) {
+    uint64_t hash = serve_hash(text, len);
+    Plan *victim = &plans[0];
+    for (size_t i = 0; i < SERVE_PLAN_CACHE; i++) {
+        Plan *plan = &plans[i];
+        if (plan->text != NULL && plan->hash == hash && plan->len == len &&
+            memcmp(plan->text, text, len) == 0) {
+            plan->last_used = ++plan_clock;
+            return program_retain(plan->prog);
+        }
+        if (plan->text == NULL || (victim->text != NULL && plan->last_used < victim->last_used)) {
+            victim = plan;
+        }
+    }
+    // エラーメッセージはクライアントに見えるようにする
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+    Program *prog = NULL;
+    SyntaxStatus result = syntax_compile(text, len, name, hash, &prog);
+    if (result == SYNTAX_INCOMPLETE) {
+        fprintf(stderr, "myshell: %s%ssyntax error: unexpected end of file\n", name ? name : "", name ? ": " : "");
+    }
+    fflush(stderr);
+    if (saved >= 0) {
+        dup2(saved, STDERR_FILENO);
+        close(saved);
+    }
+    if (result != SYNTAX_OK) {
+        return NULL;
+    }
+    char *copy = (char *)malloc(len + 1);
+    if (copy != NULL) {
+        memcpy(copy, text, len);
+        copy[len] = '\0';
+        free(victim->text);
+        program_free(victim->prog);
+        victim->hash = hash;
+        victim->text = copy;
+        victim->len = len;
+        victim->prog = program_retain(prog);
+        victim->last_used = ++plan_clock;
+    }
+    return prog;
+}
+
+/* ---------- サーバー ---------- */
+
+static void send_status(int conn, int status) {
+    int32_t value = status;
+    write_full(conn, &value, sizeof(value));
+    close(conn);
+}
+
+// 終了した子に対応する接続へ終了ステータスを返す
+static void reap_workers(void) {
+    int wstatus;
+    pid_t pid;
+    while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+        for (size_t i = 0; i < worker_count; i++) {
+            if (workers[i].pid == pid) {
+                send_status(workers[i].conn, status_to_exit_code(wstatus));
+                workers[i] = workers[--worker_count];
+                break;
+            }
+        }
+    }
+}
+
+// 要求を実行する子プロセス。戻らない
+static void worker_main(const sigset_t *mask, const int *fds, char **argv, char **envp,
+                        uint32_t argc, const Program *prog) {
+    sigprocmask(SIG_SETMASK, mask, NULL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    shell_pid = getpid();
+    if (dup2(fds[0], STDIN_FILENO) < 0 || dup2(fds[1], STDOUT_FILENO) < 0 ||
+        dup2(fds[2], STDERR_FILENO) < 0 || fchdir(fds[3]) != 0) {
+        perror("myshell: serve");
+        _exit(126);
+    }
+    for (int i = 0; i < SERVE_FDS; i++) {
+        if (fds[i] > STDERR_FILENO) {
+            close(fds[i]);
+        }
+    }
+    clearenv();
+    for (char **env = envp; *env != NULL; env++) {
+        putenv(*env);
+    }
+    char cwd[MAX_PATH];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        setenv("PWD", cwd, 1);
+    }
+    vars_set_args((int)argc, argv);
+    int status = execute_program(prog, prog->root);
+    out_flush();
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+// 接続から要求を1つ読んで実行を始める
+static void serve_connection(int conn, int listen_fd, int sig_fd, const sigset_t *mask) {
+    // 要求を送ってこないクライアントで止まらないようにする
+    struct timeval timeout = {5, 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    ServeRequest req;
+    int fds[SERVE_FDS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    while ((n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL)) < 0 && errno == EINTR) {
+    }
+    int nfds = 0;
+    struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        nfds = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds, CMSG_DATA(cmsg), (size_t)nfds * sizeof(int));
+    }
+    char *buf = NULL;
+    char **argv = NULL, **envp = NULL;
+    int status = 1;
+    if (n != (ssize_t)sizeof(req) || nfds != SERVE_FDS || req.magic != SERVE_MAGIC || req.argc == 0 ||
+        (uint64_t)req.strings_len + req.script_len > SERVE_MAX_REQUEST ||
+        req.argc + (uint64_t)req.envc > req.strings_len) {
+        fprintf(stderr, "myshell: serve: malformed request\n");
+        goto done;
+    }
+    size_t total = (size_t)req.strings_len + req.script_len;
+    buf = (char *)malloc(total + 1);
+    argv = (char **)malloc((req.argc + 1) * sizeof(char *));
+    envp = (char **)malloc((req.envc + 1) * sizeof(char *));
+    if (buf == NULL || argv == NULL || envp == NULL || read_full(conn, buf, total) != 0) {
+        goto done;
+    }
+    char *strings_end = buf + req.strings_len, *next;
+    if (split_strings(buf, strings_end, req.argc, argv, &next) != 0 ||
+        split_strings(next, strings_end, req.envc, envp, &next) != 0) {
+        fprintf(stderr, "myshell: serve: malformed request\n");
+        goto done;
+    }
+    const char *name = (req.flags & SERVE_SCRIPT_FILE) ? argv[0] : NULL;
+    Program *prog = plan_get(strings_end, req.script_len, name, fds[2]);
+    if (prog == NULL) {
+        status = 2;
+        goto done;
+    }
+    // PATH キャッシュを最新にしてから fork し、子に引き継ぐ
+    path_cache_warm();
+    out_flush();
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(listen_fd);
+        close(sig_fd);
+        close(conn);
+        worker_main(mask, fds, argv, envp, req.argc, prog);
+    }
+    program_free(prog);
+    if (pid < 0) {
+        perror("myshell: serve: fork");
+        goto done;
+    }
+    if (worker_count == worker_cap) {
+        size_t cap = worker_cap ? worker_cap * 2 : 16;
+        Worker *tmp = (Worker *)realloc(workers, cap * sizeof(Worker));
+        if (tmp == NULL) {
+            // 記録できなければ終了を待ってから返す
+            int wstatus;
+            while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {
+            }
+            status = status_to_exit_code(wstatus);
+            goto done;
+        }
+        workers = tmp;
+        worker_cap = cap;
+    }
+    workers[worker_count].pid = pid;
+    workers[worker_count].conn = conn;
+    worker_count++;
+    conn = -1; // 子が終了したら reap_workers が閉じる
+done:
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+    free(buf);
+    free(argv);
+    free(envp);
+    if (conn >= 0) {
+        send_status(conn, status);
+    }
+}
+
+static int serve_listen(const char *socket_path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "myshell: %s: socket path too long\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("myshell: serve: socket");
+        return -1;
+    }
+    // 前回のサーバーが残したソケットファイルは消す (動いているサーバーがあれば使わない)
+    struct stat st;
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            fprintf(stderr, "myshell: %s: another server is running\n", socket_path);
+            close(fd);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+    mode_t old_mask = umask(077); // 同じユーザーだけが接続できる
+    int r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (r != 0 || listen(fd, 128) != 0) {
+        fprintf(stderr, "myshell: %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief サーバーモードで要求を待ち続ける
+ *
+ * SIGINT または SIGTERM で、実行中の要求の終了を待たずにソケットを消して終了する。
+ *
+ * @param socket_path 待ち受ける Unix ソケットのパス
+ * @param init_script 起動時に実行するスクリプト (関数の定義など)。NULLなら実行しない
+ * @return 終了ステータス
+ */
+int serve_main(const char *socket_path, const char *init_script) {
+    signal(SIGPIPE, SIG_IGN);
+    if (init_script != NULL) {
+        int status = run_script(init_script);
+        if (status != 0) {
+            fprintf(stderr, "myshell: %s: exited with status %d\n", init_script, status);
+        }
+    }
+    path_cache_warm(); // 子は作ってある PATH キャッシュを引き継いで引く
+
+    int listen_fd = serve_listen(socket_path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, &old_mask);
+    int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sig_fd < 0) {
+        perror("myshell: serve: signalfd");
+        close(listen_fd);
+        unlink(socket_path);
+        return 1;
+    }
+    fprintf(stderr, "myshell: serving on %s\n", socket_path);
+    int running = 1;
+    while (running) {
+        struct pollfd pfds[2] = {{listen_fd, POLLIN, 0}, {sig_fd, POLLIN, 0}};
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("myshell: serve: poll");
+            break;
+        }
+        if (pfds[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(sig_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+                if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM) {
+                    running = 0;
+                }
+            }
+            reap_workers();
+        }
+        if (running && (pfds[0].revents & POLLIN)) {
+            int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (conn >= 0) {
+                serve_connection(conn, listen_fd, sig_fd, &old_mask);
+            }
+        }
+    }
+    close(listen_fd);
+    close(sig_fd);
+    unlink(socket_path);
+    return 0;
+}
+
+/* ---------- クライアント ---------- */
+
+static char* read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "myshell: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    size_t cap = 4096, used = 0;
+    char *buf = (char *)malloc(cap);
+    ssize_t n;
+    while (buf != NULL) {
+        if (used == cap) {
+            char *tmp = (char *)realloc(buf, cap * 2);
+            if (tmp == NULL) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+        n = read(fd, buf + used, cap - used);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+    close(fd);
+    *len = used;
+    return buf;
+}
+
+static int append_strings(char **buf, size_t *len, char *const *list, uint32_t *count) {
+    for (*count = 0; list[*count] != NULL; (*count)++) {
+        size_t n = strlen(list[*count]) + 1;
+        char *tmp = (char *)realloc(*buf, *len + n);
+        if (tmp == NULL) {
+            return -1;
+        }
+        memcpy(tmp + *len, list[*count], n);
+        *buf = tmp;
+        *len += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief サーバーにスクリプトを送って実行してもらう
+ *
+ * @param socket_path サーバーのソケット
+ * @param argc/argv "-c COMMAND [ARG0 ARGS...]" または "SCRIPT [ARGS...]"
+ * @return スクリプトの終了ステータス
+ */
+int client_main(const char *socket_path, int argc, char **argv) {
+    extern char **environ;
+    if (argc < 1 || (strcmp(argv[0], "-c") == 0 && argc < 2)) {
+        fprintf(stderr, "usage: myshell --client SOCKET (-c COMMAND [ARG0 ARGS...] | SCRIPT [ARGS...])\n");
+        return 2;
+    }
+    ServeRequest req = {SERVE_MAGIC, 0, 0, 0, 0, 0};
+    char *script;
+    size_t script_len;
+    char *default_args[] = {"myshell", NULL};
+    char **args;
+    if (strcmp(argv[0], "-c") == 0) {
+        script = strdup(argv[1]);
+        script_len = strlen(argv[1]);
+        args = argc > 2 ? argv + 2 : default_args;
+    } else {
+        script = read_file(argv[0], &script_len);
+        args = argv;
+        req.flags |= SERVE_SCRIPT_FILE;
+    }
+    char *strings = NULL;
+    size_t strings_len = 0;
+    if (script == NULL || append_strings(&strings, &strings_len, args, &req.argc) != 0 ||
+        append_strings(&strings, &strings_len, environ, &req.envc) != 0 ||
+        strings_len + script_len > SERVE_MAX_REQUEST) {
+        fprintf(stderr, "myshell: request too large\n");
+        return 1;
+    }
+    req.strings_len = (uint32_t)strings_len;
+    req.script_len = (uint32_t)script_len;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "myshell: %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    int fds[SERVE_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, cwd};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    int32_t status;
+    if (cwd < 0 || sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(req) ||
+        write_full(fd, strings, strings_len) != 0 || write_full(fd, script, script_len) != 0 ||
+        read_full(fd, &status, sizeof(status)) != 0) {
+        fprintf(stderr, "myshell: %s: server closed the connection\n", socket_path);
+        return 1;
+    }
+    close(fd);
+    free(strings);
+    free(script);
+    return status;
+}
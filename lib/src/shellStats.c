@@ -0,0 +1,274 @@
+#include <shell.h>
+
+/*
+ * メモリ使用量の計測
+ *
+ * make stats でビルドすると、lib/src の malloc / calloc / realloc / strdup / strndup / free は
+ * shell.h のマクロでここの関数に置き換わり、分類 (STATS_SUBSYSTEM) ごとに
+ * 確保の回数・確保したバイト数・生きているオブジェクトとバイト数・最大値を数える。
+ * ブロックに前置きのヘッダを付けず、ポインタから大きさと分類を引く表を別に持つので、
+ * readline などライブラリが確保したものを free しても (その逆でも) 壊れない。
+ * 表にないポインタの解放は数えずにそのまま free する。
+ *
+ * 通常のビルドではこのファイルの計測部分はコンパイルされない。
+ */
+
+#ifdef MYSHELL_STATS
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+#undef strndup
+#undef free
+
+typedef struct StatsCounter {
+    uint64_t allocs;            // 確保の回数 (realloc を含む)
+    uint64_t frees;
+    uint64_t bytes;             // 確保したバイト数の累計
+    uint64_t live_objects;
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+} StatsCounter;
+
+typedef struct StatsEntry {
+    void *ptr;                  // NULLなら空き
+    size_t size;
+    StatsSubsystem sub;
+} StatsEntry;
+
+static const char *const subsystem_names[STATS_SUBSYSTEMS] = {
+    "other", "lex", "parse", "history", "vars", "expand", "exec", "completion",
+};
+
+static StatsCounter counters[STATS_SUBSYSTEMS];
+static uint64_t heap_live = 0, heap_peak = 0;
+static StatsEntry *table = NULL;
+static size_t table_cap = 0, table_count = 0;
+static int lock = 0;            // 履歴や先読みのスレッドからも呼ばれる
+
+static void stats_lock(void) {
+    while (__atomic_exchange_n(&lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void stats_unlock(void) {
+    __atomic_store_n(&lock, 0, __ATOMIC_RELEASE);
+}
+
+static size_t ptr_hash(const void *ptr) {
+    uintptr_t x = (uintptr_t)ptr >> 4;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+static StatsEntry* table_find(const void *ptr) {
+    if (table_cap == 0) {
+        return NULL;
+    }
+    for (size_t i = ptr_hash(ptr) & (table_cap - 1);; i = (i + 1) & (table_cap - 1)) {
+        if (table[i].ptr == NULL) {
+            return NULL;
+        }
+        if (table[i].ptr == ptr) {
+            return &table[i];
+        }
+    }
+}
+
+// 開番地法の表から1つ消し、後ろに続くスロットを詰め直す
+static void table_remove(StatsEntry *entry) {
+    size_t mask = table_cap - 1;
+    size_t i = (size_t)(entry - table);
+    entry->ptr = NULL;
+    table_count--;
+    for (size_t j = (i + 1) & mask; table[j].ptr != NULL; j = (j + 1) & mask) {
+        StatsEntry moved = table[j];
+        table[j].ptr = NULL;
+        size_t k = ptr_hash(moved.ptr) & mask;
+        while (table[k].ptr != NULL) {
+            k = (k + 1) & mask;
+        }
+        table[k] = moved;
+    }
+}
+
+static int table_grow(void) {
+    size_t new_cap = table_cap ? table_cap * 2 : 4096;
+    StatsEntry *entries = (StatsEntry *)calloc(new_cap, sizeof(StatsEntry));
+    if (entries == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < table_cap; i++) {
+        if (table[i].ptr == NULL) {
+            continue;
+        }
+        size_t j = ptr_hash(table[i].ptr) & (new_cap - 1);
+        while (entries[j].ptr != NULL) {
+            j = (j + 1) & (new_cap - 1);
+        }
+        entries[j] = table[i];
+    }
+    free(table);
+    table = entries;
+    table_cap = new_cap;
+    return 0;
+}
+
+// 解放されたブロックを数える (ロックを持って呼ぶ)
+static void account_free(StatsEntry *entry) {
+    StatsCounter *c = &counters[entry->sub];
+    c->frees++;
+    c->live_objects--;
+    c->live_bytes -= entry->size;
+    heap_live -= entry->size;
+    table_remove(entry);
+}
+
+// 確保したブロックを数える (ロックを持って呼ぶ)
+static void account_alloc(StatsSubsystem sub, void *ptr, size_t size) {
+    // ライブラリが解放したアドレスが再利用された場合は、古い記録を解放済みにする
+    StatsEntry *old = table_find(ptr);
+    if (old != NULL) {
+        account_free(old);
+    }
+    if ((table_count + 1) * 2 > table_cap && table_grow() != 0) {
+        return;
+    }
+    size_t i = ptr_hash(ptr) & (table_cap - 1);
+    while (table[i].ptr != NULL) {
+        i = (i + 1) & (table_cap - 1);
+    }
+    table[i].ptr = ptr;
+    table[i].size = size;
+    table[i].sub = sub;
+    table_count++;
+    StatsCounter *c = &counters[sub];
+    c->allocs++;
+    c->bytes += size;
+    c->live_objects++;
+    c->live_bytes += size;
+    if (c->live_bytes > c->peak_bytes) {
+        c->peak_bytes = c->live_bytes;
+    }
+    heap_live += size;
+    if (heap_live > heap_peak) {
+        heap_peak = heap_live;
+    }
+}
+
+void* stats_malloc(StatsSubsystem sub, size_t size) {
+    void *ptr = malloc(size);
+    if (ptr != NULL) {
+        stats_lock();
+        account_alloc(sub, ptr, size);
+        stats_unlock();
+    }
+    return ptr;
+}
+
+void* stats_calloc(StatsSubsystem sub, size_t count, size_t size) {
+    void *ptr = calloc(count, size);
+    if (ptr != NULL) {
+        stats_lock();
+        account_alloc(sub, ptr, count * size);
+        stats_unlock();
+    }
+    return ptr;
+}
+
+void* stats_realloc(StatsSubsystem sub, void *ptr, size_t size) {
+    uintptr_t old = (uintptr_t)ptr; // 表を引くためのキー (解放後に参照はしない)
+    void *moved = realloc(ptr, size);
+    if (moved == NULL && size > 0) {
+        return NULL; // 元のブロックはそのまま
+    }
+    stats_lock();
+    StatsEntry *entry = old ? table_find((const void *)old) : NULL;
+    if (entry != NULL) {
+        account_free(entry);
+    }
+    if (moved != NULL) {
+        account_alloc(sub, moved, size);
+    }
+    stats_unlock();
+    return moved;
+}
+
+char* stats_strdup(StatsSubsystem sub, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = (char *)stats_malloc(sub, len);
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+char* stats_strndup(StatsSubsystem sub, const char *s, size_t n) {
+    size_t len = strnlen(s, n);
+    char *copy = (char *)stats_malloc(sub, len + 1);
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+void stats_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    stats_lock();
+    StatsEntry *entry = table_find(ptr);
+    if (entry != NULL) {
+        account_free(entry);
+    }
+    stats_unlock();
+    free(ptr);
+}
+
+/**
+ * @brief 分類ごとの計測結果を出力する
+ */
+void stats_report(FILE *out) {
+    StatsCounter snapshot[STATS_SUBSYSTEMS];
+    stats_lock();
+    memcpy(snapshot, counters, sizeof(snapshot));
+    uint64_t live = heap_live, peak = heap_peak;
+    stats_unlock();
+    fprintf(out, "%-11s %10s %10s %12s %10s %12s %12s\n",
+            "subsystem", "allocs", "frees", "bytes", "live", "live bytes", "peak bytes");
+    StatsCounter total = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < STATS_SUBSYSTEMS; i++) {
+        const StatsCounter *c = &snapshot[i];
+        fprintf(out, "%-11s %10llu %10llu %12llu %10llu %12llu %12llu\n", subsystem_names[i],
+                (unsigned long long)c->allocs, (unsigned long long)c->frees,
+                (unsigned long long)c->bytes, (unsigned long long)c->live_objects,
+                (unsigned long long)c->live_bytes, (unsigned long long)c->peak_bytes);
+        total.allocs += c->allocs;
+        total.frees += c->frees;
+        total.bytes += c->bytes;
+        total.live_objects += c->live_objects;
+    }
+    fprintf(out, "%-11s %10llu %10llu %12llu %10llu %12llu %12llu\n", "total",
+            (unsigned long long)total.allocs, (unsigned long long)total.frees,
+            (unsigned long long)total.bytes, (unsigned long long)total.live_objects,
+            (unsigned long long)live, (unsigned long long)peak);
+}
+
+/**
+ * @brief 終了時の計測結果を標準エラー出力に書く (atexit に登録する)
+ */
+void stats_exit_report(void) {
+    if (getpid() != shell_pid) {
+        return;
+    }
+    fprintf(stderr, "myshell: memory usage at exit\n");
+    stats_report(stderr);
+}
+
+#endif /* MYSHELL_STATS */
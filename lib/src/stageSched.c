@@ -0,0 +1,572 @@
+#define _GNU_SOURCE /* sched_setaffinity, sched_getcpu, cpu_set_t */
+#define STATS_SUBSYSTEM STATS_EXEC
+#include <shell.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/*
+ * パイプラインの段ごとの CPU の割り当てと優先度 (pipesched)
+ *
+ * pipesched で設定した方針から、段ごとに CPU の集合・nice・I/O の優先度を決める。
+ * 設定は fork した子 (フォークサーバーから起動した子も) が exec の前に自分に適用する。
+ * 値は ':' で区切って段ごとに書き、段の数より少なければ最後の値を後ろの段にも使う
+ * (空の値はその段を変えない)。
+ *
+ * -c auto は2段以上のパイプラインの段を、シェルが今動いている CPU と最後のレベルの
+ * キャッシュを共有する CPU に1つずつ順に置く。同じ物理コアのハイパースレッドは
+ * 別のコアをひと通り使ってから使い、段が CPU より多ければ先頭に戻る。
+ * キャッシュの構成は /sys/devices/system/cpu から最初に使うときに一度だけ読む。
+ *
+ * 子が適用に失敗した設定 (権限がなくて nice を下げられないなど) は、子と共有するメモリに
+ * 段ごとに書いてもらい、pipesched の表示で (failed) を付ける。フォークサーバーの子とも
+ * 共有するため、stage_sched_init はフォークサーバーを作る前に呼ぶ。
+ */
+
+#define STAGE_SCHED_MAX_CPUS (STAGE_CPU_WORDS * 64)
+#define STAGE_SCHED_MAX_RECORD 64   /* pipesched で表示する段の数の上限 */
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+enum { IOPRIO_CLASS_NONE, IOPRIO_CLASS_RT, IOPRIO_CLASS_BE, IOPRIO_CLASS_IDLE };
+
+enum { OPT_CPUS, OPT_NICE, OPT_IOPRIO, OPTS };
+
+// 1つのオプションの段ごとの値 (items[i].flags が0ならその段は変えない)
+typedef struct StageOption {
+    char *spec;                 // 指定された文字列 (表示用)。NULLなら未設定
+    StageSched *items;
+    size_t count;
+} StageOption;
+
+// 前回のパイプラインの段 (pipesched の表示用)
+typedef struct StageRecord {
+    pid_t pid;
+    char *name;
+    StageSched sched;
+} StageRecord;
+
+static StageOption options[OPTS];
+static int cpus_auto = 0;
+
+static int topology_loaded = 0;
+static int16_t cache_domain[STAGE_SCHED_MAX_CPUS];  // 最後のレベルのキャッシュを共有する CPU の最小の番号
+static int16_t thread_rank[STAGE_SCHED_MAX_CPUS];   // 物理コアの中で何番目のスレッドか
+
+static int layout[STAGE_SCHED_MAX_CPUS];            // 今のパイプラインの auto の並び
+static size_t layout_count = 0;
+
+static StageRecord records[STAGE_SCHED_MAX_RECORD];
+static size_t record_count = 0;
+static uint32_t *stage_failed = NULL;               // 段ごとの適用に失敗した STAGE_SET_* (子と共有)
+
+static void mask_set(uint64_t *mask, int cpu) {
+    mask[cpu / 64] |= 1ULL << (cpu % 64);
+}
+
+static int mask_test(const uint64_t *mask, int cpu) {
+    return (mask[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+/**
+ * @brief "0-3,8" の形の CPU の並びを読む
+ * @return 成功時0、書式が正しくなければ-1
+ */
+static int parse_cpu_list(const char *s, uint64_t *mask) {
+    memset(mask, 0, STAGE_CPU_WORDS * sizeof(uint64_t));
+    int any = 0;
+    while (*s != '\0' && *s != '\n') {
+        char *end;
+        long lo = strtol(s, &end, 10);
+        long hi = lo;
+        if (end == s || lo < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo) {
+                return -1;
+            }
+        }
+        if (hi >= STAGE_SCHED_MAX_CPUS) {
+            return -1;
+        }
+        for (long cpu = lo; cpu <= hi; cpu++) {
+            mask_set(mask, (int)cpu);
+        }
+        any = 1;
+        s = end;
+        if (*s == ',') {
+            s++;
+        } else if (*s != '\0' && *s != '\n') {
+            return -1;
+        }
+    }
+    return any ? 0 : -1;
+}
+
+// sysfs の CPU の並びのファイルを読む
+static int read_cpu_list(const char *path, uint64_t *mask) {
+    char buf[1024];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return parse_cpu_list(buf, mask);
+}
+
+static int first_cpu(const uint64_t *mask) {
+    for (int cpu = 0; cpu < STAGE_SCHED_MAX_CPUS; cpu++) {
+        if (mask_test(mask, cpu)) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+// cpu の最後のレベルのキャッシュを共有する CPU の集合を読む
+static int read_cache_domain(int cpu, uint64_t *mask) {
+    char path[128];
+    int best_level = -1;
+    for (int index = 0; index < 8; index++) {
+        char level[16];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            break;
+        }
+        ssize_t n = read(fd, level, sizeof(level) - 1);
+        close(fd);
+        if (n <= 0) {
+            continue;
+        }
+        level[n] = '\0';
+        uint64_t shared[STAGE_CPU_WORDS];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+                 cpu, index);
+        if (atoi(level) > best_level && read_cpu_list(path, shared) == 0) {
+            best_level = atoi(level);
+            memcpy(mask, shared, sizeof(shared));
+        }
+    }
+    return best_level < 0 ? -1 : 0;
+}
+
+// 各 CPU のキャッシュとコアの構成を読む (読めなければ全部を1つのキャッシュとして扱う)
+static void load_topology(void) {
+    topology_loaded = 1;
+    for (int cpu = 0; cpu < STAGE_SCHED_MAX_CPUS; cpu++) {
+        cache_domain[cpu] = 0;
+        thread_rank[cpu] = 0;
+    }
+    for (int cpu = 0; cpu < STAGE_SCHED_MAX_CPUS; cpu++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        if (access(path, F_OK) != 0) {
+            break;
+        }
+        uint64_t mask[STAGE_CPU_WORDS];
+        if (read_cache_domain(cpu, mask) == 0) {
+            cache_domain[cpu] = (int16_t)first_cpu(mask);
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        if (read_cpu_list(path, mask) == 0) {
+            for (int other = 0; other < cpu; other++) {
+                thread_rank[cpu] += mask_test(mask, other);
+            }
+        }
+    }
+}
+
+static int compare_layout(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    if (thread_rank[x] != thread_rank[y]) {
+        return thread_rank[x] - thread_rank[y];
+    }
+    return x - y;
+}
+
+// 今の CPU とキャッシュを共有する、使ってよい CPU の並びを作る
+static void build_layout(void) {
+    if (!topology_loaded) {
+        load_topology();
+    }
+    layout_count = 0;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    int current = sched_getcpu();
+    int domain = current >= 0 && current < STAGE_SCHED_MAX_CPUS ? cache_domain[current] : -1;
+    for (int pass = 0; pass < 2 && layout_count == 0; pass++) {
+        for (int cpu = 0; cpu < STAGE_SCHED_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed) && (pass == 1 || cache_domain[cpu] == domain)) {
+                layout[layout_count++] = cpu;
+            }
+        }
+    }
+    qsort(layout, layout_count, sizeof(layout[0]), compare_layout);
+}
+
+// nice の値を読む
+static int parse_nice(const char *s, StageSched *item) {
+    char *end;
+    long value = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || value < -20 || value > 19) {
+        return -1;
+    }
+    item->flags = STAGE_SET_NICE;
+    item->nice = (int32_t)value;
+    return 0;
+}
+
+// I/O の優先度 (idle, be[/N], rt[/N], N) を読む
+static int parse_ioprio(const char *s, StageSched *item) {
+    int cls = IOPRIO_CLASS_BE;
+    long level = 4;
+    if (strcmp(s, "idle") == 0) {
+        cls = IOPRIO_CLASS_IDLE;
+        level = 0;
+    } else {
+        if (strncmp(s, "be", 2) == 0 || strncmp(s, "rt", 2) == 0) {
+            cls = s[0] == 'r' ? IOPRIO_CLASS_RT : IOPRIO_CLASS_BE;
+            s += 2;
+            if (*s == '/') {
+                s++;
+            } else if (*s != '\0') {
+                return -1;
+            }
+        }
+        if (*s != '\0') {
+            char *end;
+            level = strtol(s, &end, 10);
+            if (end == s || *end != '\0' || level < 0 || level > 7) {
+                return -1;
+            }
+        }
+    }
+    item->flags = STAGE_SET_IOPRIO;
+    item->ioprio = (int32_t)(cls << IOPRIO_CLASS_SHIFT | level);
+    return 0;
+}
+
+/**
+ * @brief 段ごとの設定の結果を子から受け取る共有メモリを作る
+ *
+ * フォークサーバーの子にも引き継ぐよう、フォークサーバーより先に呼ぶ。
+ */
+void stage_sched_init(void) {
+    if (stage_failed != NULL) {
+        return;
+    }
+    void *p = mmap(NULL, STAGE_SCHED_MAX_RECORD * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    stage_failed = p != MAP_FAILED ? (uint32_t *)p : NULL;
+}
+
+// オンラインでない CPU を返す (すべてオンラインか、調べられなければ-1)
+static int offline_cpu(const uint64_t *mask) {
+    uint64_t online[STAGE_CPU_WORDS];
+    if (read_cpu_list("/sys/devices/system/cpu/online", online) != 0) {
+        return -1;
+    }
+    for (int cpu = 0; cpu < STAGE_SCHED_MAX_CPUS; cpu++) {
+        if (mask_test(mask, cpu) && !mask_test(online, cpu)) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+static int parse_cpus(const char *s, StageSched *item) {
+    if (parse_cpu_list(s, item->cpus) != 0) {
+        return -1;
+    }
+    item->flags = STAGE_SET_CPUS;
+    return 0;
+}
+
+static void option_clear(StageOption *opt) {
+    free(opt->spec);
+    free(opt->items);
+    opt->spec = NULL;
+    opt->items = NULL;
+    opt->count = 0;
+}
+
+/**
+ * @brief ':' で区切った段ごとの値を読む
+ * @return 成功時0、書式が正しくなければ-1 (opt は変えない)
+ */
+static int option_parse(StageOption *opt, const char *spec, int (*parse)(const char *, StageSched *)) {
+    char *copy = strdup(spec);
+    size_t count = 1;
+    for (const char *p = spec; *p != '\0'; p++) {
+        count += *p == ':';
+    }
+    StageSched *items = copy ? (StageSched *)calloc(count, sizeof(StageSched)) : NULL;
+    if (items == NULL) {
+        perror("pipesched");
+        free(copy);
+        return -1;
+    }
+    char *field = copy;
+    for (size_t i = 0; i < count; i++) {
+        char *colon = strchr(field, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+        }
+        if (field[0] != '\0' && parse(field, &items[i]) != 0) {
+            fprintf(stderr, "pipesched: %s: invalid value\n", field);
+            free(copy);
+            free(items);
+            return -1;
+        }
+        field = colon ? colon + 1 : field;
+    }
+    free(copy);
+    char *saved = strdup(spec);
+    if (saved == NULL) {
+        perror("pipesched");
+        free(items);
+        return -1;
+    }
+    option_clear(opt);
+    opt->spec = saved;
+    opt->items = items;
+    opt->count = count;
+    return 0;
+}
+
+/**
+ * @brief 段ごとの方針を設定する
+ *
+ * @param cpus CPU の並び ("auto" で自動)。NULLなら変えない、"" なら解除
+ * @param nice nice の値。NULLなら変えない、"" なら解除
+ * @param ioprio I/O の優先度。NULLなら変えない、"" なら解除
+ * @return 成功時0、失敗時-1 (どれかが読めなければ何も変えない)
+ */
+int stage_sched_configure(const char *cpus, const char *nice, const char *ioprio) {
+    StageOption parsed[OPTS] = {{NULL, NULL, 0}, {NULL, NULL, 0}, {NULL, NULL, 0}};
+    const char *specs[OPTS] = {cpus, nice, ioprio};
+    int (*parsers[OPTS])(const char *, StageSched *) = {parse_cpus, parse_nice, parse_ioprio};
+    int is_auto = cpus != NULL && strcmp(cpus, "auto") == 0;
+    for (int i = 0; i < OPTS; i++) {
+        if (specs[i] == NULL || specs[i][0] == '\0' || (i == OPT_CPUS && is_auto)) {
+            continue;
+        }
+        if (option_parse(&parsed[i], specs[i], parsers[i]) != 0) {
+            for (int j = 0; j < i; j++) {
+                option_clear(&parsed[j]);
+            }
+            return -1;
+        }
+    }
+    // sched_setaffinity は子の側で失敗するので、ない CPU はここで断る
+    for (size_t k = 0; k < parsed[OPT_CPUS].count; k++) {
+        int cpu = offline_cpu(parsed[OPT_CPUS].items[k].cpus);
+        if (cpu >= 0) {
+            fprintf(stderr, "pipesched: %s: CPU %d is not online\n", specs[OPT_CPUS], cpu);
+            for (int j = 0; j < OPTS; j++) {
+                option_clear(&parsed[j]);
+            }
+            return -1;
+        }
+    }
+    for (int i = 0; i < OPTS; i++) {
+        if (specs[i] != NULL) {
+            option_clear(&options[i]);
+            options[i] = parsed[i];
+        }
+    }
+    if (cpus != NULL) {
+        cpus_auto = is_auto;
+    }
+    stage_sched_init();
+    return 0;
+}
+
+/**
+ * @brief パイプラインを起動する前に呼ぶ (auto の並びを今の CPU から決める)
+ * @param stages パイプラインの段の数
+ */
+void stage_sched_begin(size_t stages) {
+    for (size_t i = 0; i < record_count; i++) {
+        free(records[i].name);
+    }
+    record_count = 0;
+    layout_count = 0;
+    if (stage_failed != NULL) {
+        memset(stage_failed, 0, STAGE_SCHED_MAX_RECORD * sizeof(uint32_t));
+    }
+    if (cpus_auto && stages > 1) {
+        build_layout();
+    }
+}
+
+static const StageSched* option_item(const StageOption *opt, size_t stage) {
+    if (opt->count == 0) {
+        return NULL;
+    }
+    return &opt->items[stage < opt->count ? stage : opt->count - 1];
+}
+
+/**
+ * @brief stage 段目に適用する設定を決める
+ *
+ * @param stage 段の番号 (0から)
+ * @param buf 結果を書き込む場所
+ * @return 設定することがあれば buf、なければNULL
+ */
+const StageSched* stage_sched_plan(size_t stage, StageSched *buf) {
+    memset(buf, 0, sizeof(*buf));
+    buf->stage = (uint32_t)stage;
+    const StageSched *cpus = option_item(&options[OPT_CPUS], stage);
+    const StageSched *nice = option_item(&options[OPT_NICE], stage);
+    const StageSched *ioprio = option_item(&options[OPT_IOPRIO], stage);
+    if (layout_count > 0) {
+        mask_set(buf->cpus, layout[stage % layout_count]);
+        buf->flags |= STAGE_SET_CPUS;
+    } else if (cpus != NULL && (cpus->flags & STAGE_SET_CPUS)) {
+        memcpy(buf->cpus, cpus->cpus, sizeof(buf->cpus));
+        buf->flags |= STAGE_SET_CPUS;
+    }
+    if (nice != NULL && (nice->flags & STAGE_SET_NICE)) {
+        buf->nice = nice->nice;
+        buf->flags |= STAGE_SET_NICE;
+    }
+    if (ioprio != NULL && (ioprio->flags & STAGE_SET_IOPRIO)) {
+        buf->ioprio = ioprio->ioprio;
+        buf->flags |= STAGE_SET_IOPRIO;
+    }
+    return buf->flags != 0 ? buf : NULL;
+}
+
+/**
+ * @brief 呼んだプロセス自身に段の設定を適用する (exec の前の子プロセスで呼ぶ)
+ *
+ * 失敗してもコマンドは実行する (nice を下げる権限がない場合など)。
+ * 失敗した設定は共有メモリに書き、pipesched の表示で (failed) を付ける。
+ */
+void stage_sched_apply(const StageSched *s) {
+    if (s == NULL) {
+        return;
+    }
+    uint32_t failed = 0;
+    if (s->flags & STAGE_SET_PGROUP) {
+        setpgid(0, s->pgid);
+    }
+    if (s->flags & STAGE_SET_CPUS) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < STAGE_SCHED_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if (mask_test(s->cpus, cpu)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "myshell: sched_setaffinity: %s\n", strerror(errno));
+            failed |= STAGE_SET_CPUS;
+        }
+    }
+    if ((s->flags & STAGE_SET_NICE) && setpriority(PRIO_PROCESS, 0, s->nice) != 0) {
+        fprintf(stderr, "myshell: setpriority: %s\n", strerror(errno));
+        failed |= STAGE_SET_NICE;
+    }
+    if ((s->flags & STAGE_SET_IOPRIO) &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, s->ioprio) != 0) {
+        fprintf(stderr, "myshell: ioprio_set: %s\n", strerror(errno));
+        failed |= STAGE_SET_IOPRIO;
+    }
+    if (failed != 0 && stage_failed != NULL && s->stage < STAGE_SCHED_MAX_RECORD) {
+        stage_failed[s->stage] = failed;
+    }
+}
+
+/**
+ * @brief 起動した段を記録する (pipesched で表示する)
+ */
+void stage_sched_record(size_t stage, pid_t pid, const Command *cmd, const StageSched *s) {
+    if (stage >= STAGE_SCHED_MAX_RECORD || stage != record_count) {
+        return;
+    }
+    StageRecord *r = &records[record_count++];
+    r->pid = pid;
+    r->name = strdup(cmd->program != NULL ? "(compound)" : cmd->argv[0] ? cmd->argv[0] : "(assign)");
+    if (s != NULL) {
+        r->sched = *s;
+    } else {
+        memset(&r->sched, 0, sizeof(r->sched));
+    }
+}
+
+// CPU の集合を "0-3,8" の形で出力する
+static void print_cpu_list(FILE *out, const uint64_t *mask) {
+    const char *sep = "";
+    for (int cpu = 0; cpu < STAGE_SCHED_MAX_CPUS; cpu++) {
+        if (!mask_test(mask, cpu)) {
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < STAGE_SCHED_MAX_CPUS && mask_test(mask, last + 1)) {
+            last++;
+        }
+        fprintf(out, last > cpu ? "%s%d-%d" : "%s%d", sep, cpu, last);
+        sep = ",";
+        cpu = last;
+    }
+}
+
+static void print_ioprio(FILE *out, int32_t ioprio) {
+    static const char *const classes[] = {"none", "rt", "be", "idle"};
+    int cls = (ioprio >> IOPRIO_CLASS_SHIFT) & 3;
+    if (cls == IOPRIO_CLASS_IDLE) {
+        fputs("idle", out);
+    } else {
+        fprintf(out, "%s/%d", classes[cls], ioprio & 7);
+    }
+}
+
+/**
+ * @brief 今の方針 (再入力できる形) と、前回のパイプラインの各段の設定を出力する
+ */
+void stage_sched_print(FILE *out) {
+    fputs("pipesched", out);
+    if (cpus_auto) {
+        fputs(" -c auto", out);
+    }
+    static const char flags[OPTS] = {'c', 'n', 'i'};
+    for (int i = 0; i < OPTS; i++) {
+        if (options[i].spec != NULL) {
+            fprintf(out, " -%c %s", flags[i], options[i].spec);
+        }
+    }
+    fputc('\n', out);
+    for (size_t i = 0; i < record_count; i++) {
+        const StageRecord *r = &records[i];
+        uint32_t failed = stage_failed != NULL ? stage_failed[i] : 0;
+        fprintf(out, "[%zu] %d %s", i, (int)r->pid, r->name ? r->name : "?");
+        if (r->sched.flags & STAGE_SET_CPUS) {
+            fputs(" cpus=", out);
+            print_cpu_list(out, r->sched.cpus);
+            fputs(failed & STAGE_SET_CPUS ? "(failed)" : "", out);
+        }
+        if (r->sched.flags & STAGE_SET_NICE) {
+            fprintf(out, " nice=%d%s", r->sched.nice, failed & STAGE_SET_NICE ? "(failed)" : "");
+        }
+        if (r->sched.flags & STAGE_SET_IOPRIO) {
+            fputs(" ioprio=", out);
+            print_ioprio(out, r->sched.ioprio);
+            fputs(failed & STAGE_SET_IOPRIO ? "(failed)" : "", out);
+        }
+        fputc('\n', out);
+    }
+}
@@ -0,0 +1,1161 @@
+#define STATS_SUBSYSTEM STATS_LEX
+#include <shell.h>
+
+/*
+ * 構文解析
+ *
+ * 入力全体を字句に分け、再帰下降で if/while/for/case/関数定義などを解析して
+ * 平坦化した構文木 (bytecode.c の Node) を直接組み立てる。
+ * 単語は引用符や $ を含んだまま保存し、展開は実行のたびに行う (expand.c)。
+ *
+ *   list     : and_or ((';' | 改行) and_or)*
+ *   and_or   : pipeline (('&&' | '||') pipeline)*
+ *   pipeline : ['!'] command ('|' command)*
+ *   command  : 単純コマンド | 複合コマンド リダイレクト* | 関数定義
+ */
+
+typedef enum {
+    TK_WORD,
+    TK_NEWLINE,
+    TK_SEMI,        // ;
+    TK_DSEMI,       // ;;
+    TK_PIPE,        // |
+    TK_AND_IF,      // &&
+    TK_OR_IF,       // ||
+    TK_LPAREN,      // (
+    TK_RPAREN,      // )
+    TK_LESS,        // <
+    TK_GREAT,       // >
+    TK_DGREAT,      // >>
+    TK_DLESS,       // <<
+    TK_DLESSDASH,   // <<-
+    TK_ARITH,       // (( 式 )) (text は式)
+    TK_EOF
+} TokenKind;
+
+typedef struct SynToken {
+    TokenKind kind;
+    char *text;         // TK_WORD: 引用符を含んだままの単語
+    char *body;         // ヒアドキュメントの区切りの単語: 本文
+    int quoted;         // 単語に引用符やエスケープを含む
+    int line;
+} SynToken;
+
+typedef struct Lexer {
+    const char *p, *end;
+    int line;
+    SynToken *tokens;
+    size_t count, cap;
+    size_t pending[16];     // 本文をまだ読んでいないヒアドキュメントの区切りのトークン
+    int pending_strip[16];  // <<- (行頭のタブを取り除く)
+    int npending;
+    int incomplete;
+    const char *error;
+} Lexer;
+
+typedef struct Parser {
+    SynToken *tokens;
+    size_t pos;
+    ProgramBuilder *b;
+    const char *name;
+    int incomplete;
+    int error;
+} Parser;
+
+/* ---------- 字句解析 ---------- */
+
+static int lex_push(Lexer *lx, TokenKind kind, const char *text, size_t len, int quoted) {
+    if (lx->count == lx->cap) {
+        size_t new_cap = lx->cap ? lx->cap * 2 : 64;
+        SynToken *tmp = (SynToken *)realloc(lx->tokens, new_cap * sizeof(SynToken));
+        if (tmp == NULL) {
+            perror("Failed to allocate tokens");
+            return -1;
+        }
+        lx->tokens = tmp;
+        lx->cap = new_cap;
+    }
+    SynToken *tok = &lx->tokens[lx->count++];
+    tok->kind = kind;
+    tok->text = text ? strndup(text, len) : NULL;
+    tok->body = NULL;
+    tok->quoted = quoted;
+    tok->line = lx->line;
+    return 0;
+}
+
+static void free_tokens(SynToken *tokens, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(tokens[i].text);
+        free(tokens[i].body);
+    }
+    free(tokens);
+}
+
+static const char* skip_single_quote(const char *p, const char *end) {
+    for (p++; p < end; p++) {
+        if (*p == '\'') {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+static const char* skip_backquote(const char *p, const char *end) {
+    for (p++; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        } else if (*p == '`') {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+static const char* skip_dollar(const char *p, const char *end);
+
+static const char* skip_double_quote(const char *p, const char *end) {
+    for (p++; p < end;) {
+        if (*p == '"') {
+            return p + 1;
+        }
+        if (*p == '\\' && p + 1 < end) {
+            p += 2;
+        } else if (*p == '$') {
+            p = skip_dollar(p, end);
+        } else if (*p == '`') {
+            p = skip_backquote(p, end);
+        } else {
+            p++;
+        }
+        if (p == NULL) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief "$(" の直後から対応する ')' を探す
+ *
+ * 中の引用符・入れ子の $( ) ・括弧を読み飛ばす。
+ *
+ * @param p "$(" の直後
+ * @return 対応する ')' の位置。閉じていなければNULL
+ */
+const char* scan_command_subst(const char *p, const char *end) {
+    int nest = 0;
+    while (p < end) {
+        switch (*p) {
+            case '\\':
+                p += p + 1 < end ? 2 : 1;
+                continue;
+            case '\'':
+                p = skip_single_quote(p, end);
+                break;
+            case '"':
+                p = skip_double_quote(p, end);
+                break;
+            case '`':
+                p = skip_backquote(p, end);
+                break;
+            case '$':
+                p = skip_dollar(p, end);
+                break;
+            case '(':
+                nest++;
+                p++;
+                break;
+            case ')':
+                if (nest == 0) {
+                    return p;
+                }
+                nest--;
+                p++;
+                break;
+            default:
+                p++;
+                break;
+        }
+        if (p == NULL) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// '$' から始まる展開を読み飛ばす。閉じていなければNULL
+static const char* skip_dollar(const char *p, const char *end) {
+    if (p + 1 < end && p[1] == '(') {
+        const char *close = scan_command_subst(p + 2, end);
+        return close ? close + 1 : NULL;
+    }
+    if (p + 1 < end && p[1] == '{') {
+        for (const char *q = p + 2; q < end; q++) {
+            if (*q == '\\' && q + 1 < end) {
+                q++;
+            } else if (*q == '\'' || *q == '"' || *q == '`' || *q == '$') {
+                const char *next = *q == '\'' ? skip_single_quote(q, end)
+                                 : *q == '"'  ? skip_double_quote(q, end)
+                                 : *q == '`'  ? skip_backquote(q, end)
+                                              : skip_dollar(q, end);
+                if (next == NULL) {
+                    return NULL;
+                }
+                q = next - 1;
+            } else if (*q == '}') {
+                return q + 1;
+            }
+        }
+        return NULL;
+    }
+    return p + 1;
+}
+
+static int is_meta(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' ||
+           c == '|' || c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+/**
+ * @brief p がプロセス置換 <(...) / >(...) の始まりか
+ *
+ * プロセス置換はリダイレクトではなく単語の一部として読み、展開のときに
+ * /dev/fd/N に置き換える (expand.c)。
+ */
+int syntax_is_process_subst(const char *p, const char *end) {
+    return p + 1 < end && (p[0] == '<' || p[0] == '>') && p[1] == '(';
+}
+
+// p が NAME=( または NAME+=( の '(' か (配列の複合代入)
+static int is_array_literal(const char *start, const char *p) {
+    if (*p != '(' || p == start || p[-1] != '=') {
+        return 0;
+    }
+    size_t len = (size_t)(p - 1 - start);
+    if (len > 0 && start[len - 1] == '+') {
+        len--;
+    }
+    return var_is_name(start, len);
+}
+
+/**
+ * @brief p から始まる単語の終わりを探す
+ *
+ * 引用符・$( )・${ }・`...`・<( )・>( )・NAME=( ) の中のメタ文字は単語に含める。
+ * 字句解析とハイライト (highlight.c) で同じ区切り方をするために公開している。
+ *
+ * @param quoted 単語が引用符やエスケープを含めば1を入れる (NULL可)
+ * @return 単語の直後の位置。引用符などが閉じていなければNULL
+ */
+const char* syntax_scan_word(const char *p, const char *end, int *quoted) {
+    const char *start = p;
+    while (p < end && (!is_meta(*p) || syntax_is_process_subst(p, end) || is_array_literal(start, p))) {
+        const char *next;
+        switch (*p) {
+            case '(':
+                next = scan_command_subst(p + 1, end); // NAME=(...) の中の空白や改行も単語に含める
+                next = next ? next + 1 : NULL;
+                break;
+            case '<':
+            case '>':
+                next = scan_command_subst(p + 2, end);
+                next = next ? next + 1 : NULL;
+                break;
+            case '\\':
+                next = p + 1 < end ? p + 2 : NULL;
+                break;
+            case '\'':
+                next = skip_single_quote(p, end);
+                break;
+            case '"':
+                next = skip_double_quote(p, end);
+                break;
+            case '`':
+                next = skip_backquote(p, end);
+                break;
+            case '$':
+                next = skip_dollar(p, end);
+                break;
+            default:
+                next = p + 1;
+                break;
+        }
+        if (quoted != NULL && (*p == '\\' || *p == '\'' || *p == '"')) {
+            *quoted = 1;
+        }
+        if (next == NULL) {
+            return NULL;
+        }
+        p = next;
+    }
+    return p;
+}
+
+/**
+ * @brief 後ろに続く単語がコマンド名になる予約語か (if, then, do, { など)
+ *
+ * 補完 (completion.c) と先読み (prefetch.c) でコマンド位置を同じように判断するために公開している。
+ */
+int syntax_starts_command(const char *w, size_t len) {
+    static const char *const words[] = {
+        "if", "then", "else", "elif", "do", "while", "until", "{", "!",
+    };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (strlen(words[i]) == len && strncmp(w, words[i], len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 単語を1つ読む
+static int lex_word(Lexer *lx) {
+    const char *start = lx->p;
+    int quoted = 0;
+    const char *next = syntax_scan_word(start, lx->end, &quoted);
+    if (next == NULL) {
+        lx->incomplete = 1;
+        return -1;
+    }
+    for (const char *q = start; q < next; q++) {
+        lx->line += *q == '\n';
+    }
+    lx->p = next;
+    return lex_push(lx, TK_WORD, start, (size_t)(lx->p - start), quoted);
+}
+
+/**
+ * @brief "((" から始まる算術コマンドを読む
+ *
+ * 対応する "))" がなければ (入れ子のサブシェル "((a); b)" など) 何もしない。
+ *
+ * @return 読んだら1、算術コマンドでなければ0
+ */
+static int lex_arith(Lexer *lx) {
+    const char *start = lx->p + 2;
+    const char *close = scan_command_subst(start, lx->end);
+    if (close == NULL || close + 1 >= lx->end || close[1] != ')') {
+        return 0;
+    }
+    if (lex_push(lx, TK_ARITH, start, (size_t)(close - start), 0) != 0) {
+        return 0;
+    }
+    for (const char *q = start; q < close; q++) {
+        lx->line += *q == '\n';
+    }
+    lx->p = close + 2;
+    return 1;
+}
+
+// 区切りの単語から引用符を取り除く (ヒアドキュメントの区切りは展開しない)
+static char* unquote_delimiter(const char *s) {
+    char *out = (char *)malloc(strlen(s) + 1);
+    if (out == NULL) {
+        return NULL;
+    }
+    char *o = out;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1] != '\0') {
+            *o++ = *++s;
+        } else if (*s != '\'' && *s != '"') {
+            *o++ = *s;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+
+// 改行の後ろに続くヒアドキュメントの本文を読む
+static int lex_heredoc_bodies(Lexer *lx) {
+    for (int i = 0; i < lx->npending; i++) {
+        SynToken *tok = &lx->tokens[lx->pending[i]];
+        char *delim = unquote_delimiter(tok->text);
+        size_t len = 0, cap = 64;
+        char *body = (char *)malloc(cap);
+        if (delim == NULL || body == NULL) {
+            free(delim);
+            free(body);
+            return -1;
+        }
+        body[0] = '\0';
+        int found = 0;
+        while (lx->p < lx->end) {
+            const char *nl = memchr(lx->p, '\n', (size_t)(lx->end - lx->p));
+            const char *line = lx->p;
+            const char *stop = nl ? nl : lx->end;
+            lx->p = nl ? nl + 1 : lx->end;
+            lx->line++;
+            if (lx->pending_strip[i]) {
+                while (line < stop && *line == '\t') {
+                    line++;
+                }
+            }
+            size_t n = (size_t)(stop - line);
+            if (n == strlen(delim) && memcmp(line, delim, n) == 0) {
+                found = 1;
+                break;
+            }
+            if (len + n + 2 > cap) {
+                while (len + n + 2 > cap) {
+                    cap *= 2;
+                }
+                char *tmp = (char *)realloc(body, cap);
+                if (tmp == NULL) {
+                    free(delim);
+                    free(body);
+                    return -1;
+                }
+                body = tmp;
+            }
+            memcpy(body + len, line, n);
+            len += n;
+            body[len++] = '\n';
+            body[len] = '\0';
+        }
+        free(delim);
+        if (!found) {
+            free(body);
+            lx->incomplete = 1;
+            return -1;
+        }
+        tok->body = body;
+    }
+    lx->npending = 0;
+    return 0;
+}
+
+/**
+ * @brief 入力全体を字句に分ける
+ * @return 成功時0。続きが必要なら lx->incomplete を立てて-1
+ */
+static int lex_all(Lexer *lx) {
+    while (lx->p < lx->end) {
+        char c = *lx->p;
+        const char *p = lx->p;
+        if (c == ' ' || c == '\t' || c == '\r') {
+            lx->p++;
+            continue;
+        }
+        if (c == '\\' && p + 1 < lx->end && p[1] == '\n') {
+            lx->p += 2;
+            lx->line++;
+            continue;
+        }
+        if (c == '#') {
+            while (lx->p < lx->end && *lx->p != '\n') {
+                lx->p++;
+            }
+            continue;
+        }
+        if (c == '\n') {
+            if (lex_push(lx, TK_NEWLINE, NULL, 0, 0) != 0) {
+                return -1;
+            }
+            lx->p++;
+            lx->line++;
+            if (lx->npending > 0 && lex_heredoc_bodies(lx) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        TokenKind kind;
+        size_t len = 1;
+        int two = p + 1 < lx->end;
+        if (syntax_is_process_subst(p, lx->end)) {
+            if (lex_word(lx) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (c == ';') {
+            kind = two && p[1] == ';' ? (len = 2, TK_DSEMI) : TK_SEMI;
+        } else if (c == '|') {
+            kind = two && p[1] == '|' ? (len = 2, TK_OR_IF) : TK_PIPE;
+        } else if (c == '&') {
+            if (!two || p[1] != '&') {
+                lx->error = "&";
+                return -1;
+            }
+            kind = TK_AND_IF;
+            len = 2;
+        } else if (c == '(' && two && p[1] == '(' && lex_arith(lx)) {
+            continue;
+        } else if (c == '(') {
+            kind = TK_LPAREN;
+        } else if (c == ')') {
+            kind = TK_RPAREN;
+        } else if (c == '<') {
+            if (two && p[1] == '<') {
+                int dash = p + 2 < lx->end && p[2] == '-';
+                kind = dash ? TK_DLESSDASH : TK_DLESS;
+                len = dash ? 3 : 2;
+            } else {
+                kind = TK_LESS;
+            }
+        } else if (c == '>') {
+            kind = two && p[1] == '>' ? (len = 2, TK_DGREAT) : TK_GREAT;
+        } else {
+            if (lex_word(lx) != 0) {
+                return -1;
+            }
+            // ヒアドキュメントの区切りなら、次の改行の後で本文を読む
+            if (lx->count >= 2 && (lx->tokens[lx->count - 2].kind == TK_DLESS ||
+                                   lx->tokens[lx->count - 2].kind == TK_DLESSDASH)) {
+                if (lx->npending == (int)(sizeof(lx->pending) / sizeof(lx->pending[0]))) {
+                    lx->error = "<<";
+                    return -1;
+                }
+                lx->pending_strip[lx->npending] = lx->tokens[lx->count - 2].kind == TK_DLESSDASH;
+                lx->pending[lx->npending++] = lx->count - 1;
+            }
+            continue;
+        }
+        if (lex_push(lx, kind, p, len, 0) != 0) {
+            return -1;
+        }
+        lx->p += len;
+    }
+    if (lx->npending > 0) {
+        lx->incomplete = 1;
+        return -1;
+    }
+    return lex_push(lx, TK_EOF, NULL, 0, 0);
+}
+
+/* ---------- 構文解析 ---------- */
+
+#undef STATS_SUBSYSTEM
+#define STATS_SUBSYSTEM STATS_PARSE
+
+static SynToken* peek(Parser *ps) {
+    return &ps->tokens[ps->pos];
+}
+
+static int is_reserved(const SynToken *tok, const char *word) {
+    return tok->kind == TK_WORD && !tok->quoted && strcmp(tok->text, word) == 0;
+}
+
+static const char* token_text(const SynToken *tok) {
+    switch (tok->kind) {
+        case TK_WORD: return tok->text;
+        case TK_NEWLINE: return "newline";
+        case TK_SEMI: return ";";
+        case TK_DSEMI: return ";;";
+        case TK_PIPE: return "|";
+        case TK_AND_IF: return "&&";
+        case TK_OR_IF: return "||";
+        case TK_LPAREN: return "(";
+        case TK_RPAREN: return ")";
+        case TK_ARITH: return "((";
+        case TK_LESS: return "<";
+        case TK_GREAT: return ">";
+        case TK_DGREAT: return ">>";
+        case TK_DLESS: return "<<";
+        case TK_DLESSDASH: return "<<-";
+        default: return "end of file";
+    }
+}
+
+// 構文エラーを報告する。入力の終わりに達しただけなら「続きが必要」とする
+static uint32_t syntax_error(Parser *ps) {
+    if (ps->error) {
+        return 0;
+    }
+    ps->error = 1;
+    SynToken *tok = peek(ps);
+    if (tok->kind == TK_EOF) {
+        ps->incomplete = 1;
+        return 0;
+    }
+    if (ps->name != NULL) {
+        fprintf(stderr, "myshell: %s: line %d: syntax error near unexpected token `%s'\n",
+                ps->name, tok->line, token_text(tok));
+    } else {
+        fprintf(stderr, "myshell: syntax error near unexpected token `%s'\n", token_text(tok));
+    }
+    return 0;
+}
+
+static int expect_reserved(Parser *ps, const char *word) {
+    if (!is_reserved(peek(ps), word)) {
+        syntax_error(ps);
+        return -1;
+    }
+    ps->pos++;
+    return 0;
+}
+
+static void skip_newlines(Parser *ps) {
+    while (peek(ps)->kind == TK_NEWLINE) {
+        ps->pos++;
+    }
+}
+
+// リストを終わらせる予約語か
+static int at_list_end(Parser *ps) {
+    static const char *const enders[] = {"then", "elif", "else", "fi", "do", "done", "esac", "}"};
+    SynToken *tok = peek(ps);
+    if (tok->kind == TK_EOF || tok->kind == TK_RPAREN || tok->kind == TK_DSEMI) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(enders) / sizeof(enders[0]); i++) {
+        if (is_reserved(tok, enders[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t parse_list(Parser *ps, int allow_empty);
+static uint32_t parse_command(Parser *ps);
+
+// 単語の並びを words に追加する
+static uint32_t add_words(Parser *ps, char **words, size_t n, uint32_t *count) {
+    char **argv = (char **)malloc((n + 1) * sizeof(char *));
+    if (argv == NULL) {
+        ps->error = 1;
+        *count = 0;
+        return 0;
+    }
+    memcpy(argv, words, n * sizeof(char *));
+    argv[n] = NULL;
+    uint32_t first = program_add_words(ps->b, argv, count);
+    free(argv);
+    return first;
+}
+
+// リダイレクトを1つ読んで node に設定する。リダイレクトでなければ0を返す
+static int parse_redirect(Parser *ps, uint32_t node) {
+    SynToken *op = peek(ps);
+    if (op->kind != TK_LESS && op->kind != TK_GREAT && op->kind != TK_DGREAT &&
+        op->kind != TK_DLESS && op->kind != TK_DLESSDASH) {
+        return 0;
+    }
+    ps->pos++;
+    SynToken *target = peek(ps);
+    if (target->kind != TK_WORD) {
+        syntax_error(ps);
+        return -1;
+    }
+    ps->pos++;
+    uint32_t str[2] = {NO_STRING, NO_STRING};
+    int slot;
+    if (op->kind == TK_LESS) {
+        slot = STR_REDIRECT_IN;
+        str[0] = program_add_string(ps->b, target->text);
+    } else if (op->kind == TK_GREAT || op->kind == TK_DGREAT) {
+        slot = STR_REDIRECT_OUT;
+        str[0] = program_add_string(ps->b, target->text);
+    } else {
+        slot = STR_HEREDOC_DELIMITER;
+        char *delim = unquote_delimiter(target->text);
+        str[0] = program_add_string(ps->b, delim);
+        str[1] = program_add_string(ps->b, target->body ? target->body : "");
+        free(delim);
+    }
+    Node *n = program_node(ps->b, node);
+    n->str[slot] = str[0];
+    if (slot == STR_REDIRECT_OUT) {
+        n->flags = (uint16_t)((n->flags & ~NODE_APPEND) | (op->kind == TK_DGREAT ? NODE_APPEND : 0));
+    } else if (slot == STR_HEREDOC_DELIMITER) {
+        n->str[STR_REDIRECT_IN] = NO_STRING; // 後に書いたものが優先
+        n->str[STR_HEREDOC_BODY] = str[1];
+        n->flags = (uint16_t)((n->flags & ~NODE_HEREDOC_QUOTED) | (target->quoted ? NODE_HEREDOC_QUOTED : 0));
+    }
+    if (slot == STR_REDIRECT_IN) {
+        n->str[STR_HEREDOC_DELIMITER] = NO_STRING;
+        n->str[STR_HEREDOC_BODY] = NO_STRING;
+    }
+    return 1;
+}
+
+static uint32_t parse_simple_command(Parser *ps) {
+    uint32_t node = program_add_node(ps->b, N_COMMAND);
+    char **words = NULL;
+    size_t n = 0, cap = 0;
+    for (;;) {
+        int r = parse_redirect(ps, node);
+        if (r < 0) {
+            free(words);
+            return 0;
+        }
+        if (r > 0) {
+            continue;
+        }
+        SynToken *tok = peek(ps);
+        if (tok->kind != TK_WORD) {
+            break;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 8;
+            char **tmp = (char **)realloc(words, cap * sizeof(char *));
+            if (tmp == NULL) {
+                free(words);
+                ps->error = 1;
+                return 0;
+            }
+            words = tmp;
+        }
+        words[n++] = tok->text;
+        ps->pos++;
+    }
+    Node *cmd = program_node(ps->b, node);
+    int has_redirect = cmd->str[STR_REDIRECT_IN] != NO_STRING || cmd->str[STR_REDIRECT_OUT] != NO_STRING ||
+                       cmd->str[STR_HEREDOC_DELIMITER] != NO_STRING;
+    if (n == 0 && !has_redirect) {
+        free(words);
+        return syntax_error(ps);
+    }
+    uint32_t count;
+    uint32_t first = add_words(ps, words, n, &count);
+    free(words);
+    cmd = program_node(ps->b, node);
+    cmd->word = first;
+    cmd->nwords = count;
+    return node;
+}
+
+static uint32_t parse_if(Parser *ps) {
+    ps->pos++; // if または elif
+    uint32_t cond = parse_list(ps, 0);
+    if (ps->error || expect_reserved(ps, "then") != 0) {
+        return 0;
+    }
+    uint32_t then_part = parse_list(ps, 0);
+    if (ps->error) {
+        return 0;
+    }
+    uint32_t else_part = 0;
+    if (is_reserved(peek(ps), "elif")) {
+        else_part = parse_if(ps); // elif は else の中の if として表す (fi は内側で読む)
+        if (ps->error) {
+            return 0;
+        }
+    } else {
+        if (is_reserved(peek(ps), "else")) {
+            ps->pos++;
+            else_part = parse_list(ps, 0);
+            if (ps->error) {
+                return 0;
+            }
+        }
+        if (expect_reserved(ps, "fi") != 0) {
+            return 0;
+        }
+    }
+    uint32_t node = program_add_node(ps->b, N_IF);
+    Node *n = program_node(ps->b, node);
+    n->kids[0] = cond;
+    n->kids[1] = then_part;
+    n->kids[2] = else_part;
+    return node;
+}
+
+static uint32_t parse_do_group(Parser *ps) {
+    skip_newlines(ps);
+    if (expect_reserved(ps, "do") != 0) {
+        return 0;
+    }
+    uint32_t body = parse_list(ps, 0);
+    if (ps->error || expect_reserved(ps, "done") != 0) {
+        return 0;
+    }
+    return body;
+}
+
+static uint32_t parse_while(Parser *ps) {
+    int until = is_reserved(peek(ps), "until");
+    ps->pos++;
+    uint32_t cond = parse_list(ps, 0);
+    if (ps->error) {
+        return 0;
+    }
+    uint32_t body = parse_do_group(ps);
+    if (ps->error) {
+        return 0;
+    }
+    uint32_t node = program_add_node(ps->b, N_WHILE);
+    Node *n = program_node(ps->b, node);
+    n->kids[0] = cond;
+    n->kids[1] = body;
+    n->flags = until ? NODE_UNTIL : 0;
+    return node;
+}
+
+static uint32_t parse_for(Parser *ps) {
+    ps->pos++;
+    SynToken *name = peek(ps);
+    if (name->kind != TK_WORD || !var_is_name(name->text, strlen(name->text))) {
+        return syntax_error(ps);
+    }
+    ps->pos++;
+    char **words = (char **)malloc(sizeof(char *));
+    size_t n = 0, cap = 1;
+    if (words == NULL) {
+        ps->error = 1;
+        return 0;
+    }
+    words[n++] = name->text;
+    int has_in = 0;
+    skip_newlines(ps);
+    if (is_reserved(peek(ps), "in")) {
+        has_in = 1;
+        ps->pos++;
+        while (peek(ps)->kind == TK_WORD) {
+            if (n == cap) {
+                cap *= 2;
+                char **tmp = (char **)realloc(words, cap * sizeof(char *));
+                if (tmp == NULL) {
+                    free(words);
+                    ps->error = 1;
+                    return 0;
+                }
+                words = tmp;
+            }
+            words[n++] = peek(ps)->text;
+            ps->pos++;
+        }
+    }
+    if (peek(ps)->kind == TK_SEMI || peek(ps)->kind == TK_NEWLINE) {
+        ps->pos++;
+    } else if (has_in) {
+        free(words);
+        return syntax_error(ps);
+    }
+    uint32_t count;
+    uint32_t first = add_words(ps, words, n, &count);
+    free(words);
+    uint32_t body = parse_do_group(ps);
+    if (ps->error) {
+        return 0;
+    }
+    uint32_t node = program_add_node(ps->b, N_FOR);
+    Node *nd = program_node(ps->b, node);
+    nd->word = first;
+    nd->nwords = count;
+    nd->kids[0] = body;
+    nd->flags = has_in ? 0 : NODE_FOR_ARGS;
+    return node;
+}
+
+static uint32_t parse_case(Parser *ps) {
+    ps->pos++;
+    SynToken *subject = peek(ps);
+    if (subject->kind != TK_WORD) {
+        return syntax_error(ps);
+    }
+    ps->pos++;
+    skip_newlines(ps);
+    if (expect_reserved(ps, "in") != 0) {
+        return 0;
+    }
+    uint32_t first = 0, prev = 0;
+    skip_newlines(ps);
+    while (!is_reserved(peek(ps), "esac")) {
+        if (peek(ps)->kind == TK_LPAREN) {
+            ps->pos++;
+        }
+        char *patterns[MAX_ARGS];
+        size_t n = 0;
+        for (;;) {
+            if (peek(ps)->kind != TK_WORD || n == MAX_ARGS) {
+                return syntax_error(ps);
+            }
+            patterns[n++] = peek(ps)->text;
+            ps->pos++;
+            if (peek(ps)->kind != TK_PIPE) {
+                break;
+            }
+            ps->pos++;
+        }
+        if (peek(ps)->kind != TK_RPAREN) {
+            return syntax_error(ps);
+        }
+        ps->pos++;
+        uint32_t count;
+        uint32_t word = add_words(ps, patterns, n, &count);
+        uint32_t body = parse_list(ps, 1);
+        if (ps->error) {
+            return 0;
+        }
+        uint32_t item = program_add_node(ps->b, N_CASE_ITEM);
+        Node *it = program_node(ps->b, item);
+        it->word = word;
+        it->nwords = count;
+        it->kids[0] = body;
+        if (prev != 0) {
+            program_node(ps->b, prev)->next = item;
+        } else {
+            first = item;
+        }
+        prev = item;
+        if (peek(ps)->kind == TK_DSEMI) {
+            ps->pos++;
+            skip_newlines(ps);
+        } else if (!is_reserved(peek(ps), "esac")) {
+            return syntax_error(ps);
+        }
+    }
+    ps->pos++; // esac
+    uint32_t count;
+    uint32_t word = add_words(ps, &subject->text, 1, &count);
+    uint32_t node = program_add_node(ps->b, N_CASE);
+    Node *nd = program_node(ps->b, node);
+    nd->word = word;
+    nd->nwords = count;
+    nd->kids[0] = first;
+    return node;
+}
+
+// { list } または ( list )
+static uint32_t parse_group(Parser *ps, NodeType type) {
+    ps->pos++;
+    uint32_t body = parse_list(ps, 0);
+    if (ps->error) {
+        return 0;
+    }
+    if (type == N_GROUP ? expect_reserved(ps, "}") != 0 : peek(ps)->kind != TK_RPAREN) {
+        return syntax_error(ps);
+    }
+    if (type == N_SUBSHELL) {
+        ps->pos++;
+    }
+    uint32_t node = program_add_node(ps->b, type);
+    program_node(ps->b, node)->kids[0] = body;
+    return node;
+}
+
+// 複合コマンドなら解析し、そうでなければ0を返す (エラーは ps->error)
+static uint32_t parse_compound(Parser *ps) {
+    SynToken *tok = peek(ps);
+    if (tok->kind == TK_LPAREN) {
+        return parse_group(ps, N_SUBSHELL);
+    }
+    if (is_reserved(tok, "{")) {
+        return parse_group(ps, N_GROUP);
+    }
+    if (is_reserved(tok, "if")) {
+        return parse_if(ps);
+    }
+    if (is_reserved(tok, "while") || is_reserved(tok, "until")) {
+        return parse_while(ps);
+    }
+    if (is_reserved(tok, "for")) {
+        return parse_for(ps);
+    }
+    if (is_reserved(tok, "case")) {
+        return parse_case(ps);
+    }
+    if (tok->kind == TK_ARITH) {
+        ps->pos++;
+        uint32_t count;
+        uint32_t word = add_words(ps, &tok->text, 1, &count);
+        uint32_t node = program_add_node(ps->b, N_ARITH);
+        Node *n = program_node(ps->b, node);
+        n->word = word;
+        n->nwords = count;
+        return node;
+    }
+    return 0;
+}
+
+static uint32_t parse_funcdef(Parser *ps, const char *name) {
+    skip_newlines(ps);
+    uint32_t body = parse_compound(ps);
+    if (body == 0) {
+        return syntax_error(ps);
+    }
+    while (parse_redirect(ps, body) > 0) {
+    }
+    if (ps->error) {
+        return 0;
+    }
+    uint32_t count;
+    char *words[1] = {(char *)name};
+    uint32_t word = add_words(ps, words, 1, &count);
+    uint32_t node = program_add_node(ps->b, N_FUNCDEF);
+    Node *n = program_node(ps->b, node);
+    n->word = word;
+    n->nwords = count;
+    n->kids[0] = body;
+    return node;
+}
+
+static uint32_t parse_command(Parser *ps) {
+    SynToken *tok = peek(ps);
+    if (is_reserved(tok, "function")) {
+        ps->pos++;
+        SynToken *name = peek(ps);
+        if (name->kind != TK_WORD) {
+            return syntax_error(ps);
+        }
+        ps->pos++;
+        if (peek(ps)->kind == TK_LPAREN) {
+            ps->pos++;
+            if (peek(ps)->kind != TK_RPAREN) {
+                return syntax_error(ps);
+            }
+            ps->pos++;
+        }
+        return parse_funcdef(ps, name->text);
+    }
+    if (tok->kind == TK_WORD && !tok->quoted && ps->tokens[ps->pos + 1].kind == TK_LPAREN &&
+        ps->tokens[ps->pos + 2].kind == TK_RPAREN) {
+        ps->pos += 3;
+        return parse_funcdef(ps, tok->text);
+    }
+    uint32_t node = parse_compound(ps);
+    if (ps->error) {
+        return 0;
+    }
+    if (node != 0) {
+        int r;
+        while ((r = parse_redirect(ps, node)) > 0) {
+        }
+        return r < 0 ? 0 : node;
+    }
+    if (tok->kind != TK_WORD && tok->kind != TK_LESS && tok->kind != TK_GREAT &&
+        tok->kind != TK_DGREAT && tok->kind != TK_DLESS && tok->kind != TK_DLESSDASH) {
+        return syntax_error(ps);
+    }
+    if (at_list_end(ps)) {
+        return syntax_error(ps);
+    }
+    return parse_simple_command(ps);
+}
+
+static uint32_t parse_pipeline(Parser *ps) {
+    int negate = 0;
+    if (is_reserved(peek(ps), "!")) {
+        negate = 1;
+        ps->pos++;
+    }
+    uint32_t first = parse_command(ps);
+    uint32_t prev = first;
+    while (!ps->error && peek(ps)->kind == TK_PIPE) {
+        ps->pos++;
+        skip_newlines(ps);
+        uint32_t stage = parse_command(ps);
+        if (ps->error) {
+            return 0;
+        }
+        program_node(ps->b, prev)->next = stage;
+        prev = stage;
+    }
+    if (ps->error) {
+        return 0;
+    }
+    uint32_t node = program_add_node(ps->b, N_PIPELINE);
+    Node *n = program_node(ps->b, node);
+    n->kids[0] = first;
+    n->flags = negate ? NODE_NEGATE : 0;
+    return node;
+}
+
+static uint32_t parse_and_or(Parser *ps) {
+    uint32_t left = parse_pipeline(ps);
+    while (!ps->error && (peek(ps)->kind == TK_AND_IF || peek(ps)->kind == TK_OR_IF)) {
+        NodeType type = peek(ps)->kind == TK_AND_IF ? N_AND : N_OR;
+        ps->pos++;
+        skip_newlines(ps);
+        uint32_t right = parse_pipeline(ps);
+        if (ps->error) {
+            return 0;
+        }
+        uint32_t node = program_add_node(ps->b, type);
+        Node *n = program_node(ps->b, node);
+        n->kids[0] = left;
+        n->kids[1] = right;
+        left = node;
+    }
+    return ps->error ? 0 : left;
+}
+
+/**
+ * @brief 終わりの予約語 (fi, done など) の手前までの文の並びを読む
+ * @param allow_empty 空のリストを許す (case の各項目)
+ * @return N_LIST ノード
+ */
+static uint32_t parse_list(Parser *ps, int allow_empty) {
+    uint32_t first = 0, prev = 0;
+    skip_newlines(ps);
+    while (!at_list_end(ps)) {
+        uint32_t item = parse_and_or(ps);
+        if (ps->error) {
+            return 0;
+        }
+        if (prev != 0) {
+            program_node(ps->b, prev)->next = item;
+        } else {
+            first = item;
+        }
+        prev = item;
+        SynToken *tok = peek(ps);
+        if (tok->kind == TK_SEMI || tok->kind == TK_NEWLINE) {
+            ps->pos++;
+            skip_newlines(ps);
+        } else if (!at_list_end(ps)) {
+            return syntax_error(ps);
+        }
+    }
+    if (first == 0 && !allow_empty) {
+        return syntax_error(ps);
+    }
+    uint32_t list = program_add_node(ps->b, N_LIST);
+    program_node(ps->b, list)->kids[0] = first;
+    return list;
+}
+
+/**
+ * @brief シェルの文をコンパイルする
+ *
+ * @param text 入力 (複数行でよい)
+ * @param len 入力の長さ
+ * @param name エラーメッセージに出すファイル名 (対話入力ではNULL)
+ * @param source_hash キャッシュのキーとして Program に記録する値
+ * @param out 成功時にコンパイル結果を返す
+ * @return SYNTAX_OK / SYNTAX_INCOMPLETE (続きの行が必要) / SYNTAX_ERROR
+ */
+SyntaxStatus syntax_compile(const char *text, size_t len, const char *name, uint64_t source_hash, Program **out) {
+    *out = NULL;
+    Lexer lx = {0};
+    lx.p = text;
+    lx.end = text + len;
+    lx.line = 1;
+    if (lex_all(&lx) != 0) {
+        free_tokens(lx.tokens, lx.count);
+        if (lx.incomplete) {
+            return SYNTAX_INCOMPLETE;
+        }
+        if (lx.error != NULL) {
+            fprintf(stderr, "myshell: syntax error near unexpected token `%s'\n", lx.error);
+        }
+        return SYNTAX_ERROR;
+    }
+    Parser ps = {0};
+    ps.tokens = lx.tokens;
+    ps.name = name;
+    ps.b = program_builder_new();
+    if (ps.b == NULL) {
+        free_tokens(lx.tokens, lx.count);
+        return SYNTAX_ERROR;
+    }
+    uint32_t root = 0;
+    skip_newlines(&ps);
+    if (peek(&ps)->kind == TK_EOF) {
+        root = program_add_node(ps.b, N_LIST); // 空の入力
+    } else {
+        root = parse_list(&ps, 0);
+        if (!ps.error && peek(&ps)->kind != TK_EOF) {
+            syntax_error(&ps); // 対応する if のない fi など
+        }
+    }
+    free_tokens(lx.tokens, lx.count);
+    if (ps.error) {
+        program_builder_free(ps.b);
+        return ps.incomplete ? SYNTAX_INCOMPLETE : SYNTAX_ERROR;
+    }
+    *out = program_builder_finish(ps.b, root, source_hash, len);
+    return *out != NULL ? SYNTAX_OK : SYNTAX_ERROR;
+}
@@ -0,0 +1,801 @@
+#define STATS_SUBSYSTEM STATS_VARS
+#include <shell.h>
+
+/*
+ * シェル変数
+ *
+ * 変数はスコープのスタックに入れる。一番下がグローバル、関数の呼び出しごとに
+ * 関数のスコープ (local と位置パラメータ) を、FOO=bar cmd のような一時的な代入には
+ * 一時スコープを積む。探すときは内側のスコープから順に見る (bashと同じ動的スコープ)。
+ * グローバルの変数のうち環境変数にあるもの・export したものは environ に置き、
+ * 子プロセスにそのまま引き継がれるようにする。
+ */
+
+#define VARS_MAX_DEPTH 1024     /* 関数呼び出しの最大の深さ */
+
+typedef struct Var {
+    char *name;                 // NULLなら空きスロット
+    char *value;                // NULLなら「宣言されたが値がない」(外側を見ない)
+    ShArray *array;             // 配列変数 (value は使わない。$name は要素0)
+    char *saved_env;            // 一時スコープ: 上書きする前の環境変数の値
+    int had_env;
+} Var;
+
+typedef enum { SCOPE_GLOBAL, SCOPE_FUNCTION, SCOPE_TEMP } ScopeKind;
+
+typedef struct Scope {
+    ScopeKind kind;
+    Var *vars;
+    size_t cap, count;
+    int has_args;               // 位置パラメータを持つ (グローバルと関数)
+    int argc;
+    char **argv;
+} Scope;
+
+static Scope scopes[VARS_MAX_DEPTH];
+static int depth = 0;           // 積んでいるスコープの数 (グローバルを含む)
+static char *arg0 = NULL;       // $0
+
+static size_t name_hash(const char *name) {
+    size_t h = 5381;
+    for (; *name; name++) {
+        h = h * 33 + (unsigned char)*name;
+    }
+    return h;
+}
+
+static Var* scope_find(Scope *scope, const char *name) {
+    if (scope->cap == 0) {
+        return NULL;
+    }
+    for (size_t i = name_hash(name) & (scope->cap - 1);; i = (i + 1) & (scope->cap - 1)) {
+        if (scope->vars[i].name == NULL) {
+            return NULL;
+        }
+        if (strcmp(scope->vars[i].name, name) == 0) {
+            return &scope->vars[i];
+        }
+    }
+}
+
+// 変数のスロットを確保する (既にあればそれを返す)
+static Var* scope_insert(Scope *scope, const char *name) {
+    Var *var = scope_find(scope, name);
+    if (var != NULL) {
+        return var;
+    }
+    if ((scope->count + 1) * 2 > scope->cap) {
+        size_t new_cap = scope->cap ? scope->cap * 2 : 16;
+        Var *vars = (Var *)calloc(new_cap, sizeof(Var));
+        if (vars == NULL) {
+            perror("Failed to allocate variables");
+            return NULL;
+        }
+        for (size_t i = 0; i < scope->cap; i++) {
+            if (scope->vars[i].name == NULL) {
+                continue;
+            }
+            size_t j = name_hash(scope->vars[i].name) & (new_cap - 1);
+            while (vars[j].name != NULL) {
+                j = (j + 1) & (new_cap - 1);
+            }
+            vars[j] = scope->vars[i];
+        }
+        free(scope->vars);
+        scope->vars = vars;
+        scope->cap = new_cap;
+    }
+    size_t i = name_hash(name) & (scope->cap - 1);
+    while (scope->vars[i].name != NULL) {
+        i = (i + 1) & (scope->cap - 1);
+    }
+    scope->vars[i].name = strdup(name);
+    if (scope->vars[i].name == NULL) {
+        perror("Failed to allocate variable name");
+        return NULL;
+    }
+    scope->count++;
+    return &scope->vars[i];
+}
+
+// 開番地法の表から1つ消し、後ろに続くスロットを詰め直す
+static void scope_remove(Scope *scope, Var *var) {
+    size_t mask = scope->cap - 1;
+    size_t i = (size_t)(var - scope->vars);
+    free(var->name);
+    free(var->value);
+    free(var->saved_env);
+    array_free(var->array);
+    memset(var, 0, sizeof(*var));
+    scope->count--;
+    for (size_t j = (i + 1) & mask; scope->vars[j].name != NULL; j = (j + 1) & mask) {
+        Var moved = scope->vars[j];
+        memset(&scope->vars[j], 0, sizeof(Var));
+        size_t k = name_hash(moved.name) & mask;
+        while (scope->vars[k].name != NULL) {
+            k = (k + 1) & mask;
+        }
+        scope->vars[k] = moved;
+    }
+}
+
+// 配列の要素0 (連想配列ではキー "0")
+static const char* array_scalar(const ShArray *a) {
+    return array_is_assoc(a) ? array_get_key(a, "0") : array_get_index(a, 0);
+}
+
+static int set_value(Var *var, const char *value) {
+    if (var->array != NULL && value != NULL) {
+        return array_is_assoc(var->array) ? array_set_key(var->array, "0", value)
+                                          : array_set_index(var->array, 0, value);
+    }
+    array_free(var->array);
+    var->array = NULL;
+    char *copy = value ? strdup(value) : NULL;
+    if (value != NULL && copy == NULL) {
+        perror("Failed to allocate variable value");
+        return -1;
+    }
+    free(var->value);
+    var->value = copy;
+    return 0;
+}
+
+// 名前として使える文字列か ([A-Za-z_][A-Za-z0-9_]*)
+int var_is_name(const char *s, size_t len) {
+    if (len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_')) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if (!(isalnum((unsigned char)s[i]) || s[i] == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief 変数の表を初期化し、スクリプトの引数を位置パラメータにする
+ * @param argc 引数の数 (argv[0] が $0)
+ */
+void vars_init(int argc, char **argv) {
+    depth = 1;
+    memset(&scopes[0], 0, sizeof(Scope));
+    scopes[0].kind = SCOPE_GLOBAL;
+    scopes[0].has_args = 1;
+    arg0 = strdup(argc > 0 ? argv[0] : "myshell");
+    for (int i = 1; i < argc; i++) {
+        char **tmp = (char **)realloc(scopes[0].argv, (size_t)(scopes[0].argc + 1) * sizeof(char *));
+        if (tmp == NULL) {
+            break;
+        }
+        scopes[0].argv = tmp;
+        scopes[0].argv[scopes[0].argc++] = strdup(argv[i]);
+    }
+}
+
+/**
+ * @brief グローバルの位置パラメータと $0 を置き換える (サーバーで要求ごとに設定する)
+ * @param argc 引数の数 (argv[0] が $0)
+ */
+void vars_set_args(int argc, char **argv) {
+    Scope *scope = &scopes[0];
+    for (int i = 0; i < scope->argc; i++) {
+        free(scope->argv[i]);
+    }
+    free(scope->argv);
+    scope->argv = NULL;
+    scope->argc = 0;
+    free(arg0);
+    arg0 = strdup(argc > 0 ? argv[0] : "myshell");
+    for (int i = 1; i < argc; i++) {
+        char **tmp = (char **)realloc(scope->argv, (size_t)(scope->argc + 1) * sizeof(char *));
+        if (tmp == NULL) {
+            break;
+        }
+        scope->argv = tmp;
+        scope->argv[scope->argc++] = strdup(argv[i]);
+    }
+}
+
+/**
+ * @brief 変数の値を返す
+ * @return 値。設定されていなければNULL
+ */
+const char* var_get(const char *name) {
+    if (rc_snapshot_tracing) {
+        rc_snapshot_note_read(name);
+    }
+    for (int d = depth - 1; d >= 0; d--) {
+        Var *var = scope_find(&scopes[d], name);
+        if (var != NULL) {
+            return var->array ? array_scalar(var->array) : var->value;
+        }
+    }
+    return getenv(name);
+}
+
+/**
+ * @brief 変数に代入する
+ *
+ * 内側のスコープで宣言されていればそこに、なければグローバルに代入する。
+ * グローバルでは環境変数にあるものは環境変数を書き換える。
+ */
+int var_set(const char *name, const char *value) {
+    if (rc_snapshot_tracing) {
+        rc_snapshot_note_write(name);
+    }
+    for (int d = depth - 1; d > 0; d--) {
+        Var *var = scope_find(&scopes[d], name);
+        if (var != NULL) {
+            if (scopes[d].kind == SCOPE_TEMP && setenv(name, value, 1) != 0) {
+                return -1;
+            }
+            return set_value(var, value);
+        }
+    }
+    Var *var = scope_find(&scopes[0], name);
+    if (var == NULL && getenv(name) != NULL) {
+        return setenv(name, value, 1);
+    }
+    if (var == NULL) {
+        var = scope_insert(&scopes[0], name);
+    }
+    return var == NULL ? -1 : set_value(var, value);
+}
+
+/**
+ * @brief 一番内側の関数のスコープに変数を作る (local)
+ * @return 成功時0、関数の外なら-1
+ */
+int var_set_local(const char *name, const char *value) {
+    for (int d = depth - 1; d > 0; d--) {
+        if (scopes[d].kind == SCOPE_FUNCTION) {
+            Var *var = scope_insert(&scopes[d], name);
+            return var == NULL ? -1 : set_value(var, value);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 変数を環境変数にする (export)
+ * @param value NULLなら今の値のまま
+ */
+int var_export(const char *name, const char *value) {
+    if (rc_snapshot_tracing) {
+        if (value == NULL) {
+            rc_snapshot_note_read(name);
+        }
+        rc_snapshot_note_write(name);
+    }
+    Var *var = scope_find(&scopes[0], name);
+    const char *current = value;
+    if (current == NULL) {
+        current = var_get(name);
+    }
+    if (current == NULL) {
+        current = "";
+    }
+    if (setenv(name, current, 1) != 0) {
+        return -1;
+    }
+    if (var != NULL) {
+        scope_remove(&scopes[0], var);
+    }
+    return 0;
+}
+
+/**
+ * @brief 変数を削除する (一番内側で見つかったもの)
+ */
+int var_unset(const char *name) {
+    if (rc_snapshot_tracing) {
+        rc_snapshot_note_write(name);
+    }
+    for (int d = depth - 1; d > 0; d--) {
+        Var *var = scope_find(&scopes[d], name);
+        if (var != NULL) {
+            return set_value(var, NULL);
+        }
+    }
+    Var *var = scope_find(&scopes[0], name);
+    if (var != NULL) {
+        scope_remove(&scopes[0], var);
+    }
+    return unsetenv(name);
+}
+
+/**
+ * @brief グローバルの変数の状態を返す (rc のスナップショットに書き出すため)
+ *
+ * @param value スカラーの値
+ * @param array 配列変数なら配列 (そうでなければNULL)
+ * @return 設定されていなければ0、シェルの変数なら1、環境変数なら2
+ */
+int var_global_state(const char *name, const char **value, const ShArray **array) {
+    Var *var = scope_find(&scopes[0], name);
+    *array = NULL;
+    if (var != NULL) {
+        *value = var->value;
+        *array = var->array;
+        return var->value != NULL || var->array != NULL ? 1 : 0;
+    }
+    *value = getenv(name);
+    return *value != NULL ? 2 : 0;
+}
+
+static Scope* push_scope(ScopeKind kind) {
+    if (depth >= VARS_MAX_DEPTH) {
+        fprintf(stderr, "myshell: maximum function nesting level exceeded\n");
+        return NULL;
+    }
+    Scope *scope = &scopes[depth++];
+    memset(scope, 0, sizeof(*scope));
+    scope->kind = kind;
+    return scope;
+}
+
+/**
+ * @brief 関数のスコープを積む。argv は位置パラメータになる ($1 から)
+ * @return 成功時0、深すぎる場合は-1
+ */
+int vars_push_function(int argc, char **argv) {
+    Scope *scope = push_scope(SCOPE_FUNCTION);
+    if (scope == NULL) {
+        return -1;
+    }
+    scope->has_args = 1;
+    scope->argv = (char **)calloc((size_t)argc + 1, sizeof(char *));
+    for (int i = 0; scope->argv != NULL && i < argc; i++) {
+        scope->argv[i] = strdup(argv[i]);
+    }
+    scope->argc = scope->argv != NULL ? argc : 0;
+    return 0;
+}
+
+/**
+ * @brief FOO=bar cmd の代入のための一時スコープを積む
+ * @return 成功時0、深すぎる場合は-1
+ */
+int vars_push_temp(void) {
+    return push_scope(SCOPE_TEMP) == NULL ? -1 : 0;
+}
+
+/**
+ * @brief 一時スコープに変数を置き、子プロセスにも見えるよう環境変数にする
+ */
+int var_set_temp(const char *name, const char *value) {
+    Scope *scope = &scopes[depth - 1];
+    Var *var = scope_find(scope, name);
+    if (var == NULL) {
+        var = scope_insert(scope, name);
+        if (var == NULL) {
+            return -1;
+        }
+        const char *old = getenv(name);
+        var->had_env = old != NULL;
+        var->saved_env = old ? strdup(old) : NULL;
+    }
+    if (set_value(var, value) != 0) {
+        return -1;
+    }
+    return setenv(name, value, 1);
+}
+
+/**
+ * @brief 一番上のスコープを取り除く (一時スコープなら環境変数を元に戻す)
+ */
+void vars_pop_scope(void) {
+    if (depth <= 1) {
+        return;
+    }
+    Scope *scope = &scopes[--depth];
+    for (size_t i = 0; i < scope->cap; i++) {
+        Var *var = &scope->vars[i];
+        if (var->name == NULL) {
+            continue;
+        }
+        if (scope->kind == SCOPE_TEMP) {
+            if (var->had_env) {
+                setenv(var->name, var->saved_env, 1);
+            } else {
+                unsetenv(var->name);
+            }
+        }
+        free(var->name);
+        free(var->value);
+        free(var->saved_env);
+        array_free(var->array);
+    }
+    free(scope->vars);
+    for (int i = 0; i < scope->argc; i++) {
+        free(scope->argv[i]);
+    }
+    free(scope->argv);
+}
+
+// 位置パラメータを持つ一番内側のスコープ
+static Scope* args_scope(void) {
+    for (int d = depth - 1; d > 0; d--) {
+        if (scopes[d].has_args) {
+            return &scopes[d];
+        }
+    }
+    return &scopes[0];
+}
+
+int var_positional_count(void) {
+    return args_scope()->argc;
+}
+
+/**
+ * @brief 位置パラメータを返す
+ * @param n 0なら $0
+ * @return 値。範囲外ならNULL
+ */
+const char* var_positional(int n) {
+    if (n == 0) {
+        return arg0 ? arg0 : "myshell";
+    }
+    Scope *scope = args_scope();
+    return n <= scope->argc ? scope->argv[n - 1] : NULL;
+}
+
+/**
+ * @brief 位置パラメータを n 個ずらす (shift)
+ * @return 成功時0、パラメータが足りなければ-1
+ */
+int var_shift(int n) {
+    Scope *scope = args_scope();
+    if (n < 0 || n > scope->argc) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        free(scope->argv[i]);
+    }
+    memmove(scope->argv, scope->argv + n, (size_t)(scope->argc - n) * sizeof(char *));
+    scope->argc -= n;
+    return 0;
+}
+
+/* ---------- 配列 ---------- */
+
+// 内側のスコープから名前の変数を探す
+static Var* var_lookup(const char *name) {
+    if (rc_snapshot_tracing) {
+        rc_snapshot_note_read(name);
+    }
+    for (int d = depth - 1; d >= 0; d--) {
+        Var *var = scope_find(&scopes[d], name);
+        if (var != NULL) {
+            return var;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 配列変数を返す
+ * @return 配列。配列でない (または設定されていない) ならNULL
+ */
+ShArray* var_get_array(const char *name) {
+    Var *var = var_lookup(name);
+    return var ? var->array : NULL;
+}
+
+/**
+ * @brief 変数を配列にして返す (declare -a/-A、a[i]=x、a=(...))
+ *
+ * スカラーの変数は値を要素0にした添字配列に変える。
+ *
+ * @param kind 'a' (添字配列)、'A' (連想配列)、0 (既にある配列はそのまま、なければ添字配列)
+ * @param local 関数のスコープに作る
+ * @return 配列。失敗時はNULL
+ */
+ShArray* var_make_array(const char *name, int kind, int local) {
+    if (rc_snapshot_tracing && !local) {
+        rc_snapshot_note_read(name); // 既にある値に要素を足すことがある
+        rc_snapshot_note_write(name);
+    }
+    Var *var = NULL;
+    if (local) {
+        for (int d = depth - 1; d > 0 && var == NULL; d--) {
+            if (scopes[d].kind == SCOPE_FUNCTION) {
+                var = scope_insert(&scopes[d], name);
+            }
+        }
+    } else if ((var = var_lookup(name)) == NULL) {
+        const char *env = getenv(name);
+        var = scope_insert(&scopes[0], name);
+        if (var != NULL && env != NULL) {
+            var->value = strdup(env); // 環境変数は配列にできないのでシェルの変数に移す
+            unsetenv(name);
+        }
+    }
+    if (var == NULL) {
+        return NULL;
+    }
+    if (var->array != NULL) {
+        if (kind != 0 && (kind == 'A') != array_is_assoc(var->array)) {
+            fprintf(stderr, "myshell: %s: cannot convert %s array\n", name,
+                    kind == 'A' ? "indexed to associative" : "associative to indexed");
+            return NULL;
+        }
+        return var->array;
+    }
+    ShArray *a = array_new(kind == 'A');
+    if (a == NULL) {
+        return NULL;
+    }
+    if (var->value != NULL) {
+        int r = kind == 'A' ? array_set_key(a, "0", var->value) : array_set_index(a, 0, var->value);
+        if (r != 0) {
+            array_free(a);
+            return NULL;
+        }
+        free(var->value);
+        var->value = NULL;
+    }
+    var->array = a;
+    return a;
+}
+
+/**
+ * @brief 配列の添字を評価する
+ *
+ * 連想配列では展開した文字列をキーにし、添字配列では算術式として評価する
+ * (負の添字は末尾から数える)。
+ *
+ * @param key 連想配列のキー (呼び出し側が解放する)
+ * @param index 添字配列の添字
+ * @return 成功時0、エラー時-1
+ */
+int var_subscript(const ShArray *a, const char *sub, size_t len, char **key, int64_t *index) {
+    *key = NULL;
+    if (a != NULL && array_is_assoc(a)) {
+        char *raw = strndup(sub, len);
+        *key = raw ? expand_word_string(raw) : NULL;
+        free(raw);
+        return *key != NULL ? 0 : -1;
+    }
+    if (arith_eval(sub, len, index) != 0) {
+        return -1;
+    }
+    if (*index < 0 && a != NULL) {
+        *index += array_end(a);
+    }
+    if (*index < 0) {
+        fprintf(stderr, "myshell: [%.*s]: bad array subscript\n", (int)len, sub);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 配列の要素の値を返す (${a[i]})
+ *
+ * スカラーの変数は要素0だけを持つ配列として扱う。
+ *
+ * @param error 添字が正しくなければ1を入れる
+ * @return 値。設定されていなければNULL
+ */
+const char* var_get_element(const char *name, const char *sub, size_t len, int *error) {
+    ShArray *a = var_get_array(name);
+    char *key;
+    int64_t index;
+    *error = 0;
+    if (var_subscript(a, sub, len, &key, &index) != 0) {
+        *error = 1;
+        return NULL;
+    }
+    const char *value;
+    if (a == NULL) {
+        value = index == 0 ? var_get(name) : NULL;
+    } else {
+        value = key ? array_get_key(a, key) : array_get_index(a, index);
+    }
+    free(key);
+    return value;
+}
+
+// 要素を1つ設定する (append なら今の値に続ける)。添字配列なら設定した添字を *set_index に入れる
+static int element_set(ShArray *a, const char *sub, size_t len, const char *value, int append, int64_t *set_index) {
+    char *key;
+    int64_t index;
+    if (var_subscript(a, sub, len, &key, &index) != 0) {
+        return -1;
+    }
+    if (set_index != NULL) {
+        *set_index = index;
+    }
+    char *joined = NULL;
+    if (append && value != NULL) {
+        const char *old = key ? array_get_key(a, key) : array_get_index(a, index);
+        if (old != NULL && (joined = (char *)malloc(strlen(old) + strlen(value) + 1)) != NULL) {
+            strcat(strcpy(joined, old), value);
+            value = joined;
+        }
+    }
+    int r = key ? array_set_key(a, key, value) : array_set_index(a, index, value);
+    free(joined);
+    free(key);
+    return r;
+}
+
+/**
+ * @brief NAME、NAME+、NAME[SUB]、NAME[SUB]+ の形の左辺に代入する
+ *
+ * @param lhs 左辺 ('=' の前まで)
+ * @param len 左辺の長さ
+ * @return 成功時0、エラー時-1
+ */
+int var_assign(const char *lhs, size_t len, const char *value) {
+    int append = len > 0 && lhs[len - 1] == '+';
+    len -= (size_t)append;
+    const char *bracket = memchr(lhs, '[', len);
+    size_t name_len = bracket ? (size_t)(bracket - lhs) : len;
+    char *name = strndup(lhs, name_len);
+    if (name == NULL) {
+        return -1;
+    }
+    int r;
+    if (bracket != NULL) {
+        ShArray *a = var_make_array(name, 0, 0);
+        r = a ? element_set(a, bracket + 1, len - name_len - 2, value, append, NULL) : -1;
+    } else if (append) {
+        const char *old = var_get(name);
+        char *joined = (char *)malloc((old ? strlen(old) : 0) + strlen(value) + 1);
+        r = -1;
+        if (joined != NULL) {
+            strcat(strcpy(joined, old ? old : ""), value);
+            r = var_set(name, joined);
+            free(joined);
+        }
+    } else {
+        r = var_set(name, value);
+    }
+    free(name);
+    return r;
+}
+
+/**
+ * @brief 配列の要素を削除する (unset 'a[i]')
+ */
+int var_unset_element(const char *name, const char *sub, size_t len) {
+    ShArray *a = var_get_array(name);
+    if (a == NULL) {
+        return 0;
+    }
+    return element_set(a, sub, len, NULL, 0, NULL);
+}
+
+/**
+ * @brief NAME=(...) と NAME+=(...) の複合代入をする
+ *
+ * 要素は実行のときに展開する。[KEY]=VALUE の要素はその添字に、
+ * それ以外はフィールド分割とパス名展開をして続きの添字に入れる。
+ *
+ * @param word 展開前の単語
+ * @param kind var_make_array の kind
+ * @param local 関数のスコープに作る (declare と local)
+ * @return 成功時0、エラー時-1
+ */
+int var_assign_compound(const char *word, int kind, int local) {
+    const char *eq = strchr(word, '=');
+    const char *close = strrchr(word, ')');
+    if (eq == NULL || eq[1] != '(' || close == NULL || close < eq + 1) {
+        return -1;
+    }
+    int append = eq > word && eq[-1] == '+';
+    char *name = strndup(word, (size_t)(eq - word) - (size_t)append);
+    ShArray *a = name ? var_make_array(name, kind, local) : NULL;
+    if (a == NULL) {
+        free(name);
+        return -1;
+    }
+    if (!append) {
+        array_clear(a);
+    }
+    int64_t next = array_end(a);
+    int status = 0;
+    const char *p = eq + 2;
+    while (status == 0) {
+        while (p < close && isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (p < close && *p == '#') {
+            while (p < close && *p != '\n') {
+                p++;
+            }
+            continue;
+        }
+        if (p >= close) {
+            break;
+        }
+        const char *end = syntax_scan_word(p, close, NULL);
+        if (end == NULL || end == p) {
+            fprintf(stderr, "myshell: %s: syntax error in array assignment\n", name);
+            status = -1;
+            break;
+        }
+        char *elem = strndup(p, (size_t)(end - p));
+        p = end;
+        if (elem == NULL) {
+            status = -1;
+            break;
+        }
+        // [KEY]=VALUE (添字の中の ] は入れ子の [ ] で数える)
+        const char *key_end = NULL;
+        if (elem[0] == '[') {
+            int nest = 0;
+            for (const char *q = elem + 1; *q; q++) {
+                if (*q == '[') {
+                    nest++;
+                } else if (*q == ']' && nest-- == 0) {
+                    key_end = q;
+                    break;
+                }
+            }
+        }
+        int elem_append = key_end && key_end[1] == '+';
+        if (key_end != NULL && key_end[1 + elem_append] == '=') {
+            char *value = expand_word_string(key_end + 2 + elem_append);
+            int64_t index = next - 1;
+            status = value ? element_set(a, elem + 1, (size_t)(key_end - elem - 1), value, elem_append, &index) : -1;
+            next = index + 1;
+            free(value);
+        } else if (array_is_assoc(a)) {
+            fprintf(stderr, "myshell: %s: %s: must use subscript when assigning associative array\n", name, elem);
+            status = -1;
+        } else {
+            size_t count;
+            char **fields = expand_word_fields(elem, &count);
+            if (fields == NULL) {
+                status = -1;
+            }
+            for (size_t i = 0; fields != NULL && i < count; i++) {
+                if (status == 0 && array_set_index(a, next++, fields[i]) != 0) {
+                    status = -1;
+                }
+                free(fields[i]);
+            }
+            free(fields);
+        }
+        free(elem);
+    }
+    free(name);
+    return status;
+}
+
+/**
+ * @brief declare と local の引数 (NAME、NAME=VALUE、NAME=(...)) を1つ処理する
+ *
+ * @param arg 引数 (名前は呼び出し側が確かめる)
+ * @param kind 'a' (添字配列)、'A' (連想配列)、0 (指定なし)
+ * @param local 関数のスコープに作る
+ * @return 成功時0、エラー時-1
+ */
+int var_declare(const char *arg, int kind, int local) {
+    const char *eq = strchr(arg, '=');
+    size_t len = eq ? (size_t)(eq - arg) : strlen(arg);
+    if (eq != NULL && eq[1] == '(' && arg[strlen(arg) - 1] == ')') {
+        return var_assign_compound(arg, kind, local);
+    }
+    int append = eq != NULL && len > 0 && arg[len - 1] == '+';
+    char *name = strndup(arg, len - (size_t)append);
+    if (name == NULL) {
+        return -1;
+    }
+    int r = 0;
+    if (kind != 0) {
+        ShArray *a = var_make_array(name, kind, local);
+        r = a == NULL ? -1 : eq ? element_set(a, "0", 1, eq + 1, append, NULL) : 0;
+    } else if (local) {
+        r = var_set_local(name, eq ? eq + 1 : NULL);
+    } else if (eq != NULL) {
+        r = var_assign(arg, len, eq + 1);
+    }
+    free(name);
+    return r;
+}
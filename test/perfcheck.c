@@ -0,0 +1,494 @@
+#include <shell.h>
+#include <sys/resource.h>
+
+/*
+ * 性能の回帰テスト
+ *
+ *   make perf-check       基準値と比べて、許容範囲を超えて遅くなっていたら失敗する
+ *   make perf-baseline    今の結果を基準値として保存する
+ *
+ *   perfcheck [--update-baseline | --no-baseline] SHELL PERFDIR
+ *
+ * --no-baseline は基準値と比べずに結果だけを出す (最適化したビルドの比較や PGO のプロファイル取り)。
+ *
+ * PERFDIR/sessions の .rec ファイルは $MYSHELL_RECORD で記録したセッション (sessionRecord.c)。
+ * 各セッションの入力を順につないだスクリプトを作り、SHELL で実行して
+ * 1件ごとの終了ステータスが記録と一致するかを確かめる。記録された待ち時間は再生しない。
+ * PATH の先頭には PERFDIR/stubs を置くので、curl や git などはネットワークを使わない
+ * 決まった出力を返すスタブになる。HOME と XDG_CACHE_HOME は一時ディレクトリに向ける。
+ *
+ * 測るもの:
+ *   lines_per_sec  セッションの入力を1秒に何行実行できるか (起動を含む)
+ *   spawn_us       外部コマンド1回の起動から終了までの時間
+ *   rss_kb         セッションを実行したときの最大RSS
+ * PERFDIR/thresholds に指標ごとの許容する悪化の割合を、PERFDIR/baseline に基準値を書く。
+ * 基準値は測ったマシンに依存するので、マシンを変えたら make perf-baseline で作り直す。
+ */
+
+#define PERF_SPAWN_COUNT 200    /* spawn_us を測るときに起動する回数 */
+#define PERF_PATH (MAX_PATH * 2) /* ディレクトリ名にファイル名をつなげたパス */
+
+typedef struct Metric {
+    const char *name;
+    int higher_is_better;
+    double value;
+    double baseline;            // 0なら基準値なし
+    double tolerance;           // 許容する悪化の割合 (0.2 なら20%)
+} Metric;
+
+static Metric metrics[] = {
+    {"lines_per_sec", 1, 0, 0, 0.2},
+    {"spawn_us", 0, 0, 0, 0.3},
+    {"rss_kb", 0, 0, 0, 0.25},
+};
+#define METRIC_COUNT ((int)(sizeof(metrics) / sizeof(metrics[0])))
+
+static int runs = 5;
+static char work_dir[64];
+
+static Metric* find_metric(const char *name) {
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        if (strcmp(metrics[i].name, name) == 0) {
+            return &metrics[i];
+        }
+    }
+    return NULL;
+}
+
+// "name value" の行を読む。field は 0 なら基準値、1 なら許容範囲
+static int read_settings(const char *path, int field) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    char line[256], name[64];
+    double value;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%63s %lf", name, &value) != 2) {
+            continue;
+        }
+        if (field == 1 && strcmp(name, "runs") == 0) {
+            runs = value >= 1 ? (int)value : 1;
+            continue;
+        }
+        Metric *m = find_metric(name);
+        if (m == NULL) {
+            fprintf(stderr, "perfcheck: %s: unknown metric %s\n", path, name);
+        } else if (field == 0) {
+            m->baseline = value;
+        } else {
+            m->tolerance = value;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* ---------- セッションの読み込み ---------- */
+
+typedef struct Entry {
+    char *text;
+    int status;
+} Entry;
+
+typedef struct Session {
+    Entry *entries;
+    size_t count;
+} Session;
+
+// sessionRecord.c の書き方を元に戻す
+static void unescape(char *s) {
+    char *out = s;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1] != '\0') {
+            s++;
+            *out++ = *s == 'n' ? '\n' : (*s == 't' ? '\t' : *s);
+        } else {
+            *out++ = *s;
+        }
+    }
+    *out = '\0';
+}
+
+static int load_session(const char *path, Session *session) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "perfcheck: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, fp)) > 0) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (line[n - 1] == '\n') {
+            line[n - 1] = '\0';
+        }
+        // 経過時間\t実行時間\t終了ステータス\t入力
+        char *fields[4];
+        char *p = line;
+        int k = 0;
+        for (; k < 3; k++) {
+            fields[k] = p;
+            p = strchr(p, '\t');
+            if (p == NULL) {
+                break;
+            }
+            *p++ = '\0';
+        }
+        if (k < 3) {
+            continue;
+        }
+        fields[3] = p;
+        unescape(fields[3]);
+        Entry *tmp = (Entry *)realloc(session->entries, (session->count + 1) * sizeof(Entry));
+        if (tmp == NULL) {
+            break;
+        }
+        session->entries = tmp;
+        session->entries[session->count].text = strdup(fields[3]);
+        session->entries[session->count].status = atoi(fields[2]);
+        session->count++;
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+/* ---------- 実行 ---------- */
+
+// スクリプトを実行して経過時間と最大RSSを返す。終了ステータスを返す
+static int run_shell(const char *shell, const char *script, const char *cwd, double *elapsed, long *rss_kb) {
+    double start = now_sec();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("perfcheck: fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (chdir(cwd) != 0) {
+            _exit(126);
+        }
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        execl(shell, shell, script, (char *)NULL);
+        perror(shell);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+    }
+    *elapsed = now_sec() - start;
+    if (rss_kb != NULL && usage.ru_maxrss > *rss_kb) {
+        *rss_kb = usage.ru_maxrss;
+    }
+    return status_to_exit_code(status);
+}
+
+static int write_file(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "perfcheck: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fputs(text, fp);
+    return fclose(fp);
+}
+
+/**
+ * @brief セッションを再生するスクリプトを作る
+ *
+ * 入力ごとに終了ステータスをファイルに追記し、$? を元に戻してから次の入力に進む。
+ * 構文エラーになる入力はスクリプトに入れず、記録のステータスが2かだけを確かめる。
+ *
+ * @return 再生する入力の行数。記録と合わない構文エラーがあれば-1
+ */
+static long build_replay(const Session *session, const char *name, const char *status_path, FILE *out,
+                         int *expected, size_t *nexpected) {
+    fprintf(out, "__perf_restore() { return $1; }\n");
+    long count = 0;
+    for (size_t i = 0; i < session->count; i++) {
+        const Entry *e = &session->entries[i];
+        Program *prog = NULL;
+        FILE *saved = stderr;
+        stderr = fopen("/dev/null", "w"); // 構文エラーのメッセージは出さない
+        SyntaxStatus result = syntax_compile(e->text, strlen(e->text), NULL, 0, &prog);
+        fclose(stderr);
+        stderr = saved;
+        program_free(prog);
+        if (result != SYNTAX_OK) {
+            if (e->status != 2) {
+                fprintf(stderr, "perfcheck: %s: entry %zu no longer parses: %s\n", name, i + 1, e->text);
+                return -1;
+            }
+            continue;
+        }
+        fprintf(out, "%s\n__perf_status=$?\necho $__perf_status >> %s\n__perf_restore $__perf_status\n",
+                e->text, status_path);
+        expected[(*nexpected)++] = e->status;
+        // スクリプトを記録したものは1件に複数行あるので、行数で数える
+        for (const char *p = e->text; *p; p++) {
+            if (*p == '\n' && p[1] != '\0') {
+                count++;
+            }
+        }
+        count++;
+    }
+    return count;
+}
+
+// 記録した終了ステータスと再生したものを比べる
+static int check_statuses(const char *name, const char *status_path, const int *expected, size_t count) {
+    FILE *fp = fopen(status_path, "r");
+    size_t i = 0;
+    int status, ok = 1;
+    while (fp != NULL && i < count && fscanf(fp, "%d", &status) == 1) {
+        if (status != expected[i]) {
+            fprintf(stderr, "perfcheck: %s: entry %zu exited with %d (recorded %d)\n", name, i + 1, status, expected[i]);
+            ok = 0;
+        }
+        i++;
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    // exit で終わるセッションは最後の入力のステータスが書かれない
+    if (i + 1 < count) {
+        fprintf(stderr, "perfcheck: %s: replay stopped after %zu of %zu entries\n", name, i, count);
+        ok = 0;
+    }
+    return ok;
+}
+
+static int remove_tree(const char *path) {
+    char cmd[PERF_PATH + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", path);
+    return system(cmd);
+}
+
+/**
+ * @brief すべてのセッションを runs 回再生し、lines_per_sec と rss_kb を求める
+ * @return 記録と動作が一致すれば0
+ */
+static int measure_sessions(const char *shell, const char *perf_dir) {
+    char dir_path[MAX_PATH];
+    snprintf(dir_path, sizeof(dir_path), "%s/sessions", perf_dir);
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        fprintf(stderr, "perfcheck: %s: %s\n", dir_path, strerror(errno));
+        return -1;
+    }
+    struct dirent *ent;
+    double total_time = 0;
+    long total_lines = 0, rss = 0;
+    int failed = 0;
+    while ((ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len < 5 || strcmp(ent->d_name + len - 4, ".rec") != 0) {
+            continue;
+        }
+        char path[PERF_PATH], script[PERF_PATH], status_path[PERF_PATH], cwd[PERF_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name);
+        snprintf(script, sizeof(script), "%s/%s.sh", work_dir, ent->d_name);
+        snprintf(status_path, sizeof(status_path), "%s/%s.status", work_dir, ent->d_name);
+        snprintf(cwd, sizeof(cwd), "%s/run", work_dir);
+        Session session = {NULL, 0};
+        if (load_session(path, &session) != 0) {
+            failed = 1;
+            continue;
+        }
+        int *expected = (int *)calloc(session.count + 1, sizeof(int));
+        size_t nexpected = 0;
+        FILE *out = fopen(script, "w");
+        long count = out && expected ? build_replay(&session, ent->d_name, status_path, out, expected, &nexpected) : -1;
+        if (out != NULL) {
+            fclose(out);
+        }
+        double *times = (double *)calloc((size_t)runs, sizeof(double));
+        for (int r = 0; count > 0 && times != NULL && r <= runs; r++) {
+            // 毎回まっさらな作業ディレクトリで実行する (1回目はキャッシュを温めるだけ)
+            remove_tree(cwd);
+            mkdir(cwd, 0700);
+            unlink(status_path);
+            double elapsed;
+            run_shell(shell, script, cwd, &elapsed, r > 0 ? &rss : NULL);
+            if (r == 0 && !check_statuses(ent->d_name, status_path, expected, nexpected)) {
+                failed = 1;
+                break;
+            }
+            if (r > 0) {
+                times[r - 1] = elapsed;
+            }
+        }
+        if (count > 0 && !failed) {
+            qsort(times, (size_t)runs, sizeof(double), compare_double);
+            total_time += times[runs / 2];
+            total_lines += count;
+            printf("  %-24s %5ld lines  %8.2f ms\n", ent->d_name, count, times[runs / 2] * 1e3);
+        } else if (count < 0) {
+            failed = 1;
+        }
+        free(times);
+        free(expected);
+        for (size_t i = 0; i < session.count; i++) {
+            free(session.entries[i].text);
+        }
+        free(session.entries);
+    }
+    closedir(dir);
+    if (failed || total_lines == 0) {
+        return -1;
+    }
+    find_metric("lines_per_sec")->value = total_lines / total_time;
+    find_metric("rss_kb")->value = (double)rss;
+    return 0;
+}
+
+// 外部コマンドを PERF_SPAWN_COUNT 回起動するスクリプトと空のスクリプトの差から spawn_us を求める
+static int measure_spawn(const char *shell) {
+    char spawn_script[PERF_PATH], empty_script[PERF_PATH], cwd[PERF_PATH];
+    snprintf(spawn_script, sizeof(spawn_script), "%s/spawn.sh", work_dir);
+    snprintf(empty_script, sizeof(empty_script), "%s/empty.sh", work_dir);
+    snprintf(cwd, sizeof(cwd), "%s/run", work_dir);
+    FILE *fp = fopen(spawn_script, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < PERF_SPAWN_COUNT; i++) {
+        fputs("/bin/true\n", fp);
+    }
+    fclose(fp);
+    if (write_file(empty_script, ":\n") != 0) {
+        return -1;
+    }
+    double *spawn_times = (double *)calloc((size_t)runs, sizeof(double));
+    double *empty_times = (double *)calloc((size_t)runs, sizeof(double));
+    if (spawn_times == NULL || empty_times == NULL) {
+        return -1;
+    }
+    double elapsed;
+    run_shell(shell, spawn_script, cwd, &elapsed, NULL); // キャッシュを温める
+    run_shell(shell, empty_script, cwd, &elapsed, NULL);
+    for (int r = 0; r < runs; r++) {
+        run_shell(shell, spawn_script, cwd, &spawn_times[r], NULL);
+        run_shell(shell, empty_script, cwd, &empty_times[r], NULL);
+    }
+    qsort(spawn_times, (size_t)runs, sizeof(double), compare_double);
+    qsort(empty_times, (size_t)runs, sizeof(double), compare_double);
+    double per_spawn = (spawn_times[runs / 2] - empty_times[runs / 2]) / PERF_SPAWN_COUNT;
+    find_metric("spawn_us")->value = per_spawn > 0 ? per_spawn * 1e6 : 0;
+    free(spawn_times);
+    free(empty_times);
+    return 0;
+}
+
+static int write_baseline(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "perfcheck: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(fp, "# make perf-baseline で作った基準値 (測ったマシンでのみ意味がある)\n");
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        fprintf(fp, "%s %.1f\n", metrics[i].name, metrics[i].value);
+    }
+    fclose(fp);
+    printf("perfcheck: baseline written to %s\n", path);
+    return 0;
+}
+
+// 基準値と比べて結果を出力する。許容範囲を超えて悪くなったものがあれば1
+static int compare_baseline(void) {
+    int regressed = 0;
+    printf("  %-14s %12s %12s %9s %9s\n", "metric", "baseline", "current", "change", "limit");
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        Metric *m = &metrics[i];
+        if (m->baseline <= 0) {
+            printf("  %-14s %12s %12.1f\n", m->name, "-", m->value);
+            continue;
+        }
+        double change = (m->value - m->baseline) / m->baseline;
+        double worse = m->higher_is_better ? -change : change;
+        int bad = worse > m->tolerance;
+        printf("  %-14s %12.1f %12.1f %+8.1f%% %8.0f%%%s\n", m->name, m->baseline, m->value,
+               change * 100, m->tolerance * 100, bad ? "  REGRESSION" : "");
+        regressed |= bad;
+    }
+    return regressed;
+}
+
+int main(int argc, char *argv[]) {
+    int update = argc > 1 && strcmp(argv[1], "--update-baseline") == 0;
+    int no_baseline = argc > 1 && strcmp(argv[1], "--no-baseline") == 0;
+    int skip = update || no_baseline;
+    if (argc - skip != 3) {
+        fprintf(stderr, "usage: %s [--update-baseline | --no-baseline] SHELL PERFDIR\n", argv[0]);
+        return 2;
+    }
+    char shell[MAX_PATH], perf_dir[MAX_PATH];
+    if (realpath(argv[1 + skip], shell) == NULL || realpath(argv[2 + skip], perf_dir) == NULL) {
+        perror("perfcheck");
+        return 2;
+    }
+    char path[PERF_PATH];
+    snprintf(path, sizeof(path), "%s/thresholds", perf_dir);
+    read_settings(path, 1);
+    char baseline_path[PERF_PATH];
+    snprintf(baseline_path, sizeof(baseline_path), "%s/baseline", perf_dir);
+    int has_baseline = !no_baseline && read_settings(baseline_path, 0) == 0;
+
+    // 再生する環境を固定する
+    snprintf(work_dir, sizeof(work_dir), "/tmp/myshell-perf.XXXXXX");
+    if (mkdtemp(work_dir) == NULL) {
+        perror("perfcheck: mkdtemp");
+        return 2;
+    }
+    char value[MAX_PATH * 2];
+    snprintf(value, sizeof(value), "%s/stubs:/usr/bin:/bin", perf_dir);
+    setenv("PATH", value, 1);
+    setenv("HOME", work_dir, 1);
+    snprintf(value, sizeof(value), "%s/cache", work_dir);
+    setenv("XDG_CACHE_HOME", value, 1);
+    setenv("LC_ALL", "C", 1);
+    unsetenv("MYSHELL_RECORD");
+    unsetenv("MYSHELL_FORK_SERVER");
+    snprintf(value, sizeof(value), "%s/run", work_dir);
+    mkdir(value, 0700);
+
+    printf("perfcheck: %s (%d runs, median)\n", shell, runs);
+    int failed = measure_sessions(shell, perf_dir) != 0 || measure_spawn(shell) != 0;
+    remove_tree(work_dir);
+    if (failed) {
+        fprintf(stderr, "perfcheck: replay did not match the recorded sessions\n");
+        return 1;
+    }
+    if (no_baseline) {
+        compare_baseline();
+        return 0;
+    }
+    if (update || !has_baseline) {
+        compare_baseline();
+        return write_baseline(baseline_path) == 0 ? 0 : 2;
+    }
+    if (compare_baseline()) {
+        fprintf(stderr, "perfcheck: performance regressed beyond the thresholds in %s/thresholds\n", perf_dir);
+        return 1;
+    }
+    printf("perfcheck: ok\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <shell.h>
+
+/*
+ * コマンド起動の遅延のベンチマーク
+ *
+ *   make bench
+ *   _gate_build/bin/spawnbench [回数] [RSS(MB)...]
+ *
+ * シェルのヒープが大きくなった状態を、メモリを確保して全ページに書き込むことで再現し、
+ * 直接 fork + exec する場合とフォークサーバー経由の場合で /bin/true の起動から
+ * 終了を待つまでの時間を比べる。フォークサーバーはシェルと同じく、
+ * メモリを確保する前 (プロセスが小さいうち) に起動しておく。
+ */
+
+extern char **environ;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static long rss_mb(void) {
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+static pid_t spawn_direct(char **argv) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t spawn_server(char **argv) {
+    return fork_server_spawn(argv, environ, -1, -1, -1, NULL);
+}
+
+// 起動して終了を待つまでを runs 回測り、中央値と99パーセンタイルを出力する
+static void measure(const char *label, pid_t (*spawn)(char **), int runs, double *samples) {
+    char *argv[] = {"/bin/true", NULL};
+    for (int i = 0; i < runs; i++) {
+        double start = now_us();
+        pid_t pid = spawn(argv);
+        if (pid < 0) {
+            perror(label);
+            exit(1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        samples[i] = now_us() - start;
+    }
+    qsort(samples, (size_t)runs, sizeof(double), compare_double);
+    double sum = 0;
+    for (int i = 0; i < runs; i++) {
+        sum += samples[i];
+    }
+    printf("  %-12s mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n", label, sum / runs,
+           samples[runs / 2], samples[(runs * 99) / 100]);
+}
+
+int main(int argc, char *argv[]) {
+    int runs = argc > 1 ? atoi(argv[1]) : 200;
+    long default_sizes[] = {0, 256, 1024};
+    int nsizes = argc > 2 ? argc - 2 : 3;
+    if (runs <= 0) {
+        fprintf(stderr, "usage: %s [runs] [rss-mb...]\n", argv[0]);
+        return 2;
+    }
+    if (fork_server_start() != 0) {
+        return 1;
+    }
+    double *samples = (double *)malloc((size_t)runs * sizeof(double));
+    char *heap = NULL;
+    size_t heap_size = 0;
+    for (int s = 0; s < nsizes; s++) {
+        long mb = argc > 2 ? atol(argv[s + 2]) : default_sizes[s];
+        size_t size = (size_t)mb * 1024 * 1024;
+        if (size > heap_size) {
+            char *tmp = (char *)realloc(heap, size);
+            if (tmp == NULL) {
+                perror("realloc");
+                return 1;
+            }
+            heap = tmp;
+            memset(heap + heap_size, 1, size - heap_size); // 全ページを実際に確保する
+            heap_size = size;
+        }
+        printf("heap %ld MB (RSS %ld MB), %d runs\n", mb, rss_mb(), runs);
+        measure("fork+exec", spawn_direct, runs, samples);
+        measure("fork-server", spawn_server, runs, samples);
+    }
+    fork_server_stop();
+    free(heap);
+    free(samples);
+    return 0;
+}